@@ -0,0 +1,150 @@
+#pragma once
+
+/*
+Read-only asset pack:
+    One file, memory mapped for the lifetime of the pack. Assets are used in place through pointers into the mapping,
+    so loading an asset is a page fault instead of a read() + copy.
+
+    Layout:
+        AssetPackHeader
+        AssetPackEntry[entryCount]
+        payloads (each aligned to ASSET_PACK_ALIGNMENT from the start of the file)
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+
+const uint32_t ASSET_PACK_MAGIC = 0x4B415056;    //"VPAK"
+const uint32_t ASSET_PACK_VERSION = 1;
+const uint64_t ASSET_PACK_ALIGNMENT = 4096;
+
+
+struct AssetPackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+
+struct AssetPackEntry {
+    char name[48];
+    uint64_t offset;    //From the start of the file
+    uint64_t size;
+};
+
+
+class AssetPack {
+
+public:
+    AssetPack() = default;
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+
+    ~AssetPack(){
+        close();
+    }
+
+
+    void open(const std::string& path){
+        close();
+
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0){
+            throw std::runtime_error("Failed to open asset pack " + path);
+        }
+
+        struct stat info;
+        if(fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(AssetPackHeader)){
+            close();
+            throw std::runtime_error("Invalid asset pack " + path);
+        }
+        size = static_cast<size_t>(info.st_size);
+
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(mapping == MAP_FAILED){
+            close();
+            throw std::runtime_error("Failed to map asset pack " + path);
+        }
+        base = static_cast<const uint8_t*>(mapping);
+
+        const AssetPackHeader* header = reinterpret_cast<const AssetPackHeader*>(base);
+        if(header->magic != ASSET_PACK_MAGIC || header->version != ASSET_PACK_VERSION ||
+           sizeof(AssetPackHeader) + header->entryCount * sizeof(AssetPackEntry) > size){
+            close();
+            throw std::runtime_error("Invalid asset pack " + path);
+        }
+        entries = reinterpret_cast<const AssetPackEntry*>(base + sizeof(AssetPackHeader));
+        entryCount = header->entryCount;
+
+        for(uint32_t i = 0; i < entryCount; i++){
+            if(entries[i].offset + entries[i].size > size){
+                close();
+                throw std::runtime_error("Asset pack entry out of range in " + path);
+            }
+        }
+    }
+
+
+    void close(){
+        if(base != nullptr){
+            munmap(const_cast<uint8_t*>(base), size);
+            base = nullptr;
+        }
+        if(fd >= 0){
+            ::close(fd);
+            fd = -1;
+        }
+        entries = nullptr;
+        entryCount = 0;
+        size = 0;
+    }
+
+
+    bool isOpen() const { return base != nullptr; }
+
+
+    const AssetPackEntry* find(const char* name) const {
+        for(uint32_t i = 0; i < entryCount; i++){
+            if(strncmp(entries[i].name, name, sizeof(entries[i].name)) == 0){
+                return &entries[i];
+            }
+        }
+        return nullptr;
+    }
+
+
+    const uint8_t* data(const AssetPackEntry& entry) const {
+        return base + entry.offset;
+    }
+
+
+    void prefetch(const void* address, size_t length) const {     //Hint the kernel to start reading ahead; never blocks
+        uintptr_t start = reinterpret_cast<uintptr_t>(address) & ~(uintptr_t)(ASSET_PACK_ALIGNMENT - 1);
+        uintptr_t end = reinterpret_cast<uintptr_t>(address) + length;
+        madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+    }
+
+
+    int getFd() const { return fd; }
+
+    const uint8_t* getBase() const { return base; }
+
+    size_t getSize() const { return size; }
+
+
+private:
+    int fd = -1;
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    const AssetPackEntry* entries = nullptr;
+    uint32_t entryCount = 0;
+};
@@ -0,0 +1,405 @@
+#pragma once
+
+/*
+Coroutine layer over the job system (C++20):
+    Task<T> is a lazily started coroutine. co_await on it starts it and resumes the awaiting coroutine when it
+    finishes; exceptions travel to the awaiter. Everything that would otherwise be a callback or a polling loop is a
+    co_await instead:
+
+        co_await scheduleOn(jobs)                   continue on a worker thread
+        co_await awaitJob(jobs, handle)             a JobHandle from JobSystem::submit/parallelFor
+        co_await runAsync(jobs, function)           run a blocking function (file IO) on a worker, get its result
+        co_await readFileAsync(jobs, path)          whole file as bytes
+        co_await completion.fence(fence)            GPU completion, see GpuCompletion below
+        co_await completion.timeline(semaphore, value)
+        co_await completion.ticket(queue, ticket)   a SubmissionQueue flush
+
+    Whatever completes an await never runs the coroutine inline: it submits the resume to the job system, so the
+    coroutine continues on a worker thread and a finishing job or the GPU poll thread is never held up by it.
+
+    spawn() starts a Task<void> on the job system and lets it run to completion on its own; syncWait() blocks the
+    calling thread (running queued jobs meanwhile) until a task is done and returns its result.
+*/
+
+#include "JobSystem.h"
+#include "SubmissionQueue.h"
+#include "Profiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <type_traits>
+#include <stdexcept>
+
+
+template<typename T = void>
+class Task;
+
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {     //Symmetric transfer, no stack growth
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception(){ exception = std::current_exception(); }
+};
+
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    void return_value(T result){ value = std::move(result); }
+
+    T result(){
+        if(exception) std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+};
+
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+
+    void return_void(){}
+
+    void result(){
+        if(exception) std::rethrow_exception(exception);
+    }
+};
+
+
+template<typename T>
+class Task {
+
+public:
+    using promise_type = TaskPromise<T>;
+
+    Task() = default;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other){
+            if(handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task(){
+        if(handle) handle.destroy();
+    }
+
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume(){ return handle.promise().result(); }
+
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object(){ return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this)); }
+
+inline Task<void> TaskPromise<void>::get_return_object(){ return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this)); }
+
+
+struct DetachedTask {   //Starts eagerly and frees itself at the end; only used by spawn() and syncWait()
+    struct promise_type {
+        DetachedTask get_return_object(){ return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ std::terminate(); }    //spawn()ed tasks must handle their own errors
+    };
+};
+
+
+inline void resumeOnJobs(JobSystem& jobs, std::coroutine_handle<> handle){
+    jobs.submit([handle]{ handle.resume(); });
+}
+
+
+struct ScheduleAwaiter {
+    JobSystem& jobs;
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle){ resumeOnJobs(jobs, handle); }
+
+    void await_resume() const noexcept {}
+};
+
+
+inline ScheduleAwaiter scheduleOn(JobSystem& jobs){
+    return {jobs};
+}
+
+
+struct JobAwaiter {
+    JobSystem& jobs;
+    JobHandle handle;
+
+    bool await_ready() const { return JobSystem::isDone(handle); }
+
+    bool await_suspend(std::coroutine_handle<> awaiting){
+        JobSystem* system = &jobs;
+        return handle->onDone([system, awaiting]{ resumeOnJobs(*system, awaiting); });
+    }
+
+    void await_resume() const { JobSystem::rethrowError(handle); }
+};
+
+
+inline JobAwaiter awaitJob(JobSystem& jobs, JobHandle handle){
+    return {jobs, std::move(handle)};
+}
+
+
+template<typename Function>
+Task<std::invoke_result_t<Function>> runAsync(JobSystem& jobs, Function function){
+    co_await scheduleOn(jobs);
+    co_return function();
+}
+
+
+inline Task<std::vector<char>> readFileAsync(JobSystem& jobs, std::string path){    //Empty if the file cannot be read
+    return runAsync(jobs, [path]{
+        PROFILE_ZONE("readFileAsync");
+        std::vector<char> data;
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if(file.is_open()){
+            data.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            if(!file.read(data.data(), data.size())) data.clear();
+        }
+        return data;
+    });
+}
+
+
+inline DetachedTask spawnRunner(JobSystem& jobs, Task<void> task){
+    co_await scheduleOn(jobs);
+    co_await task;
+}
+
+
+inline void spawn(JobSystem& jobs, Task<void> task){   //Fire and forget; the task runs on the job system
+    spawnRunner(jobs, std::move(task));
+}
+
+
+template<typename T>
+struct SyncWaitState {
+    std::atomic<bool> done{false};
+    std::exception_ptr exception;
+    std::optional<std::conditional_t<std::is_void_v<T>, char, T>> value;
+};
+
+
+template<typename T>
+DetachedTask syncWaitRunner(Task<T>& task, SyncWaitState<T>& state){
+    try {
+        if constexpr (std::is_void_v<T>){
+            co_await task;
+        } else {
+            state.value.emplace(co_await task);
+        }
+    } catch(...){
+        state.exception = std::current_exception();
+    }
+    state.done.store(true, std::memory_order_release);
+}
+
+
+template<typename T>
+T syncWait(JobSystem& jobs, Task<T> task){     //Blocks, but runs queued jobs so it also works with a single worker
+    SyncWaitState<T> state;
+    syncWaitRunner(task, state);
+    jobs.waitUntil([&state]{ return state.done.load(std::memory_order_acquire); });
+
+    if(state.exception) std::rethrow_exception(state.exception);
+    if constexpr (!std::is_void_v<T>){
+        return std::move(*state.value);
+    }
+}
+
+
+/*
+GPU completion for coroutines:
+    Fences and timeline semaphores cannot call back, so one thread polls every pending wait and hands finished ones
+    to the job system. It sleeps on a condition variable while nothing is pending.
+*/
+
+const uint32_t GPU_COMPLETION_POLL_US = 100;
+
+
+class GpuCompletion {
+
+public:
+    struct Awaiter {
+        GpuCompletion* completion;
+        std::function<bool()> ready;
+
+        bool await_ready(){ return ready(); }
+
+        void await_suspend(std::coroutine_handle<> handle){ completion->add(std::move(ready), handle); }
+
+        void await_resume() const noexcept {}
+    };
+
+
+    void init(VkDevice device, JobSystem& jobs, SubmissionQueue& submissions){
+        this->device = device;
+        this->jobs = &jobs;
+        this->submissions = &submissions;
+
+        getCounterValue = (PFN_vkGetSemaphoreCounterValue) vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValue");
+        if(getCounterValue == nullptr){     //VK_KHR_timeline_semaphore before 1.2
+            getCounterValue = (PFN_vkGetSemaphoreCounterValue) vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+        }
+
+        running = true;
+        thread = std::thread([this]{ loop(); });
+    }
+
+
+    void destroy(){     //Every awaited operation must have completed, their coroutines would never resume otherwise
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if(thread.joinable()){
+            thread.join();
+        }
+        waits.clear();
+    }
+
+
+    Awaiter fence(VkFence fence){
+        VkDevice device = this->device;
+        return {this, [device, fence]{ return vkGetFenceStatus(device, fence) == VK_SUCCESS; }};
+    }
+
+
+    Awaiter timeline(VkSemaphore semaphore, uint64_t value){
+        if(getCounterValue == nullptr){
+            throw std::runtime_error("Timeline semaphores are not supported by this device");
+        }
+        VkDevice device = this->device;
+        PFN_vkGetSemaphoreCounterValue getValue = getCounterValue;
+        return {this, [device, getValue, semaphore, value]{
+            uint64_t current = 0;
+            return getValue(device, semaphore, &current) == VK_SUCCESS && current >= value;
+        }};
+    }
+
+
+    Awaiter ticket(VkQueue queue, SubmitTicket ticket){
+        SubmissionQueue* submissions = this->submissions;
+        return {this, [submissions, queue, ticket]{ return submissions->isComplete(queue, ticket); }};
+    }
+
+
+private:
+    struct Wait {
+        std::function<bool()> ready;
+        std::coroutine_handle<> handle;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    JobSystem* jobs = nullptr;
+    SubmissionQueue* submissions = nullptr;
+    PFN_vkGetSemaphoreCounterValue getCounterValue = nullptr;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Wait> waits;
+    bool running = false;
+
+
+    void add(std::function<bool()> ready, std::coroutine_handle<> handle){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            waits.push_back({std::move(ready), handle});
+        }
+        wake.notify_one();
+    }
+
+
+    void loop(){
+        PROFILE_THREAD("GPU completion");
+        std::vector<Wait> polling;
+        while(true){
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                waits.insert(waits.end(), std::make_move_iterator(polling.begin()), std::make_move_iterator(polling.end()));
+                polling.clear();
+                wake.wait(lock, [this]{ return !running || !waits.empty(); });
+                if(!running) return;
+                polling.swap(waits);
+            }
+
+            bool finished = false;
+            for(size_t i = 0; i < polling.size();){    //Vulkan calls happen outside the lock
+                if(polling[i].ready()){
+                    resumeOnJobs(*jobs, polling[i].handle);
+                    polling[i] = std::move(polling.back());
+                    polling.pop_back();
+                    finished = true;
+                } else {
+                    i++;
+                }
+            }
+
+            if(!finished && !polling.empty()){
+                std::this_thread::sleep_for(std::chrono::microseconds(GPU_COMPLETION_POLL_US));
+            }
+        }
+    }
+};
@@ -0,0 +1,420 @@
+#pragma once
+
+/*
+Bounding volume hierarchy over object bounds (CPU side):
+    A four-wide tree. Each node keeps the boxes of its four children side by side (minX[4], minY[4], ... arrays), so a
+    query tests all four children against a plane or a ray in one pass over two cache lines, and the tree has half
+    the levels of a binary one. Queries cost O(log n) instead of a scan over every object.
+
+    1) build() splits with a binned surface area heuristic (BVH_BINS bins along the longest centroid axis). Every
+       four-wide node is made from two levels of binary splits. Ranges larger than BVH_PARALLEL_PRIMITIVES are built
+       as separate jobs, nodes are taken from a shared counter so a child always has a larger index than its parent
+    2) update() records a primitive's new box and refit() resizes only the boxes on the paths from updated primitives
+       to the root, children before parents. The topology stays, so the tree loosens as objects drift far from where
+       it was built; build() again then
+    3) queryFrustum() drops subtrees outside the frustum and stops testing below nodes that are fully inside.
+       raycast() visits children nearest first and prunes by the closest hit found so far
+
+    Primitives are referred to by the index they had in the array given to build().
+*/
+
+#include "JobSystem.h"
+#include "MathUtil.h"
+#include "Profiler.h"
+
+#include <vector>
+#include <atomic>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+
+
+const uint32_t BVH_WIDTH = 4;
+const uint32_t BVH_LEAF_SIZE = 4;                   //Primitives per leaf at most
+const uint32_t BVH_BINS = 16;
+const uint32_t BVH_PARALLEL_PRIMITIVES = 4096;      //Smaller ranges are built on the job that reached them
+const uint32_t BVH_EMPTY = UINT32_MAX;              //Unused child slot
+
+
+struct Aabb {
+    Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vec3 max = Vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+
+    void grow(const Vec3& point){
+        min = minVec(min, point);
+        max = maxVec(max, point);
+    }
+
+    void grow(const Aabb& box){
+        min = minVec(min, box.min);
+        max = maxVec(max, box.max);
+    }
+
+    Vec3 center() const { return (min + max) * 0.5f; }
+
+    float halfArea() const {    //Half the surface area, all the heuristic needs
+        Vec3 d = max - min;
+        return d.x < 0.0f ? 0.0f : d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+};
+
+
+inline Aabb sphereBounds(const Vec3& center, float radius){
+    return {center - Vec3(radius, radius, radius), center + Vec3(radius, radius, radius)};
+}
+
+
+struct alignas(64) BvhNode {
+    float minX[BVH_WIDTH], minY[BVH_WIDTH], minZ[BVH_WIDTH];
+    float maxX[BVH_WIDTH], maxY[BVH_WIDTH], maxZ[BVH_WIDTH];
+    uint32_t child[BVH_WIDTH];      //Node index, first entry of a leaf in the primitive order, or BVH_EMPTY
+    uint32_t count[BVH_WIDTH];      //Primitives in a leaf, 0 for a child node
+};
+
+static_assert(sizeof(BvhNode) == 128, "BvhNode should span exactly two cache lines");
+
+
+struct BvhHit {
+    uint32_t primitive = BVH_EMPTY;     //BVH_EMPTY if nothing was hit
+    float t = std::numeric_limits<float>::infinity();
+};
+
+
+class Bvh {
+
+public:
+    void build(const Aabb* bounds, uint32_t count, JobSystem& jobs){
+        PROFILE_ZONE("Bvh::build");
+        primitiveBounds.assign(bounds, bounds + count);
+        order.resize(count);
+        for(uint32_t i = 0; i < count; i++) order[i] = i;
+        primitiveSlots.assign(count, 0);
+        dirtyPrimitives.clear();
+        primitiveDirty.assign(count, false);
+
+        nodes.resize(std::max(1u, count));  //Every node holds at least two children, so never more nodes than primitives
+        parents.resize(nodes.size());
+        nodeCount = 1;
+        parents[0] = BVH_EMPTY;
+
+        JobHandle counter = std::make_shared<JobCounter>();
+        buildNode(0, 0, count, jobs, counter);
+        jobs.wait(counter);
+
+        nodes.resize(nodeCount.load());
+        parents.resize(nodes.size());
+    }
+
+
+    void clear(){
+        nodes.clear();
+        parents.clear();
+        order.clear();
+        primitiveBounds.clear();
+        primitiveSlots.clear();
+        dirtyPrimitives.clear();
+        primitiveDirty.clear();
+    }
+
+
+    uint32_t getPrimitiveCount() const { return static_cast<uint32_t>(primitiveBounds.size()); }
+
+    uint32_t getNodeCount() const { return static_cast<uint32_t>(nodes.size()); }
+
+
+    void update(uint32_t primitive, const Aabb& bounds){     //Takes effect at the next refit()
+        primitiveBounds[primitive] = bounds;
+        if(!primitiveDirty[primitive]){
+            primitiveDirty[primitive] = true;
+            dirtyPrimitives.push_back(primitive);
+        }
+    }
+
+
+    void refit(){
+        if(dirtyPrimitives.empty()) return;
+        PROFILE_ZONE("Bvh::refit");
+
+        std::priority_queue<uint32_t> pending;      //Largest index first, children come before their parents
+        std::vector<bool> queued(nodes.size(), false);
+        for(uint32_t primitive : dirtyPrimitives){
+            primitiveDirty[primitive] = false;
+            uint32_t node = primitiveSlots[primitive] / BVH_WIDTH;
+            uint32_t slot = primitiveSlots[primitive] % BVH_WIDTH;
+            Aabb box;
+            for(uint32_t i = 0; i < nodes[node].count[slot]; i++){
+                box.grow(primitiveBounds[order[nodes[node].child[slot] + i]]);
+            }
+            setSlot(nodes[node], slot, box);
+            if(!queued[node]){
+                queued[node] = true;
+                pending.push(node);
+            }
+        }
+        dirtyPrimitives.clear();
+
+        while(!pending.empty()){
+            uint32_t node = pending.top();
+            pending.pop();
+            if(parents[node] == BVH_EMPTY) continue;
+
+            uint32_t parent = parents[node] / BVH_WIDTH;
+            setSlot(nodes[parent], parents[node] % BVH_WIDTH, nodeBounds(nodes[node]));
+            if(!queued[parent]){
+                queued[parent] = true;
+                pending.push(parent);
+            }
+        }
+    }
+
+
+    //visit(primitive, inside): inside is true when the primitive's box is known to be fully inside, so an exact
+    //test can be skipped. Every primitive whose box touches the frustum is visited exactly once
+    template<typename Visit>
+    void queryFrustum(const Frustum& frustum, Visit&& visit) const {
+        if(primitiveBounds.empty()) return;
+
+        struct Entry { uint32_t node; bool inside; };
+        std::vector<Entry> stack;
+        stack.reserve(64);
+        stack.push_back({0, false});
+
+        while(!stack.empty()){
+            Entry entry = stack.back();
+            stack.pop_back();
+            const BvhNode& node = nodes[entry.node];
+
+            uint32_t outside = 0;       //Lane masks
+            uint32_t crossing = 0;
+            if(!entry.inside){
+                for(const auto& plane : frustum.planes){
+                    for(uint32_t lane = 0; lane < BVH_WIDTH; lane++){
+                        float positive = plane[0] * (plane[0] >= 0.0f ? node.maxX[lane] : node.minX[lane]) +     //Corner furthest along the normal
+                                         plane[1] * (plane[1] >= 0.0f ? node.maxY[lane] : node.minY[lane]) +
+                                         plane[2] * (plane[2] >= 0.0f ? node.maxZ[lane] : node.minZ[lane]) + plane[3];
+                        float negative = plane[0] * (plane[0] >= 0.0f ? node.minX[lane] : node.maxX[lane]) +     //And the one furthest against it
+                                         plane[1] * (plane[1] >= 0.0f ? node.minY[lane] : node.maxY[lane]) +
+                                         plane[2] * (plane[2] >= 0.0f ? node.minZ[lane] : node.maxZ[lane]) + plane[3];
+                        outside |= (positive < 0.0f) << lane;
+                        crossing |= (negative < 0.0f) << lane;
+                    }
+                }
+            }
+
+            for(uint32_t lane = 0; lane < BVH_WIDTH; lane++){
+                if(node.child[lane] == BVH_EMPTY || (outside >> lane & 1)) continue;
+                bool inside = entry.inside || !(crossing >> lane & 1);
+                if(node.count[lane] > 0){
+                    for(uint32_t i = 0; i < node.count[lane]; i++){
+                        visit(order[node.child[lane] + i], inside);
+                    }
+                } else {
+                    stack.push_back({node.child[lane], inside});
+                }
+            }
+        }
+    }
+
+
+    //intersect(primitive, tMax) returns the hit distance along the ray, or infinity for a miss or one beyond tMax.
+    //direction need not be normalized; distances are in its units
+    template<typename Intersect>
+    BvhHit raycast(const Vec3& origin, const Vec3& direction, float tMax, Intersect&& intersect) const {
+        BvhHit hit;
+        hit.t = tMax;
+        if(primitiveBounds.empty()) return hit;
+
+        Vec3 inverse(1.0f / (direction.x != 0.0f ? direction.x : 1e-30f), 1.0f / (direction.y != 0.0f ? direction.y : 1e-30f),
+                     1.0f / (direction.z != 0.0f ? direction.z : 1e-30f));
+        struct Entry { uint32_t node; float t; };
+        std::vector<Entry> stack;
+        stack.reserve(64);
+        stack.push_back({0, 0.0f});
+
+        while(!stack.empty()){
+            Entry entry = stack.back();
+            stack.pop_back();
+            if(entry.t > hit.t) continue;   //A closer hit was found since this node was pushed
+            const BvhNode& node = nodes[entry.node];
+
+            float entryT[BVH_WIDTH];
+            for(uint32_t lane = 0; lane < BVH_WIDTH; lane++){      //Slab test
+                float x0 = (node.minX[lane] - origin.x) * inverse.x, x1 = (node.maxX[lane] - origin.x) * inverse.x;
+                float y0 = (node.minY[lane] - origin.y) * inverse.y, y1 = (node.maxY[lane] - origin.y) * inverse.y;
+                float z0 = (node.minZ[lane] - origin.z) * inverse.z, z1 = (node.maxZ[lane] - origin.z) * inverse.z;
+                float tNear = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+                float tFar = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), hit.t));
+                entryT[lane] = node.child[lane] != BVH_EMPTY && tNear <= tFar ? tNear : std::numeric_limits<float>::infinity();
+            }
+
+            uint32_t lanes[BVH_WIDTH] = {0, 1, 2, 3};
+            std::sort(lanes, lanes + BVH_WIDTH, [&entryT](uint32_t a, uint32_t b){ return entryT[a] > entryT[b]; });   //Farthest pushed first
+            for(uint32_t lane : lanes){
+                if(std::isinf(entryT[lane]) || entryT[lane] > hit.t) continue;     //Missed and empty lanes; hit.t may be infinite too
+                if(node.count[lane] > 0){
+                    for(uint32_t i = 0; i < node.count[lane]; i++){
+                        uint32_t primitive = order[node.child[lane] + i];
+                        float t = intersect(primitive, hit.t);
+                        if(t < hit.t){
+                            hit.t = t;
+                            hit.primitive = primitive;
+                        }
+                    }
+                } else {
+                    stack.push_back({node.child[lane], entryT[lane]});
+                }
+            }
+        }
+        return hit;
+    }
+
+
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> parents;          //Per node: parent node * BVH_WIDTH + slot, BVH_EMPTY for the root
+    std::atomic<uint32_t> nodeCount{0};
+    std::vector<uint32_t> order;            //Primitive indices, leaves refer to ranges of it
+    std::vector<Aabb> primitiveBounds;
+    std::vector<uint32_t> primitiveSlots;   //Per primitive: leaf node * BVH_WIDTH + slot
+    std::vector<uint32_t> dirtyPrimitives;
+    std::vector<bool> primitiveDirty;
+
+
+    static void setSlot(BvhNode& node, uint32_t slot, const Aabb& box){
+        node.minX[slot] = box.min.x;
+        node.minY[slot] = box.min.y;
+        node.minZ[slot] = box.min.z;
+        node.maxX[slot] = box.max.x;
+        node.maxY[slot] = box.max.y;
+        node.maxZ[slot] = box.max.z;
+    }
+
+
+    static Aabb nodeBounds(const BvhNode& node){
+        Aabb box;
+        for(uint32_t slot = 0; slot < BVH_WIDTH; slot++){
+            if(node.child[slot] == BVH_EMPTY) continue;
+            box.grow(Vec3(node.minX[slot], node.minY[slot], node.minZ[slot]));
+            box.grow(Vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]));
+        }
+        return box;
+    }
+
+
+    Aabb rangeBounds(uint32_t begin, uint32_t end) const {
+        Aabb box;
+        for(uint32_t i = begin; i < end; i++) box.grow(primitiveBounds[order[i]]);
+        return box;
+    }
+
+
+    uint32_t split(uint32_t begin, uint32_t end){      //Binned SAH; returns the first index of the right half
+        Aabb centroids;
+        for(uint32_t i = begin; i < end; i++) centroids.grow(primitiveBounds[order[i]].center());
+
+        Vec3 extent = centroids.max - centroids.min;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        uint32_t middle = begin + (end - begin) / 2;
+        if(extent[axis] <= 0.0f) return middle;     //All centroids coincide, any split is as good
+
+        float scale = BVH_BINS / extent[axis];
+        auto binOf = [&](uint32_t primitive){
+            int bin = static_cast<int>((primitiveBounds[primitive].center()[axis] - centroids.min[axis]) * scale);
+            return static_cast<uint32_t>(std::clamp(bin, 0, static_cast<int>(BVH_BINS) - 1));
+        };
+
+        Aabb binBounds[BVH_BINS];
+        uint32_t binCounts[BVH_BINS] = {};
+        for(uint32_t i = begin; i < end; i++){
+            uint32_t bin = binOf(order[i]);
+            binBounds[bin].grow(primitiveBounds[order[i]]);
+            binCounts[bin]++;
+        }
+
+        float rightCost[BVH_BINS];      //Sweep from the right, then from the left; split after bin b
+        Aabb right;
+        uint32_t rightCount = 0;
+        for(uint32_t b = BVH_BINS - 1; b > 0; b--){
+            right.grow(binBounds[b]);
+            rightCount += binCounts[b];
+            rightCost[b - 1] = right.halfArea() * rightCount;
+        }
+        Aabb left;
+        uint32_t leftCount = 0;
+        float bestCost = std::numeric_limits<float>::max();
+        uint32_t bestBin = 0;
+        for(uint32_t b = 0; b + 1 < BVH_BINS; b++){
+            left.grow(binBounds[b]);
+            leftCount += binCounts[b];
+            float cost = left.halfArea() * leftCount + rightCost[b];
+            if(leftCount > 0 && leftCount < end - begin && cost < bestCost){
+                bestCost = cost;
+                bestBin = b;
+            }
+        }
+
+        uint32_t* first = order.data() + begin;
+        uint32_t* boundary = std::partition(first, order.data() + end, [&](uint32_t primitive){ return binOf(primitive) <= bestBin; });
+        uint32_t at = static_cast<uint32_t>(boundary - order.data());
+        if(at == begin || at == end){   //Degenerate binning, fall back to the median
+            std::nth_element(first, order.data() + middle, order.data() + end, [&](uint32_t a, uint32_t b){
+                return primitiveBounds[a].center()[axis] < primitiveBounds[b].center()[axis];
+            });
+            return middle;
+        }
+        return at;
+    }
+
+
+    void buildNode(uint32_t index, uint32_t begin, uint32_t end, JobSystem& jobs, const JobHandle& counter){
+        uint32_t ranges[BVH_WIDTH + 1];     //Up to four child ranges from two levels of binary splits
+        uint32_t rangeCount = 1;
+        ranges[0] = begin;
+        ranges[1] = end;
+        if(end - begin > BVH_LEAF_SIZE){
+            uint32_t mid = split(begin, end);
+            uint32_t bounds[5] = {begin, 0, mid, 0, end};
+            uint32_t out = 0;
+            for(uint32_t half = 0; half < 2; half++){
+                uint32_t first = bounds[half * 2], last = bounds[half * 2 + 2];
+                ranges[out++] = first;
+                if(last - first > BVH_LEAF_SIZE){
+                    ranges[out++] = split(first, last);
+                }
+            }
+            ranges[out] = end;
+            rangeCount = out;
+        }
+
+        BvhNode& node = nodes[index];
+        for(uint32_t slot = 0; slot < BVH_WIDTH; slot++){
+            node.child[slot] = BVH_EMPTY;
+            node.count[slot] = 0;
+            setSlot(node, slot, Aabb());
+        }
+
+        for(uint32_t slot = 0; slot < rangeCount; slot++){
+            uint32_t first = ranges[slot], last = ranges[slot + 1];
+            if(first == last) continue;     //Only for an empty tree
+            setSlot(node, slot, rangeBounds(first, last));
+
+            if(last - first <= BVH_LEAF_SIZE){
+                node.child[slot] = first;
+                node.count[slot] = last - first;
+                for(uint32_t i = first; i < last; i++) primitiveSlots[order[i]] = index * BVH_WIDTH + slot;
+                continue;
+            }
+
+            uint32_t child = nodeCount.fetch_add(1);
+            node.child[slot] = child;
+            parents[child] = index * BVH_WIDTH + slot;
+            if(last - first > BVH_PARALLEL_PRIMITIVES){
+                jobs.submit([this, child, first, last, &jobs, counter]{ buildNode(child, first, last, jobs, counter); }, counter);
+            } else {
+                buildNode(child, first, last, jobs, counter);
+            }
+        }
+    }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+/*
+Secondary command buffer cache for draw lists:
+    Most frames draw the same objects as the frame before, and transforms and materials are read by device address
+    (see GpuScene.h), so the recorded commands only change when the list of draws itself changes.
+
+    1) The draw list is cut into fixed chunks of COMMAND_CACHE_CHUNK_DRAWS draws; each chunk is recorded into its own
+       secondary command buffer
+    2) A chunk is keyed by a hash of its object/mesh/material ids, the inheritance state and the cache generation.
+       Per-draw transforms and flags are not part of the key, they reach the GPU through the scene buffers
+    3) Each frame in flight owns its own set of chunk buffers, so a chunk is only re-recorded once the fence of that
+       frame has signalled, and every frame copy catches up on a change the next time it is used
+    4) invalidate() bumps the generation, which re-records everything (pipeline rebuilt, render pass recreated, ...)
+
+    A draw inserted in the middle of the list shifts all later chunks; keeping the list order stable (the scene's
+    object order) keeps such changes local.
+*/
+
+#include "FramePacket.h"
+#include "Profiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+
+const uint32_t COMMAND_CACHE_CHUNK_DRAWS = 256;
+
+
+class CommandCache {
+
+public:
+    using Recorder = std::function<void(VkCommandBuffer commandBuffer, const DrawItem* draws, uint32_t count)>;
+
+
+    void init(VkDevice device, uint32_t queueFamily, uint32_t framesInFlight){
+        this->device = device;
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = queueFamily;
+
+        frames.resize(framesInFlight);
+        for(FrameChunks& frame : frames){
+            if(vkCreateCommandPool(device, &poolInfo, nullptr, &frame.pool) != VK_SUCCESS){
+                throw std::runtime_error("Failed to create command cache pool");
+            }
+        }
+    }
+
+
+    void destroy(){     //Device must be idle
+        for(FrameChunks& frame : frames){
+            vkDestroyCommandPool(device, frame.pool, nullptr);   //Frees the chunk buffers with it
+        }
+        frames.clear();
+    }
+
+
+    void invalidate(){ generation++; }
+
+
+    //Render thread, after the fence of frameIndex. Returns the secondary buffers to execute in order; the framebuffer
+    //in inheritance must be VK_NULL_HANDLE, it differs per swapchain image and would defeat the cache
+    const std::vector<VkCommandBuffer>& update(uint32_t frameIndex, const std::vector<DrawItem>& draws,
+                                               const VkCommandBufferInheritanceInfo& inheritance, const Recorder& record)
+    {
+        PROFILE_ZONE("CommandCache::update");
+        FrameChunks& frame = frames[frameIndex];
+        uint32_t chunkCount = static_cast<uint32_t>((draws.size() + COMMAND_CACHE_CHUNK_DRAWS - 1) / COMMAND_CACHE_CHUNK_DRAWS);
+
+        allocateChunks(frame, chunkCount);
+        frame.executable.clear();
+        uint64_t baseKey = hashInheritance(inheritance);
+
+        for(uint32_t i = 0; i < chunkCount; i++){
+            Chunk& chunk = frame.chunks[i];
+            const DrawItem* first = draws.data() + i * COMMAND_CACHE_CHUNK_DRAWS;
+            uint32_t count = std::min<uint32_t>(COMMAND_CACHE_CHUNK_DRAWS, static_cast<uint32_t>(draws.size()) - i * COMMAND_CACHE_CHUNK_DRAWS);
+            uint64_t key = hashDraws(baseKey, first, count);
+
+            if(!chunk.valid || chunk.key != key || chunk.count != count || chunk.generation != generation){
+                recordChunk(chunk.commandBuffer, inheritance, first, count, record);
+                chunk.key = key;
+                chunk.count = count;
+                chunk.generation = generation;
+                chunk.valid = true;
+                recordedChunks++;
+            } else {
+                reusedChunks++;
+            }
+            frame.executable.push_back(chunk.commandBuffer);
+        }
+        return frame.executable;
+    }
+
+
+    uint64_t getRecordedChunks() const { return recordedChunks; }
+
+    uint64_t getReusedChunks() const { return reusedChunks; }
+
+
+private:
+    struct Chunk {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        uint64_t key = 0;
+        uint64_t generation = 0;
+        uint32_t count = 0;
+        bool valid = false;
+    };
+
+    struct FrameChunks {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<Chunk> chunks;                  //Kept when the list shrinks, reused when it grows again
+        std::vector<VkCommandBuffer> executable;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<FrameChunks> frames;
+    uint64_t generation = 1;
+    uint64_t recordedChunks = 0;
+    uint64_t reusedChunks = 0;
+
+
+    void allocateChunks(FrameChunks& frame, uint32_t chunkCount){
+        if(frame.chunks.size() >= chunkCount) return;
+
+        uint32_t first = static_cast<uint32_t>(frame.chunks.size());
+        std::vector<VkCommandBuffer> buffers(chunkCount - first);
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = static_cast<uint32_t>(buffers.size());
+
+        if(vkAllocateCommandBuffers(device, &allocInfo, buffers.data()) != VK_SUCCESS){
+            throw std::runtime_error("Failed to allocate cached command buffers");
+        }
+        frame.chunks.resize(chunkCount);
+        for(uint32_t i = first; i < chunkCount; i++){
+            frame.chunks[i].commandBuffer = buffers[i - first];
+        }
+    }
+
+
+    void recordChunk(VkCommandBuffer commandBuffer, const VkCommandBufferInheritanceInfo& inheritance,
+                     const DrawItem* draws, uint32_t count, const Recorder& record)
+    {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pInheritanceInfo = &inheritance;
+        if(inheritance.renderPass != VK_NULL_HANDLE){
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        }
+
+        vkResetCommandBuffer(commandBuffer, 0);
+        if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS){
+            throw std::runtime_error("Failed to begin recording cached command buffer");
+        }
+        record(commandBuffer, draws, count);
+        if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){
+            throw std::runtime_error("Failed to record cached command buffer");
+        }
+    }
+
+
+    static uint64_t mix(uint64_t hash, uint64_t value){     //FNV-1a over 64-bit words
+        hash ^= value;
+        return hash * 1099511628211ull;
+    }
+
+
+    static uint64_t hashInheritance(const VkCommandBufferInheritanceInfo& inheritance){
+        uint64_t hash = 14695981039346656037ull;
+        hash = mix(hash, (uint64_t) inheritance.renderPass);
+        hash = mix(hash, inheritance.subpass);
+        return hash;
+    }
+
+
+    static uint64_t hashDraws(uint64_t hash, const DrawItem* draws, uint32_t count){
+        for(uint32_t i = 0; i < count; i++){
+            hash = mix(hash, draws[i].object);
+            hash = mix(hash, draws[i].mesh.key());
+            hash = mix(hash, draws[i].material);
+        }
+        return mix(hash, count);
+    }
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+/*
+Incremental defragmenter for DeviceAllocator:
+    1) Pick the sparsest block (usage below maxUsage) and stop placing new allocations in it
+    2) Each step() copies a few of its movable allocations into gaps of denser blocks with vkCmdCopyBuffer,
+       bounded by a CPU time budget and a byte budget so the GPU copy cost stays small per frame
+    3) The copies join the frame's batch in the SubmissionQueue; once their ticket completes the allocation swaps to the new buffer and onMove() lets owners rebind descriptors
+    4) The old location is kept alive for framesInFlight more steps (frames may still read it) and then released
+    5) Blocks left empty are returned to the driver
+
+    Allocations whose contents change during a move (DeviceAllocator::touch) are left in place and retried later.
+*/
+
+#include "DeviceAllocator.h"
+#include "GpuProfiler.h"
+#include "SubmissionQueue.h"
+
+#include <chrono>
+
+
+class Defragmenter {
+
+public:
+    float maxUsage = 0.5f;                                  //Only blocks used less than this are compacted
+    VkDeviceSize maxBytesPerStep = 16ull * 1024 * 1024;     //Caps GPU copy time per frame
+
+
+    void init(DeviceAllocator& allocator, SubmissionQueue& submissions, VkQueue queue, uint32_t queueFamilyIndex, uint32_t framesInFlight,
+              GpuProfiler* gpuProfiler = nullptr)
+    {
+        this->allocator = &allocator;
+        this->submissions = &submissions;
+        this->gpuProfiler = gpuProfiler;
+        this->device = allocator.getDevice();
+        this->queue = queue;
+        this->framesInFlight = framesInFlight;
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+        if(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create defragmenter command pool");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        if(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS){
+            throw std::runtime_error("Failed to allocate defragmenter command buffer");
+        }
+    }
+
+
+    void destroy(){     //Device must be idle and the copies flushed
+        if(inFlight){
+            finishMoves();
+        }
+        for(const Retired& retired : retiredList){
+            allocator->free(retired.ghost);
+        }
+        retiredList.clear();
+        if(source != nullptr){
+            allocator->undrain(source);
+            source = nullptr;
+        }
+
+        vkDestroyCommandPool(device, commandPool, nullptr);
+    }
+
+
+    void step(double budgetMs){    //Call once per frame, before the frame flushes the queue
+        PROFILE_ZONE("Defragmenter::step");
+        auto start = std::chrono::steady_clock::now();
+        frame++;
+
+        releaseRetired();
+
+        if(inFlight){
+            if(!submissions->isComplete(queue, ticket)) return;     //Copies still running, look again next frame
+            finishMoves();
+        }
+
+        if(elapsedMs(start) < budgetMs){
+            planMoves(start, budgetMs);
+        }
+    }
+
+
+    uint64_t getBytesMoved() const { return bytesMoved; }
+
+
+private:
+    struct Move {
+        Allocation* allocation;
+        Allocation* ghost;
+        uint32_t version;
+    };
+
+    struct Retired {
+        Allocation* ghost;      //Old placement + old buffer, still possibly read by frames in flight
+        uint64_t frame;
+    };
+
+    DeviceAllocator* allocator = nullptr;
+    GpuProfiler* gpuProfiler = nullptr;
+    SubmissionQueue* submissions = nullptr;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t framesInFlight = 2;
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    SubmitTicket ticket = 0;
+
+    MemoryBlock* source = nullptr;
+    std::vector<Move> moves;
+    std::vector<Retired> retiredList;
+    bool inFlight = false;
+    uint64_t frame = 0;
+    uint64_t bytesMoved = 0;
+
+
+    static double elapsedMs(std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+
+    void releaseRetired(){
+        bool released = false;
+        retiredList.erase(std::remove_if(retiredList.begin(), retiredList.end(), [&](const Retired& retired){
+            if(frame - retired.frame <= framesInFlight) return false;
+            allocator->free(retired.ghost);
+            released = true;
+            return true;
+        }), retiredList.end());
+
+        if(released){
+            allocator->releaseEmptyBlocks();
+        }
+    }
+
+
+    void finishMoves(){
+        for(const Move& move : moves){
+            Allocation* allocation = move.allocation;
+
+            if(allocation->freeRequested){
+                allocator->abortMove(allocation, move.ghost);
+                allocator->releaseFreeRequested(allocation);
+                continue;
+            }
+
+            if(allocation->version != move.version){    //Written during the copy; the new location is stale
+                allocator->abortMove(allocation, move.ghost);
+                continue;
+            }
+
+            allocator->commitMove(allocation, move.ghost);
+            retiredList.push_back({move.ghost, frame});
+            bytesMoved += allocation->size;
+
+            if(allocation->onMove){
+                allocation->onMove(*allocation, move.ghost->buffer);
+            }
+        }
+
+        moves.clear();
+        inFlight = false;
+    }
+
+
+    void planMoves(std::chrono::steady_clock::time_point start, double budgetMs){
+        if(source == nullptr){
+            source = allocator->pickSparseBlock(maxUsage);
+            if(source == nullptr) return;   //Nothing worth compacting
+        }
+
+        std::vector<Allocation*> candidates = allocator->movableAllocations(source);
+        if(candidates.empty()){             //Drained; the block is released once its retired ghosts are
+            allocator->undrain(source);
+            source = nullptr;
+            return;
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS){
+            throw std::runtime_error("Failed to begin defragmenter command buffer");
+        }
+
+        VkMemoryBarrier barrier{};      //Make writes from earlier submissions visible to the copies
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        uint32_t zone = gpuProfiler ? gpuProfiler->begin(commandBuffer, "Defragment copies") : GPU_ZONE_INVALID;
+
+        VkDeviceSize bytes = 0;
+        for(Allocation* allocation : candidates){
+            if(!moves.empty() && (bytes + allocation->size > maxBytesPerStep || elapsedMs(start) >= budgetMs)) break;
+
+            Allocation* ghost = allocator->beginMove(allocation);
+            if(ghost == nullptr){           //No room left in denser blocks, give the block back
+                allocator->undrain(source);
+                source = nullptr;
+                break;
+            }
+
+            VkBufferCopy region{};
+            region.size = allocation->bufferSize;   //The allocation's size may be padded past the end of the buffer
+            vkCmdCopyBuffer(commandBuffer, allocation->buffer, ghost->buffer, 1, &region);
+
+            moves.push_back({allocation, ghost, allocation->version});
+            bytes += allocation->size;
+        }
+
+        if(gpuProfiler) gpuProfiler->end(commandBuffer, zone);
+        if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){     //Nothing was copied, every allocation stays where it is
+            for(const Move& move : moves){
+                allocator->abortMove(move.allocation, move.ghost);
+            }
+            moves.clear();
+            if(gpuProfiler) gpuProfiler->discard(zone);
+            throw std::runtime_error("Failed to record defragmenter command buffer");
+        }
+
+        if(moves.empty()){
+            if(gpuProfiler) gpuProfiler->discard(zone);
+            return;
+        }
+
+        ticket = submissions->enqueue(queue, Submission(commandBuffer));     //Goes out with the frame's submit
+        inFlight = true;
+    }
+};
@@ -0,0 +1,571 @@
+#pragma once
+
+/*
+Device memory suballocator:
+    Vulkan implementations only guarantee a few thousand vkAllocateMemory calls (maxMemoryAllocationCount), so resources are
+    placed inside large VkDeviceMemory blocks instead of getting an allocation each.
+
+    1) Blocks are grouped by memory type and by resource kind (buffers vs. images), which keeps bufferImageGranularity out of the picture
+    2) Inside a block allocations are kept sorted by offset and new ones go into the first gap that fits
+    3) Host visible blocks are mapped once for their whole lifetime
+    4) Buffer allocations can be marked movable, which lets the Defragmenter relocate them (see Defragmenter.h)
+    5) With VK_EXT_external_memory_host, importHostBuffer() wraps existing host memory (shared memory, mapped files) in
+       a buffer of its own. Such a block holds exactly that one allocation and is freed together with it; the host
+       memory must stay mapped until then
+*/
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+
+struct MemoryBlock;
+
+
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;                  //Memory requirement, may be padded past the resource's own size
+    VkDeviceSize alignment = 1;
+    void* mapped = nullptr;                 //Host pointer to the start of the allocation, only set for host visible memory
+    MemoryBlock* block = nullptr;
+
+    VkBuffer buffer = VK_NULL_HANDLE;       //Buffer bound to this allocation (VK_NULL_HANDLE for image allocations)
+    VkDeviceSize bufferSize = 0;            //Size buffer was created with; copies of its contents must not go past it
+    VkBufferUsageFlags usage = 0;
+    bool movable = false;
+
+    uint32_t version = 0;                   //Bumped by DeviceAllocator::touch() on every write so an in-flight move can detect stale copies
+    bool moving = false;                    //A copy to a new location is in flight
+    bool freeRequested = false;             //free() was called while moving, the defragmenter releases it once the copy retires
+
+    std::function<void(Allocation&, VkBuffer oldBuffer)> onMove;   //Called after relocation so owners can rewrite descriptors/bindings
+};
+
+
+struct MemoryBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    VkDeviceSize used = 0;
+    uint32_t memoryTypeIndex = 0;
+    bool linear = true;                     //true: buffers, false: optimal tiling images
+    void* mapped = nullptr;
+    bool draining = false;                  //Being emptied by the defragmenter, no new allocations are placed here
+    bool imported = false;                  //Wraps host memory from importHostBuffer(), never shared or moved
+    std::vector<Allocation*> allocations;   //Sorted by offset
+};
+
+
+static inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment){
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+class DeviceAllocator {
+
+public:
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, bool bufferDeviceAddress = false, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE){
+        this->device = device;
+        this->blockSize = blockSize;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        if(bufferDeviceAddress){    //Core in 1.2, otherwise VK_KHR_buffer_device_address
+            getBufferDeviceAddress = (PFN_vkGetBufferDeviceAddress) vkGetDeviceProcAddr(device, "vkGetBufferDeviceAddress");
+            if(getBufferDeviceAddress == nullptr){
+                getBufferDeviceAddress = (PFN_vkGetBufferDeviceAddress) vkGetDeviceProcAddr(device, "vkGetBufferDeviceAddressKHR");
+            }
+        }
+    }
+
+
+    void destroy(){
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& block : blocks){
+            for(Allocation* allocation : block->allocations){
+                if(allocation->buffer != VK_NULL_HANDLE){
+                    vkDestroyBuffer(device, allocation->buffer, nullptr);
+                }
+                delete allocation;
+            }
+            vkFreeMemory(device, block->memory, nullptr);   //Freeing implicitly unmaps
+        }
+        blocks.clear();
+    }
+
+
+    Allocation* createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, bool movable = true){
+        if(movable){
+            usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;  //Moves are plain GPU copies
+        }
+
+        VkBuffer buffer = makeBuffer(size, usage);
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer, &requirements);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Allocation* allocation;
+        try {
+            allocation = allocate(requirements, properties, true, nullptr);
+        } catch(...){
+            vkDestroyBuffer(device, buffer, nullptr);
+            throw;
+        }
+        allocation->buffer = buffer;
+        allocation->bufferSize = size;
+        allocation->usage = usage;
+        allocation->movable = movable;
+
+        if(vkBindBufferMemory(device, buffer, allocation->memory, allocation->offset) != VK_SUCCESS){
+            release(allocation);    //Destroys the buffer as well
+            throw std::runtime_error("Failed to bind buffer memory");
+        }
+        return allocation;
+    }
+
+
+    Allocation* allocateImage(VkImage image, VkMemoryPropertyFlags properties){  //Images are never moved, their layout is not tracked here
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, image, &requirements);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Allocation* allocation = allocate(requirements, properties, false, nullptr);
+
+        if(vkBindImageMemory(device, image, allocation->memory, allocation->offset) != VK_SUCCESS){
+            release(allocation);    //The image stays with the caller
+            throw std::runtime_error("Failed to bind image memory");
+        }
+        return allocation;
+    }
+
+
+    void free(Allocation* allocation){     //Caller guarantees the GPU no longer uses the resource
+        if(allocation == nullptr) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(allocation->moving){
+            allocation->freeRequested = true;
+            return;
+        }
+        release(allocation);
+    }
+
+
+    VkDeviceAddress getAddress(const Allocation* allocation) const {  //Changes when the defragmenter moves the allocation
+        if(getBufferDeviceAddress == nullptr){
+            throw std::runtime_error("Buffer device addresses are not enabled");
+        }
+
+        VkBufferDeviceAddressInfo addressInfo{};
+        addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+        addressInfo.buffer = allocation->buffer;
+        return getBufferDeviceAddress(device, &addressInfo);
+    }
+
+
+    bool hasBufferDeviceAddress() const { return getBufferDeviceAddress != nullptr; }
+
+
+    void touch(Allocation* allocation){    //Call after writing the contents of a movable allocation
+        std::lock_guard<std::mutex> lock(mutex);
+        allocation->version++;
+    }
+
+
+    VkDeviceSize totalBlockSize(){
+        std::lock_guard<std::mutex> lock(mutex);
+        VkDeviceSize total = 0;
+        for(auto& block : blocks) total += block->size;
+        return total;
+    }
+
+
+    VkDeviceSize totalUsed(){
+        std::lock_guard<std::mutex> lock(mutex);
+        VkDeviceSize total = 0;
+        for(auto& block : blocks) total += block->used;
+        return total;
+    }
+
+
+    void enableHostImport(VkDeviceSize alignment){     //Device has VK_EXT_external_memory_host enabled
+        getHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT) vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+        hostImportAlignment = alignment;
+    }
+
+
+    bool canImportHost() const { return getHostPointerProperties != nullptr; }
+
+    VkDeviceSize getHostImportAlignment() const { return hostImportAlignment; }     //minImportedHostPointerAlignment
+
+
+    //Buffer backed by size bytes at hostPointer, both aligned to getHostImportAlignment(). nullptr if the driver cannot
+    //import that memory (or no host coherent type fits), the caller falls back to a copy then
+    Allocation* importHostBuffer(void* hostPointer, VkDeviceSize size, VkBufferUsageFlags usage){
+        if(getHostPointerProperties == nullptr) return nullptr;
+        if(reinterpret_cast<uintptr_t>(hostPointer) % hostImportAlignment != 0 || size % hostImportAlignment != 0) return nullptr;
+
+        VkMemoryHostPointerPropertiesEXT pointerProperties{};
+        pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+        if(getHostPointerProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, hostPointer, &pointerProperties) != VK_SUCCESS){
+            return nullptr;
+        }
+
+        VkExternalMemoryBufferCreateInfo externalInfo{};
+        externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+        externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+        VkBuffer buffer = makeBuffer(size, usage, &externalInfo);
+
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer, &requirements);
+
+        uint32_t typeBits = requirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+        uint32_t memoryTypeIndex = UINT32_MAX;
+        for(uint32_t i = 0; i < memoryProperties.memoryTypeCount && memoryTypeIndex == UINT32_MAX; i++){    //Coherent, nobody flushes
+            if((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)){
+                memoryTypeIndex = i;
+            }
+        }
+
+        VkImportMemoryHostPointerInfoEXT importInfo{};
+        importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+        importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+        importInfo.pHostPointer = hostPointer;
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.pNext = &importInfo;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+        auto block = std::make_unique<MemoryBlock>();
+        if(memoryTypeIndex == UINT32_MAX || vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS){
+            vkDestroyBuffer(device, buffer, nullptr);
+            return nullptr;
+        }
+        if(vkBindBufferMemory(device, buffer, block->memory, 0) != VK_SUCCESS){
+            vkFreeMemory(device, block->memory, nullptr);
+            vkDestroyBuffer(device, buffer, nullptr);
+            return nullptr;
+        }
+        block->size = size;
+        block->memoryTypeIndex = memoryTypeIndex;
+        block->mapped = hostPointer;
+        block->imported = true;
+
+        Allocation* allocation = new Allocation();
+        allocation->size = size;
+        allocation->alignment = hostImportAlignment;
+        allocation->buffer = buffer;
+        allocation->bufferSize = size;
+        allocation->usage = usage;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        place(*block, allocation, 0, 0);
+        blocks.push_back(std::move(block));
+        return allocation;
+    }
+
+
+    VkDevice getDevice() const { return device; }
+
+    const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const { return memoryProperties; }
+
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+        for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++){
+            if((typeFilter & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties){
+                return i;
+            }
+        }
+        throw std::runtime_error("Failed to find suitable memory type");
+    }
+
+
+    ////////////////////////////////////////// Defragmentation support ///////////////////////////////////////////////////////////////////////////////////////////
+
+    MemoryBlock* pickSparseBlock(float maxUsage){  //Least used block below maxUsage that still holds movable allocations
+        std::lock_guard<std::mutex> lock(mutex);
+        MemoryBlock* best = nullptr;
+        float bestUsage = maxUsage;
+
+        for(auto& block : blocks){
+            if(!block->linear || block->draining || block->imported || block->allocations.empty()) continue;
+
+            float usage = static_cast<float>(block->used) / static_cast<float>(block->size);
+            if(usage >= bestUsage || !hasMovable(*block) || !hasSibling(*block)) continue;
+
+            best = block.get();
+            bestUsage = usage;
+        }
+
+        if(best != nullptr){
+            best->draining = true;
+        }
+        return best;
+    }
+
+
+    std::vector<Allocation*> movableAllocations(MemoryBlock* block){
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Allocation*> result;
+        for(Allocation* allocation : block->allocations){
+            if(allocation->movable && !allocation->moving && !allocation->freeRequested){
+                result.push_back(allocation);
+            }
+        }
+        return result;
+    }
+
+
+    Allocation* beginMove(Allocation* allocation){  //Reserves a new home outside draining blocks; never grows the heap
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t memoryTypeIndex = allocation->block->memoryTypeIndex;
+
+        for(auto& block : blocks){
+            if(block->draining || block->imported || !block->linear || block->memoryTypeIndex != memoryTypeIndex) continue;
+
+            VkDeviceSize offset;
+            size_t index;
+            if(!findGap(*block, allocation->size, allocation->alignment, offset, index)) continue;
+
+            Allocation* ghost = new Allocation();
+            ghost->size = allocation->size;
+            ghost->alignment = allocation->alignment;
+            ghost->usage = allocation->usage;
+            ghost->bufferSize = allocation->bufferSize;     //Same create info, so the same requirements as the original
+            place(*block, ghost, offset, index);
+
+            try {
+                ghost->buffer = makeBuffer(allocation->bufferSize, allocation->usage);
+            } catch(...){
+                release(ghost);
+                throw;
+            }
+            if(vkBindBufferMemory(device, ghost->buffer, ghost->memory, ghost->offset) != VK_SUCCESS){
+                release(ghost);
+                throw std::runtime_error("Failed to bind buffer memory");
+            }
+
+            allocation->moving = true;
+            return ghost;
+        }
+        return nullptr;
+    }
+
+
+    void commitMove(Allocation* allocation, Allocation* ghost){  //Swap placements; ghost now holds the old memory and buffer
+        std::lock_guard<std::mutex> lock(mutex);
+        MemoryBlock* oldBlock = allocation->block;
+        MemoryBlock* newBlock = ghost->block;
+
+        *std::find(oldBlock->allocations.begin(), oldBlock->allocations.end(), allocation) = ghost;
+        *std::find(newBlock->allocations.begin(), newBlock->allocations.end(), ghost) = allocation;
+
+        std::swap(allocation->memory, ghost->memory);
+        std::swap(allocation->offset, ghost->offset);
+        std::swap(allocation->mapped, ghost->mapped);
+        std::swap(allocation->block, ghost->block);
+        std::swap(allocation->buffer, ghost->buffer);
+        allocation->moving = false;
+    }
+
+
+    void abortMove(Allocation* allocation, Allocation* ghost){
+        std::lock_guard<std::mutex> lock(mutex);
+        allocation->moving = false;
+        release(ghost);
+    }
+
+
+    void releaseFreeRequested(Allocation* allocation){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(allocation->freeRequested){
+            release(allocation);
+        }
+    }
+
+
+    void undrain(MemoryBlock* block){
+        std::lock_guard<std::mutex> lock(mutex);
+        block->draining = false;
+    }
+
+
+    void releaseEmptyBlocks(){
+        std::lock_guard<std::mutex> lock(mutex);
+        blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [this](const std::unique_ptr<MemoryBlock>& block){
+            if(!block->allocations.empty() || block->draining) return false;
+            vkFreeMemory(device, block->memory, nullptr);
+            return true;
+        }), blocks.end());
+    }
+
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    PFN_vkGetBufferDeviceAddress getBufferDeviceAddress = nullptr;
+    PFN_vkGetMemoryHostPointerPropertiesEXT getHostPointerProperties = nullptr;
+    VkDeviceSize hostImportAlignment = 1;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<MemoryBlock>> blocks;
+
+
+    VkBuffer makeBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const void* pNext = nullptr){
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.pNext = pNext;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VkBuffer buffer;
+        if(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create buffer");
+        }
+        return buffer;
+    }
+
+
+    Allocation* allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, const void* pNext){
+        uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+
+        Allocation* allocation = new Allocation();
+        allocation->size = requirements.size;
+        allocation->alignment = requirements.alignment;
+
+        for(auto& block : blocks){
+            if(block->draining || block->imported || block->linear != linear || block->memoryTypeIndex != memoryTypeIndex) continue;
+
+            VkDeviceSize offset;
+            size_t index;
+            if(findGap(*block, requirements.size, requirements.alignment, offset, index)){
+                place(*block, allocation, offset, index);
+                return allocation;
+            }
+        }
+
+        VkMemoryAllocateFlagsInfo flagsInfo{};     //Any buffer in a linear block may ask for its device address
+        if(linear && getBufferDeviceAddress != nullptr){
+            flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+            flagsInfo.pNext = pNext;
+            flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+            pNext = &flagsInfo;
+        }
+
+        MemoryBlock* block;
+        try {
+            block = &createBlock(std::max(blockSize, requirements.size), memoryTypeIndex, linear, pNext);
+        } catch(...){
+            delete allocation;
+            throw;
+        }
+        place(*block, allocation, 0, 0);
+        return allocation;
+    }
+
+
+    MemoryBlock& createBlock(VkDeviceSize size, uint32_t memoryTypeIndex, bool linear, const void* pNext){
+        auto block = std::make_unique<MemoryBlock>();
+        block->size = size;
+        block->memoryTypeIndex = memoryTypeIndex;
+        block->linear = linear;
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.pNext = pNext;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+        if(vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS){
+            throw std::runtime_error("Failed to allocate device memory block");
+        }
+
+        if(memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT){
+            if(vkMapMemory(device, block->memory, 0, size, 0, &block->mapped) != VK_SUCCESS){     //Persistently mapped
+                vkFreeMemory(device, block->memory, nullptr);
+                throw std::runtime_error("Failed to map device memory block");
+            }
+        }
+
+        blocks.push_back(std::move(block));
+        return *blocks.back();
+    }
+
+
+    bool findGap(const MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, size_t& index){  //First fit
+        VkDeviceSize cursor = 0;
+        for(size_t i = 0; i < block.allocations.size(); i++){
+            const Allocation* next = block.allocations[i];
+            VkDeviceSize aligned = alignUp(cursor, alignment);
+            if(aligned + size <= next->offset){
+                offset = aligned;
+                index = i;
+                return true;
+            }
+            cursor = next->offset + next->size;
+        }
+
+        VkDeviceSize aligned = alignUp(cursor, alignment);
+        if(aligned + size <= block.size){
+            offset = aligned;
+            index = block.allocations.size();
+            return true;
+        }
+        return false;
+    }
+
+
+    void place(MemoryBlock& block, Allocation* allocation, VkDeviceSize offset, size_t index){
+        allocation->memory = block.memory;
+        allocation->offset = offset;
+        allocation->block = &block;
+        allocation->mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+
+        block.allocations.insert(block.allocations.begin() + index, allocation);
+        block.used += allocation->size;
+    }
+
+
+    void release(Allocation* allocation){
+        MemoryBlock* block = allocation->block;
+        block->allocations.erase(std::find(block->allocations.begin(), block->allocations.end(), allocation));
+        block->used -= allocation->size;
+
+        if(allocation->buffer != VK_NULL_HANDLE){
+            vkDestroyBuffer(device, allocation->buffer, nullptr);
+        }
+        delete allocation;
+
+        if(block->imported){    //Gone right away, the owner unmaps the host memory next
+            vkFreeMemory(device, block->memory, nullptr);
+            blocks.erase(std::find_if(blocks.begin(), blocks.end(), [block](const std::unique_ptr<MemoryBlock>& each){ return each.get() == block; }));
+        }
+    }
+
+
+    bool hasMovable(const MemoryBlock& block){
+        for(const Allocation* allocation : block.allocations){
+            if(allocation->movable && !allocation->moving) return true;
+        }
+        return false;
+    }
+
+
+    bool hasSibling(const MemoryBlock& block){     //Another block the contents could move into
+        for(auto& other : blocks){
+            if(other.get() != &block && !other->draining && !other->imported && other->linear && other->memoryTypeIndex == block.memoryTypeIndex) return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+/*
+Frame-scoped linear arenas:
+    Per-frame temporaries (submission lists, barrier lists, culling output, scratch vectors) are bump allocated and
+    released wholesale instead of going through malloc one by one.
+
+    1) LinearArena is a std::pmr::memory_resource: any std::pmr container can live in it (ArenaVector<T>), and
+       deallocate is a no-op
+    2) It grows by chaining chunks and never moves memory. On reset() a frame that needed several chunks gets one
+       chunk of the combined size, so steady state is a single chunk and no allocations at all
+    3) FrameArenas keeps one arena per thread for each frame in flight. local() returns the calling thread's arena of
+       the current frame, so threads never share an arena and need no locks. A thread's slot goes back to a free list
+       when the thread exits, so a restarted thread (the render thread after a swap chain recreation) takes it over
+       instead of using up maxThreads
+    4) beginFrame(frameIndex) is called once that frame slot has retired; it resets every thread's arena of that slot
+
+    Memory from local() stays valid until the same frame slot begins again, i.e. for framesInFlight frames. Only the
+    render thread and jobs it waits for within a frame should allocate from it.
+*/
+
+#include <memory_resource>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+
+const size_t FRAME_ARENA_CHUNK_SIZE = 256 * 1024;
+
+
+template<typename T>
+using ArenaVector = std::pmr::vector<T>;
+
+
+class LinearArena : public std::pmr::memory_resource {
+
+public:
+    explicit LinearArena(size_t chunkSize = FRAME_ARENA_CHUNK_SIZE) : chunkSize(chunkSize) {}
+
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+
+
+    void reset(){
+        if(chunks.size() > 1){      //Coalesce so the next frame fits in one chunk
+            size_t total = 0;
+            for(const Chunk& chunk : chunks) total += chunk.size;
+            chunks.clear();
+            addChunk(total);
+        }
+        current = 0;
+        offset = 0;
+        used = 0;
+    }
+
+
+    size_t getUsed() const { return used; }
+
+    size_t getPeak() const { return peak; }
+
+    size_t getCapacity() const {
+        size_t total = 0;
+        for(const Chunk& chunk : chunks) total += chunk.size;
+        return total;
+    }
+
+
+private:
+    struct Chunk {
+        std::unique_ptr<std::byte[]> memory;
+        size_t size;
+    };
+
+    size_t chunkSize;
+    std::vector<Chunk> chunks;
+    size_t current = 0;     //Chunk being filled
+    size_t offset = 0;      //Within chunks[current]
+    size_t used = 0;
+    size_t peak = 0;
+
+
+    void addChunk(size_t size){
+        chunks.push_back({std::make_unique<std::byte[]>(size), size});
+    }
+
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        while(true){
+            if(current < chunks.size()){
+                Chunk& chunk = chunks[current];
+                uintptr_t base = reinterpret_cast<uintptr_t>(chunk.memory.get());
+                size_t aligned = ((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+                if(aligned + bytes <= chunk.size){
+                    offset = aligned + bytes;
+                    used += bytes;
+                    peak = std::max(peak, used);
+                    return chunk.memory.get() + aligned;
+                }
+                if(current + 1 < chunks.size()){
+                    current++;
+                    offset = 0;
+                    continue;
+                }
+            }
+            addChunk(std::max(chunkSize, bytes + alignment));
+            current = chunks.size() - 1;
+            offset = 0;
+        }
+    }
+
+
+    void do_deallocate(void*, size_t, size_t) override {}     //Freed by reset()
+
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+
+class FrameArenas {
+
+public:
+    void init(uint32_t framesInFlight, uint32_t maxThreads){
+        this->maxThreads = maxThreads;
+        arenas.clear();
+        for(uint32_t i = 0; i < framesInFlight * maxThreads; i++){
+            arenas.push_back(std::make_unique<LinearArena>());
+        }
+        currentFrame = 0;
+    }
+
+
+    void beginFrame(uint32_t frameIndex){   //Render thread, once everything the slot's previous frame used has retired
+        for(uint32_t thread = 0; thread < maxThreads; thread++){
+            arena(frameIndex, thread).reset();
+        }
+        currentFrame.store(frameIndex, std::memory_order_release);
+    }
+
+
+    LinearArena& local(){
+        uint32_t slot = threadSlot();
+        if(slot >= maxThreads){
+            throw std::runtime_error("More threads use FrameArenas than it was initialized for");
+        }
+        return arena(currentFrame.load(std::memory_order_acquire), slot);
+    }
+
+
+    size_t getUsed(uint32_t frameIndex) const {
+        size_t total = 0;
+        for(uint32_t thread = 0; thread < maxThreads; thread++){
+            total += arenas[frameIndex * maxThreads + thread]->getUsed();
+        }
+        return total;
+    }
+
+
+private:
+    std::vector<std::unique_ptr<LinearArena>> arenas;   //[frame][thread]
+    uint32_t maxThreads = 0;
+    std::atomic<uint32_t> currentFrame{0};
+
+
+    LinearArena& arena(uint32_t frameIndex, uint32_t thread){
+        return *arenas[frameIndex * maxThreads + thread];
+    }
+
+
+    struct SlotAllocator {      //Process-wide, slots are indices into every FrameArenas
+        std::mutex mutex;
+        std::vector<uint32_t> free;
+        uint32_t next = 0;
+
+        uint32_t acquire(){     //Lowest free slot, so live threads stay packed below maxThreads
+            std::lock_guard<std::mutex> lock(mutex);
+            if(free.empty()) return next++;
+            auto lowest = std::min_element(free.begin(), free.end());
+            uint32_t slot = *lowest;
+            free.erase(lowest);
+            return slot;
+        }
+
+        void release(uint32_t slot){
+            std::lock_guard<std::mutex> lock(mutex);
+            free.push_back(slot);
+        }
+    };
+
+
+    struct ThreadSlot {     //Held by each thread that used local(), released when the thread exits
+        uint32_t slot;
+        ThreadSlot() : slot(slotAllocator().acquire()) {}
+        ~ThreadSlot(){ slotAllocator().release(slot); }
+    };
+
+
+    static SlotAllocator& slotAllocator(){
+        static SlotAllocator allocator;
+        return allocator;
+    }
+
+
+    //Handed out on a thread's first use. The next owner of a released slot keeps bump allocating into the same arenas;
+    //nothing it allocates overlaps what the exited thread left there, and beginFrame() frees both as usual
+    static uint32_t threadSlot(){
+        thread_local ThreadSlot slot;
+        return slot.slot;
+    }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+/*
+GPU side of frame sharing (SharedFrames.h):
+    Each frame's swap chain image is copied into the shared memory slot the frame is assigned, by the frame's own
+    command buffer.
+
+    1) With VK_EXT_external_memory_host the whole slot range is imported as one buffer (DeviceAllocator::importHostBuffer)
+       and vkCmdCopyImageToBuffer writes straight into shared memory; nothing is copied on the CPU
+    2) Without it, or when the driver refuses the import, every frame in flight gets a host visible readback buffer
+       and retire() copies it into the slot once
+    3) A slot is published in retire(), after the frame slot's submission completed, so readers never see a frame the
+       GPU is still writing. The shared ring needs more slots than frames in flight for that
+*/
+
+#include "SharedFrames.h"
+#include "DeviceAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+
+class FrameExport {
+
+public:
+    void init(DeviceAllocator& allocator, SharedFrameWriter& frames, uint32_t framesInFlight){
+        this->allocator = &allocator;
+        this->frames = &frames;
+        const SharedFrameHeader& header = frames.getHeader();
+        frameSize = static_cast<VkDeviceSize>(header.stride) * header.height;
+
+        imported = allocator.importHostBuffer(frames.slotsBegin(), frames.getSlotsSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        if(imported == nullptr){
+            readback.resize(framesInFlight);
+            for(Allocation*& buffer : readback){
+                buffer = allocator.createBuffer(frameSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+            }
+        }
+        pending.assign(framesInFlight, {});
+    }
+
+
+    void destroy(){     //GPU must be done with every frame; unpublished frames are dropped
+        allocator->free(imported);
+        for(Allocation* buffer : readback){
+            allocator->free(buffer);
+        }
+        imported = nullptr;
+        readback.clear();
+    }
+
+
+    bool isZeroCopy() const { return imported != nullptr; }
+
+
+    //image is in TRANSFER_SRC_OPTIMAL and matches the shared header's size and format
+    void record(VkCommandBuffer commandBuffer, uint32_t frame, uint64_t frameNumber, VkImage image){
+        const SharedFrameHeader& header = frames->getHeader();
+        uint32_t slot = frames->beginFrame();
+        pending[frame] = {slot, frameNumber, true};
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = imported != nullptr ? header.slotSize * slot : 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {header.width, header.height, 1};
+        VkBuffer buffer = imported != nullptr ? imported->buffer : readback[frame]->buffer;
+        vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+        VkMemoryBarrier barrier{};      //Made visible to the host, which is where readers look
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+
+    void retire(uint32_t frame){    //The last submission of this frame slot has completed
+        Pending& done = pending[frame];
+        if(!done.active) return;
+
+        if(imported == nullptr){
+            memcpy(frames->slotData(done.slot), readback[frame]->mapped, frameSize);
+        }
+        frames->endFrame(done.slot, done.frameNumber);
+        done.active = false;
+    }
+
+
+private:
+    struct Pending {
+        uint32_t slot = 0;
+        uint64_t frameNumber = 0;
+        bool active = false;
+    };
+
+    DeviceAllocator* allocator = nullptr;
+    SharedFrameWriter* frames = nullptr;
+    VkDeviceSize frameSize = 0;
+    Allocation* imported = nullptr;         //Every shared slot, when the import worked
+    std::vector<Allocation*> readback;      //One per frame in flight otherwise
+    std::vector<Pending> pending;           //Frame written by each frame slot's last submission
+};
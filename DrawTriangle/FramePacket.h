@@ -0,0 +1,123 @@
+#pragma once
+
+/*
+Frame packets hand one frame's worth of state from the simulation thread to the render thread:
+    1) The simulation thread takes a free packet (acquire), fills it and publishes it. From then on it is
+       read-only until the render thread releases it
+    2) The render thread consumes packets in order, records and submits the frame, and releases the packet
+       back to the free list
+    3) Both directions are SpscRings, so the handoff takes no locks and allocates nothing; packets keep the
+       capacity of their vectors across reuse
+
+    When every packet is in use the simulation thread simply gets nullptr from acquire() and keeps handling
+    input, instead of blocking on a render thread that is stuck in the driver.
+
+    Picks ride along the same way: a packet may ask for the object id under a pixel, and the render thread answers
+    through a third ring once that frame's ids are readable, which for the GPU is some frames later.
+*/
+
+#include "SpscRing.h"
+#include "HandlePool.h"
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+
+const uint32_t FRAME_PACKET_COUNT = 4;      //Packets in the pipe: queued for render, being rendered, being filled
+const uint32_t PICK_RESULT_CAPACITY = 8;    //Answered picks the simulation thread has not taken yet; more are dropped
+const uint32_t PICK_NONE = UINT32_MAX;      //Object id where nothing was drawn
+
+
+struct CameraData {
+    float view[16];
+    float projection[16];
+    float position[3];
+    float fovY;
+};
+
+
+const uint32_t DRAW_TRANSFORM_CHANGED = 1;     //transform differs from what the render thread last wrote for this object
+
+
+struct DrawItem {
+    uint32_t object;    //GpuScene object id
+    MeshHandle mesh;
+    uint32_t material;
+    uint32_t flags;
+    float transform[16];    //Interpolated object to world for this frame
+};
+
+
+struct FramePacket {
+    uint64_t frameNumber = 0;
+    double time = 0.0;                  //Interpolated simulation time this packet shows, in seconds
+    uint64_t inputTimestampNs = 0;      //Arrival of the earliest input folded into this packet (steady_clock ns), 0 if none
+    CameraData camera{};
+    float clearColor[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    std::vector<DrawItem> draws;        //Visible draws in submission order
+    uint32_t pickSequence = 0;          //Nonzero asks for the object id under pickPixel
+    int32_t pickPixel[2] = {0, 0};      //Framebuffer pixel, top row first
+};
+
+
+struct PickResult {
+    uint32_t sequence;      //pickSequence of the packet that asked
+    uint32_t object;        //GpuScene object id, PICK_NONE when nothing was drawn there
+};
+
+
+class FramePipe {
+
+public:
+    FramePipe(){
+        for(FramePacket& packet : packets){
+            freePackets.tryPush(&packet);
+        }
+    }
+
+
+    FramePacket* acquire(){                     //Simulation thread; nullptr while the render thread is behind
+        FramePacket* packet = nullptr;
+        if(!freePackets.tryPop(packet)) return nullptr;
+        packet->draws.clear();
+        return packet;
+    }
+
+
+    void publish(FramePacket* packet){          //Simulation thread; the packet must come from acquire()
+        readyPackets.tryPush(packet);           //Never full, there are only as many packets as slots
+    }
+
+
+    const FramePacket* consume(){               //Render thread; nullptr when nothing is queued
+        FramePacket* packet = nullptr;
+        readyPackets.tryPop(packet);
+        return packet;
+    }
+
+
+    void release(const FramePacket* packet){    //Render thread, once the packet is no longer read
+        freePackets.tryPush(const_cast<FramePacket*>(packet));
+    }
+
+
+    size_t queued() const { return readyPackets.size(); }
+
+
+    void postPick(const PickResult& result){    //Render thread
+        pickResults.tryPush(result);
+    }
+
+
+    bool takePick(PickResult& result){          //Simulation thread
+        return pickResults.tryPop(result);
+    }
+
+
+private:
+    std::array<FramePacket, FRAME_PACKET_COUNT> packets;
+    SpscRing<FramePacket*, FRAME_PACKET_COUNT> freePackets;     //render -> simulation
+    SpscRing<FramePacket*, FRAME_PACKET_COUNT> readyPackets;    //simulation -> render
+    SpscRing<PickResult, PICK_RESULT_CAPACITY> pickResults;     //render -> simulation
+};
@@ -0,0 +1,755 @@
+#pragma once
+
+/*
+glTF 2.0 importer (.gltf with external or embedded buffers, and .glb):
+    open() reads the JSON, maps the buffers and works out how much geometry there is; decode() then converts it
+    straight into memory the caller provides, normally a host visible staging buffer, so every vertex is written
+    once in its final packed form (Vertex.h) and never copied on the CPU again.
+
+    1) The JSON is parsed on the calling thread (Json.h), it is small next to the binary payload. External buffers are
+       memory mapped, base64 data URIs are decoded on the job system in parallel chunks
+    2) Every triangle primitive becomes one GltfMesh with its own range of vertices and indices. decode() converts the
+       primitives in parallel, one job each: attributes are read with their component type and normalization (so
+       KHR_mesh_quantization files load too), sparse accessors are applied, strips and fans become lists, missing
+       normals are computed and the bounding sphere is taken
+    3) The node hierarchy of the default scene is flattened into GltfInstances with world matrices
+    4) Materials keep their metallic-roughness factors; textures are not loaded
+
+    Compressed geometry (KHR_draco_mesh_compression, EXT_meshopt_compression) has no decoder in this tree: when a file
+    only uses the extension the uncompressed fallback data is read, when it requires it open() throws.
+    Points and lines are skipped. All errors are reported as std::runtime_error.
+*/
+
+#include "Json.h"
+#include "MappedFile.h"
+#include "JobSystem.h"
+#include "MathUtil.h"
+#include "Vertex.h"
+#include "Profiler.h"
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+
+const uint32_t GLTF_NO_MATERIAL = UINT32_MAX;
+const uint32_t GLTF_BASE64_CHUNK = 64 * 1024;      //Characters per base64 decoding job, a multiple of 4
+
+const uint32_t GLB_MAGIC = 0x46546C67;             //"glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+const uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+
+struct GltfMaterial {
+    float baseColor[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    float emissive[3] = {0.0f, 0.0f, 0.0f};
+    float metallic = 1.0f;
+    float roughness = 1.0f;
+};
+
+
+struct GltfMesh {           //One triangle primitive
+    uint32_t firstVertex = 0;           //Into the arrays given to decode()
+    uint32_t vertexCount = 0;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;            //Indices count from firstVertex
+    uint32_t material = GLTF_NO_MATERIAL;
+    float center[3] = {0.0f, 0.0f, 0.0f};   //Bounding sphere in object space, filled in by decode()
+    float radius = 0.0f;
+};
+
+
+struct GltfInstance {
+    uint32_t mesh;
+    float transform[16];    //Column major object to world
+};
+
+
+struct GltfScene {
+    std::vector<GltfMesh> meshes;
+    std::vector<GltfMaterial> materials;
+    std::vector<GltfInstance> instances;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+};
+
+
+class GltfImporter {
+
+public:
+    void open(const std::string& path, JobSystem& jobs){
+        PROFILE_ZONE("GltfImporter::open");
+        close();
+        if(!file.open(path)){
+            throw std::runtime_error("Failed to open glTF file " + path);
+        }
+        this->path = path;
+        directory = path.substr(0, path.find_last_of('/') + 1);
+
+        const uint8_t* binChunk = nullptr;
+        size_t binSize = 0;
+        const char* jsonText = reinterpret_cast<const char*>(file.data());
+        size_t jsonSize = file.getSize();
+        if(file.getSize() >= 12 && readU32(file.data()) == GLB_MAGIC){
+            parseGlbContainer(jsonText, jsonSize, binChunk, binSize);
+        }
+        json = parseJson(jsonText, jsonSize);
+
+        if(json["asset"]["version"].string().rfind("2.", 0) != 0){
+            throw std::runtime_error("Not a glTF 2.0 file: " + path);
+        }
+        const JsonValue& required = json["extensionsRequired"];
+        for(size_t i = 0; i < required.size(); i++){
+            const std::string& name = required[i].string();
+            if(name == "KHR_draco_mesh_compression" || name == "EXT_meshopt_compression"){
+                throw std::runtime_error(path + " requires " + name + ", which this build cannot decode");
+            }
+        }
+
+        loadBuffers(jobs, binChunk, binSize);
+        loadAccessors();
+        loadMaterials();
+        loadMeshes();
+        loadNodes();
+    }
+
+
+    void close(){
+        files.clear();
+        decodedBuffers.clear();
+        buffers.clear();
+        accessors.clear();
+        primitives.clear();
+        meshPrimitives.clear();
+        scene = GltfScene();
+        json = JsonValue();
+        file.close();
+    }
+
+
+    const GltfScene& getScene() const { return scene; }
+
+
+    static std::string decodeUri(const std::string& uri){    //Percent escapes only
+        std::string out;
+        for(size_t i = 0; i < uri.size(); i++){
+            if(uri[i] == '%' && i + 2 < uri.size()){
+                out += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+                i += 2;
+            } else {
+                out += uri[i];
+            }
+        }
+        return out;
+    }
+
+
+    //vertices/indices hold getScene().vertexCount/indexCount elements and may be write-combined memory: every element
+    //is written exactly once, never read back
+    void decode(JobSystem& jobs, Vertex* vertices, uint32_t* indices){
+        PROFILE_ZONE("GltfImporter::decode");
+        error.clear();
+        jobs.wait(jobs.parallelFor(static_cast<uint32_t>(primitives.size()), 1, [this, vertices, indices](uint32_t begin, uint32_t end){
+            for(uint32_t i = begin; i < end; i++){
+                decodePrimitive(i, vertices, indices);
+            }
+        }));
+        if(!error.empty()){
+            throw std::runtime_error(error);
+        }
+    }
+
+
+private:
+    struct BufferData {
+        const uint8_t* data = nullptr;  //nullptr for buffers without data (meshopt fallback buffers)
+        size_t size = 0;
+    };
+
+    struct Accessor {
+        const uint8_t* data = nullptr;  //nullptr: all zeros (no bufferView)
+        uint32_t count = 0;
+        uint32_t componentType = 0;
+        uint32_t components = 0;
+        size_t stride = 0;
+        bool normalized = false;
+
+        uint32_t sparseCount = 0;       //Elements replaced by the sparse values
+        const uint8_t* sparseIndices = nullptr;
+        uint32_t sparseIndexType = 0;
+        const uint8_t* sparseValues = nullptr;
+    };
+
+    struct Primitive {
+        uint32_t position = UINT32_MAX;
+        uint32_t normal = UINT32_MAX;
+        uint32_t tangent = UINT32_MAX;
+        uint32_t uv = UINT32_MAX;
+        uint32_t color = UINT32_MAX;
+        uint32_t indices = UINT32_MAX;
+        uint32_t mode = 4;              //4 triangles, 5 strip, 6 fan
+        uint32_t elementCount = 0;      //Indices before strips and fans are expanded
+    };
+
+    std::string path;
+    std::string directory;              //Ends in '/' or is empty
+    MappedFile file;
+    JsonValue json;
+    std::vector<MappedFile> files;      //External buffers
+    std::vector<std::vector<uint8_t>> decodedBuffers;   //base64 data URIs
+    std::vector<BufferData> buffers;
+    std::vector<Accessor> accessors;
+    std::vector<Primitive> primitives;  //Parallel to scene.meshes
+    std::vector<std::vector<uint32_t>> meshPrimitives;  //glTF mesh -> its entries in scene.meshes
+    GltfScene scene;
+
+    std::mutex errorMutex;
+    std::string error;                  //First error of a decode() job
+
+
+    static uint32_t readU32(const uint8_t* p){
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+
+    [[noreturn]] void fail(const std::string& reason) const {
+        throw std::runtime_error(path + ": " + reason);
+    }
+
+
+    void parseGlbContainer(const char*& jsonText, size_t& jsonSize, const uint8_t*& binChunk, size_t& binSize){
+        const uint8_t* data = file.data();
+        size_t size = std::min<size_t>(file.getSize(), readU32(data + 8));
+        if(readU32(data + 4) != 2) fail("unsupported GLB version");
+
+        size_t offset = 12;
+        bool haveJson = false;
+        while(offset + 8 <= size){
+            uint32_t chunkLength = readU32(data + offset);
+            uint32_t chunkType = readU32(data + offset + 4);
+            if(offset + 8 + chunkLength > size) fail("GLB chunk runs past the end of the file");
+
+            if(chunkType == GLB_CHUNK_JSON && !haveJson){
+                jsonText = reinterpret_cast<const char*>(data + offset + 8);
+                jsonSize = chunkLength;
+                haveJson = true;
+            } else if(chunkType == GLB_CHUNK_BIN && binChunk == nullptr){
+                binChunk = data + offset + 8;
+                binSize = chunkLength;
+            }
+            offset += 8 + ((chunkLength + 3) & ~3u);    //Chunks are 4 byte aligned
+        }
+        if(!haveJson) fail("GLB has no JSON chunk");
+    }
+
+
+    static int base64Value(char c){
+        if(c >= 'A' && c <= 'Z') return c - 'A';
+        if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if(c >= '0' && c <= '9') return c - '0' + 52;
+        if(c == '+') return 62;
+        if(c == '/') return 63;
+        return -1;
+    }
+
+
+    void decodeBase64(JobSystem& jobs, const char* text, size_t length, std::vector<uint8_t>& out){
+        if(length % 4 != 0) fail("base64 data URI length is not a multiple of 4");
+        size_t padding = length == 0 ? 0 : (text[length - 1] == '=') + (text[length - 2] == '=');
+        out.resize(length / 4 * 3 - padding);
+
+        std::atomic<bool> invalid{false};
+        uint32_t chunks = static_cast<uint32_t>((length + GLTF_BASE64_CHUNK - 1) / GLTF_BASE64_CHUNK);
+        jobs.wait(jobs.parallelFor(chunks, 1, [&](uint32_t begin, uint32_t end){
+            for(size_t quad = begin * static_cast<size_t>(GLTF_BASE64_CHUNK / 4); quad < std::min(end * static_cast<size_t>(GLTF_BASE64_CHUNK / 4), length / 4); quad++){
+                const char* in = text + quad * 4;
+                int a = base64Value(in[0]), b = base64Value(in[1]);
+                int c = in[2] == '=' ? 0 : base64Value(in[2]);
+                int d = in[3] == '=' ? 0 : base64Value(in[3]);
+                if((a | b | c | d) < 0){
+                    invalid = true;
+                    return;
+                }
+                uint32_t bits = (a << 18) | (b << 12) | (c << 6) | d;
+                uint8_t bytes[3] = {static_cast<uint8_t>(bits >> 16), static_cast<uint8_t>(bits >> 8), static_cast<uint8_t>(bits)};
+                size_t at = quad * 3;
+                for(size_t i = 0; i < 3 && at + i < out.size(); i++){
+                    out[at + i] = bytes[i];
+                }
+            }
+        }));
+        if(invalid) fail("invalid base64 data URI");
+    }
+
+
+    void loadBuffers(JobSystem& jobs, const uint8_t* binChunk, size_t binSize){
+        const JsonValue& list = json["buffers"];
+        buffers.resize(list.size());
+        decodedBuffers.resize(list.size());
+        files.resize(list.size());
+
+        for(size_t i = 0; i < list.size(); i++){
+            const JsonValue& buffer = list[i];
+            size_t byteLength = buffer["byteLength"].number(0.0);
+            const std::string& uri = buffer["uri"].string();
+
+            if(uri.empty()){
+                if(i == 0 && binChunk != nullptr){     //GLB binary chunk
+                    buffers[i] = {binChunk, std::min(binSize, byteLength)};
+                }
+                continue;       //Otherwise a meshopt fallback buffer, it has no data
+            }
+
+            if(uri.rfind("data:", 0) == 0){
+                size_t comma = uri.find(',');
+                if(comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos) fail("buffer " + std::to_string(i) + " has an unsupported data URI");
+                decodeBase64(jobs, uri.data() + comma + 1, uri.size() - comma - 1, decodedBuffers[i]);
+                buffers[i] = {decodedBuffers[i].data(), decodedBuffers[i].size()};
+            } else {
+                std::string bufferPath = directory + decodeUri(uri);
+                if(!files[i].open(bufferPath)) fail("cannot open buffer " + bufferPath);
+                files[i].willNeed();    //Read ahead while the rest of the JSON is processed
+                buffers[i] = {files[i].data(), files[i].getSize()};
+            }
+            if(buffers[i].size < byteLength) fail("buffer " + std::to_string(i) + " is shorter than its byteLength");
+        }
+    }
+
+
+    static uint32_t componentSize(uint32_t componentType){
+        switch(componentType){
+            case 5120: case 5121: return 1;     //BYTE, UNSIGNED_BYTE
+            case 5122: case 5123: return 2;     //SHORT, UNSIGNED_SHORT
+            case 5125: case 5126: return 4;     //UNSIGNED_INT, FLOAT
+            default: return 0;
+        }
+    }
+
+
+    static uint32_t componentCount(const std::string& type){
+        if(type == "SCALAR") return 1;
+        if(type == "VEC2") return 2;
+        if(type == "VEC3") return 3;
+        if(type == "VEC4") return 4;
+        if(type == "MAT2") return 4;
+        if(type == "MAT3") return 9;
+        if(type == "MAT4") return 16;
+        return 0;
+    }
+
+
+    //Start of bufferView + offset, with room for size bytes
+    const uint8_t* viewData(uint32_t viewIndex, size_t offset, size_t size, size_t* stride){
+        const JsonValue& view = json["bufferViews"][viewIndex];
+        if(!view.isObject()) fail("bufferView " + std::to_string(viewIndex) + " does not exist");
+
+        uint32_t bufferIndex = view["buffer"].index();
+        if(bufferIndex >= buffers.size()) fail("bufferView " + std::to_string(viewIndex) + " names a missing buffer");
+        const BufferData& buffer = buffers[bufferIndex];
+        if(buffer.data == nullptr){
+            fail("buffer " + std::to_string(bufferIndex) + " has no data (compressed with EXT_meshopt_compression?)");
+        }
+
+        size_t viewOffset = view["byteOffset"].number(0.0);
+        size_t viewLength = view["byteLength"].number(0.0);
+        if(viewOffset + viewLength > buffer.size || offset + size > viewLength){
+            fail("bufferView " + std::to_string(viewIndex) + " is out of range");
+        }
+        if(stride != nullptr){
+            *stride = static_cast<size_t>(view["byteStride"].number(0.0));
+        }
+        return buffer.data + viewOffset + offset;
+    }
+
+
+    void loadAccessors(){
+        const JsonValue& list = json["accessors"];
+        accessors.resize(list.size());
+
+        for(size_t i = 0; i < list.size(); i++){
+            const JsonValue& source = list[i];
+            Accessor& accessor = accessors[i];
+            accessor.count = source["count"].index(0);
+            accessor.componentType = source["componentType"].index(0);
+            accessor.components = componentCount(source["type"].string());
+            accessor.normalized = source["normalized"].boolean(false);
+
+            uint32_t elementSize = componentSize(accessor.componentType) * accessor.components;
+            if(elementSize == 0) fail("accessor " + std::to_string(i) + " has an unknown type");
+
+            if(source.has("bufferView") && accessor.count > 0){
+                size_t stride = 0;
+                size_t span = 0;
+                viewData(source["bufferView"].index(), 0, 0, &stride);
+                accessor.stride = stride != 0 ? stride : elementSize;
+                span = accessor.stride * (accessor.count - 1) + elementSize;
+                accessor.data = viewData(source["bufferView"].index(), static_cast<size_t>(source["byteOffset"].number(0.0)), span, nullptr);
+            }
+
+            const JsonValue& sparse = source["sparse"];
+            if(sparse.isObject()){
+                accessor.sparseCount = sparse["count"].index(0);
+                const JsonValue& sparseIndices = sparse["indices"];
+                const JsonValue& sparseValues = sparse["values"];
+                accessor.sparseIndexType = sparseIndices["componentType"].index(0);
+                if(componentSize(accessor.sparseIndexType) == 0 || accessor.sparseIndexType == 5126) fail("accessor " + std::to_string(i) + " has invalid sparse indices");
+                accessor.sparseIndices = viewData(sparseIndices["bufferView"].index(), static_cast<size_t>(sparseIndices["byteOffset"].number(0.0)),
+                    static_cast<size_t>(accessor.sparseCount) * componentSize(accessor.sparseIndexType), nullptr);
+                accessor.sparseValues = viewData(sparseValues["bufferView"].index(), static_cast<size_t>(sparseValues["byteOffset"].number(0.0)),
+                    static_cast<size_t>(accessor.sparseCount) * elementSize, nullptr);
+            }
+        }
+    }
+
+
+    void loadMaterials(){
+        const JsonValue& list = json["materials"];
+        scene.materials.resize(list.size());
+
+        for(size_t i = 0; i < list.size(); i++){
+            const JsonValue& pbr = list[i]["pbrMetallicRoughness"];
+            GltfMaterial& material = scene.materials[i];
+            for(int c = 0; c < 4; c++){
+                material.baseColor[c] = static_cast<float>(pbr["baseColorFactor"][c].number(1.0));
+            }
+            for(int c = 0; c < 3; c++){
+                material.emissive[c] = static_cast<float>(list[i]["emissiveFactor"][c].number(0.0));
+            }
+            material.metallic = static_cast<float>(pbr["metallicFactor"].number(1.0));
+            material.roughness = static_cast<float>(pbr["roughnessFactor"].number(1.0));
+        }
+    }
+
+
+    uint32_t attributeAccessor(const JsonValue& attributes, const char* name){
+        uint32_t index = attributes[name].index();
+        if(index != UINT32_MAX && index >= accessors.size()) fail(std::string("attribute ") + name + " names a missing accessor");
+        return index;
+    }
+
+
+    void loadMeshes(){
+        const JsonValue& list = json["meshes"];
+        meshPrimitives.resize(list.size());
+        uint64_t vertexTotal = 0;
+        uint64_t indexTotal = 0;
+
+        for(size_t m = 0; m < list.size(); m++){
+            const JsonValue& primitiveList = list[m]["primitives"];
+            for(size_t p = 0; p < primitiveList.size(); p++){
+                const JsonValue& source = primitiveList[p];
+                const JsonValue& attributes = source["attributes"];
+
+                Primitive primitive;
+                primitive.mode = source["mode"].index(4);
+                primitive.position = attributeAccessor(attributes, "POSITION");
+                primitive.normal = attributeAccessor(attributes, "NORMAL");
+                primitive.tangent = attributeAccessor(attributes, "TANGENT");
+                primitive.uv = attributeAccessor(attributes, "TEXCOORD_0");
+                primitive.color = attributeAccessor(attributes, "COLOR_0");
+                primitive.indices = source["indices"].index();
+                if(primitive.indices != UINT32_MAX && primitive.indices >= accessors.size()) fail("primitive indices name a missing accessor");
+                if(primitive.mode < 4 || primitive.mode > 6 || primitive.position == UINT32_MAX) continue;     //Points, lines, or nothing to draw
+
+                uint32_t vertexCount = accessors[primitive.position].count;
+                primitive.elementCount = primitive.indices != UINT32_MAX ? accessors[primitive.indices].count : vertexCount;
+                uint32_t indexCount = primitive.mode == 4 ? primitive.elementCount / 3 * 3 : (primitive.elementCount >= 3 ? (primitive.elementCount - 2) * 3 : 0);
+                if(vertexCount == 0 || indexCount == 0) continue;
+                for(uint32_t attribute : {primitive.normal, primitive.tangent, primitive.uv, primitive.color}){    //Decoded into arrays of vertexCount
+                    if(attribute != UINT32_MAX && accessors[attribute].count != vertexCount){
+                        fail("mesh " + std::to_string(m) + " has an attribute whose count differs from POSITION's");
+                    }
+                }
+
+                GltfMesh mesh;
+                mesh.firstVertex = static_cast<uint32_t>(vertexTotal);
+                mesh.vertexCount = vertexCount;
+                mesh.firstIndex = static_cast<uint32_t>(indexTotal);
+                mesh.indexCount = indexCount;
+                mesh.material = source["material"].index(GLTF_NO_MATERIAL);
+                if(mesh.material != GLTF_NO_MATERIAL && mesh.material >= scene.materials.size()) mesh.material = GLTF_NO_MATERIAL;
+                vertexTotal += vertexCount;
+                indexTotal += indexCount;
+
+                meshPrimitives[m].push_back(static_cast<uint32_t>(scene.meshes.size()));
+                scene.meshes.push_back(mesh);
+                primitives.push_back(primitive);
+            }
+        }
+
+        if(vertexTotal > UINT32_MAX || indexTotal > UINT32_MAX) fail("too much geometry for 32-bit offsets");
+        scene.vertexCount = static_cast<uint32_t>(vertexTotal);
+        scene.indexCount = static_cast<uint32_t>(indexTotal);
+    }
+
+
+    static void nodeMatrix(const JsonValue& node, float out[16]){     //matrix, or translation * rotation * scale
+        const JsonValue& matrix = node["matrix"];
+        if(matrix.size() == 16){
+            for(int i = 0; i < 16; i++) out[i] = static_cast<float>(matrix[i].number(0.0));
+            return;
+        }
+
+        const JsonValue& t = node["translation"];
+        const JsonValue& r = node["rotation"];
+        const JsonValue& s = node["scale"];
+        Transform rotation;
+        rotation.rotation = {static_cast<float>(r[0].number(0.0)), static_cast<float>(r[1].number(0.0)),
+                             static_cast<float>(r[2].number(0.0)), static_cast<float>(r[3].number(1.0))};
+        transformToMatrix(rotation, out);
+
+        float scale[3] = {static_cast<float>(s[0].number(1.0)), static_cast<float>(s[1].number(1.0)), static_cast<float>(s[2].number(1.0))};
+        for(int column = 0; column < 3; column++){
+            for(int row = 0; row < 3; row++) out[column * 4 + row] *= scale[column];
+        }
+        out[12] = static_cast<float>(t[0].number(0.0));
+        out[13] = static_cast<float>(t[1].number(0.0));
+        out[14] = static_cast<float>(t[2].number(0.0));
+    }
+
+
+    void loadNodes(){
+        const JsonValue& nodes = json["nodes"];
+        std::vector<uint32_t> roots;
+        const JsonValue& sceneNodes = json["scenes"][json["scene"].index(0)]["nodes"];
+        if(sceneNodes.isArray()){
+            for(size_t i = 0; i < sceneNodes.size(); i++) roots.push_back(sceneNodes[i].index());
+        } else {    //No scene: every node nobody lists as a child
+            std::vector<bool> isChild(nodes.size(), false);
+            for(size_t i = 0; i < nodes.size(); i++){
+                const JsonValue& children = nodes[i]["children"];
+                for(size_t c = 0; c < children.size(); c++){
+                    uint32_t child = children[c].index();
+                    if(child < nodes.size()) isChild[child] = true;
+                }
+            }
+            for(size_t i = 0; i < nodes.size(); i++){
+                if(!isChild[i]) roots.push_back(static_cast<uint32_t>(i));
+            }
+        }
+
+        struct Pending {
+            uint32_t node;
+            uint32_t depth;
+            float parent[16];
+        };
+        std::vector<Pending> stack;
+        for(uint32_t root : roots){
+            Pending pending{root, 0, {}};
+            mat4Identity(pending.parent);
+            stack.push_back(pending);
+        }
+
+        while(!stack.empty()){
+            Pending pending = stack.back();
+            stack.pop_back();
+            const JsonValue& node = nodes[pending.node];
+            if(!node.isObject()) fail("scene names a missing node");
+            if(pending.depth > nodes.size()) fail("node hierarchy has a cycle");
+
+            float local[16];
+            float world[16];
+            nodeMatrix(node, local);
+            mat4Multiply(pending.parent, local, world);
+
+            uint32_t mesh = node["mesh"].index();
+            if(mesh < meshPrimitives.size()){
+                for(uint32_t primitive : meshPrimitives[mesh]){
+                    GltfInstance instance;
+                    instance.mesh = primitive;
+                    memcpy(instance.transform, world, sizeof(world));
+                    scene.instances.push_back(instance);
+                }
+            }
+
+            const JsonValue& children = node["children"];
+            for(size_t c = 0; c < children.size(); c++){
+                Pending child{children[c].index(), pending.depth + 1, {}};
+                memcpy(child.parent, world, sizeof(world));
+                stack.push_back(child);
+            }
+        }
+    }
+
+
+    static float readComponent(const uint8_t* p, uint32_t componentType, bool normalized){
+        switch(componentType){
+            case 5120: { int8_t v; memcpy(&v, p, 1); return normalized ? std::max(v / 127.0f, -1.0f) : v; }
+            case 5121: { uint8_t v = *p; return normalized ? v / 255.0f : v; }
+            case 5122: { int16_t v; memcpy(&v, p, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+            case 5123: { uint16_t v; memcpy(&v, p, 2); return normalized ? v / 65535.0f : v; }
+            case 5125: { uint32_t v; memcpy(&v, p, 4); return static_cast<float>(v); }
+            default: { float v; memcpy(&v, p, 4); return v; }
+        }
+    }
+
+
+    static uint32_t readIndex(const uint8_t* p, uint32_t componentType){
+        switch(componentType){
+            case 5121: return *p;
+            case 5123: { uint16_t v; memcpy(&v, p, 2); return v; }
+            default: { uint32_t v; memcpy(&v, p, 4); return v; }
+        }
+    }
+
+
+    //count * components floats; components the accessor lacks become 0, except a missing fourth which becomes 1
+    void readAccessor(uint32_t index, uint32_t components, float* out){
+        const Accessor& accessor = accessors[index];
+        uint32_t present = std::min(components, accessor.components);
+        uint32_t size = componentSize(accessor.componentType);
+
+        for(uint32_t i = 0; i < accessor.count; i++){
+            float* element = out + static_cast<size_t>(i) * components;
+            if(accessor.data == nullptr){
+                for(uint32_t c = 0; c < present; c++) element[c] = 0.0f;
+            } else if(accessor.componentType == 5126){     //Plain floats, the common case
+                memcpy(element, accessor.data + accessor.stride * i, present * sizeof(float));
+            } else {
+                for(uint32_t c = 0; c < present; c++){
+                    element[c] = readComponent(accessor.data + accessor.stride * i + c * size, accessor.componentType, accessor.normalized);
+                }
+            }
+            for(uint32_t c = present; c < components; c++) element[c] = c == 3 ? 1.0f : 0.0f;
+        }
+
+        uint32_t elementSize = size * accessor.components;
+        for(uint32_t s = 0; s < accessor.sparseCount; s++){
+            uint32_t target = readIndex(accessor.sparseIndices + s * componentSize(accessor.sparseIndexType), accessor.sparseIndexType);
+            if(target >= accessor.count) continue;
+            float* element = out + static_cast<size_t>(target) * components;
+            for(uint32_t c = 0; c < present; c++){
+                element[c] = readComponent(accessor.sparseValues + static_cast<size_t>(s) * elementSize + c * size, accessor.componentType, accessor.normalized);
+            }
+        }
+    }
+
+
+    void reportError(const std::string& message){
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if(error.empty()) error = path + ": " + message;
+    }
+
+
+    void decodePrimitive(uint32_t index, Vertex* vertices, uint32_t* indices){     //Job; touches only its own ranges
+        const Primitive& primitive = primitives[index];
+        GltfMesh& mesh = scene.meshes[index];
+        uint32_t count = mesh.vertexCount;
+
+        std::vector<float> positions(static_cast<size_t>(count) * 3);
+        readAccessor(primitive.position, 3, positions.data());
+
+        std::vector<uint32_t> elements(primitive.elementCount);     //Vertex order as stored, before strips and fans are expanded
+        if(primitive.indices != UINT32_MAX){
+            const Accessor& accessor = accessors[primitive.indices];
+            if(accessor.data == nullptr || accessor.componentType == 5126 || accessor.components != 1){
+                reportError("primitive " + std::to_string(index) + " has invalid indices");
+                return;
+            }
+            for(uint32_t i = 0; i < primitive.elementCount; i++){
+                elements[i] = readIndex(accessor.data + accessor.stride * i, accessor.componentType);
+            }
+        } else {
+            for(uint32_t i = 0; i < primitive.elementCount; i++) elements[i] = i;
+        }
+
+        std::vector<uint32_t> triangles(mesh.indexCount);
+        for(uint32_t t = 0; t < mesh.indexCount / 3; t++){
+            uint32_t* triangle = triangles.data() + t * 3;
+            if(primitive.mode == 4){
+                triangle[0] = elements[t * 3];
+                triangle[1] = elements[t * 3 + 1];
+                triangle[2] = elements[t * 3 + 2];
+            } else if(primitive.mode == 5){     //Strip, every other triangle flipped to keep the winding
+                triangle[0] = elements[t + (t & 1)];
+                triangle[1] = elements[t + 1 - (t & 1)];
+                triangle[2] = elements[t + 2];
+            } else {                            //Fan
+                triangle[0] = elements[0];
+                triangle[1] = elements[t + 1];
+                triangle[2] = elements[t + 2];
+            }
+        }
+        for(uint32_t& vertex : triangles){
+            if(vertex >= count){
+                reportError("primitive " + std::to_string(index) + " indexes past its vertices");
+                return;
+            }
+        }
+
+        std::vector<float> normals(static_cast<size_t>(count) * 3, 0.0f);
+        if(primitive.normal != UINT32_MAX){
+            readAccessor(primitive.normal, 3, normals.data());
+        } else {    //Area weighted face normals
+            for(size_t t = 0; t + 2 < triangles.size(); t += 3){
+                const float* p0 = positions.data() + triangles[t] * 3;
+                const float* p1 = positions.data() + triangles[t + 1] * 3;
+                const float* p2 = positions.data() + triangles[t + 2] * 3;
+                Vec3 n = cross(Vec3(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]), Vec3(p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]));
+                for(int v = 0; v < 3; v++){
+                    float* target = normals.data() + triangles[t + v] * 3;
+                    target[0] += n.x;
+                    target[1] += n.y;
+                    target[2] += n.z;
+                }
+            }
+        }
+
+        std::vector<float> tangents;
+        if(primitive.tangent != UINT32_MAX){
+            tangents.resize(static_cast<size_t>(count) * 4);
+            readAccessor(primitive.tangent, 4, tangents.data());
+        }
+        std::vector<float> uvs;
+        if(primitive.uv != UINT32_MAX){
+            uvs.resize(static_cast<size_t>(count) * 2);
+            readAccessor(primitive.uv, 2, uvs.data());
+        }
+        std::vector<float> colors;
+        if(primitive.color != UINT32_MAX){
+            colors.resize(static_cast<size_t>(count) * 4);
+            readAccessor(primitive.color, 4, colors.data());
+        }
+
+        Vec3 low(positions[0], positions[1], positions[2]);
+        Vec3 high = low;
+        Vertex* out = vertices + mesh.firstVertex;
+        for(uint32_t i = 0; i < count; i++){
+            Vertex vertex;
+            memcpy(vertex.position, positions.data() + i * 3, sizeof(vertex.position));
+            Vec3 p(vertex.position[0], vertex.position[1], vertex.position[2]);
+            low = minVec(low, p);
+            high = maxVec(high, p);
+
+            Vec3 n(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]);
+            n = length(n) > 0.0f ? normalize(n) : Vec3(0.0f, 0.0f, 1.0f);
+            vertex.normal = {{packSnorm8(n.x), packSnorm8(n.y), packSnorm8(n.z), packSnorm8(tangents.empty() || tangents[i * 4 + 3] >= 0.0f ? 1.0f : -1.0f)}};
+            vertex.uv = {{uvs.empty() ? uint16_t(0) : packHalf(uvs[i * 2]), uvs.empty() ? uint16_t(0) : packHalf(uvs[i * 2 + 1])}};
+            if(colors.empty()){
+                vertex.color = {{255, 255, 255, 255}};
+            } else {
+                vertex.color = {{packUnorm8(colors[i * 4]), packUnorm8(colors[i * 4 + 1]), packUnorm8(colors[i * 4 + 2]), packUnorm8(colors[i * 4 + 3])}};
+            }
+            out[i] = vertex;    //One write per vertex, staging memory is not read back
+        }
+        memcpy(indices + mesh.firstIndex, triangles.data(), triangles.size() * sizeof(uint32_t));
+
+        Vec3 center = (low + high) * 0.5f;
+        float radius = 0.0f;
+        for(uint32_t i = 0; i < count; i++){
+            radius = std::max(radius, length(Vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]) - center));
+        }
+        mesh.center[0] = center.x;
+        mesh.center[1] = center.y;
+        mesh.center[2] = center.z;
+        mesh.radius = radius;
+    }
+};
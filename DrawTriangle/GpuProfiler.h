@@ -0,0 +1,264 @@
+#pragma once
+
+/*
+GPU timestamp zones on the Profiler timeline:
+    1) begin()/end() write a pair of timestamps around commands in any command buffer; the pair's queries are reset
+       in that same command buffer, so no host query reset feature is needed
+    2) collect() polls finished pairs with VK_QUERY_RESULT_WITH_AVAILABILITY_BIT, converts them to steady_clock
+       nanoseconds and hands them to Profiler::recordGpu()
+    3) GPU ticks are mapped to CPU time with VK_EXT_calibrated_timestamps (recalibrated on every collect) when the
+       device offers CLOCK_MONOTONIC; otherwise once at init from a timestamp submitted between two CPU clock reads
+
+    Until the reset recorded with a reused pair has executed, the pool still reports the previous results as
+    available, so a pair only counts as finished once its values differ from the ones collected last time.
+*/
+
+#include "Profiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <stdexcept>
+
+
+const uint32_t GPU_ZONE_INVALID = ~0u;
+
+
+class GpuProfiler {
+
+public:
+    void init(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, VkQueue queue, uint32_t queueFamilyIndex,
+              bool calibratedTimestamps, uint32_t capacity = 512)
+    {
+        this->device = device;
+        this->capacity = capacity;
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+        uint32_t validBits = families[queueFamilyIndex].timestampValidBits;
+        if(validBits == 0) return;      //Queue can't write timestamps, zones become no-ops
+        timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        nsPerTick = properties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = capacity * 2 + 1;     //Last query is used for calibration
+
+        if(vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create timestamp query pool");
+        }
+
+        zones.resize(capacity);
+        for(uint32_t i = capacity; i-- > 0;){
+            freeZones.push_back(i);
+        }
+
+        if(calibratedTimestamps && supportsMonotonicDomain(instance, physicalDevice)){
+            getCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT) vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT");
+        }
+        resetAndCalibrate(queue, queueFamilyIndex);
+    }
+
+
+    void destroy(){
+        if(queryPool != VK_NULL_HANDLE){
+            vkDestroyQueryPool(device, queryPool, nullptr);
+            queryPool = VK_NULL_HANDLE;
+        }
+    }
+
+
+    bool isEnabled() const { return queryPool != VK_NULL_HANDLE; }
+
+
+    uint32_t begin(VkCommandBuffer commandBuffer, const char* name){    //Outside of a render pass
+        std::lock_guard<std::mutex> lock(mutex);
+        if(freeZones.empty()) return GPU_ZONE_INVALID;    //Also the disabled case
+
+        uint32_t zone = freeZones.back();
+        freeZones.pop_back();
+        zones[zone].name = name;
+
+        vkCmdResetQueryPool(commandBuffer, queryPool, zone * 2, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, zone * 2);
+        return zone;
+    }
+
+
+    void end(VkCommandBuffer commandBuffer, uint32_t zone){
+        if(zone == GPU_ZONE_INVALID) return;
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, zone * 2 + 1);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(zone);
+    }
+
+
+    void discard(uint32_t zone){    //The command buffer holding the zone was never submitted
+        if(zone == GPU_ZONE_INVALID) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(std::remove(pending.begin(), pending.end(), zone), pending.end());
+        freeZones.push_back(zone);
+    }
+
+
+    void collect(){
+        if(!isEnabled()) return;
+        PROFILE_ZONE("GpuProfiler::collect");
+
+        if(getCalibratedTimestamps != nullptr){
+            calibrate();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto it = pending.begin(); it != pending.end();){
+            Zone& zone = zones[*it];
+
+            uint64_t results[4];    //begin, available, end, available
+            VkResult result = vkGetQueryPoolResults(device, queryPool, *it * 2, 2, sizeof(results), results, 2 * sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+            bool available = (result == VK_SUCCESS || result == VK_NOT_READY) && results[1] != 0 && results[3] != 0;
+            bool stale = results[0] == zone.lastBegin && results[2] == zone.lastEnd;
+            if(!available || stale){
+                ++it;
+                continue;
+            }
+
+            zone.lastBegin = results[0];
+            zone.lastEnd = results[2];
+            Profiler::instance().recordGpu(zone.name, toSteadyNanoseconds(results[0]), toSteadyNanoseconds(results[2]));
+
+            freeZones.push_back(*it);
+            it = pending.erase(it);
+        }
+    }
+
+
+private:
+    struct Zone {
+        const char* name = "";
+        uint64_t lastBegin = 0;
+        uint64_t lastEnd = 0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    uint32_t capacity = 0;
+    uint64_t timestampMask = ~0ull;
+    double nsPerTick = 1.0;
+    double offsetNs = 0.0;      //steady_clock ns = ticks * nsPerTick + offsetNs
+    PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps = nullptr;
+
+    std::mutex mutex;
+    std::vector<Zone> zones;
+    std::vector<uint32_t> freeZones;
+    std::deque<uint32_t> pending;
+
+
+    uint64_t toSteadyNanoseconds(uint64_t ticks) const {
+        return static_cast<uint64_t>(static_cast<double>(ticks & timestampMask) * nsPerTick + offsetNs);
+    }
+
+
+    static bool supportsMonotonicDomain(VkInstance instance, VkPhysicalDevice physicalDevice){
+        auto getDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+        if(getDomains == nullptr) return false;
+
+        uint32_t count = 0;
+        getDomains(physicalDevice, &count, nullptr);
+        std::vector<VkTimeDomainEXT> domains(count);
+        getDomains(physicalDevice, &count, domains.data());
+
+        bool device = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end();
+        bool monotonic = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) != domains.end();
+        return device && monotonic;     //steady_clock is CLOCK_MONOTONIC
+    }
+
+
+    void calibrate(){
+        VkCalibratedTimestampInfoEXT infos[2]{};
+        infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+        infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+        infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+        infos[1].timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+
+        uint64_t timestamps[2];
+        uint64_t deviation;
+        if(getCalibratedTimestamps(device, 2, infos, timestamps, &deviation) == VK_SUCCESS){
+            offsetNs = static_cast<double>(timestamps[1]) - static_cast<double>(timestamps[0] & timestampMask) * nsPerTick;
+        }
+    }
+
+
+    void resetAndCalibrate(VkQueue queue, uint32_t queueFamilyIndex){  //Queries start in an undefined state
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+        VkCommandPool commandPool;
+        if(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create profiler command pool");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        vkCmdResetQueryPool(commandBuffer, queryPool, 0, capacity * 2 + 1);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, capacity * 2);
+        vkEndCommandBuffer(commandBuffer);
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        vkCreateFence(device, &fenceInfo, nullptr, &fence);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        uint64_t before = Profiler::steadyNanoseconds();
+        VkResult result = vkQueueSubmit(queue, 1, &submitInfo, fence);
+        if(result == VK_SUCCESS){
+            vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        }
+        uint64_t after = Profiler::steadyNanoseconds();
+
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyCommandPool(device, commandPool, nullptr);
+
+        if(result != VK_SUCCESS){
+            throw std::runtime_error("Failed to submit profiler calibration");
+        }
+
+        if(getCalibratedTimestamps != nullptr){
+            calibrate();
+            return;
+        }
+
+        uint64_t ticks;     //Fallback: assume the timestamp landed halfway between the CPU reads
+        vkGetQueryPoolResults(device, queryPool, capacity * 2, 1, sizeof(ticks), &ticks, sizeof(ticks), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        offsetNs = (static_cast<double>(before) + static_cast<double>(after)) * 0.5 - static_cast<double>(ticks & timestampMask) * nsPerTick;
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+/*
+Handle based registry of GPU resources:
+    Buffers, images and pipelines are owned by one GpuResources object and handed out as BufferHandle, ImageHandle
+    and PipelineHandle (HandlePool.h) instead of raw Vulkan handles kept in application members.
+
+    1) Each kind has its own HandlePool, so the Vulkan handles and their metadata sit in dense arrays and a lookup is an
+       index plus a generation compare
+    2) Memory comes from the DeviceAllocator. Buffers are looked up through their Allocation, so a defragmenter move is
+       picked up by the next get() without the owner being told
+    3) destroy*() releases the Vulkan objects right away; the caller guarantees the GPU is done with them, as for
+       DeviceAllocator::free(). Any handle still held afterwards is stale and get() returns nullptr for it
+    4) destroy() releases whatever is still registered
+
+    Not thread safe; create and destroy resources from the thread that owns the GpuResources object.
+*/
+
+#include "HandlePool.h"
+#include "DeviceAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdexcept>
+#include <cstdint>
+
+
+struct BufferResource {
+    Allocation* allocation = nullptr;   //allocation->buffer is the VkBuffer; it changes when the defragmenter moves it
+    VkDeviceSize size = 0;
+    VkBufferUsageFlags usage = 0;
+};
+
+struct ImageResource {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    Allocation* allocation = nullptr;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent3D extent{};
+    VkImageUsageFlags usage = 0;
+};
+
+struct PipelineResource {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;   //VK_NULL_HANDLE if the layout is owned elsewhere
+    VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+};
+
+
+class GpuResources {
+
+public:
+    void init(DeviceAllocator& allocator){
+        this->allocator = &allocator;
+        device = allocator.getDevice();
+    }
+
+
+    void destroy(){     //Device must be idle
+        for(const PipelineResource& pipeline : pipelines){
+            releasePipeline(pipeline);
+        }
+        for(const ImageResource& image : images){
+            releaseImage(image);
+        }
+        for(const BufferResource& buffer : buffers){
+            allocator->free(buffer.allocation);
+        }
+        pipelines.clear();
+        images.clear();
+        buffers.clear();
+    }
+
+
+    BufferHandle createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, bool movable = true){
+        BufferResource buffer;
+        buffer.allocation = allocator->createBuffer(size, usage, properties, movable);
+        buffer.size = size;
+        buffer.usage = buffer.allocation->usage;
+        return buffers.add(buffer);
+    }
+
+
+    //2D image with one mip level and a view over all of it; aspect is the view's aspect mask
+    ImageHandle createImage(VkFormat format, uint32_t width, uint32_t height, VkImageUsageFlags usage, VkImageAspectFlags aspect,
+                            VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+    {
+        ImageResource image;
+        image.format = format;
+        image.extent = {width, height, 1};
+        image.usage = usage;
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = format;
+        imageInfo.extent = image.extent;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = usage;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if(vkCreateImage(device, &imageInfo, nullptr, &image.image) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create image");
+        }
+        image.allocation = allocator->allocateImage(image.image, properties);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image.image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.subresourceRange.aspectMask = aspect;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        if(vkCreateImageView(device, &viewInfo, nullptr, &image.view) != VK_SUCCESS){
+            releaseImage(image);
+            throw std::runtime_error("Failed to create image view");
+        }
+        return images.add(image);
+    }
+
+
+    PipelineHandle addPipeline(VkPipeline pipeline, VkPipelineLayout layout, VkPipelineBindPoint bindPoint){   //Takes ownership of both
+        return pipelines.add({pipeline, layout, bindPoint});
+    }
+
+
+    void destroyBuffer(BufferHandle handle){
+        BufferResource* buffer = buffers.get(handle);
+        if(buffer == nullptr) return;
+        allocator->free(buffer->allocation);
+        buffers.remove(handle);
+    }
+
+
+    void destroyImage(ImageHandle handle){
+        ImageResource* image = images.get(handle);
+        if(image == nullptr) return;
+        releaseImage(*image);
+        images.remove(handle);
+    }
+
+
+    void destroyPipeline(PipelineHandle handle){
+        PipelineResource* pipeline = pipelines.get(handle);
+        if(pipeline == nullptr) return;
+        releasePipeline(*pipeline);
+        pipelines.remove(handle);
+    }
+
+
+    const BufferResource* get(BufferHandle handle) const { return buffers.get(handle); }
+
+    const ImageResource* get(ImageHandle handle) const { return images.get(handle); }
+
+    const PipelineResource* get(PipelineHandle handle) const { return pipelines.get(handle); }
+
+
+    VkBuffer getBuffer(BufferHandle handle) const { return buffers.at(handle).allocation->buffer; }
+
+    Allocation* getAllocation(BufferHandle handle) const { return buffers.at(handle).allocation; }
+
+    VkImage getImage(ImageHandle handle) const { return images.at(handle).image; }
+
+    VkImageView getView(ImageHandle handle) const { return images.at(handle).view; }
+
+    VkPipeline getPipeline(PipelineHandle handle) const { return pipelines.at(handle).pipeline; }
+
+
+    uint32_t getBufferCount() const { return buffers.size(); }
+
+    uint32_t getImageCount() const { return images.size(); }
+
+    uint32_t getPipelineCount() const { return pipelines.size(); }
+
+
+private:
+    DeviceAllocator* allocator = nullptr;
+    VkDevice device = VK_NULL_HANDLE;
+
+    HandlePool<BufferTag, BufferResource> buffers;
+    HandlePool<ImageTag, ImageResource> images;
+    HandlePool<PipelineTag, PipelineResource> pipelines;
+
+
+    void releaseImage(const ImageResource& image){
+        if(image.view != VK_NULL_HANDLE){
+            vkDestroyImageView(device, image.view, nullptr);
+        }
+        vkDestroyImage(device, image.image, nullptr);
+        allocator->free(image.allocation);
+    }
+
+
+    void releasePipeline(const PipelineResource& pipeline){
+        vkDestroyPipeline(device, pipeline.pipeline, nullptr);
+        if(pipeline.layout != VK_NULL_HANDLE){
+            vkDestroyPipelineLayout(device, pipeline.layout, nullptr);
+        }
+    }
+};
@@ -0,0 +1,426 @@
+#pragma once
+
+/*
+GPU scene addressed through buffer device addresses:
+    Objects, meshes and materials live in plain storage buffers and reference each other by 64-bit device address.
+    A small table (GpuSceneTable) holds the base address and count of each array; shaders receive the table address
+    through a push constant and walk everything from there (shaders/gpu_scene.glsl), so adding, changing or removing
+    scene entries never touches a descriptor set. Compute culling and drawing read the same memory.
+
+    1) The CPU keeps the authoritative copy of every record, with mesh/material references stored as indices
+    2) Each frame in flight has its own host visible copy of the arrays; beginFrame() patches only the records that
+       changed since that copy was last used and resolves indices into addresses within that copy
+    3) Mesh vertex/index data is device local and shared by all frames; when the defragmenter moves it the mesh records
+       are rewritten with the new addresses
+    4) Meshes are referred to by MeshHandle and kept in a HandlePool, so the GPU mesh array is dense. Removing a mesh
+       moves the last one into its place, which rewrites that record and every object's mesh address
+
+    Objects whose mesh was removed get flags 0 and are skipped by culling.
+*/
+
+#include "DeviceAllocator.h"
+#include "HandlePool.h"
+#include "UploadContext.h"
+#include "Vertex.h"
+
+#include <string>
+
+
+struct GpuMesh {            //std430, matches Mesh in shaders/gpu_scene.glsl
+    VkDeviceAddress vertices;
+    VkDeviceAddress indices;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t vertexStride;
+    uint32_t padding;
+    float center[3];        //Bounding sphere in object space
+    float radius;
+};
+
+struct GpuMaterial {
+    float baseColor[4];
+    float emissive[4];
+    float metallic;
+    float roughness;
+    uint32_t textureIndex;
+    uint32_t flags;
+};
+
+const uint32_t GPU_OBJECT_VISIBLE = 1;
+
+struct GpuObject {
+    float transform[16];    //Column major object to world
+    VkDeviceAddress mesh;
+    VkDeviceAddress material;
+    uint32_t flags;         //0 for removed slots, culling skips them
+    uint32_t padding[3];
+};
+
+struct GpuSceneTable {
+    VkDeviceAddress objects;
+    VkDeviceAddress meshes;
+    VkDeviceAddress materials;
+    uint32_t objectCount;
+    uint32_t meshCount;
+    uint32_t materialCount;
+    uint32_t padding;
+};
+
+
+struct StagedMesh {         //Where one mesh's data sits in an upload source, for GpuScene::addMeshes
+    VkDeviceSize vertexOffset;
+    uint32_t vertexCount;
+    VkDeviceSize indexOffset;
+    uint32_t indexCount;
+    float center[3];
+    float radius;
+};
+
+
+class GpuScene {
+
+public:
+    void init(DeviceAllocator& allocator, UploadContext& uploads, uint32_t framesInFlight){
+        if(!allocator.hasBufferDeviceAddress()){
+            throw std::runtime_error("GpuScene needs bufferDeviceAddress");
+        }
+        this->allocator = &allocator;
+        this->uploads = &uploads;
+
+        frames.resize(framesInFlight);
+        for(FrameCopy& copy : frames){
+            copy.table = allocator.createBuffer(sizeof(GpuSceneTable), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+        }
+    }
+
+
+    void destroy(){     //Device must be idle
+        for(FrameCopy& copy : frames){
+            allocator->free(copy.table);
+            allocator->free(copy.objects.buffer);
+            allocator->free(copy.meshes.buffer);
+            allocator->free(copy.materials.buffer);
+        }
+        frames.clear();
+
+        for(MeshRecord& mesh : meshes){
+            allocator->free(mesh.vertices);
+            allocator->free(mesh.indices);
+        }
+        meshes.clear();
+    }
+
+
+    MeshHandle addMesh(const void* vertices, uint32_t vertexCount, uint32_t vertexStride, const uint32_t* indices, uint32_t indexCount,
+                     const float center[3], float radius)
+    {
+        MeshRecord mesh = createMesh(vertexCount, vertexStride, indexCount, center, radius);
+        uploads->uploadBuffer(mesh.vertices, 0, vertices, mesh.gpu.vertexCount * static_cast<VkDeviceSize>(vertexStride));
+        uploads->uploadBuffer(mesh.indices, 0, indices, mesh.gpu.indexCount * sizeof(uint32_t));
+        return registerMesh(mesh);
+    }
+
+
+    //Many meshes uploaded with a single submission. source holds the bytes at data starting at sourceOffset: a host
+    //visible staging buffer the caller filled, or imported host memory (UploadContext::findHostSource). StagedMesh
+    //offsets are relative to data. handles receives one MeshHandle per StagedMesh
+    void addMeshes(const void* data, VkBuffer source, VkDeviceSize sourceOffset, const StagedMesh* staged, uint32_t count, uint32_t vertexStride,
+                   MeshHandle* handles)
+    {
+        for(uint32_t i = 0; i < count; i++){     //Checked up front so a bad mesh leaves nothing half created
+            if(staged[i].vertexCount == 0 || staged[i].indexCount == 0){
+                throw std::runtime_error("Failed to add meshes: mesh " + std::to_string(i) + " has no vertices or indices");
+            }
+        }
+
+        std::vector<MeshRecord> created(count);
+        for(uint32_t i = 0; i < count; i++){
+            created[i] = createMesh(staged[i].vertexCount, vertexStride, staged[i].indexCount, staged[i].center, staged[i].radius);
+        }
+
+        auto copy = [&](VkCommandBuffer commandBuffer, VkDeviceSize offset, Allocation* destination, VkDeviceSize size){
+            if(destination->mapped != nullptr){     //Host visible device memory, no GPU copy needed
+                memcpy(destination->mapped, static_cast<const char*>(data) + offset, size);
+                return;
+            }
+            VkBufferCopy region{};
+            region.srcOffset = sourceOffset + offset;
+            region.size = size;
+            vkCmdCopyBuffer(commandBuffer, source, destination->buffer, 1, &region);
+        };
+        uploads->submit([&](VkCommandBuffer commandBuffer){
+            for(uint32_t i = 0; i < count; i++){
+                copy(commandBuffer, staged[i].vertexOffset, created[i].vertices, staged[i].vertexCount * static_cast<VkDeviceSize>(vertexStride));
+                copy(commandBuffer, staged[i].indexOffset, created[i].indices, staged[i].indexCount * sizeof(uint32_t));
+            }
+        });
+
+        for(uint32_t i = 0; i < count; i++){
+            handles[i] = registerMesh(created[i]);
+        }
+    }
+
+
+    void removeMesh(MeshHandle handle){     //Caller guarantees no frame in flight still draws it
+        MeshRecord* mesh = meshes.get(handle);
+        if(mesh == nullptr) return;
+        allocator->free(mesh->vertices);
+        allocator->free(mesh->indices);
+
+        uint32_t dense = meshes.denseIndex(handle);
+        meshes.remove(handle);
+        if(dense < meshes.size()){      //The last mesh moved into the hole
+            markDirty(&FrameCopy::dirtyMeshes, dense);
+        }
+        for(FrameCopy& copy : frames){  //Objects resolve their mesh by dense index
+            markAll(copy.dirtyObjects, objects.size());
+        }
+        meshGeneration++;
+    }
+
+
+    template<typename VertexType>
+    MeshHandle addMesh(const VertexType* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount,
+                     const float center[3], float radius)
+    {
+        static_assert(vertexLayoutIsPacked<VertexType>(), "Mesh vertices need a packed VERTEX_LAYOUT");
+        return addMesh(vertices, vertexCount, sizeof(VertexType), indices, indexCount, center, radius);   //Stride from the type, never typed by hand
+    }
+
+
+    uint32_t addMaterial(const GpuMaterial& material){
+        materials.push_back(material);
+        uint32_t id = static_cast<uint32_t>(materials.size() - 1);
+        markDirty(&FrameCopy::dirtyMaterials, id);
+        return id;
+    }
+
+
+    void updateMaterial(uint32_t id, const GpuMaterial& material){
+        materials[id] = material;
+        markDirty(&FrameCopy::dirtyMaterials, id);
+    }
+
+
+    uint32_t addObject(MeshHandle mesh, uint32_t material, const float transform[16]){
+        uint32_t id;
+        if(!freeObjects.empty()){
+            id = freeObjects.back();
+            freeObjects.pop_back();
+        } else {
+            id = static_cast<uint32_t>(objects.size());
+            objects.push_back({});
+        }
+
+        ObjectRecord& record = objects[id];
+        memcpy(record.transform, transform, sizeof(record.transform));
+        record.mesh = mesh;
+        record.material = material;
+        record.flags = GPU_OBJECT_VISIBLE;
+        markDirty(&FrameCopy::dirtyObjects, id);
+        return id;
+    }
+
+
+    void setTransform(uint32_t id, const float transform[16]){
+        memcpy(objects[id].transform, transform, sizeof(objects[id].transform));
+        markDirty(&FrameCopy::dirtyObjects, id);
+    }
+
+
+    void removeObject(uint32_t id){
+        objects[id].flags = 0;
+        freeObjects.push_back(id);
+        markDirty(&FrameCopy::dirtyObjects, id);
+    }
+
+
+    void beginFrame(uint32_t frameIndex){    //Call once the fence of frameIndex has signalled
+        FrameCopy& copy = frames[frameIndex];
+
+        bool meshesMoved = reserve(copy.meshes, meshes.size(), sizeof(GpuMesh), copy.dirtyMeshes);
+        bool materialsMoved = reserve(copy.materials, materials.size(), sizeof(GpuMaterial), copy.dirtyMaterials);
+        reserve(copy.objects, objects.size(), sizeof(GpuObject), copy.dirtyObjects);
+
+        if(meshesMoved || materialsMoved){      //Every object points into the moved arrays
+            markAll(copy.dirtyObjects, objects.size());
+        }
+
+        for(uint32_t id : copy.dirtyMeshes.list){
+            if(id >= meshes.size()) continue;   //Removed since it was marked
+            static_cast<GpuMesh*>(copy.meshes.buffer->mapped)[id] = meshes.data()[id].gpu;
+        }
+        for(uint32_t id : copy.dirtyMaterials.list){
+            static_cast<GpuMaterial*>(copy.materials.buffer->mapped)[id] = materials[id];
+        }
+        for(uint32_t id : copy.dirtyObjects.list){
+            const ObjectRecord& record = objects[id];
+            GpuObject& object = static_cast<GpuObject*>(copy.objects.buffer->mapped)[id];
+            memcpy(object.transform, record.transform, sizeof(object.transform));
+            bool hasMesh = meshes.isValid(record.mesh);
+            object.mesh = hasMesh ? copy.meshes.address + meshes.denseIndex(record.mesh) * sizeof(GpuMesh) : 0;
+            object.material = copy.materials.address + record.material * sizeof(GpuMaterial);
+            object.flags = hasMesh ? record.flags : 0;
+        }
+        copy.dirtyMeshes.clear();
+        copy.dirtyMaterials.clear();
+        copy.dirtyObjects.clear();
+
+        GpuSceneTable* table = static_cast<GpuSceneTable*>(copy.table->mapped);
+        table->objects = copy.objects.address;
+        table->meshes = copy.meshes.address;
+        table->materials = copy.materials.address;
+        table->objectCount = static_cast<uint32_t>(objects.size());
+        table->meshCount = static_cast<uint32_t>(meshes.size());
+        table->materialCount = static_cast<uint32_t>(materials.size());
+    }
+
+
+    VkDeviceAddress getTableAddress(uint32_t frameIndex) const { return allocator->getAddress(frames[frameIndex].table); }
+
+    uint32_t getObjectCount() const { return static_cast<uint32_t>(objects.size()); }
+
+    VkBuffer getVertexBuffer(MeshHandle mesh) const { return meshes.at(mesh).vertices->buffer; }
+
+    VkBuffer getIndexBuffer(MeshHandle mesh) const { return meshes.at(mesh).indices->buffer; }
+
+    uint32_t getIndexCount(MeshHandle mesh) const { return meshes.at(mesh).gpu.indexCount; }
+
+    bool hasMesh(MeshHandle mesh) const { return meshes.isValid(mesh); }
+
+    uint64_t getMeshGeneration() const { return meshGeneration; }     //Changes whenever a mesh buffer is added, moved or removed
+
+
+private:
+    struct ObjectRecord {
+        float transform[16];
+        MeshHandle mesh;
+        uint32_t material;
+        uint32_t flags;
+    };
+
+    struct MeshRecord {
+        GpuMesh gpu;            //Addresses filled in by updateMeshAddresses
+        Allocation* vertices;
+        Allocation* indices;
+    };
+
+    struct DirtySet {       //Deduplicated list of record ids
+        std::vector<uint32_t> list;
+        std::vector<bool> marked;
+
+        void add(uint32_t id){
+            if(id >= marked.size()) marked.resize(id + 1, false);
+            if(marked[id]) return;
+            marked[id] = true;
+            list.push_back(id);
+        }
+
+        void clear(){
+            for(uint32_t id : list) marked[id] = false;
+            list.clear();
+        }
+    };
+
+    struct Array {
+        Allocation* buffer = nullptr;
+        VkDeviceAddress address = 0;
+        size_t capacity = 0;
+    };
+
+    struct FrameCopy {
+        Allocation* table = nullptr;
+        Array objects;
+        Array meshes;
+        Array materials;
+        DirtySet dirtyObjects;
+        DirtySet dirtyMeshes;
+        DirtySet dirtyMaterials;
+    };
+
+    DeviceAllocator* allocator = nullptr;
+    UploadContext* uploads = nullptr;
+    std::vector<FrameCopy> frames;
+
+    std::vector<ObjectRecord> objects;
+    std::vector<uint32_t> freeObjects;
+    HandlePool<MeshTag, MeshRecord> meshes;
+    uint64_t meshGeneration = 0;
+    std::vector<GpuMaterial> materials;
+
+
+    void markDirty(DirtySet FrameCopy::* set, uint32_t id){
+        for(FrameCopy& copy : frames){
+            (copy.*set).add(id);
+        }
+    }
+
+
+    static void markAll(DirtySet& set, size_t count){
+        for(size_t i = 0; i < count; i++){
+            set.add(static_cast<uint32_t>(i));
+        }
+    }
+
+
+    MeshRecord createMesh(uint32_t vertexCount, uint32_t vertexStride, uint32_t indexCount, const float center[3], float radius){    //Buffers left empty
+        if(vertexCount == 0 || indexCount == 0){    //A size 0 VkBuffer is invalid
+            throw std::runtime_error("Failed to create mesh: it has no vertices or indices");
+        }
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+        VkDeviceSize vertexBytes = static_cast<VkDeviceSize>(vertexCount) * vertexStride;
+        VkDeviceSize indexBytes = static_cast<VkDeviceSize>(indexCount) * sizeof(uint32_t);
+
+        MeshRecord mesh{};
+        mesh.vertices = allocator->createBuffer(vertexBytes, usage | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        mesh.indices = allocator->createBuffer(indexBytes, usage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        mesh.gpu.vertexCount = vertexCount;
+        mesh.gpu.indexCount = indexCount;
+        mesh.gpu.vertexStride = vertexStride;
+        mesh.gpu.center[0] = center[0];
+        mesh.gpu.center[1] = center[1];
+        mesh.gpu.center[2] = center[2];
+        mesh.gpu.radius = radius;
+        return mesh;
+    }
+
+
+    MeshHandle registerMesh(const MeshRecord& mesh){   //Data uploaded
+        MeshHandle handle = meshes.add(mesh);
+        auto refresh = [this, handle](Allocation&, VkBuffer){ updateMeshAddresses(handle); };   //Defragmenter moved the data
+        MeshRecord& record = meshes.at(handle);
+        record.vertices->onMove = refresh;
+        record.indices->onMove = refresh;
+        updateMeshAddresses(handle);
+        return handle;
+    }
+
+
+    void updateMeshAddresses(MeshHandle handle){
+        MeshRecord* mesh = meshes.get(handle);
+        if(mesh == nullptr) return;     //Removed while a move was in flight
+        mesh->gpu.vertices = allocator->getAddress(mesh->vertices);
+        mesh->gpu.indices = allocator->getAddress(mesh->indices);
+        markDirty(&FrameCopy::dirtyMeshes, meshes.denseIndex(handle));
+        meshGeneration++;
+    }
+
+
+    bool reserve(Array& array, size_t count, size_t stride, DirtySet& dirty){     //Grows by doubling; returns true if the base address changed
+        if(count <= array.capacity) return false;
+
+        size_t capacity = std::max<size_t>(64, array.capacity);
+        while(capacity < count) capacity *= 2;
+
+        allocator->free(array.buffer);  //This frame's copy is no longer read by the GPU
+        array.buffer = allocator->createBuffer(capacity * stride, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+        array.address = allocator->getAddress(array.buffer);
+        array.capacity = capacity;
+
+        markAll(dirty, count);  //New memory, rewrite every record
+        return true;
+    }
+};
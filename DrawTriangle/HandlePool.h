@@ -0,0 +1,168 @@
+#pragma once
+
+/*
+Generational handle pools:
+    Resources are referred to by a small typed handle (slot index + generation) instead of a pointer or a raw Vulkan
+    handle, so slots can be reused safely and a handle to something already destroyed is caught with one compare.
+
+    1) Items live in a dense array with no holes; iteration touches only live items, in one contiguous block
+    2) A slot table maps a handle's index to the item's position in the dense array and holds the slot's generation.
+       Removing an item moves the last dense item into the hole and patches that one slot, so removal is O(1)
+    3) A slot's generation is bumped when its item is removed; a handle whose generation no longer matches is stale
+       and get() returns nullptr for it. Generation 0 is never handed out, so a default constructed handle is null
+    4) Freed slots are reused oldest first, which spreads generation bumps over all slots
+
+    Handles of different pools are distinct types (the Tag parameter), so a MeshHandle cannot be passed where a
+    BufferHandle is expected. Dense positions change on removal; only handles are stable.
+*/
+
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdexcept>
+#include <cstdint>
+
+
+template<typename Tag>
+struct Handle {
+    uint32_t index = 0;
+    uint32_t generation = 0;    //0 is the null handle
+
+    explicit operator bool() const { return generation != 0; }
+
+    bool operator==(const Handle& other) const { return index == other.index && generation == other.generation; }
+
+    bool operator!=(const Handle& other) const { return !(*this == other); }
+
+    uint64_t key() const { return (static_cast<uint64_t>(generation) << 32) | index; }     //Unique per handle ever issued, for hashing
+};
+
+
+template<typename Tag, typename T>
+class HandlePool {
+
+public:
+    using HandleType = Handle<Tag>;
+
+
+    HandleType add(T item){
+        uint32_t index;
+        if(!freeSlots.empty()){
+            index = freeSlots.front();
+            freeSlots.pop_front();
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.push_back({0, 1});
+        }
+
+        Slot& slot = slots[index];
+        slot.dense = static_cast<uint32_t>(items.size());
+        items.push_back(std::move(item));
+        owners.push_back(index);
+        return {index, slot.generation};
+    }
+
+
+    bool remove(HandleType handle){     //False if the handle was already stale
+        if(!isValid(handle)) return false;
+
+        Slot& slot = slots[handle.index];
+        uint32_t last = static_cast<uint32_t>(items.size() - 1);
+        if(slot.dense != last){         //Fill the hole with the last item
+            items[slot.dense] = std::move(items[last]);
+            owners[slot.dense] = owners[last];
+            slots[owners[last]].dense = slot.dense;
+        }
+        items.pop_back();
+        owners.pop_back();
+
+        slot.generation++;
+        if(slot.generation == 0) slot.generation = 1;   //Wrapped, skip the null generation
+        freeSlots.push_back(handle.index);
+        return true;
+    }
+
+
+    bool isValid(HandleType handle) const {
+        return handle.generation != 0 && handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+
+
+    T* get(HandleType handle){      //nullptr for null or stale handles
+        return isValid(handle) ? &items[slots[handle.index].dense] : nullptr;
+    }
+
+    const T* get(HandleType handle) const {
+        return isValid(handle) ? &items[slots[handle.index].dense] : nullptr;
+    }
+
+
+    T& at(HandleType handle){       //Throws for null or stale handles
+        T* item = get(handle);
+        if(item == nullptr){
+            throw std::runtime_error("Stale or null resource handle");
+        }
+        return *item;
+    }
+
+    const T& at(HandleType handle) const {
+        const T* item = get(handle);
+        if(item == nullptr){
+            throw std::runtime_error("Stale or null resource handle");
+        }
+        return *item;
+    }
+
+
+    uint32_t denseIndex(HandleType handle) const { return slots[handle.index].dense; }    //Handle must be valid; changes when items are removed
+
+    HandleType handleAt(uint32_t dense) const { return {owners[dense], slots[owners[dense]].generation}; }
+
+
+    uint32_t size() const { return static_cast<uint32_t>(items.size()); }
+
+    bool empty() const { return items.empty(); }
+
+    T* data(){ return items.data(); }
+
+    const T* data() const { return items.data(); }
+
+    typename std::vector<T>::iterator begin(){ return items.begin(); }
+
+    typename std::vector<T>::iterator end(){ return items.end(); }
+
+    typename std::vector<T>::const_iterator begin() const { return items.begin(); }
+
+    typename std::vector<T>::const_iterator end() const { return items.end(); }
+
+
+    void clear(){   //Invalidates every handle, slots are kept for reuse
+        for(uint32_t dense = 0; dense < items.size(); dense++){
+            Slot& slot = slots[owners[dense]];
+            slot.generation++;
+            if(slot.generation == 0) slot.generation = 1;
+            freeSlots.push_back(owners[dense]);
+        }
+        items.clear();
+        owners.clear();
+    }
+
+
+private:
+    struct Slot {
+        uint32_t dense;         //Position of the item in items, meaningless while the slot is free
+        uint32_t generation;
+    };
+
+    std::vector<T> items;               //Dense
+    std::vector<uint32_t> owners;       //Dense, slot index of each item
+    std::vector<Slot> slots;
+    std::deque<uint32_t> freeSlots;
+};
+
+
+//Handle types of the renderer's pools (GpuResources.h, GpuScene.h)
+using BufferHandle = Handle<struct BufferTag>;
+using ImageHandle = Handle<struct ImageTag>;
+using PipelineHandle = Handle<struct PipelineTag>;
+using MeshHandle = Handle<struct MeshTag>;
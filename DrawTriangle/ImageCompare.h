@@ -0,0 +1,260 @@
+#pragma once
+
+/*
+Golden image comparison:
+    Compares a rendered frame against a reference image, for regression runs (see the --golden mode in main.cpp).
+
+    1) Per pixel difference: the largest absolute RGB channel difference. Computed 4 pixels at a time with SSE2, and
+       the statistics (count above tolerance, sum, maximum) 16 pixels at a time over the resulting byte array
+    2) Structural similarity: mean SSIM of the luma over 8x8 windows with a stride of 4. It catches blur, shifted edges
+       and banding that stay under the per pixel tolerance, and ignores noise that a strict pixel test would flag
+    3) A heatmap shows where they differ: pixels within tolerance are the dimmed reference, others run from yellow to
+       red with the size of the difference
+
+    A comparison passes when the fraction of pixels above the channel tolerance and the SSIM are both within
+    ImageTolerance. Images are RGBA8, tightly packed; alpha is ignored. PPM (P6) is the file format on both sides.
+*/
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <bit>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IMAGE_COMPARE_SSE2 1
+#endif
+
+
+struct RgbaImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;    //width * height * 4
+};
+
+
+struct ImageTolerance {
+    uint8_t channel = 2;            //Largest channel difference that still counts as equal
+    double maxBadPixels = 0.001;    //Fraction of pixels allowed above channel
+    double minSsim = 0.98;
+};
+
+
+struct ImageDiff {
+    bool passed = false;
+    bool sizeMismatch = false;
+    uint64_t badPixels = 0;
+    uint32_t maxDifference = 0;
+    double meanDifference = 0.0;
+    double ssim = 0.0;
+};
+
+
+const uint32_t IMAGE_COMPARE_SSIM_WINDOW = 8;
+const uint32_t IMAGE_COMPARE_SSIM_STRIDE = 4;
+
+
+inline RgbaImage makeRgbaImage(const void* rgba, uint32_t width, uint32_t height, uint32_t rowPixels){    //Drops row padding
+    RgbaImage image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(static_cast<size_t>(width) * height * 4);
+    for(uint32_t y = 0; y < height; y++){
+        memcpy(image.pixels.data() + static_cast<size_t>(y) * width * 4, static_cast<const uint8_t*>(rgba) + static_cast<size_t>(y) * rowPixels * 4, width * 4);
+    }
+    return image;
+}
+
+
+inline bool readPpm(const std::string& path, RgbaImage& image){    //Binary P6 with maxval 255
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open()) return false;
+
+    std::string magic;
+    uint32_t width = 0, height = 0, maxValue = 0;
+    file >> magic >> width >> height >> maxValue;
+    file.get();     //Single whitespace before the pixel data
+    if(!file || magic != "P6" || maxValue != 255 || width == 0 || height == 0) return false;
+
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    if(!file.read(reinterpret_cast<char*>(rgb.data()), rgb.size())) return false;
+
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(static_cast<size_t>(width) * height * 4);
+    for(size_t i = 0, pixelCount = static_cast<size_t>(width) * height; i < pixelCount; i++){
+        image.pixels[i * 4 + 0] = rgb[i * 3 + 0];
+        image.pixels[i * 4 + 1] = rgb[i * 3 + 1];
+        image.pixels[i * 4 + 2] = rgb[i * 3 + 2];
+        image.pixels[i * 4 + 3] = 255;
+    }
+    return true;
+}
+
+
+inline bool writePpm(const std::string& path, const RgbaImage& image){
+    std::ofstream file(path, std::ios::binary);
+    if(!file.is_open()) return false;
+
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+    std::vector<uint8_t> rgb(static_cast<size_t>(image.width) * image.height * 3);
+    for(size_t i = 0; i < rgb.size() / 3; i++){
+        rgb[i * 3 + 0] = image.pixels[i * 4 + 0];
+        rgb[i * 3 + 1] = image.pixels[i * 4 + 1];
+        rgb[i * 3 + 2] = image.pixels[i * 4 + 2];
+    }
+    file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    return static_cast<bool>(file);
+}
+
+
+inline void pixelDifferences(const uint8_t* a, const uint8_t* b, size_t pixelCount, uint8_t* out){     //Max RGB channel difference per pixel
+    size_t i = 0;
+#if defined(IMAGE_COMPARE_SSE2)
+    __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);   //Little endian RGBA, alpha is the top byte
+    for(; i + 4 <= pixelCount; i += 4){
+        __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * 4));
+        __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 4));
+        __m128i difference = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(pa, pb), _mm_subs_epu8(pb, pa)), rgbMask);
+        difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 8));      //Low byte: max(R, G)
+        difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 16));     //Low byte: max(R, G, B)
+        difference = _mm_and_si128(difference, _mm_set1_epi32(0xFF));
+        difference = _mm_packs_epi32(difference, difference);
+        difference = _mm_packus_epi16(difference, difference);
+        int32_t packed = _mm_cvtsi128_si32(difference);
+        memcpy(out + i, &packed, 4);
+    }
+#endif
+    for(; i < pixelCount; i++){
+        uint8_t difference = 0;
+        for(int c = 0; c < 3; c++){
+            difference = std::max<uint8_t>(difference, static_cast<uint8_t>(std::abs(a[i * 4 + c] - b[i * 4 + c])));
+        }
+        out[i] = difference;
+    }
+}
+
+
+inline void differenceStatistics(const uint8_t* differences, size_t count, uint8_t tolerance, uint64_t& bad, uint64_t& sum, uint32_t& maximum){
+    bad = 0;
+    sum = 0;
+    maximum = 0;
+    size_t i = 0;
+#if defined(IMAGE_COMPARE_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i limit = _mm_set1_epi8(static_cast<char>(tolerance));
+    __m128i sums = zero;
+    __m128i maxima = zero;
+    for(; i + 16 <= count; i += 16){
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(differences + i));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(d, zero));
+        maxima = _mm_max_epu8(maxima, d);
+        int within = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(d, limit), zero));
+        bad += 16 - std::popcount(static_cast<uint32_t>(within));
+    }
+    uint64_t partial[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(partial), sums);
+    sum = partial[0] + partial[1];
+    uint8_t lanes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), maxima);
+    for(uint8_t lane : lanes) maximum = std::max<uint32_t>(maximum, lane);
+#endif
+    for(; i < count; i++){
+        sum += differences[i];
+        maximum = std::max<uint32_t>(maximum, differences[i]);
+        if(differences[i] > tolerance) bad++;
+    }
+}
+
+
+inline std::vector<float> lumaPlane(const RgbaImage& image){
+    std::vector<float> luma(static_cast<size_t>(image.width) * image.height);
+    for(size_t i = 0; i < luma.size(); i++){
+        const uint8_t* p = image.pixels.data() + i * 4;
+        luma[i] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+    }
+    return luma;
+}
+
+
+inline double meanSsim(const RgbaImage& a, const RgbaImage& b){
+    const double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+    const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+    std::vector<float> lumaA = lumaPlane(a);
+    std::vector<float> lumaB = lumaPlane(b);
+
+    uint32_t window = std::min({IMAGE_COMPARE_SSIM_WINDOW, a.width, a.height});
+    double total = 0.0;
+    uint64_t windows = 0;
+    for(uint32_t y = 0; y + window <= a.height; y += IMAGE_COMPARE_SSIM_STRIDE){
+        for(uint32_t x = 0; x + window <= a.width; x += IMAGE_COMPARE_SSIM_STRIDE){
+            double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+            for(uint32_t wy = 0; wy < window; wy++){
+                size_t row = static_cast<size_t>(y + wy) * a.width + x;
+                for(uint32_t wx = 0; wx < window; wx++){
+                    double va = lumaA[row + wx];
+                    double vb = lumaB[row + wx];
+                    sumA += va;
+                    sumB += vb;
+                    sumAA += va * va;
+                    sumBB += vb * vb;
+                    sumAB += va * vb;
+                }
+            }
+            double n = static_cast<double>(window) * window;
+            double meanA = sumA / n;
+            double meanB = sumB / n;
+            double varianceA = sumAA / n - meanA * meanA;
+            double varianceB = sumBB / n - meanB * meanB;
+            double covariance = sumAB / n - meanA * meanB;
+            total += ((2.0 * meanA * meanB + C1) * (2.0 * covariance + C2)) /
+                     ((meanA * meanA + meanB * meanB + C1) * (varianceA + varianceB + C2));
+            windows++;
+        }
+    }
+    return windows > 0 ? total / windows : 1.0;
+}
+
+
+inline ImageDiff compareImages(const RgbaImage& reference, const RgbaImage& image, const ImageTolerance& tolerance, RgbaImage* heatmap = nullptr){
+    ImageDiff diff;
+    if(reference.width != image.width || reference.height != image.height){
+        diff.sizeMismatch = true;
+        return diff;
+    }
+
+    size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+    std::vector<uint8_t> differences(pixelCount);
+    pixelDifferences(reference.pixels.data(), image.pixels.data(), pixelCount, differences.data());
+
+    uint64_t sum = 0;
+    differenceStatistics(differences.data(), pixelCount, tolerance.channel, diff.badPixels, sum, diff.maxDifference);
+    diff.meanDifference = pixelCount > 0 ? static_cast<double>(sum) / pixelCount : 0.0;
+    diff.ssim = meanSsim(reference, image);
+    diff.passed = diff.badPixels <= tolerance.maxBadPixels * pixelCount && diff.ssim >= tolerance.minSsim;
+
+    if(heatmap != nullptr){
+        heatmap->width = image.width;
+        heatmap->height = image.height;
+        heatmap->pixels.resize(pixelCount * 4);
+        for(size_t i = 0; i < pixelCount; i++){
+            uint8_t* out = heatmap->pixels.data() + i * 4;
+            const uint8_t* in = reference.pixels.data() + i * 4;
+            if(differences[i] <= tolerance.channel){    //Context: the reference at a quarter brightness
+                uint8_t gray = static_cast<uint8_t>((in[0] * 77 + in[1] * 150 + in[2] * 29) >> 10);
+                out[0] = out[1] = out[2] = gray;
+            } else {
+                float t = std::min(1.0f, (differences[i] - tolerance.channel) / 64.0f);
+                out[0] = 255;
+                out[1] = static_cast<uint8_t>(255.0f * (1.0f - t));
+                out[2] = 0;
+            }
+            out[3] = 255;
+        }
+    }
+    return diff;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+/*
+Fixed pool of worker threads fed from one shared queue:
+    submit() returns a JobHandle that can be polled with isDone(), waited on with wait(), or given continuations
+    with onDone() (how coroutines await jobs, see Async.h).
+    A thread that waits runs other queued jobs in the meantime instead of sleeping.
+    A job that throws does not take its worker down: the first exception is kept on its handle, and wait() (or
+    co_await awaitJob) rethrows it once every job of the handle has finished.
+*/
+
+#include "Profiler.h"
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+
+
+struct JobCounter {
+    std::atomic<uint32_t> pending{0};
+    std::mutex mutex;                                   //Guards continuations and error
+    std::vector<std::function<void()>> continuations;  //Run by the thread that finishes the last job
+    std::exception_ptr error;                           //First exception one of the jobs threw
+
+
+    bool onDone(std::function<void()> continuation){   //false if already done; the caller continues itself then
+        std::lock_guard<std::mutex> lock(mutex);
+        if(pending.load(std::memory_order_acquire) == 0) return false;
+        continuations.push_back(std::move(continuation));
+        return true;
+    }
+
+
+    void fail(std::exception_ptr exception){    //Before finish(), by the thread that ran the job
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!error) error = exception;
+    }
+
+
+    void finish(){
+        if(pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.swap(continuations);
+        }
+        for(auto& continuation : ready){
+            continuation();
+        }
+    }
+};
+
+using JobHandle = std::shared_ptr<JobCounter>;
+
+
+class JobSystem {
+
+public:
+    void start(uint32_t threadCount = 0){
+        if(threadCount == 0){   //Leave one core for the thread that owns the window; 0 means the core count is unknown
+            unsigned cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+
+        running = true;
+        for(uint32_t i = 0; i < threadCount; i++){
+            workers.emplace_back([this, i]{
+                PROFILE_THREAD("Worker " + std::to_string(i));
+                work();
+            });
+        }
+    }
+
+
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        for(auto& worker : workers){
+            worker.join();
+        }
+        workers.clear();
+        queue.clear();
+    }
+
+
+    JobHandle submit(std::function<void()> job, JobHandle counter = nullptr){   //Pass a counter to group several jobs under one handle
+        if(!counter){
+            counter = std::make_shared<JobCounter>();
+        }
+        counter->pending++;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back({std::move(job), counter});
+        }
+        wake.notify_one();
+        return counter;
+    }
+
+
+    template<typename Function>
+    JobHandle parallelFor(uint32_t count, uint32_t batchSize, Function function){   //function(begin, end) over [0, count)
+        JobHandle counter = std::make_shared<JobCounter>();
+        for(uint32_t begin = 0; begin < count; begin += batchSize){
+            uint32_t end = std::min(count, begin + batchSize);
+            submit([function, begin, end]{ function(begin, end); }, counter);
+        }
+        return counter;
+    }
+
+
+    static bool isDone(const JobHandle& handle){
+        return !handle || handle->pending.load(std::memory_order_acquire) == 0;
+    }
+
+
+    void wait(const JobHandle& handle){     //Rethrows the first exception of the handle's jobs
+        waitUntil([&handle]{ return isDone(handle); });
+        rethrowError(handle);
+    }
+
+
+    static void rethrowError(const JobHandle& handle){     //For a handle that isDone()
+        if(!handle) return;
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(handle->mutex);
+            error = handle->error;
+        }
+        if(error) std::rethrow_exception(error);
+    }
+
+
+    template<typename Predicate>
+    void waitUntil(Predicate done){     //Runs queued jobs until done() holds
+        while(!done()){
+            if(!runOne()){
+                std::this_thread::yield();
+            }
+        }
+    }
+
+
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+
+private:
+    struct Job {
+        std::function<void()> function;
+        JobHandle counter;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<Job> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running = false;
+
+
+    bool runOne(){
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(queue.empty()) return false;
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        execute(job);
+        return true;
+    }
+
+
+    static void execute(Job& job){
+        PROFILE_ZONE("Job");
+        try {
+            job.function();
+        } catch(...){       //The worker lives on and the counter still reaches zero
+            job.counter->fail(std::current_exception());
+        }
+        job.counter->finish();
+    }
+
+
+    void work(){
+        while(true){
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]{ return !running || !queue.empty(); });
+                if(!running) return;
+
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            execute(job);
+        }
+    }
+};
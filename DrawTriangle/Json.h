@@ -0,0 +1,335 @@
+#pragma once
+
+/*
+Small JSON reader for asset manifests (glTF):
+    parseJson() builds a read-only tree of JsonValue in one recursive descent pass and throws std::runtime_error with
+    the byte offset on malformed input.
+
+    Lookups never throw: a missing key, an index out of range or a value of the wrong type yields the shared null
+    value, and the typed getters return the fallback they are given. So optional glTF properties read as
+        json["materials"][i]["pbrMetallicRoughness"]["roughnessFactor"].number(1.0)
+
+    Objects keep their members in file order and are searched linearly; manifests have few keys per object.
+    Strings are UTF-8, \u escapes (including surrogate pairs) are decoded.
+*/
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <type_traits>
+#include <charconv>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+
+enum class JsonType : uint8_t {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object
+};
+
+
+const uint32_t JSON_MAX_DEPTH = 256;     //Deeper nesting is rejected instead of overflowing the stack
+
+
+class JsonValue {
+
+public:
+    JsonType getType() const { return type; }
+
+    bool isNull() const { return type == JsonType::Null; }
+
+    bool isNumber() const { return type == JsonType::Number; }
+
+    bool isString() const { return type == JsonType::String; }
+
+    bool isArray() const { return type == JsonType::Array; }
+
+    bool isObject() const { return type == JsonType::Object; }
+
+
+    double number(double fallback = 0.0) const { return type == JsonType::Number ? numberValue : fallback; }
+
+    uint32_t index(uint32_t fallback = UINT32_MAX) const {     //Non negative integer, e.g. a glTF index or count
+        return type == JsonType::Number && numberValue >= 0.0 && numberValue <= 4294967295.0 ? static_cast<uint32_t>(numberValue) : fallback;
+    }
+
+    bool boolean(bool fallback = false) const { return type == JsonType::Bool ? boolValue : fallback; }
+
+    const std::string& string() const { return type == JsonType::String ? stringValue : emptyString(); }
+
+
+    size_t size() const {       //Elements of an array or members of an object, 0 otherwise
+        return type == JsonType::Array ? elements.size() : type == JsonType::Object ? members.size() : 0;
+    }
+
+
+    template<typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+    const JsonValue& operator[](Integer i) const {     //Any integer type, so json[0] is not taken for a null key
+        return type == JsonType::Array && i >= 0 && static_cast<size_t>(i) < elements.size() ? elements[i] : null();
+    }
+
+
+    const JsonValue& operator[](const char* key) const {
+        if(type == JsonType::Object){
+            for(const auto& member : members){
+                if(member.first == key) return member.second;
+            }
+        }
+        return null();
+    }
+
+
+    bool has(const char* key) const { return !(*this)[key].isNull(); }
+
+    const std::vector<std::pair<std::string, JsonValue>>& getMembers() const { return members; }     //Empty unless an object
+
+
+    static const JsonValue& null(){
+        static const JsonValue value;
+        return value;
+    }
+
+
+private:
+    friend class JsonParser;
+
+    JsonType type = JsonType::Null;
+    bool boolValue = false;
+    double numberValue = 0.0;
+    std::string stringValue;
+    std::vector<JsonValue> elements;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+
+    static const std::string& emptyString(){
+        static const std::string value;
+        return value;
+    }
+};
+
+
+class JsonParser {
+
+public:
+    JsonParser(const char* text, size_t length) : cursor(text), begin(text), end(text + length) {}
+
+
+    JsonValue parseDocument(){
+        JsonValue root;
+        skipWhitespace();
+        parseValue(root, 0);
+        skipWhitespace();
+        if(cursor != end) fail("trailing characters");
+        return root;
+    }
+
+
+private:
+    const char* cursor;
+    const char* begin;
+    const char* end;
+
+
+    [[noreturn]] void fail(const char* reason) const {
+        throw std::runtime_error("Failed to parse JSON at offset " + std::to_string(cursor - begin) + ": " + reason);
+    }
+
+
+    void skipWhitespace(){
+        while(cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r')) cursor++;
+    }
+
+
+    bool consume(const char* literal){
+        size_t length = strlen(literal);
+        if(static_cast<size_t>(end - cursor) < length || memcmp(cursor, literal, length) != 0) return false;
+        cursor += length;
+        return true;
+    }
+
+
+    void parseValue(JsonValue& value, uint32_t depth){
+        if(depth > JSON_MAX_DEPTH) fail("nested too deeply");
+        if(cursor >= end) fail("unexpected end");
+
+        switch(*cursor){
+            case '{': parseObject(value, depth); break;
+            case '[': parseArray(value, depth); break;
+            case '"':
+                value.type = JsonType::String;
+                parseString(value.stringValue);
+                break;
+            case 't':
+            case 'f':
+                value.type = JsonType::Bool;
+                if(consume("true")) value.boolValue = true;
+                else if(consume("false")) value.boolValue = false;
+                else fail("invalid literal");
+                break;
+            case 'n':
+                if(!consume("null")) fail("invalid literal");
+                break;
+            default: parseNumber(value); break;
+        }
+    }
+
+
+    void parseObject(JsonValue& value, uint32_t depth){
+        value.type = JsonType::Object;
+        cursor++;
+        skipWhitespace();
+        if(cursor < end && *cursor == '}'){
+            cursor++;
+            return;
+        }
+
+        while(true){
+            if(cursor >= end || *cursor != '"') fail("expected a key");
+            value.members.emplace_back();
+            parseString(value.members.back().first);
+            skipWhitespace();
+            if(cursor >= end || *cursor != ':') fail("expected ':'");
+            cursor++;
+            skipWhitespace();
+            parseValue(value.members.back().second, depth + 1);
+            skipWhitespace();
+
+            if(cursor < end && *cursor == ','){
+                cursor++;
+                skipWhitespace();
+            } else if(cursor < end && *cursor == '}'){
+                cursor++;
+                return;
+            } else {
+                fail("expected ',' or '}'");
+            }
+        }
+    }
+
+
+    void parseArray(JsonValue& value, uint32_t depth){
+        value.type = JsonType::Array;
+        cursor++;
+        skipWhitespace();
+        if(cursor < end && *cursor == ']'){
+            cursor++;
+            return;
+        }
+
+        while(true){
+            value.elements.emplace_back();
+            parseValue(value.elements.back(), depth + 1);
+            skipWhitespace();
+
+            if(cursor < end && *cursor == ','){
+                cursor++;
+                skipWhitespace();
+            } else if(cursor < end && *cursor == ']'){
+                cursor++;
+                return;
+            } else {
+                fail("expected ',' or ']'");
+            }
+        }
+    }
+
+
+    void parseNumber(JsonValue& value){
+        const char* start = cursor;
+        if(cursor < end && *cursor == '-') cursor++;
+        while(cursor < end && ((*cursor >= '0' && *cursor <= '9') || *cursor == '.' || *cursor == 'e' || *cursor == 'E' || *cursor == '+' || *cursor == '-')){
+            cursor++;
+        }
+
+        auto result = std::from_chars(start, cursor, value.numberValue);    //Locale independent
+        if(result.ec != std::errc() || result.ptr != cursor){
+            cursor = start;
+            fail("invalid number");
+        }
+        value.type = JsonType::Number;
+    }
+
+
+    uint32_t parseHex4(){
+        if(end - cursor < 4) fail("truncated \\u escape");
+        uint32_t code = 0;
+        for(int i = 0; i < 4; i++){
+            char c = *cursor++;
+            code <<= 4;
+            if(c >= '0' && c <= '9') code |= c - '0';
+            else if(c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if(c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else fail("invalid \\u escape");
+        }
+        return code;
+    }
+
+
+    static void appendUtf8(std::string& out, uint32_t code){
+        if(code < 0x80){
+            out += static_cast<char>(code);
+        } else if(code < 0x800){
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if(code < 0x10000){
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+
+    void parseString(std::string& out){
+        cursor++;   //Opening quote
+        while(true){
+            const char* run = cursor;   //Copy unescaped runs in one go
+            while(cursor < end && *cursor != '"' && *cursor != '\\'){
+                if(static_cast<unsigned char>(*cursor) < 0x20) fail("control character in string");
+                cursor++;
+            }
+            out.append(run, cursor);
+            if(cursor >= end) fail("unterminated string");
+            if(*cursor++ == '"') return;
+
+            if(cursor >= end) fail("unterminated string");
+            char escape = *cursor++;
+            switch(escape){
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t code = parseHex4();
+                    if(code >= 0xD800 && code < 0xDC00){    //High surrogate, the low one must follow
+                        if(!consume("\\u")) fail("unpaired surrogate");
+                        uint32_t low = parseHex4();
+                        if(low < 0xDC00 || low >= 0xE000) fail("unpaired surrogate");
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(out, code);
+                    break;
+                }
+                default: fail("invalid escape");
+            }
+        }
+    }
+};
+
+
+inline JsonValue parseJson(const char* text, size_t length){
+    return JsonParser(text, length).parseDocument();
+}
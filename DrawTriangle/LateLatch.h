@@ -0,0 +1,120 @@
+#pragma once
+
+/*
+Late-latched camera and input uniforms:
+    Frame packets are built before the render thread gets to them and command buffers are recorded before the submit,
+    so the camera they carry can be a frame old when the GPU runs. Data the shaders only read through a buffer can be
+    written much later than that.
+
+    1) The simulation thread publishes the newest camera and cursor whenever they change (LatchMailbox, a lock-free
+       triple buffer: the writer never waits and the reader always gets the most recent complete value)
+    2) Each frame in flight owns one slot of a persistently mapped, host coherent buffer. Command buffers only
+       reference the slot; the render thread copies the newest mailbox value into it right before vkQueueSubmit
+    3) Host writes made before vkQueueSubmit are visible to the submitted work, so no flush or barrier is needed
+    4) Shaders reach the slot through getAddress() in a push constant and read it as LateLatch (shaders/late_latch.glsl),
+       so cached command buffers stay valid while the camera moves
+
+    The slot of a frame may only be written once that frame's last submission has completed, which drawFrame waits for.
+    Culling in the packet still uses the packet's camera; the sphere test has enough slack for the small difference.
+*/
+
+#include "DeviceAllocator.h"
+
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+
+
+struct LatchedUniforms {    //std140, matches LateLatch in shaders/late_latch.glsl
+    float view[16];
+    float projection[16];
+    float viewProjection[16];
+    float cameraPosition[4];    //xyz, w unused
+    float cursor[4];            //Framebuffer pixels in xy, normalized device coordinates in zw
+    uint64_t inputTimestampNs;  //steady_clock ns of the newest input the values reflect, 0 if none
+    uint64_t padding;
+};
+
+static_assert(offsetof(LatchedUniforms, cameraPosition) == 192 && offsetof(LatchedUniforms, inputTimestampNs) == 224 &&
+              sizeof(LatchedUniforms) == 240, "LatchedUniforms must keep the std140 offsets of shaders/late_latch.glsl");
+
+
+template<typename T>
+class LatchMailbox {    //Single writer, single reader, newest value wins
+
+public:
+    void publish(const T& value){
+        slots[back] = value;
+        uint32_t previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & INDEX;
+    }
+
+
+    bool read(T& value){    //false until the first publish; keeps returning the last value when nothing new arrived
+        if(middle.load(std::memory_order_relaxed) & FRESH){
+            uint32_t previous = middle.exchange(front, std::memory_order_acq_rel);
+            front = previous & INDEX;
+            received = true;
+        }
+        if(received){
+            value = slots[front];
+        }
+        return received;
+    }
+
+
+private:
+    static constexpr uint32_t INDEX = 3;
+    static constexpr uint32_t FRESH = 4;
+
+    T slots[3]{};
+    uint32_t back = 0;                  //Writer only
+    std::atomic<uint32_t> middle{1};
+    uint32_t front = 2;                 //Reader only
+    bool received = false;
+};
+
+
+class LateLatchBuffer {
+
+public:
+    void init(DeviceAllocator& allocator, uint32_t framesInFlight, VkDeviceSize minUniformAlignment){
+        this->allocator = &allocator;
+        stride = alignUp(sizeof(LatchedUniforms), std::max<VkDeviceSize>(minUniformAlignment, 1));
+
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        if(allocator.hasBufferDeviceAddress()){
+            usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+        }
+        buffer = allocator.createBuffer(stride * framesInFlight, usage,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);     //Not movable, the mapping is written without touch()
+    }
+
+
+    void destroy(){     //Device must be idle
+        if(buffer != nullptr){
+            allocator->free(buffer);
+            buffer = nullptr;
+        }
+    }
+
+
+    void latch(uint32_t frameIndex, const LatchedUniforms& uniforms){  //Render thread, after the frame's last submission completed and before the flush
+        std::memcpy(static_cast<char*>(buffer->mapped) + getOffset(frameIndex), &uniforms, sizeof(LatchedUniforms));
+    }
+
+
+    VkBuffer getBuffer() const { return buffer->buffer; }
+
+    VkDeviceSize getOffset(uint32_t frameIndex) const { return stride * frameIndex; }
+
+    VkDeviceSize getRange() const { return sizeof(LatchedUniforms); }
+
+    VkDeviceAddress getAddress(uint32_t frameIndex) const { return allocator->getAddress(buffer) + getOffset(frameIndex); }
+
+
+private:
+    DeviceAllocator* allocator = nullptr;
+    Allocation* buffer = nullptr;
+    VkDeviceSize stride = 0;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+/*
+Input-to-photon latency measurement:
+    1) The simulation thread stamps the earliest input event folded into each frame packet (steady_clock ns, taken
+       when GLFW hands the event to us)
+    2) The present thread reports every present that carried input, together with its submit and present call times
+    3) With VK_KHR_present_wait a waiter thread blocks in vkWaitForPresentKHR for the frame's present id; the time it
+       returns is taken as the moment the image reached the screen. Without it the sample ends at the return of
+       vkQueuePresentKHR, which underestimates by the compositor/scanout delay, and the report says so
+
+    report() prints the distribution (p50/p90/p99/max) of input->submit and input->display.
+*/
+
+#include "SpscRing.h"
+#include "Profiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <string>
+
+
+const uint64_t PRESENT_WAIT_TIMEOUT_NS = 100000000;     //Gives up on a present after 100 ms, also bounds shutdown
+const size_t LATENCY_MAX_SAMPLES = 1 << 16;             //Most recent samples kept for the report
+
+
+class LatencyTracker {
+
+public:
+    void init(VkDevice device, VkSwapchainKHR swapchain, bool presentWait){
+        this->device = device;
+        this->swapchain = swapchain;
+
+        if(presentWait){
+            waitForPresent = (PFN_vkWaitForPresentKHR) vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+        }
+        if(waitForPresent != nullptr){
+            running = true;
+            waiter = std::thread([this]{ waitLoop(); });
+        }
+    }
+
+
+    void destroy(){
+        running = false;
+        if(waiter.joinable()){
+            waiter.join();
+        }
+    }
+
+
+    bool measuresDisplay() const { return waitForPresent != nullptr; }
+
+
+    uint64_t nextPresentId(){   //Present thread; ids must increase for every present on the swapchain
+        return ++presentId;
+    }
+
+
+    void framePresented(uint64_t presentId, uint64_t inputNs, uint64_t submitNs, uint64_t presentNs){  //Present thread
+        if(inputNs == 0) return;    //No input reached this frame
+
+        if(waitForPresent == nullptr){
+            addSample({inputNs, submitNs, presentNs});
+            return;
+        }
+        if(!pending.tryPush({presentId, inputNs, submitNs})){
+            dropped++;              //Waiter is behind; losing a sample is better than stalling presentation
+        }
+    }
+
+
+    std::string report(){
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2);
+        out << "Input latency over " << samples.size() << " frames with input";
+        if(dropped > 0) out << " (" << dropped << " dropped)";
+        out << "\n";
+        if(samples.empty()) return out.str();
+
+        std::vector<double> toSubmit, toDisplay;
+        for(const Sample& sample : samples){
+            toSubmit.push_back((sample.submitNs - sample.inputNs) / 1e6);
+            toDisplay.push_back((sample.displayNs - sample.inputNs) / 1e6);
+        }
+        writeDistribution(out, "  input -> submit  ", toSubmit);
+        writeDistribution(out, waitForPresent ? "  input -> display " : "  input -> present (vkQueuePresentKHR return, no present_wait)", toDisplay);
+        return out.str();
+    }
+
+
+private:
+    struct Pending {
+        uint64_t presentId;
+        uint64_t inputNs;
+        uint64_t submitNs;
+    };
+
+    struct Sample {
+        uint64_t inputNs;
+        uint64_t submitNs;
+        uint64_t displayNs;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+
+    uint64_t presentId = 0;
+    SpscRing<Pending, 64> pending;      //render -> waiter
+    std::thread waiter;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> dropped{0};
+
+    std::mutex mutex;
+    std::vector<Sample> samples;
+    size_t nextSample = 0;
+
+
+    void addSample(const Sample& sample){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(samples.size() < LATENCY_MAX_SAMPLES){
+            samples.push_back(sample);
+        } else {
+            samples[nextSample] = sample;
+        }
+        nextSample = (nextSample + 1) % LATENCY_MAX_SAMPLES;
+    }
+
+
+    void waitLoop(){
+        PROFILE_THREAD("Present wait");
+        while(running){
+            Pending frame;
+            if(!pending.tryPop(frame)){
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                continue;
+            }
+
+            VkResult result;
+            {
+                PROFILE_ZONE("vkWaitForPresentKHR");
+                result = waitForPresent(device, swapchain, frame.presentId, PRESENT_WAIT_TIMEOUT_NS);
+            }
+            if(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR){
+                addSample({frame.inputNs, frame.submitNs, Profiler::steadyNanoseconds()});
+            }
+        }
+    }
+
+
+    static void writeDistribution(std::ostringstream& out, const char* label, std::vector<double>& values){
+        std::sort(values.begin(), values.end());
+        auto percentile = [&](double p){ return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))]; };
+        out << label << "  p50 " << percentile(0.5) << " ms  p90 " << percentile(0.9) << " ms  p99 " << percentile(0.99)
+            << " ms  max " << values.back() << " ms\n";
+    }
+};
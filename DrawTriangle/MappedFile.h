@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+Read-only memory mapped file:
+    The whole file is mapped for the lifetime of the object and read by the kernel on first touch, so opening even a
+    large file is cheap and only the pages that are used are ever read. An empty file opens with size 0 and no data.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+#include <cstdint>
+
+
+class MappedFile {
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept : base(std::exchange(other.base, nullptr)), size(std::exchange(other.size, 0)), opened(std::exchange(other.opened, false)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if(this != &other){
+            close();
+            base = std::exchange(other.base, nullptr);
+            size = std::exchange(other.size, 0);
+            opened = std::exchange(other.opened, false);
+        }
+        return *this;
+    }
+
+    ~MappedFile(){
+        close();
+    }
+
+
+    bool open(const std::string& path){     //false if the file cannot be opened or mapped
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+
+        struct stat info;
+        if(fstat(fd, &info) != 0){
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(info.st_size);
+
+        if(size > 0){
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if(mapping == MAP_FAILED){
+                ::close(fd);
+                size = 0;
+                return false;
+            }
+            base = static_cast<const uint8_t*>(mapping);
+        }
+        ::close(fd);    //The mapping keeps the file open
+        opened = true;
+        return true;
+    }
+
+
+    void close(){
+        if(base != nullptr){
+            munmap(const_cast<uint8_t*>(base), size);
+        }
+        base = nullptr;
+        size = 0;
+        opened = false;
+    }
+
+
+    void willNeed() const {     //Start reading the whole file ahead; never blocks
+        if(base != nullptr){
+            madvise(const_cast<uint8_t*>(base), size, MADV_WILLNEED);
+        }
+    }
+
+
+    bool isOpen() const { return opened; }
+
+    const uint8_t* data() const { return base; }
+
+    size_t getSize() const { return size; }
+
+
+private:
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    bool opened = false;
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+/*
+Minimal vector/matrix helpers:
+    Matrices are float[16], column major, the same layout the GPU structs (GpuObject::transform) and GLSL mat4 use.
+    Projection follows Vulkan conventions: right handed view space, depth 0..1, y pointing down in clip space.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+
+struct Vec3 {
+    float x = 0.0f, y = 0.0f, z = 0.0f;
+
+    Vec3() = default;
+    Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+    Vec3 operator+(const Vec3& o) const { return {x + o.x, y + o.y, z + o.z}; }
+    Vec3 operator-(const Vec3& o) const { return {x - o.x, y - o.y, z - o.z}; }
+    Vec3 operator*(float s) const { return {x * s, y * s, z * s}; }
+    float& operator[](int i){ return (&x)[i]; }
+    float operator[](int i) const { return (&x)[i]; }
+};
+
+
+inline float dot(const Vec3& a, const Vec3& b){ return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+inline Vec3 cross(const Vec3& a, const Vec3& b){ return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+
+inline float length(const Vec3& v){ return std::sqrt(dot(v, v)); }
+
+inline Vec3 normalize(const Vec3& v){
+    float len = length(v);
+    return len > 0.0f ? v * (1.0f / len) : v;
+}
+
+inline Vec3 minVec(const Vec3& a, const Vec3& b){ return {std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)}; }
+
+inline Vec3 maxVec(const Vec3& a, const Vec3& b){ return {std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)}; }
+
+inline Vec3 lerp(const Vec3& a, const Vec3& b, float t){ return a + (b - a) * t; }
+
+
+inline void mat4Identity(float out[16]){
+    memset(out, 0, 16 * sizeof(float));
+    out[0] = out[5] = out[10] = out[15] = 1.0f;
+}
+
+
+inline void mat4Multiply(const float a[16], const float b[16], float out[16]){     //out = a * b, out may alias neither
+    for(int column = 0; column < 4; column++){
+        for(int row = 0; row < 4; row++){
+            float sum = 0.0f;
+            for(int k = 0; k < 4; k++){
+                sum += a[k * 4 + row] * b[column * 4 + k];
+            }
+            out[column * 4 + row] = sum;
+        }
+    }
+}
+
+
+inline Vec3 mat4TransformPoint(const float m[16], const Vec3& p){    //Affine transforms only, w is dropped
+    return {m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12],
+            m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+            m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14]};
+}
+
+
+inline Vec3 mat4Unproject(const float inverseViewProjection[16], float x, float y, float depth){     //Clip space x, y, depth back to world
+    const float* m = inverseViewProjection;
+    float w = m[3] * x + m[7] * y + m[11] * depth + m[15];
+    return Vec3(m[0] * x + m[4] * y + m[8] * depth + m[12],
+                m[1] * x + m[5] * y + m[9] * depth + m[13],
+                m[2] * x + m[6] * y + m[10] * depth + m[14]) * (1.0f / w);
+}
+
+
+inline void mat4Translation(const Vec3& t, float out[16]){
+    mat4Identity(out);
+    out[12] = t.x;
+    out[13] = t.y;
+    out[14] = t.z;
+}
+
+
+inline void mat4LookAt(const Vec3& eye, const Vec3& target, const Vec3& up, float out[16]){
+    Vec3 f = normalize(target - eye);
+    Vec3 s = normalize(cross(f, up));
+    Vec3 u = cross(s, f);
+
+    mat4Identity(out);
+    out[0] = s.x;  out[4] = s.y;  out[8] = s.z;
+    out[1] = u.x;  out[5] = u.y;  out[9] = u.z;
+    out[2] = -f.x; out[6] = -f.y; out[10] = -f.z;
+    out[12] = -dot(s, eye);
+    out[13] = -dot(u, eye);
+    out[14] = dot(f, eye);
+}
+
+
+inline void mat4Perspective(float fovY, float aspect, float nearPlane, float farPlane, float out[16]){
+    float f = 1.0f / std::tan(fovY * 0.5f);
+
+    memset(out, 0, 16 * sizeof(float));
+    out[0] = f / aspect;
+    out[5] = -f;                                            //Vulkan clip space y points down
+    out[10] = farPlane / (nearPlane - farPlane);
+    out[11] = -1.0f;
+    out[14] = (nearPlane * farPlane) / (nearPlane - farPlane);
+}
+
+
+inline void mat4Inverse(const float m[16], float out[16]){     //General 4x4 inverse via cofactors
+    float inv[16];
+    inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+    inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+    inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+    inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+    inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+    inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+    inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+    inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+    inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+    inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+    inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+    inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+    inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+    inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+    inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+    inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+    float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+    for(int i = 0; i < 16; i++){
+        out[i] = inv[i] * invDet;
+    }
+}
+
+
+struct Quat {
+    float x = 0.0f, y = 0.0f, z = 0.0f, w = 1.0f;
+};
+
+
+inline Quat quatAxisAngle(const Vec3& axis, float angle){
+    Vec3 n = normalize(axis);
+    float s = std::sin(angle * 0.5f);
+    return {n.x * s, n.y * s, n.z * s, std::cos(angle * 0.5f)};
+}
+
+
+inline Quat quatMultiply(const Quat& a, const Quat& b){     //Applies b first, then a
+    return {a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+            a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+            a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+            a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
+}
+
+
+inline Vec3 quatRotate(const Quat& q, const Vec3& v){     //Unit quaternions only
+    Vec3 u(q.x, q.y, q.z);
+    Vec3 t = cross(u, v) * 2.0f;
+    return v + t * q.w + cross(u, t);
+}
+
+
+inline Quat quatNlerp(const Quat& a, const Quat& b, float t){  //Normalized lerp along the shorter arc; close enough to slerp for per-step deltas
+    float sign = (a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w) < 0.0f ? -1.0f : 1.0f;
+    Quat q{a.x + (b.x * sign - a.x) * t, a.y + (b.y * sign - a.y) * t, a.z + (b.z * sign - a.z) * t, a.w + (b.w * sign - a.w) * t};
+    float len = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    return {q.x / len, q.y / len, q.z / len, q.w / len};
+}
+
+
+struct Transform {
+    Vec3 position;
+    Quat rotation;
+    float scale = 1.0f;
+};
+
+
+inline bool operator==(const Transform& a, const Transform& b){
+    return a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z &&
+           a.rotation.x == b.rotation.x && a.rotation.y == b.rotation.y && a.rotation.z == b.rotation.z && a.rotation.w == b.rotation.w &&
+           a.scale == b.scale;
+}
+
+
+inline Transform interpolate(const Transform& a, const Transform& b, float t){
+    return {lerp(a.position, b.position, t), quatNlerp(a.rotation, b.rotation, t), a.scale + (b.scale - a.scale) * t};
+}
+
+
+inline void transformToMatrix(const Transform& transform, float out[16]){
+    const Quat& q = transform.rotation;
+    float s = transform.scale;
+
+    out[0] = (1.0f - 2.0f * (q.y * q.y + q.z * q.z)) * s;
+    out[1] = (2.0f * (q.x * q.y + q.z * q.w)) * s;
+    out[2] = (2.0f * (q.x * q.z - q.y * q.w)) * s;
+    out[3] = 0.0f;
+    out[4] = (2.0f * (q.x * q.y - q.z * q.w)) * s;
+    out[5] = (1.0f - 2.0f * (q.x * q.x + q.z * q.z)) * s;
+    out[6] = (2.0f * (q.y * q.z + q.x * q.w)) * s;
+    out[7] = 0.0f;
+    out[8] = (2.0f * (q.x * q.z + q.y * q.w)) * s;
+    out[9] = (2.0f * (q.y * q.z - q.x * q.w)) * s;
+    out[10] = (1.0f - 2.0f * (q.x * q.x + q.y * q.y)) * s;
+    out[11] = 0.0f;
+    out[12] = transform.position.x;
+    out[13] = transform.position.y;
+    out[14] = transform.position.z;
+    out[15] = 1.0f;
+}
+
+
+struct Frustum {
+    float planes[6][4];     //xyz inward normal, w distance; a point p is inside when dot(n, p) + w >= 0 for every plane
+};
+
+
+inline Frustum frustumFromMatrix(const float viewProjection[16]){     //Gribb/Hartmann extraction for 0..1 depth
+    const float* m = viewProjection;
+    auto row = [&](int r, int i){ return m[i * 4 + r]; };
+
+    Frustum frustum;
+    for(int i = 0; i < 4; i++){
+        frustum.planes[0][i] = row(3, i) + row(0, i);   //Left
+        frustum.planes[1][i] = row(3, i) - row(0, i);   //Right
+        frustum.planes[2][i] = row(3, i) + row(1, i);   //Bottom/top, y is flipped in Vulkan clip space
+        frustum.planes[3][i] = row(3, i) - row(1, i);
+        frustum.planes[4][i] = row(2, i);               //Near
+        frustum.planes[5][i] = row(3, i) - row(2, i);   //Far
+    }
+
+    for(auto& plane : frustum.planes){
+        float len = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if(len > 0.0f){
+            for(float& value : plane) value /= len;
+        }
+    }
+    return frustum;
+}
+
+
+inline bool sphereInFrustum(const Frustum& frustum, const Vec3& center, float radius){
+    for(const auto& plane : frustum.planes){
+        if(plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3] < -radius) return false;
+    }
+    return true;
+}
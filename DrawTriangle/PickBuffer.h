@@ -0,0 +1,197 @@
+#pragma once
+
+/*
+Object picking through an id render target:
+    The frame draws the object id of every pixel into an R32_UINT image next to its color: the main render pass has it
+    as its second color attachment, clears it to PICK_NONE and leaves it in TRANSFER_SRC_OPTIMAL, with a dependency
+    that makes the writes visible to transfers. A pick copies only the PICK_REGION square around the cursor out of it,
+    so the readback is a few hundred bytes instead of a frame.
+
+    1) Copies land in a ring of PICK_READBACK_SLOTS small host visible buffers. A slot is tied to the ticket of the
+       submission that recorded it and is read by poll() once SubmissionQueue reports that ticket complete, usually a
+       couple of frames later. Nothing here ever waits on the GPU
+    2) When every slot is still in flight the request stays queued for the next frame instead of stalling; a newer
+       request replaces a queued one
+    3) The answer is the id nearest the cursor inside the region, so a click just beside a thin object still hits it
+
+    resolvePick() is shared with the software rasterizer, whose ids are readable as soon as the frame is rasterized.
+*/
+
+#include "GpuResources.h"
+#include "DeviceAllocator.h"
+#include "SubmissionQueue.h"
+#include "FramePacket.h"
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+
+const uint32_t PICK_REGION = 5;             //Pixels per side of the square read around the cursor, odd so it centres on it
+const uint32_t PICK_READBACK_SLOTS = 4;
+const VkFormat PICK_FORMAT = VK_FORMAT_R32_UINT;
+
+
+struct PickRegion {
+    int32_t x0, y0;             //Top left pixel
+    uint32_t width, height;     //PICK_REGION or less at the image edges
+    int32_t centerX, centerY;   //The picked pixel, clamped to the image
+};
+
+
+inline PickRegion pickRegion(int32_t x, int32_t y, uint32_t imageWidth, uint32_t imageHeight){
+    int32_t half = static_cast<int32_t>(PICK_REGION / 2);
+    PickRegion region;
+    region.centerX = std::clamp(x, 0, static_cast<int32_t>(imageWidth) - 1);
+    region.centerY = std::clamp(y, 0, static_cast<int32_t>(imageHeight) - 1);
+    region.x0 = std::max(region.centerX - half, 0);
+    region.y0 = std::max(region.centerY - half, 0);
+    region.width = static_cast<uint32_t>(std::min(region.centerX + half, static_cast<int32_t>(imageWidth) - 1) - region.x0 + 1);
+    region.height = static_cast<uint32_t>(std::min(region.centerY + half, static_cast<int32_t>(imageHeight) - 1) - region.y0 + 1);
+    return region;
+}
+
+
+//Id nearest the region's center; ids points at the region's top left pixel and has rowPitch entries per row
+inline uint32_t resolvePick(const uint32_t* ids, size_t rowPitch, const PickRegion& region){
+    uint32_t nearest = PICK_NONE;
+    int32_t nearestDistance = INT32_MAX;
+    for(uint32_t y = 0; y < region.height; y++){
+        for(uint32_t x = 0; x < region.width; x++){
+            uint32_t id = ids[y * rowPitch + x];
+            if(id == PICK_NONE) continue;
+            int32_t dx = region.x0 + static_cast<int32_t>(x) - region.centerX;
+            int32_t dy = region.y0 + static_cast<int32_t>(y) - region.centerY;
+            int32_t distance = dx * dx + dy * dy;
+            if(distance < nearestDistance){
+                nearest = id;
+                nearestDistance = distance;
+            }
+        }
+    }
+    return nearest;
+}
+
+
+class PickBuffer {
+
+public:
+    void init(GpuResources& resources, DeviceAllocator& allocator, uint32_t width, uint32_t height){
+        this->resources = &resources;
+        this->allocator = &allocator;
+        this->width = width;
+        this->height = height;
+
+        image = resources.createImage(PICK_FORMAT, width, height,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+        for(Slot& slot : slots){
+            slot.buffer = allocator.createBuffer(PICK_REGION * PICK_REGION * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+        }
+    }
+
+
+    void destroy(){     //GPU must be done with every frame; unanswered picks are dropped
+        for(Slot& slot : slots){
+            allocator->free(slot.buffer);
+            slot = {};
+        }
+        resources->destroyImage(image);
+        image = {};
+    }
+
+
+    ImageHandle getImage() const { return image; }      //Color attachment the draws write ids into
+
+
+    void request(const FramePacket& packet){    //Render thread, per packet; queues the packet's pick if it has one
+        if(packet.pickSequence == 0) return;
+        queued = {packet.pickSequence, packet.pickPixel[0], packet.pickPixel[1]};
+    }
+
+
+    //After the render pass; copies the region of the queued pick, if any and a slot is free
+    void recordReadback(VkCommandBuffer commandBuffer){
+        if(queued.sequence == 0) return;
+        Slot* slot = nullptr;
+        for(Slot& candidate : slots){
+            if(candidate.state == SlotState::Free){
+                slot = &candidate;
+                break;
+            }
+        }
+        if(slot == nullptr) return;     //All in flight, try again next frame
+
+        slot->region = pickRegion(queued.x, queued.y, width, height);
+        slot->sequence = queued.sequence;
+        slot->state = SlotState::Recorded;
+        queued = {};
+
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {slot->region.x0, slot->region.y0, 0};
+        region.imageExtent = {slot->region.width, slot->region.height, 1};   //Tightly packed rows
+        vkCmdCopyImageToBuffer(commandBuffer, resources->get(image)->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer->buffer, 1, &region);
+
+        VkMemoryBarrier hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+    }
+
+
+    void submitted(SubmitTicket ticket){    //The flush that carries the frame recorded last
+        for(Slot& slot : slots){
+            if(slot.state == SlotState::Recorded){
+                slot.ticket = ticket;
+                slot.state = SlotState::InFlight;
+            }
+        }
+    }
+
+
+    //Hands every pick whose copy has completed to done(const PickResult&); never waits
+    template<typename Done>
+    void poll(SubmissionQueue& submissions, VkQueue queue, Done&& done){
+        for(Slot& slot : slots){
+            if(slot.state != SlotState::InFlight || !submissions.isComplete(queue, slot.ticket)) continue;
+
+            const uint32_t* ids = static_cast<const uint32_t*>(slot.buffer->mapped);
+            done(PickResult{slot.sequence, resolvePick(ids, slot.region.width, slot.region)});
+            slot.state = SlotState::Free;
+        }
+    }
+
+
+private:
+    enum class SlotState : uint8_t {
+        Free,
+        Recorded,       //In the command buffer being recorded, not submitted yet
+        InFlight
+    };
+
+    struct Slot {
+        Allocation* buffer = nullptr;
+        SlotState state = SlotState::Free;
+        SubmitTicket ticket = 0;
+        uint32_t sequence = 0;
+        PickRegion region{};                //Copied into buffer
+    };
+
+    struct Request {
+        uint32_t sequence = 0;      //0 when nothing is queued
+        int32_t x = 0, y = 0;
+    };
+
+    GpuResources* resources = nullptr;
+    DeviceAllocator* allocator = nullptr;
+    ImageHandle image;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::array<Slot, PICK_READBACK_SLOTS> slots;
+    Request queued;
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+/*
+Dedicated present thread:
+    vkAcquireNextImageKHR and vkQueuePresentKHR can block for up to a vblank in FIFO mode. Doing them on the render
+    thread would leave it idle for that time instead of recording the next frame, so both run here:
+
+    1) The present thread acquires images ahead of the render thread with a short timeout and hands them over through
+       an SpscRing, so the render thread only ever polls (tryAcquire) and never waits in the driver
+    2) After submitting, the render thread queues a PresentRequest; the present thread presents requests in order and
+       tags them with present ids for the LatencyTracker
+    3) Acquire semaphores come from a small pool. A semaphore returns to the pool with the ticket of the submission that
+       waited on it and is only reused once that ticket has completed
+
+    4) An acquire or present that reports VK_ERROR_OUT_OF_DATE_KHR or VK_SUBOPTIMAL_KHR marks the swapchain out of
+       date and stops further acquires. The owner polls isOutOfDate(), stops both threads, recreates the swapchain and
+       calls init() again
+    5) Any other error (VK_ERROR_DEVICE_LOST, VK_ERROR_SURFACE_LOST_KHR, ...) ends the present thread. isFailed()
+       turns true and stop() rethrows the error on the owner's thread
+
+    At most imageCount - minImageCount + 1 images are held between acquire and present, the most the swapchain can hand
+    out without an acquire that may never return.
+*/
+
+#include "SpscRing.h"
+#include "SubmissionQueue.h"
+#include "LatencyTracker.h"
+#include "VulkanTypes.h"
+#include "Profiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+
+const uint64_t PRESENT_THREAD_ACQUIRE_TIMEOUT_NS = 500000;  //Bounds how long a queued present waits behind an acquire
+const uint32_t PRESENT_THREAD_QUEUE_SIZE = 8;               //Power of two, more than any swapchain image count we create
+
+
+struct AcquiredImage {
+    uint32_t imageIndex;
+    VkSemaphore semaphore;      //Signalled by the acquire; the frame submission must wait on it
+};
+
+
+struct PresentRequest {
+    uint32_t imageIndex;
+    VkSemaphore waitSemaphore;      //Signalled by the frame submission
+    VkSemaphore acquireSemaphore;   //From the AcquiredImage, goes back to the pool
+    SubmitTicket ticket;            //Submission that waited on acquireSemaphore
+    uint64_t inputNs;
+    uint64_t submitNs;
+};
+
+
+class PresentThread {
+
+public:
+    void init(VkDevice device, VkSwapchainKHR swapchain, SubmissionQueue& submissions, VkQueue presentQueue, VkQueue waitQueue,
+              uint32_t imageCount, uint32_t minImageCount, LatencyTracker& latencyTracker, bool presentIds)
+    {
+        this->device = device;
+        this->swapchain = swapchain;
+        this->submissions = &submissions;
+        this->presentQueue = presentQueue;
+        this->waitQueue = waitQueue;
+        this->latencyTracker = &latencyTracker;
+        this->presentIds = presentIds;
+        maxHeld = std::min(imageCount - minImageCount + 1, PRESENT_THREAD_QUEUE_SIZE);
+        held = 0;
+        outOfDate = false;
+        failed = false;
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        for(uint32_t i = 0; i < maxHeld + 1; i++){      //One spare lets an acquire start while the oldest ticket retires
+            VkSemaphore semaphore;
+            if(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS){
+                throw std::runtime_error("Failed to create acquire semaphores");
+            }
+            semaphores.push_back(semaphore);
+            freeSemaphores.push_back({semaphore, 0});
+        }
+
+        running = true;
+        thread = std::thread([this]{ loop(); });
+    }
+
+
+    void stop(){        //After the render thread stopped; presents whatever it queued last, or rethrows what ended the thread
+        running = false;
+        if(thread.joinable()){
+            thread.join();
+        }
+        if(error){
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+        PresentRequest request;
+        while(requests.tryPop(request)){    //The present thread is gone, this thread is the consumer now
+            presentImage(request);
+        }
+    }
+
+
+    void destroy(){     //Device must be idle; images acquired but never taken by the render thread are dropped
+        AcquiredImage image;
+        while(acquired.tryPop(image)){}
+        for(VkSemaphore semaphore : semaphores){
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        semaphores.clear();
+        freeSemaphores.clear();
+    }
+
+
+    bool tryAcquire(AcquiredImage& image){      //Render thread, never blocks
+        return acquired.tryPop(image);
+    }
+
+
+    bool isOutOfDate() const { return outOfDate.load(std::memory_order_relaxed); }   //Swapchain must be recreated
+
+    bool isFailed() const { return failed.load(std::memory_order_relaxed); }         //Thread ended on an error, stop() rethrows it
+
+
+    void present(const PresentRequest& request){    //Render thread
+        while(!requests.tryPush(request)){          //Cannot happen while maxHeld <= the ring size, kept as a guard
+            std::this_thread::yield();
+        }
+    }
+
+
+private:
+    struct FreeSemaphore {
+        VkSemaphore semaphore;
+        SubmitTicket ticket;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    SubmissionQueue* submissions = nullptr;
+    VkQueue presentQueue = VK_NULL_HANDLE;
+    VkQueue waitQueue = VK_NULL_HANDLE;             //Queue the frame submissions (and their tickets) go to
+    LatencyTracker* latencyTracker = nullptr;
+    bool presentIds = false;
+    uint32_t maxHeld = 1;
+
+    std::vector<VkSemaphore> semaphores;
+    std::vector<FreeSemaphore> freeSemaphores;      //Present thread only after init
+    uint32_t held = 0;                              //Acquired and not yet presented
+
+    SpscRing<AcquiredImage, PRESENT_THREAD_QUEUE_SIZE> acquired;    //present -> render
+    SpscRing<PresentRequest, PRESENT_THREAD_QUEUE_SIZE> requests;   //render -> present
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> outOfDate{false};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;       //Set by the present thread before failed, read after the join
+
+
+    void loop(){
+        PROFILE_THREAD("Present");
+        try {
+            while(running){
+                bool busy = false;
+
+                PresentRequest request;
+                while(requests.tryPop(request)){    //Presents first, they are what the display is waiting for
+                    presentImage(request);
+                    busy = true;
+                }
+
+                if(held < maxHeld && !outOfDate){
+                    busy |= acquireImage();
+                }
+
+                if(!busy){
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+        } catch(...){       //Escaping the thread would terminate the process
+            error = std::current_exception();
+            failed = true;
+        }
+    }
+
+
+    bool acquireImage(){
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        for(size_t i = 0; i < freeSemaphores.size(); i++){
+            if(submissions->isComplete(waitQueue, freeSemaphores[i].ticket)){
+                semaphore = freeSemaphores[i].semaphore;
+                freeSemaphores.erase(freeSemaphores.begin() + i);
+                break;
+            }
+        }
+        if(semaphore == VK_NULL_HANDLE) return false;   //Every semaphore is still waited on by a running frame
+
+        uint32_t imageIndex;
+        VkResult result;
+        {
+            PROFILE_ZONE("vkAcquireNextImageKHR");
+            result = vkAcquireNextImageKHR(device, swapchain, PRESENT_THREAD_ACQUIRE_TIMEOUT_NS, semaphore, VK_NULL_HANDLE, &imageIndex);
+        }
+
+        if(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR){
+            held++;
+            acquired.tryPush({imageIndex, semaphore});      //Never full, held <= maxHeld <= the ring size
+            if(result == VK_SUBOPTIMAL_KHR){                //Still presentable, the frame goes out before recreation
+                outOfDate = true;
+            }
+            return true;
+        }
+
+        freeSemaphores.push_back({semaphore, 0});           //Not signalled, usable again right away
+        if(result == VK_TIMEOUT || result == VK_NOT_READY) return false;
+        if(result == VK_ERROR_OUT_OF_DATE_KHR){
+            outOfDate = true;
+            return false;
+        }
+        throw std::runtime_error("Failed to acquire swap chain image");
+    }
+
+
+    VkResult presentImage(const PresentRequest& request){
+        StructChain<VkPresentInfoKHR, VkPresentIdKHR> chain;
+        uint64_t presentId = latencyTracker->nextPresentId();
+        VkPresentIdKHR& presentIdInfo = chain.get<VkPresentIdKHR>();
+        presentIdInfo.swapchainCount = 1;
+        presentIdInfo.pPresentIds = &presentId;
+        if(!presentIds){
+            chain.unlink<VkPresentIdKHR>();
+        }
+
+        VkPresentInfoKHR& presentInfo = chain.root();
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = &request.waitSemaphore;
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = &swapchain;
+        presentInfo.pImageIndices = &request.imageIndex;
+
+        VkResult result = submissions->present(presentQueue, presentInfo);
+
+        held--;     //Even a rejected present still waits on its semaphore, so the bookkeeping is the same
+        freeSemaphores.push_back({request.acquireSemaphore, request.ticket});
+
+        if(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR){
+            latencyTracker->framePresented(presentId, request.inputNs, request.submitNs, Profiler::steadyNanoseconds());
+        }
+        if(result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR){
+            outOfDate = true;
+        } else if(result != VK_SUCCESS){
+            throw std::runtime_error("Failed to present swap chain image");
+        }
+        return result;
+    }
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+/*
+Scoped-zone CPU profiler with a shared CPU/GPU timeline:
+    1) PROFILE_ZONE("name") stamps begin/end with the TSC (steady_clock where there is no TSC) and appends one event
+       to a ring owned by the calling thread. No locks and no allocation on that path; old events are overwritten
+       once a ring is full
+    2) GPU zones (GpuProfiler.h) arrive already converted to steady_clock nanoseconds and go to a separate locked list
+    3) exportChromeTrace() converts TSC ticks to steady_clock time using two calibration points (profiler start and
+       export) and writes Chrome trace JSON. chrome://tracing and ui.perfetto.dev both load it, CPU threads and the GPU
+       queue appearing as tracks of one timeline
+
+    Zone names must be string literals (or otherwise outlive the profiler); only the pointer is stored.
+    A thread's ring is handed to the next thread that starts recording once it exits, so threads restarted on every
+    swap chain recreation reuse memory instead of adding a ring each; the new thread continues the old one's track.
+    Export while other threads are still recording may tear the events being written, so export at shutdown.
+    Build with -DDISABLE_PROFILER to compile every zone out.
+*/
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define PROFILER_HAS_TSC 1
+#else
+    #define PROFILER_HAS_TSC 0
+#endif
+
+
+const uint32_t PROFILER_EVENTS_PER_THREAD = 1 << 16;
+
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+
+class Profiler {
+
+public:
+    static Profiler& instance(){
+        static Profiler profiler;
+        return profiler;
+    }
+
+
+    static uint64_t now(){
+#if PROFILER_HAS_TSC
+        return __rdtsc();
+#else
+        return steadyNanoseconds();
+#endif
+    }
+
+
+    static uint64_t steadyNanoseconds(){
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+
+    void setThreadName(const std::string& name){
+        threadBuffer().name = name;
+    }
+
+
+    void record(const char* name, uint64_t begin, uint64_t end){
+        ThreadBuffer& buffer = threadBuffer();
+        uint64_t index = buffer.written.load(std::memory_order_relaxed);
+        buffer.events[index % PROFILER_EVENTS_PER_THREAD] = {name, begin, end};
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+
+    void recordGpu(const char* name, uint64_t beginNs, uint64_t endNs){   //steady_clock nanoseconds
+        std::lock_guard<std::mutex> lock(mutex);
+        if(gpuEvents.size() >= PROFILER_EVENTS_PER_THREAD){
+            gpuEvents.erase(gpuEvents.begin(), gpuEvents.begin() + PROFILER_EVENTS_PER_THREAD / 2);
+        }
+        gpuEvents.push_back({name, beginNs, endNs});
+    }
+
+
+    size_t getThreadBufferCount(){      //Rings ever created, in use or free
+        std::lock_guard<std::mutex> lock(mutex);
+        return threads.size();
+    }
+
+
+    bool exportChromeTrace(const std::string& path){
+        std::ofstream file(path);
+        if(!file.is_open()) return false;
+
+        uint64_t endTicks = now();
+        uint64_t endNs = steadyNanoseconds();
+        double nsPerTick = endTicks > startTicks ? static_cast<double>(endNs - startNs) / static_cast<double>(endTicks - startTicks) : 1.0;
+        auto tickToUs = [&](uint64_t ticks){ return (static_cast<double>(ticks) - static_cast<double>(startTicks)) * nsPerTick / 1000.0; };
+        auto nsToUs = [&](uint64_t ns){ return (static_cast<double>(ns) - static_cast<double>(startNs)) / 1000.0; };
+
+        std::lock_guard<std::mutex> lock(mutex);
+        file << std::fixed << std::setprecision(3);
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}},\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":0,\"args\":{\"name\":\"Queue\"}}";
+
+        for(const auto& buffer : threads){
+            file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t first = written > PROFILER_EVENTS_PER_THREAD ? written - PROFILER_EVENTS_PER_THREAD : 0;
+            for(uint64_t i = first; i < written; i++){
+                const ProfileEvent& event = buffer->events[i % PROFILER_EVENTS_PER_THREAD];
+                writeEvent(file, event.name, 1, buffer->id, tickToUs(event.begin), tickToUs(event.end));
+            }
+        }
+
+        for(const ProfileEvent& event : gpuEvents){
+            writeEvent(file, event.name, 2, 0, nsToUs(event.begin), nsToUs(event.end));
+        }
+
+        file << "\n]}\n";
+        return file.good();
+    }
+
+
+private:
+    struct ThreadBuffer {
+        std::vector<ProfileEvent> events = std::vector<ProfileEvent>(PROFILER_EVENTS_PER_THREAD);
+        std::atomic<uint64_t> written{0};
+        uint32_t id = 0;
+        std::string name;
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;     //Owned here so events outlive the thread that wrote them
+    std::vector<ThreadBuffer*> freeBuffers;                 //Of threads that exited, reused before a new ring is made
+    std::vector<ProfileEvent> gpuEvents;
+    uint64_t startTicks;
+    uint64_t startNs;
+
+
+    Profiler(){
+        startTicks = now();
+        startNs = steadyNanoseconds();
+    }
+
+
+    struct ThreadHandle {       //Gives the thread's ring back when the thread exits
+        ThreadBuffer* buffer = nullptr;
+
+        ~ThreadHandle(){
+            if(buffer != nullptr) Profiler::instance().releaseBuffer(buffer);
+        }
+    };
+
+
+    ThreadBuffer& threadBuffer(){
+        thread_local ThreadHandle handle;
+        if(handle.buffer == nullptr){       //First event of this thread
+            handle.buffer = acquireBuffer();
+        }
+        return *handle.buffer;
+    }
+
+
+    ThreadBuffer* acquireBuffer(){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!freeBuffers.empty()){       //Events already in it stay until the ring wraps
+            ThreadBuffer* buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            return buffer;
+        }
+        threads.push_back(std::make_unique<ThreadBuffer>());
+        ThreadBuffer* buffer = threads.back().get();
+        buffer->id = static_cast<uint32_t>(threads.size());
+        buffer->name = "Thread " + std::to_string(buffer->id);
+        return buffer;
+    }
+
+
+    void releaseBuffer(ThreadBuffer* buffer){
+        std::lock_guard<std::mutex> lock(mutex);
+        freeBuffers.push_back(buffer);
+    }
+
+
+    static void writeEvent(std::ofstream& file, const char* name, int pid, uint32_t tid, double beginUs, double endUs){
+        file << ",\n{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tid
+             << ",\"ts\":" << beginUs << ",\"dur\":" << std::max(0.0, endUs - beginUs) << "}";
+    }
+};
+
+
+class ProfileZone {
+
+public:
+    explicit ProfileZone(const char* name) : name(name), begin(Profiler::now()) {}
+
+    ~ProfileZone(){
+        Profiler::instance().record(name, begin, Profiler::now());
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+#ifdef DISABLE_PROFILER
+    #define PROFILE_ZONE(name)
+    #define PROFILE_THREAD(name)
+#else
+    #define PROFILE_ZONE(name) ProfileZone PROFILER_CONCAT(profileZone, __LINE__)(name)
+    #define PROFILE_THREAD(name) Profiler::instance().setThreadName(name)
+#endif
@@ -0,0 +1,329 @@
+#pragma once
+
+/*
+Binary scene cache:
+    The processed result of a glTF import (GltfLoader.h) - meshes with bounds, materials, flattened instances, packed
+    vertices and indices - stored as one pointer-free file. Every reference is an offset from the start of the file or
+    an index, so the file is memory mapped and used in place: the records are read straight from the mapping and the
+    geometry is uploaded from it (imported as buffer memory where the device allows, UploadContext::addHostSource).
+
+    1) load() maps an existing cache and accepts it only if magic, version, record sizes, file size, section bounds and
+       the hash of the source files all match; anything else is a miss
+    2) build() imports the source and has the importer decode straight into a mapping of the new cache file, written
+       under a temporary name and renamed into place once complete, so a crash never leaves a half written cache. If
+       the file cannot be created the cache lives in anonymous memory for this run
+    3) hashSceneSources() hashes the glTF/GLB file and every external buffer it names, in parallel chunks
+
+    Geometry starts on a page boundary and the file is padded to one, so the whole geometry section can be imported.
+    The cache is only read by the machine that wrote it: byte order and struct layout are the writer's.
+    Index values are not range checked on load; the file is our own output and its hash is checked.
+*/
+
+#include "GltfLoader.h"
+#include "Json.h"
+#include "MappedFile.h"
+#include "JobSystem.h"
+#include "Vertex.h"
+#include "Profiler.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+#include <string>
+#include <type_traits>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+
+const uint32_t SCENE_CACHE_MAGIC = 0x48435353;         //"SSCH"
+const uint32_t SCENE_CACHE_VERSION = 1;
+const uint64_t SCENE_CACHE_PAGE = 4096;                 //Geometry alignment, the usual host import alignment
+const uint64_t SCENE_HASH_CHUNK = 4 * 1024 * 1024;      //Bytes hashed per job
+
+
+struct SceneCacheSection {
+    uint64_t offset;        //From the start of the file
+    uint64_t count;
+};
+
+
+struct SceneCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSizes[4];    //GltfMesh, GltfMaterial, GltfInstance, Vertex; a layout change invalidates the cache
+    uint64_t sourceHash;
+    uint64_t fileSize;
+    SceneCacheSection meshes;
+    SceneCacheSection materials;
+    SceneCacheSection instances;
+    SceneCacheSection vertices;     //Vertices then indices form the geometry section
+    SceneCacheSection indices;
+};
+
+static_assert(std::is_trivially_copyable_v<GltfMesh> && std::is_trivially_copyable_v<GltfMaterial> &&
+              std::is_trivially_copyable_v<GltfInstance> && std::is_trivially_copyable_v<Vertex>, "Scene cache records are copied as bytes");
+
+
+inline uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull){     //FNV-1a over 64-bit words
+    size_t words = size / 8;
+    for(size_t i = 0; i < words; i++){
+        uint64_t word;
+        memcpy(&word, data + i * 8, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    uint64_t tail = 0;
+    if(size % 8 != 0) memcpy(&tail, data + words * 8, size % 8);
+    return (hash ^ tail ^ size) * 1099511628211ull;
+}
+
+
+inline uint64_t hashFile(const MappedFile& file, JobSystem& jobs){     //Chunks are hashed in parallel, then combined in order
+    size_t chunks = (file.getSize() + SCENE_HASH_CHUNK - 1) / SCENE_HASH_CHUNK;
+    std::vector<uint64_t> chunkHashes(chunks);
+    jobs.wait(jobs.parallelFor(static_cast<uint32_t>(chunks), 1, [&file, &chunkHashes](uint32_t begin, uint32_t end){
+        for(uint32_t i = begin; i < end; i++){
+            size_t offset = i * SCENE_HASH_CHUNK;
+            chunkHashes[i] = hashBytes(file.data() + offset, std::min<size_t>(SCENE_HASH_CHUNK, file.getSize() - offset));
+        }
+    }));
+    return hashBytes(reinterpret_cast<const uint8_t*>(chunkHashes.data()), chunkHashes.size() * sizeof(uint64_t));
+}
+
+
+//Hash of the glTF/GLB file and the external buffers it names; throws if any of them cannot be opened
+inline uint64_t hashSceneSources(const std::string& path, JobSystem& jobs){
+    PROFILE_ZONE("hashSceneSources");
+    MappedFile file;
+    if(!file.open(path)){
+        throw std::runtime_error("Failed to open glTF file " + path);
+    }
+    file.willNeed();
+    uint64_t hash = hashFile(file, jobs);
+
+    uint32_t magic = 0;
+    memcpy(&magic, file.data(), std::min<size_t>(file.getSize(), sizeof(magic)));
+    if(magic == GLB_MAGIC) return hash;     //External buffers in a GLB are rare; its binary chunk is already hashed
+
+    JsonValue json = parseJson(reinterpret_cast<const char*>(file.data()), file.getSize());
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+    const JsonValue& buffers = json["buffers"];
+    for(size_t i = 0; i < buffers.size(); i++){
+        const std::string& uri = buffers[i]["uri"].string();
+        if(uri.empty() || uri.rfind("data:", 0) == 0) continue;     //Part of the file already hashed
+
+        MappedFile buffer;
+        std::string bufferPath = directory + GltfImporter::decodeUri(uri);
+        if(!buffer.open(bufferPath)){
+            throw std::runtime_error("Failed to open glTF buffer " + bufferPath);
+        }
+        buffer.willNeed();
+        hash = hashBytes(reinterpret_cast<const uint8_t*>(&hash), sizeof(hash), hashFile(buffer, jobs));
+    }
+    return hash;
+}
+
+
+class SceneCache {
+
+public:
+    SceneCache() = default;
+    SceneCache(const SceneCache&) = delete;
+    SceneCache& operator=(const SceneCache&) = delete;
+
+    ~SceneCache(){
+        close();
+    }
+
+
+    bool load(const std::string& path, uint64_t sourceHash){      //false if missing, stale or malformed
+        PROFILE_ZONE("SceneCache::load");
+        close();
+        if(!file.open(path)) return false;
+        if(!isValid(file.data(), file.getSize(), sourceHash)){
+            close();
+            return false;
+        }
+        base = file.data();
+        size = file.getSize();
+        return true;
+    }
+
+
+    //Imports into a new cache at path. Returns false if the file could not be written; the cache is usable either way
+    bool build(const std::string& path, uint64_t sourceHash, GltfImporter& importer, JobSystem& jobs){
+        PROFILE_ZONE("SceneCache::build");
+        close();
+        const GltfScene& scene = importer.getScene();
+        SceneCacheHeader header = layout(scene, sourceHash);
+
+        std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        bool persistent = fd >= 0 && ftruncate(fd, static_cast<off_t>(header.fileSize)) == 0;
+        void* mapping = persistent ? mmap(nullptr, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if(mapping == MAP_FAILED){
+            persistent = false;
+            mapping = mmap(nullptr, header.fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if(fd >= 0){
+            ::close(fd);    //The mapping keeps the file open
+            if(!persistent) unlink(temporary.c_str());
+        }
+        if(mapping == MAP_FAILED){
+            throw std::runtime_error("Failed to allocate the scene cache");
+        }
+        writable = static_cast<uint8_t*>(mapping);
+        base = writable;
+        size = header.fileSize;
+
+        try {
+            importer.decode(jobs, reinterpret_cast<Vertex*>(writable + header.vertices.offset), reinterpret_cast<uint32_t*>(writable + header.indices.offset));
+        } catch(...){
+            close();
+            if(persistent) unlink(temporary.c_str());
+            throw;
+        }
+        copySection(header.meshes, scene.meshes);           //Bounds were filled in by decode()
+        copySection(header.materials, scene.materials);
+        copySection(header.instances, scene.instances);
+        memcpy(writable, &header, sizeof(header));
+
+        return persistent && rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+
+    void close(){
+        if(writable != nullptr){
+            munmap(writable, size);
+        }
+        file.close();
+        writable = nullptr;
+        base = nullptr;
+        size = 0;
+    }
+
+
+    const uint8_t* data() const { return base; }
+
+    size_t getSize() const { return size; }
+
+    const SceneCacheHeader& getHeader() const { return *reinterpret_cast<const SceneCacheHeader*>(base); }
+
+
+    const GltfMesh* getMeshes() const { return section<GltfMesh>(getHeader().meshes); }
+
+    uint32_t getMeshCount() const { return static_cast<uint32_t>(getHeader().meshes.count); }
+
+    const GltfMaterial* getMaterials() const { return section<GltfMaterial>(getHeader().materials); }
+
+    uint32_t getMaterialCount() const { return static_cast<uint32_t>(getHeader().materials.count); }
+
+    const GltfInstance* getInstances() const { return section<GltfInstance>(getHeader().instances); }
+
+    uint32_t getInstanceCount() const { return static_cast<uint32_t>(getHeader().instances.count); }
+
+    const Vertex* getVertices() const { return section<Vertex>(getHeader().vertices); }
+
+    uint32_t getVertexCount() const { return static_cast<uint32_t>(getHeader().vertices.count); }
+
+    const uint32_t* getIndices() const { return section<uint32_t>(getHeader().indices); }
+
+    uint32_t getIndexCount() const { return static_cast<uint32_t>(getHeader().indices.count); }
+
+
+    const uint8_t* getGeometry() const { return base + getHeader().vertices.offset; }   //Vertices, then indices at getIndexOffset()
+
+    uint64_t getIndexOffset() const { return getHeader().indices.offset - getHeader().vertices.offset; }
+
+    uint64_t getGeometrySize() const { return getIndexOffset() + getHeader().indices.count * sizeof(uint32_t); }
+
+
+private:
+    MappedFile file;                    //A loaded cache
+    uint8_t* writable = nullptr;        //A built one
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+
+
+    template<typename T>
+    const T* section(const SceneCacheSection& entry) const { return reinterpret_cast<const T*>(base + entry.offset); }
+
+
+    template<typename T>
+    void copySection(const SceneCacheSection& entry, const std::vector<T>& records){
+        if(!records.empty()) memcpy(writable + entry.offset, records.data(), records.size() * sizeof(T));
+    }
+
+
+    static uint64_t alignUp(uint64_t value, uint64_t alignment){
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+
+    static SceneCacheHeader layout(const GltfScene& scene, uint64_t sourceHash){
+        SceneCacheHeader header{};
+        header.magic = SCENE_CACHE_MAGIC;
+        header.version = SCENE_CACHE_VERSION;
+        header.recordSizes[0] = sizeof(GltfMesh);
+        header.recordSizes[1] = sizeof(GltfMaterial);
+        header.recordSizes[2] = sizeof(GltfInstance);
+        header.recordSizes[3] = sizeof(Vertex);
+        header.sourceHash = sourceHash;
+
+        uint64_t offset = alignUp(sizeof(SceneCacheHeader), 16);
+        auto place = [&offset](SceneCacheSection& entry, uint64_t count, uint64_t recordSize, uint64_t alignment){
+            offset = alignUp(offset, alignment);
+            entry = {offset, count};
+            offset += count * recordSize;
+        };
+        place(header.meshes, scene.meshes.size(), sizeof(GltfMesh), 16);
+        place(header.materials, scene.materials.size(), sizeof(GltfMaterial), 16);
+        place(header.instances, scene.instances.size(), sizeof(GltfInstance), 16);
+        place(header.vertices, scene.vertexCount, sizeof(Vertex), SCENE_CACHE_PAGE);
+        place(header.indices, scene.indexCount, sizeof(uint32_t), 16);
+        header.fileSize = alignUp(offset, SCENE_CACHE_PAGE);
+        return header;
+    }
+
+
+    static bool isValid(const uint8_t* data, size_t fileSize, uint64_t sourceHash){
+        if(fileSize < sizeof(SceneCacheHeader)) return false;
+        SceneCacheHeader header;
+        memcpy(&header, data, sizeof(header));
+
+        if(header.magic != SCENE_CACHE_MAGIC || header.version != SCENE_CACHE_VERSION || header.sourceHash != sourceHash || header.fileSize != fileSize ||
+           header.recordSizes[0] != sizeof(GltfMesh) || header.recordSizes[1] != sizeof(GltfMaterial) ||
+           header.recordSizes[2] != sizeof(GltfInstance) || header.recordSizes[3] != sizeof(Vertex))
+        {
+            return false;
+        }
+
+        const SceneCacheSection* sections[5] = {&header.meshes, &header.materials, &header.instances, &header.vertices, &header.indices};
+        const uint64_t recordSizes[5] = {sizeof(GltfMesh), sizeof(GltfMaterial), sizeof(GltfInstance), sizeof(Vertex), sizeof(uint32_t)};
+        for(int i = 0; i < 5; i++){
+            const SceneCacheSection& entry = *sections[i];
+            if(entry.offset % 16 != 0 || entry.offset > fileSize || entry.count > UINT32_MAX || entry.count * recordSizes[i] > fileSize - entry.offset){
+                return false;
+            }
+        }
+
+        const GltfMesh* meshes = reinterpret_cast<const GltfMesh*>(data + header.meshes.offset);
+        for(uint64_t i = 0; i < header.meshes.count; i++){
+            const GltfMesh& mesh = meshes[i];
+            if(static_cast<uint64_t>(mesh.firstVertex) + mesh.vertexCount > header.vertices.count ||
+               static_cast<uint64_t>(mesh.firstIndex) + mesh.indexCount > header.indices.count ||
+               (mesh.material != GLTF_NO_MATERIAL && mesh.material >= header.materials.count))
+            {
+                return false;
+            }
+        }
+        const GltfInstance* instances = reinterpret_cast<const GltfInstance*>(data + header.instances.offset);
+        for(uint64_t i = 0; i < header.instances.count; i++){
+            if(instances[i].mesh >= header.meshes.count) return false;
+        }
+        return true;
+    }
+};
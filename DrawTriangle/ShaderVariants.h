@@ -0,0 +1,199 @@
+#pragma once
+
+/*
+Shader variants through specialization constants:
+    One SPIR-V module per stage serves every permutation. Shaders declare (see shaders/variants.glsl)
+        constant_id 0: VARIANT_DYNAMIC  - true: features come from a runtime value (uber shader), false: baked in
+        constant_id 1: VARIANT_FEATURES - feature bitmask the driver constant-folds into the specialized pipeline
+
+    1) registerProgram() compiles the dynamic fallback up front, so there is always something to draw with
+    2) get(program, features) returns the specialized pipeline once it exists; the first request for a mask queues its
+       compilation on the job system and hands back the fallback until the job finishes
+    3) All compilation goes through the shared VkPipelineCache so later runs get cheap cache hits
+*/
+
+#include "JobSystem.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
+#include <cstddef>
+
+
+const uint32_t VARIANT_CONSTANT_DYNAMIC = 0;
+const uint32_t VARIANT_CONSTANT_FEATURES = 1;
+
+
+struct ShaderStageDesc {
+    VkShaderStageFlagBits stage;
+    VkShaderModule module;
+    const char* entryPoint = "main";
+};
+
+
+//Builds one pipeline from the specialized stages; called on worker threads, so everything it captures must stay valid
+using PipelineBuilder = std::function<VkPipeline(VkPipelineCache cache, const VkPipelineShaderStageCreateInfo* stages, uint32_t stageCount)>;
+
+
+class ShaderVariantManager {
+
+public:
+    void init(VkDevice device, VkPipelineCache pipelineCache, JobSystem& jobs){
+        this->device = device;
+        this->pipelineCache = pipelineCache;
+        this->jobs = &jobs;
+    }
+
+
+    void destroy(){     //Device must be idle
+        for(auto& program : programs){
+            jobs->wait(program->compiling);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto& variant : program->variants){
+                if(variant.second.pipeline != VK_NULL_HANDLE){
+                    vkDestroyPipeline(device, variant.second.pipeline, nullptr);
+                }
+            }
+            vkDestroyPipeline(device, program->fallback, nullptr);
+        }
+        programs.clear();
+    }
+
+
+    uint32_t registerProgram(const std::vector<ShaderStageDesc>& stages, PipelineBuilder builder){
+        auto program = std::make_unique<Program>();
+        program->stages = stages;
+        program->builder = std::move(builder);
+        program->compiling = std::make_shared<JobCounter>();
+        program->fallback = compile(*program, 0, true);
+
+        if(program->fallback == VK_NULL_HANDLE){
+            throw std::runtime_error("Failed to create fallback shader variant");
+        }
+
+        programs.push_back(std::move(program));
+        return static_cast<uint32_t>(programs.size() - 1);
+    }
+
+
+    VkPipeline get(uint32_t programId, uint32_t features){  //Never blocks on compilation
+        Program& program = *programs[programId];
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = program.variants.find(features);
+        if(found != program.variants.end()){
+            return found->second.pipeline != VK_NULL_HANDLE ? found->second.pipeline : program.fallback;
+        }
+
+        program.variants[features] = Variant{};
+        jobs->submit([this, &program, features]{
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            try {
+                pipeline = compile(program, features, false);
+            } catch(const std::exception&){}   //Would otherwise be rethrown by destroy()'s wait
+
+            std::lock_guard<std::mutex> lock(mutex);
+            program.variants[features].pipeline = pipeline;     //Stays on the fallback if compilation failed
+        }, program.compiling);
+
+        return program.fallback;
+    }
+
+
+    bool isSpecialized(uint32_t programId, uint32_t features){
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& variants = programs[programId]->variants;
+        auto found = variants.find(features);
+        return found != variants.end() && found->second.pipeline != VK_NULL_HANDLE;
+    }
+
+
+    void prewarm(uint32_t programId, const std::vector<uint32_t>& featureSets){    //Queue known permutations ahead of first use
+        for(uint32_t features : featureSets){
+            get(programId, features);
+        }
+    }
+
+
+    static VkShaderModule loadShaderModule(VkDevice device, const std::string& path){
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if(!file.is_open()){
+            throw std::runtime_error("Failed to open shader " + path);
+        }
+
+        size_t fileSize = static_cast<size_t>(file.tellg());
+        std::vector<uint32_t> code((fileSize + 3) / 4);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(code.data()), fileSize);
+
+        VkShaderModuleCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.codeSize = fileSize;
+        createInfo.pCode = code.data();
+
+        VkShaderModule module;
+        if(vkCreateShaderModule(device, &createInfo, nullptr, &module) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create shader module " + path);
+        }
+        return module;
+    }
+
+
+private:
+    struct Variant {
+        VkPipeline pipeline = VK_NULL_HANDLE;   //VK_NULL_HANDLE while compiling
+    };
+
+    struct Program {
+        std::vector<ShaderStageDesc> stages;
+        PipelineBuilder builder;
+        VkPipeline fallback = VK_NULL_HANDLE;
+        std::unordered_map<uint32_t, Variant> variants;
+        JobHandle compiling;
+    };
+
+    struct SpecializationData {
+        VkBool32 dynamic;
+        uint32_t features;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    JobSystem* jobs = nullptr;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Program>> programs;
+
+
+    VkPipeline compile(const Program& program, uint32_t features, bool dynamic){
+        SpecializationData data{dynamic ? VK_TRUE : VK_FALSE, features};
+
+        VkSpecializationMapEntry entries[2];
+        entries[0] = {VARIANT_CONSTANT_DYNAMIC, offsetof(SpecializationData, dynamic), sizeof(VkBool32)};
+        entries[1] = {VARIANT_CONSTANT_FEATURES, offsetof(SpecializationData, features), sizeof(uint32_t)};
+
+        VkSpecializationInfo specialization{};
+        specialization.mapEntryCount = 2;
+        specialization.pMapEntries = entries;
+        specialization.dataSize = sizeof(data);
+        specialization.pData = &data;
+
+        std::vector<VkPipelineShaderStageCreateInfo> stages;
+        for(const ShaderStageDesc& desc : program.stages){
+            VkPipelineShaderStageCreateInfo stage{};
+            stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stage.stage = desc.stage;
+            stage.module = desc.module;
+            stage.pName = desc.entryPoint;
+            stage.pSpecializationInfo = &specialization;
+            stages.push_back(stage);
+        }
+
+        return program.builder(pipelineCache, stages.data(), static_cast<uint32_t>(stages.size()));
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+/*
+Frame sharing with other local processes:
+    Rendered frames are written into a named POSIX shared memory object that compositor and streaming processes map
+    themselves, so a frame reaches them without being pushed through a pipe.
+
+    1) Layout: a SharedFrameHeader, then slotCount pixel slots. Header size and slot size are rounded up to the
+       alignment passed to create(), so every slot can be imported as Vulkan host memory (see FrameExport.h)
+    2) Slots are a ring. Frame n (counting from 1) goes into slot (n - 1) % slotCount; while it is written the slot's
+       sequence is 2n - 1, once it is complete it becomes 2n and header.latest becomes n
+    3) Readers never take a lock and the writer never waits for them. A reader checks the slot sequence before and
+       after using the pixels (a seqlock); if it changed, the writer lapped the reader and the frame is dropped.
+       More slots give slow readers more time: a slot is only reused slotCount - 1 frames later
+    4) SharedFrameWriter lives in the renderer, SharedFrameReader is all a consumer needs
+
+    Writer calls come from one thread. Pixels are tightly packed rows of stride bytes in the header's VkFormat.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+
+const uint32_t SHARED_FRAMES_MAGIC = 0x58464B56;   //"VKFX"
+const uint32_t SHARED_FRAMES_VERSION = 1;
+const uint32_t SHARED_FRAMES_MAX_SLOTS = 8;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared frame sequences must be lock free to work across processes");
+
+
+struct alignas(64) SharedFrameSlot {
+    std::atomic<uint64_t> sequence{0};  //2n - 1 while frame n is written, 2n once it is complete
+    uint64_t frameNumber = 0;           //Renderer's frame number
+    uint64_t timestampNs = 0;           //steady_clock (CLOCK_MONOTONIC) when the frame completed
+};
+
+
+struct SharedFrameHeader {
+    uint32_t magic = SHARED_FRAMES_MAGIC;
+    uint32_t version = SHARED_FRAMES_VERSION;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;                //Bytes per row
+    uint32_t format = 0;                //VkFormat of the pixels
+    uint32_t slotCount = 0;
+    uint32_t reserved = 0;
+    uint64_t slotSize = 0;              //Bytes between slots
+    uint64_t slotsOffset = 0;           //Offset of slot 0 from the start of the object
+
+    alignas(64) std::atomic<uint64_t> latest{0};   //Newest complete frame, 0 before the first one
+    SharedFrameSlot slots[SHARED_FRAMES_MAX_SLOTS];
+};
+
+
+class SharedFrameWriter {
+
+public:
+    //name is a shm_open() name ("/something"); alignment 0 means page alignment
+    bool create(const std::string& name, uint32_t width, uint32_t height, uint32_t stride, uint32_t format, uint32_t slotCount, size_t alignment = 0){
+        if(slotCount < 2 || slotCount > SHARED_FRAMES_MAX_SLOTS) return false;
+
+        size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        alignment = std::max(alignment, pageSize);
+        size_t headerSize = alignTo(sizeof(SharedFrameHeader), alignment);
+        size_t slotSize = alignTo(static_cast<size_t>(stride) * height, alignment);
+        size = headerSize + slotSize * slotCount;
+
+        shm_unlink(name.c_str());       //Left behind by a run that crashed; readers still holding it keep their copy
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if(fd < 0) return false;
+        this->name = name;
+
+        if(ftruncate(fd, static_cast<off_t>(size)) != 0){
+            destroy();
+            return false;
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(mapping == MAP_FAILED){
+            destroy();
+            return false;
+        }
+        base = static_cast<uint8_t*>(mapping);
+
+        header = new(base) SharedFrameHeader();
+        header->width = width;
+        header->height = height;
+        header->stride = stride;
+        header->format = format;
+        header->slotCount = slotCount;
+        header->slotSize = slotSize;
+        header->slotsOffset = headerSize;
+        slotSequences.assign(slotCount, 0);
+        written = 0;
+        return true;
+    }
+
+
+    void destroy(){     //Readers that already mapped the object keep it until they unmap
+        if(base != nullptr){
+            munmap(base, size);
+        }
+        if(fd >= 0){
+            close(fd);
+            shm_unlink(name.c_str());
+        }
+        base = nullptr;
+        header = nullptr;
+        fd = -1;
+    }
+
+
+    bool isOpen() const { return header != nullptr; }
+
+
+    uint32_t beginFrame(){      //Returns the slot to write; it must not be written after endFrame()
+        uint64_t sequence = ++written;
+        uint32_t slot = static_cast<uint32_t>((sequence - 1) % header->slotCount);
+        slotSequences[slot] = sequence;
+        header->slots[slot].sequence.store(sequence * 2 - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);    //Readers see the odd sequence before any new pixel
+        return slot;
+    }
+
+
+    void endFrame(uint32_t slot, uint64_t frameNumber){
+        SharedFrameSlot& shared = header->slots[slot];
+        shared.frameNumber = frameNumber;
+        shared.timestampNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        shared.sequence.store(slotSequences[slot] * 2, std::memory_order_release);
+        header->latest.store(slotSequences[slot], std::memory_order_release);
+    }
+
+
+    uint8_t* slotData(uint32_t slot){ return base + header->slotsOffset + header->slotSize * slot; }
+
+    uint8_t* slotsBegin(){ return base + header->slotsOffset; }     //All slots, one contiguous aligned range
+
+    size_t getSlotsSize() const { return header->slotSize * header->slotCount; }
+
+    const SharedFrameHeader& getHeader() const { return *header; }
+
+
+private:
+    std::string name;
+    int fd = -1;
+    uint8_t* base = nullptr;
+    size_t size = 0;
+    SharedFrameHeader* header = nullptr;
+    std::vector<uint64_t> slotSequences;    //Frame sequence each slot was last begun with
+    uint64_t written = 0;
+
+
+    static size_t alignTo(size_t value, size_t alignment){ return (value + alignment - 1) / alignment * alignment; }
+};
+
+
+class SharedFrameReader {
+
+public:
+    bool open(const std::string& name){
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0) return false;
+
+        struct stat status;
+        if(fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(SharedFrameHeader)){
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(status.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);    //The mapping keeps the object alive
+        if(mapping == MAP_FAILED) return false;
+        base = static_cast<const uint8_t*>(mapping);
+        header = reinterpret_cast<const SharedFrameHeader*>(base);
+
+        if(header->magic != SHARED_FRAMES_MAGIC || header->version != SHARED_FRAMES_VERSION ||
+           header->slotCount < 2 || header->slotCount > SHARED_FRAMES_MAX_SLOTS ||
+           header->slotsOffset + header->slotSize * header->slotCount > size)
+        {
+            close();
+            return false;
+        }
+        lastSequence = 0;
+        return true;
+    }
+
+
+    void close(){
+        if(base != nullptr){
+            munmap(const_cast<uint8_t*>(base), size);
+        }
+        base = nullptr;
+        header = nullptr;
+    }
+
+
+    //Newest complete frame not returned before, or nullptr. The pixels stay valid until endRead() says otherwise
+    const uint8_t* beginRead(uint64_t& sequence, uint64_t* frameNumber = nullptr){
+        sequence = header->latest.load(std::memory_order_acquire);
+        if(sequence == 0 || sequence == lastSequence) return nullptr;
+
+        const SharedFrameSlot& slot = header->slots[(sequence - 1) % header->slotCount];
+        if(slot.sequence.load(std::memory_order_acquire) != sequence * 2) return nullptr;     //Already being overwritten
+        if(frameNumber != nullptr) *frameNumber = slot.frameNumber;
+        lastSequence = sequence;
+        return base + header->slotsOffset + header->slotSize * ((sequence - 1) % header->slotCount);
+    }
+
+
+    bool endRead(uint64_t sequence) const {     //false if the writer reused the slot meanwhile; what was read may be torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const SharedFrameSlot& slot = header->slots[(sequence - 1) % header->slotCount];
+        return slot.sequence.load(std::memory_order_relaxed) == sequence * 2;
+    }
+
+
+    bool isOpen() const { return header != nullptr; }
+
+    const SharedFrameHeader& getHeader() const { return *header; }
+
+
+private:
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    const SharedFrameHeader* header = nullptr;
+    uint64_t lastSequence = 0;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+Fixed-step simulation clock:
+    advance() is called once per simulation loop iteration and returns how many fixed steps of getStep() seconds
+    are due. Simulation runs exactly that many updates, however fast frames are presented (MAILBOX) or however
+    slowly (FIFO, hitches), so its cost depends on elapsed time and not on the frame rate.
+
+    getAlpha() is how far real time has moved past the last completed step, as a fraction of a step. Rendering blends
+    the state before and after that step with it, so motion stays smooth when frames fall between steps.
+
+    After a long stall at most maxSteps steps are run and the rest of the backlog is dropped. Otherwise a slow
+    simulation would fall further behind on every frame.
+*/
+
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+
+class SimulationClock {
+
+public:
+    void start(double stepSeconds, uint32_t maxSteps = 5){
+        step = stepSeconds;
+        this->maxSteps = maxSteps;
+        accumulator = 0.0;
+        ticks = 0;
+        last = std::chrono::steady_clock::now();
+    }
+
+
+    uint32_t advance(){
+        auto now = std::chrono::steady_clock::now();
+        accumulator += std::chrono::duration<double>(now - last).count();
+        last = now;
+
+        uint32_t due = static_cast<uint32_t>(accumulator / step);
+        if(due > maxSteps){
+            accumulator -= (due - maxSteps) * step;     //Drop the backlog instead of trying to catch up
+            due = maxSteps;
+        }
+
+        accumulator -= due * step;
+        ticks += due;
+        return due;
+    }
+
+
+    double getStep() const { return step; }
+
+    uint64_t getTicks() const { return ticks; }
+
+    double getTime() const { return ticks * step; }     //Simulation time of the last completed step
+
+    float getAlpha() const { return static_cast<float>(std::clamp(accumulator / step, 0.0, 1.0)); }
+
+    double getInterpolatedTime() const { return (ticks + getAlpha()) * step; }
+
+
+private:
+    double step = 1.0 / 60.0;
+    uint32_t maxSteps = 5;
+    double accumulator = 0.0;
+    uint64_t ticks = 0;
+    std::chrono::steady_clock::time_point last;
+};
@@ -0,0 +1,433 @@
+#pragma once
+
+/*
+CPU fallback renderer for machines without a usable Vulkan device:
+    Consumes the same FramePackets as the Vulkan path and draws them into a SoftwareFramebuffer, which main.cpp puts on
+    screen through the window's GL context or writes out as PPM when there is no window.
+
+    1) Geometry: draws are split over the job system. Each draw's triangles are transformed to clip space, clipped
+       against the near plane, projected and given a flat lambert color from their world space face normal
+    2) Binning: triangles are appended, in draw order, to every SOFTWARE_TILE_SIZE square tile their bounds touch
+    3) Raster: tiles are independent, so each is cleared and rasterized by one job without locks. Inside a tile edge
+       functions and depth are evaluated 4 pixels at a time with SSE2 (scalar where SSE2 is missing), with a less-than
+       depth test in [0, 1] like the Vulkan pipeline. Each pixel also keeps the object id of the draw that won the
+       depth test, for picking
+
+    Meshes are registered here instead of in GpuScene; addMesh/addMaterial return the ids the draw packets carry. Only
+    the vertex position (first three floats of a vertex) is read. Triangles are not backface culled.
+*/
+
+#include "HandlePool.h"
+#include "FramePacket.h"
+#include "JobSystem.h"
+#include "MathUtil.h"
+#include "Vertex.h"
+#include "Profiler.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SOFTWARE_RASTERIZER_SSE2 1
+#endif
+
+
+const uint32_t SOFTWARE_TILE_SIZE = 64;             //Multiple of 4, the SIMD width
+const uint32_t SOFTWARE_GEOMETRY_BATCH = 16;        //Draws per geometry job
+
+
+struct SoftwareFramebuffer {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;            //Pixels per row, a multiple of 4 so SIMD rows never run past the end
+    std::vector<uint32_t> color;    //RGBA8 in memory order, top row first
+    std::vector<float> depth;
+    std::vector<uint32_t> ids;      //Object id of the nearest draw per pixel, PICK_NONE where nothing was drawn
+};
+
+
+class SoftwareRasterizer {
+
+public:
+    void init(uint32_t width, uint32_t height){
+        framebuffer.width = width;
+        framebuffer.height = height;
+        framebuffer.stride = (width + 3) & ~3u;
+        framebuffer.color.assign(static_cast<size_t>(framebuffer.stride) * height, 0);
+        framebuffer.depth.assign(static_cast<size_t>(framebuffer.stride) * height, 1.0f);
+        framebuffer.ids.assign(static_cast<size_t>(framebuffer.stride) * height, PICK_NONE);
+
+        tilesX = (width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+        tilesY = (height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+        bins.assign(tilesX * tilesY, {});
+    }
+
+
+    MeshHandle addMesh(const void* vertices, uint32_t vertexCount, uint32_t vertexStride, const uint32_t* indices, uint32_t indexCount){
+        Mesh mesh;
+        mesh.positions.resize(vertexCount);
+        for(uint32_t i = 0; i < vertexCount; i++){
+            float position[3];
+            memcpy(position, static_cast<const char*>(vertices) + static_cast<size_t>(i) * vertexStride, sizeof(position));
+            mesh.positions[i] = Vec3(position[0], position[1], position[2]);
+        }
+        mesh.indices.assign(indices, indices + indexCount);
+        return meshes.add(std::move(mesh));
+    }
+
+
+    template<typename VertexType>
+    MeshHandle addMesh(const VertexType* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount){
+        static_assert(vertexLayoutIsPacked<VertexType>(), "Mesh vertices need a packed VERTEX_LAYOUT");
+        return addMesh(vertices, vertexCount, sizeof(VertexType), indices, indexCount);
+    }
+
+
+    void removeMesh(MeshHandle mesh){ meshes.remove(mesh); }
+
+
+    uint32_t addMaterial(const float baseColor[4]){
+        materials.push_back({baseColor[0], baseColor[1], baseColor[2], baseColor[3]});
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+
+    void render(const FramePacket& packet, JobSystem& jobs){
+        PROFILE_ZONE("SoftwareRasterizer::render");
+        mat4Multiply(packet.camera.projection, packet.camera.view, viewProjection);
+        clearColor = packColor(packet.clearColor[0], packet.clearColor[1], packet.clearColor[2], packet.clearColor[3]);
+
+        uint32_t drawCount = static_cast<uint32_t>(packet.draws.size());
+        if(drawTriangles.size() < drawCount){
+            drawTriangles.resize(drawCount);
+        }
+        {
+            PROFILE_ZONE("Geometry");
+            const DrawItem* draws = packet.draws.data();
+            jobs.wait(jobs.parallelFor(drawCount, SOFTWARE_GEOMETRY_BATCH, [this, draws](uint32_t begin, uint32_t end){
+                for(uint32_t i = begin; i < end; i++){
+                    processDraw(draws[i], drawTriangles[i]);
+                }
+            }));
+        }
+
+        {
+            PROFILE_ZONE("Binning");
+            for(std::vector<const Triangle*>& bin : bins){
+                bin.clear();
+            }
+            for(uint32_t i = 0; i < drawCount; i++){
+                for(const Triangle& triangle : drawTriangles[i]){
+                    binTriangle(triangle);
+                }
+            }
+        }
+
+        {
+            PROFILE_ZONE("Raster");
+            jobs.wait(jobs.parallelFor(tilesX * tilesY, 1, [this](uint32_t begin, uint32_t end){
+                for(uint32_t tile = begin; tile < end; tile++){
+                    rasterizeTile(tile);
+                }
+            }));
+        }
+    }
+
+
+    const SoftwareFramebuffer& getFramebuffer() const { return framebuffer; }
+
+
+    bool writePpm(const std::string& path) const {  //Binary P6, alpha dropped
+        std::ofstream file(path, std::ios::binary);
+        if(!file.is_open()) return false;
+
+        file << "P6\n" << framebuffer.width << " " << framebuffer.height << "\n255\n";
+        std::vector<uint8_t> row(framebuffer.width * 3);
+        for(uint32_t y = 0; y < framebuffer.height; y++){
+            const uint8_t* pixels = reinterpret_cast<const uint8_t*>(framebuffer.color.data() + static_cast<size_t>(y) * framebuffer.stride);
+            for(uint32_t x = 0; x < framebuffer.width; x++){
+                row[x * 3 + 0] = pixels[x * 4 + 0];
+                row[x * 3 + 1] = pixels[x * 4 + 1];
+                row[x * 3 + 2] = pixels[x * 4 + 2];
+            }
+            file.write(reinterpret_cast<const char*>(row.data()), row.size());
+        }
+        return static_cast<bool>(file);
+    }
+
+
+private:
+    struct Mesh {
+        std::vector<Vec3> positions;
+        std::vector<uint32_t> indices;
+    };
+
+    struct Material {
+        float baseColor[4];
+    };
+
+    struct ClipVertex {
+        float x, y, z, w;
+    };
+
+    struct Triangle {       //Screen space, counter-clockwise (positive area)
+        float edgeA[3], edgeB[3], edgeC[3];     //Edge functions A*x + B*y + C, >= 0 inside
+        float depthA, depthB, depthC;           //Depth plane
+        int32_t minX, minY, maxX, maxY;         //Inclusive pixel bounds, clamped to the framebuffer
+        uint32_t color;
+        uint32_t id;            //DrawItem::object
+    };
+
+    SoftwareFramebuffer framebuffer;
+    uint32_t tilesX = 0;
+    uint32_t tilesY = 0;
+
+    HandlePool<MeshTag, Mesh> meshes;
+    std::vector<Material> materials;
+
+    float viewProjection[16];
+    uint32_t clearColor = 0;
+    std::vector<std::vector<Triangle>> drawTriangles;   //Per draw, capacity kept across frames
+    std::vector<std::vector<const Triangle*>> bins;     //Per tile, in draw order
+
+
+    static uint32_t packColor(float r, float g, float b, float a){
+        uint8_t channels[4] = {packUnorm8(r), packUnorm8(g), packUnorm8(b), packUnorm8(a)};
+        uint32_t packed;
+        memcpy(&packed, channels, sizeof(packed));  //Memory order RGBA regardless of endianness
+        return packed;
+    }
+
+
+    void processDraw(const DrawItem& draw, std::vector<Triangle>& triangles){   //Geometry job
+        triangles.clear();
+        const Mesh* mesh = meshes.get(draw.mesh);
+        if(mesh == nullptr) return;
+
+        float mvp[16];
+        mat4Multiply(viewProjection, draw.transform, mvp);
+        Material material = draw.material < materials.size() ? materials[draw.material] : Material{{1.0f, 1.0f, 1.0f, 1.0f}};
+        const Vec3 light = normalize(Vec3(0.4f, 1.0f, 0.3f));
+
+        for(size_t i = 0; i + 2 < mesh->indices.size(); i += 3){
+            Vec3 positions[3];
+            ClipVertex clip[3];
+            for(int v = 0; v < 3; v++){
+                positions[v] = mesh->positions[mesh->indices[i + v]];
+                clip[v] = toClip(mvp, positions[v]);
+            }
+            if(outsideFrustum(clip)) continue;
+
+            Vec3 normal = cross(mat4TransformPoint(draw.transform, positions[1]) - mat4TransformPoint(draw.transform, positions[0]),
+                                mat4TransformPoint(draw.transform, positions[2]) - mat4TransformPoint(draw.transform, positions[0]));
+            float normalLength = length(normal);
+            float shade = 0.2f + 0.8f * (normalLength > 0.0f ? std::fabs(dot(normal, light)) / normalLength : 0.0f);    //Two sided
+            uint32_t color = packColor(material.baseColor[0] * shade, material.baseColor[1] * shade, material.baseColor[2] * shade, material.baseColor[3]);
+
+            ClipVertex polygon[4];
+            uint32_t count = clipNear(clip, polygon);
+            for(uint32_t v = 1; v + 1 < count; v++){    //Fan, at most two triangles
+                setupTriangle(polygon[0], polygon[v], polygon[v + 1], color, draw.object, triangles);
+            }
+        }
+    }
+
+
+    static ClipVertex toClip(const float m[16], const Vec3& p){
+        return {m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12],
+                m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+                m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14],
+                m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15]};
+    }
+
+
+    static bool outsideFrustum(const ClipVertex clip[3]){   //All three vertices beyond the same plane
+        auto all = [clip](auto outside){ return outside(clip[0]) && outside(clip[1]) && outside(clip[2]); };
+        return all([](const ClipVertex& v){ return v.x < -v.w; }) || all([](const ClipVertex& v){ return v.x > v.w; })
+            || all([](const ClipVertex& v){ return v.y < -v.w; }) || all([](const ClipVertex& v){ return v.y > v.w; })
+            || all([](const ClipVertex& v){ return v.z < 0.0f; }) || all([](const ClipVertex& v){ return v.z > v.w; });
+    }
+
+
+    static uint32_t clipNear(const ClipVertex in[3], ClipVertex out[4]){     //Against z >= 0, the Vulkan near plane
+        uint32_t count = 0;
+        for(int i = 0; i < 3; i++){
+            const ClipVertex& a = in[i];
+            const ClipVertex& b = in[(i + 1) % 3];
+            bool aInside = a.z >= 0.0f;
+            bool bInside = b.z >= 0.0f;
+            if(aInside){
+                out[count++] = a;
+            }
+            if(aInside != bInside){
+                float t = a.z / (a.z - b.z);
+                out[count++] = {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, 0.0f, a.w + (b.w - a.w) * t};
+            }
+        }
+        return count;
+    }
+
+
+    void setupTriangle(const ClipVertex& c0, const ClipVertex& c1, const ClipVertex& c2, uint32_t color, uint32_t id, std::vector<Triangle>& triangles){
+        float sx[3], sy[3], sz[3];
+        const ClipVertex* clip[3] = {&c0, &c1, &c2};
+        for(int v = 0; v < 3; v++){
+            if(clip[v]->w <= 0.0f) return;      //Only after near clipping when the camera sits on the plane
+            float inverseW = 1.0f / clip[v]->w;
+            sx[v] = (clip[v]->x * inverseW * 0.5f + 0.5f) * framebuffer.width;
+            sy[v] = (clip[v]->y * inverseW * 0.5f + 0.5f) * framebuffer.height;
+            sz[v] = clip[v]->z * inverseW;
+        }
+
+        float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+        if(std::fabs(area) < 1e-8f) return;
+        if(area < 0.0f){                        //Make the winding positive so inside is >= 0 for every edge
+            std::swap(sx[1], sx[2]);
+            std::swap(sy[1], sy[2]);
+            std::swap(sz[1], sz[2]);
+            area = -area;
+        }
+
+        Triangle triangle;
+        for(int e = 0; e < 3; e++){             //Edge e is opposite vertex e
+            int a = (e + 1) % 3;
+            int b = (e + 2) % 3;
+            triangle.edgeA[e] = sy[a] - sy[b];
+            triangle.edgeB[e] = sx[b] - sx[a];
+            triangle.edgeC[e] = sx[a] * sy[b] - sy[a] * sx[b];
+        }
+        float inverseArea = 1.0f / area;
+        triangle.depthA = (triangle.edgeA[0] * sz[0] + triangle.edgeA[1] * sz[1] + triangle.edgeA[2] * sz[2]) * inverseArea;
+        triangle.depthB = (triangle.edgeB[0] * sz[0] + triangle.edgeB[1] * sz[1] + triangle.edgeB[2] * sz[2]) * inverseArea;
+        triangle.depthC = (triangle.edgeC[0] * sz[0] + triangle.edgeC[1] * sz[1] + triangle.edgeC[2] * sz[2]) * inverseArea;
+
+        float minX = std::min({sx[0], sx[1], sx[2]});
+        float maxX = std::max({sx[0], sx[1], sx[2]});
+        float minY = std::min({sy[0], sy[1], sy[2]});
+        float maxY = std::max({sy[0], sy[1], sy[2]});
+        triangle.minX = std::max(0, static_cast<int32_t>(std::floor(minX)));
+        triangle.minY = std::max(0, static_cast<int32_t>(std::floor(minY)));
+        triangle.maxX = std::min(static_cast<int32_t>(framebuffer.width) - 1, static_cast<int32_t>(std::ceil(maxX)));
+        triangle.maxY = std::min(static_cast<int32_t>(framebuffer.height) - 1, static_cast<int32_t>(std::ceil(maxY)));
+        if(triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) return;
+
+        triangle.color = color;
+        triangle.id = id;
+        triangles.push_back(triangle);
+    }
+
+
+    void binTriangle(const Triangle& triangle){
+        uint32_t firstX = triangle.minX / SOFTWARE_TILE_SIZE;
+        uint32_t lastX = triangle.maxX / SOFTWARE_TILE_SIZE;
+        uint32_t firstY = triangle.minY / SOFTWARE_TILE_SIZE;
+        uint32_t lastY = triangle.maxY / SOFTWARE_TILE_SIZE;
+        for(uint32_t y = firstY; y <= lastY; y++){
+            for(uint32_t x = firstX; x <= lastX; x++){
+                bins[y * tilesX + x].push_back(&triangle);
+            }
+        }
+    }
+
+
+    void rasterizeTile(uint32_t tile){     //Raster job; touches only this tile's pixels
+        int32_t tileX = static_cast<int32_t>((tile % tilesX) * SOFTWARE_TILE_SIZE);
+        int32_t tileY = static_cast<int32_t>((tile / tilesX) * SOFTWARE_TILE_SIZE);
+        int32_t tileMaxX = std::min(tileX + static_cast<int32_t>(SOFTWARE_TILE_SIZE), static_cast<int32_t>(framebuffer.width)) - 1;
+        int32_t tileMaxY = std::min(tileY + static_cast<int32_t>(SOFTWARE_TILE_SIZE), static_cast<int32_t>(framebuffer.height)) - 1;
+
+        for(int32_t y = tileY; y <= tileMaxY; y++){
+            size_t row = static_cast<size_t>(y) * framebuffer.stride;
+            std::fill(framebuffer.color.begin() + row + tileX, framebuffer.color.begin() + row + tileMaxX + 1, clearColor);
+            std::fill(framebuffer.depth.begin() + row + tileX, framebuffer.depth.begin() + row + tileMaxX + 1, 1.0f);
+            std::fill(framebuffer.ids.begin() + row + tileX, framebuffer.ids.begin() + row + tileMaxX + 1, PICK_NONE);
+        }
+
+        for(const Triangle* triangle : bins[tile]){
+            int32_t minX = std::max(triangle->minX, tileX) & ~3;    //Aligned to the SIMD width; tiles start aligned
+            int32_t maxX = std::min(triangle->maxX, tileMaxX);
+            int32_t minY = std::max(triangle->minY, tileY);
+            int32_t maxY = std::min(triangle->maxY, tileMaxY);
+            int32_t firstX = std::max(triangle->minX, tileX);
+            for(int32_t y = minY; y <= maxY; y++){
+                rasterizeRow(*triangle, y, minX, firstX, maxX);
+            }
+        }
+    }
+
+
+#if defined(SOFTWARE_RASTERIZER_SSE2)
+    void rasterizeRow(const Triangle& t, int32_t y, int32_t alignedX, int32_t firstX, int32_t lastX){
+        size_t row = static_cast<size_t>(y) * framebuffer.stride;
+        float* depthRow = framebuffer.depth.data() + row;
+        uint32_t* colorRow = framebuffer.color.data() + row;
+        uint32_t* idRow = framebuffer.ids.data() + row;
+
+        float py = y + 0.5f;
+        __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        __m128 rowEdge0 = _mm_set1_ps(t.edgeB[0] * py + t.edgeC[0]);
+        __m128 rowEdge1 = _mm_set1_ps(t.edgeB[1] * py + t.edgeC[1]);
+        __m128 rowEdge2 = _mm_set1_ps(t.edgeB[2] * py + t.edgeC[2]);
+        __m128 rowDepth = _mm_set1_ps(t.depthB * py + t.depthC);
+        __m128 edgeA0 = _mm_set1_ps(t.edgeA[0]);
+        __m128 edgeA1 = _mm_set1_ps(t.edgeA[1]);
+        __m128 edgeA2 = _mm_set1_ps(t.edgeA[2]);
+        __m128 depthA = _mm_set1_ps(t.depthA);
+        __m128 zero = _mm_setzero_ps();
+        __m128i color = _mm_set1_epi32(static_cast<int32_t>(t.color));
+        __m128i id = _mm_set1_epi32(static_cast<int32_t>(t.id));
+        __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+        __m128i first = _mm_set1_epi32(firstX - 1);
+        __m128i last = _mm_set1_epi32(lastX + 1);
+
+        for(int32_t x = alignedX; x <= lastX; x += 4){
+            __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(edgeA0, px), rowEdge0);
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(edgeA1, px), rowEdge1);
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(edgeA2, px), rowEdge2);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+
+            __m128i pixel = _mm_add_epi32(_mm_set1_epi32(x), lanes);    //Lanes outside this triangle's span in the tile
+            __m128i span = _mm_and_si128(_mm_cmpgt_epi32(pixel, first), _mm_cmplt_epi32(pixel, last));
+            inside = _mm_and_ps(inside, _mm_castsi128_ps(span));
+            if(_mm_movemask_ps(inside) == 0) continue;
+
+            __m128 depth = _mm_add_ps(_mm_mul_ps(depthA, px), rowDepth);
+            __m128 stored = _mm_loadu_ps(depthRow + x);
+            __m128 pass = _mm_and_ps(inside, _mm_and_ps(_mm_cmplt_ps(depth, stored), _mm_cmpge_ps(depth, zero)));
+            if(_mm_movemask_ps(pass) == 0) continue;
+
+            _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, stored)));
+            __m128i mask = _mm_castps_si128(pass);
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colorRow + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(colorRow + x), _mm_or_si128(_mm_and_si128(mask, color), _mm_andnot_si128(mask, pixels)));
+            __m128i ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(idRow + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(idRow + x), _mm_or_si128(_mm_and_si128(mask, id), _mm_andnot_si128(mask, ids)));
+        }
+    }
+#else
+    void rasterizeRow(const Triangle& t, int32_t y, int32_t alignedX, int32_t firstX, int32_t lastX){
+        size_t row = static_cast<size_t>(y) * framebuffer.stride;
+        float py = y + 0.5f;
+        for(int32_t x = firstX; x <= lastX; x++){
+            float px = x + 0.5f;
+            if(t.edgeA[0] * px + t.edgeB[0] * py + t.edgeC[0] < 0.0f) continue;
+            if(t.edgeA[1] * px + t.edgeB[1] * py + t.edgeC[1] < 0.0f) continue;
+            if(t.edgeA[2] * px + t.edgeB[2] * py + t.edgeC[2] < 0.0f) continue;
+
+            float depth = t.depthA * px + t.depthB * py + t.depthC;
+            float& stored = framebuffer.depth[row + x];
+            if(depth < 0.0f || depth >= stored) continue;
+            stored = depth;
+            framebuffer.color[row + x] = t.color;
+            framebuffer.ids[row + x] = t.id;
+        }
+    }
+#endif
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+Bounded lock-free queue for exactly one producer thread and one consumer thread:
+    The producer only writes tail and the consumer only writes head, each published with release ordering.
+    Capacity must be a power of two; indices run freely and are masked on access.
+    head and tail sit on separate cache lines so the two threads don't fight over one line.
+*/
+
+#include <atomic>
+#include <utility>
+#include <cstddef>
+
+
+template<typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    bool tryPush(T value){     //Producer thread only
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if(tail - head.load(std::memory_order_acquire) == Capacity) return false;
+
+        slots[tail & (Capacity - 1)] = std::move(value);
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+
+    bool tryPop(T& value){     //Consumer thread only
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if(head == tail.load(std::memory_order_acquire)) return false;
+
+        value = std::move(slots[head & (Capacity - 1)]);
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+
+    size_t size() const {      //Approximate when called while the other side is active
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+
+private:
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) T slots[Capacity];
+};
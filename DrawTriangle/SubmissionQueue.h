@@ -0,0 +1,304 @@
+#pragma once
+
+/*
+Batched queue submission:
+    vkQueueSubmit is a kernel transition on most drivers, and VkQueue access must be externally synchronized. Producers
+    (frame recording, defragmenter copies, uploads) therefore do not submit themselves:
+
+    1) enqueue() adds a Submission (command buffers plus the semaphores it waits on and signals) to the queue's pending
+       list and returns the ticket of the flush that will carry it. Any thread may enqueue
+    2) flush() hands everything pending to a single vkQueueSubmit, in enqueue order. Consecutive submissions are merged
+       into one VkSubmitInfo unless a semaphore wait or signal would be reordered
+    3) Every flush signals a fence from a small pool; isComplete()/wait() turn tickets back into GPU completion, so
+       producers no longer own fences
+    4) Each VkQueue has its own lock, also taken by present() and bindSparse(), so threads sharing a queue are safe
+    5) A vkQueueSubmit that fails throws, and the ticket it would have completed is marked failed: isComplete() and
+       wait() throw for it instead of reporting the dropped work as done once a later flush completes
+
+    Work on different queues is ordered by the semaphores in the submissions; a flush never waits for another queue.
+*/
+
+#include "Profiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <deque>
+#include <memory_resource>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+
+
+typedef uint64_t SubmitTicket;      //0 is always complete
+
+
+struct Submission {     //Lists may live in a frame arena (FrameArena.h); they must then outlive the flush
+    std::pmr::vector<VkCommandBuffer> commandBuffers;
+    std::pmr::vector<VkSemaphore> waitSemaphores;
+    std::pmr::vector<VkPipelineStageFlags> waitStages;     //One per wait semaphore
+    std::pmr::vector<VkSemaphore> signalSemaphores;
+
+    explicit Submission(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : commandBuffers(resource), waitSemaphores(resource), waitStages(resource), signalSemaphores(resource) {}
+
+    explicit Submission(VkCommandBuffer commandBuffer, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : Submission(resource)
+    {
+        commandBuffers.push_back(commandBuffer);
+    }
+};
+
+
+class SubmissionQueue {
+
+public:
+    void init(VkDevice device){
+        this->device = device;
+    }
+
+
+    void destroy(){     //Device must be idle
+        for(auto& queue : queues){
+            for(const InFlight& flight : queue->inFlight){
+                vkDestroyFence(device, flight.fence, nullptr);
+            }
+            for(VkFence fence : queue->freeFences){
+                vkDestroyFence(device, fence, nullptr);
+            }
+            for(VkFence fence : queue->retiredFences){
+                vkDestroyFence(device, fence, nullptr);
+            }
+        }
+        queues.clear();
+    }
+
+
+    void addQueue(VkQueue queue){   //During init, before any thread submits; the same VkQueue may be added twice
+        if(find(queue) != nullptr) return;
+        queues.push_back(std::make_unique<QueueState>());
+        queues.back()->queue = queue;
+    }
+
+
+    SubmitTicket enqueue(VkQueue queue, Submission submission){
+        QueueState& state = get(queue);
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.pending.push_back(std::move(submission));
+        return state.nextTicket;
+    }
+
+
+    SubmitTicket flush(VkQueue queue){  //Returns the ticket of this flush, or of the last one if nothing was pending
+        QueueState& state = get(queue);
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if(state.pending.empty()) return state.nextTicket - 1;
+
+        size_t total = 0;
+        for(const Submission& submission : state.pending){
+            total += submission.commandBuffers.size();
+        }
+        std::byte scratch[2048];            //The usual flush builds its lists without touching the heap
+        std::pmr::monotonic_buffer_resource local(scratch, sizeof(scratch));
+        std::pmr::vector<VkCommandBuffer> commandBuffers(&local);
+        commandBuffers.reserve(total);      //No reallocation, the submit infos point into it
+        std::pmr::vector<VkSubmitInfo> infos(&local);
+        infos.reserve(state.pending.size());
+        batch(state.pending.data(), state.pending.size(), commandBuffers, infos);
+
+        VkFence fence = takeFence(state);
+        SubmitTicket ticket = state.nextTicket++;   //Never reused, even when the submit fails
+        {
+            PROFILE_ZONE("vkQueueSubmit");
+            if(vkQueueSubmit(state.queue, static_cast<uint32_t>(infos.size()), infos.data(), fence) != VK_SUCCESS){
+                state.freeFences.push_back(fence);
+                state.pending.clear();
+                state.failed.push_back(ticket);
+                throw std::runtime_error("Failed to submit to queue");
+            }
+        }
+        submitCount++;
+
+        state.inFlight.push_back({fence, ticket});
+        state.pending.clear();
+        return ticket;
+    }
+
+
+    SubmitTicket submit(VkQueue queue, Submission submission){     //enqueue + flush, for paths that need the work started now
+        enqueue(queue, std::move(submission));
+        return flush(queue);
+    }
+
+
+    bool isComplete(VkQueue queue, SubmitTicket ticket){    //Throws if the ticket's submit failed
+        QueueState& state = get(queue);
+        std::lock_guard<std::mutex> lock(state.mutex);
+        checkFailed(state, ticket);
+        retire(state);
+        return ticket <= state.completed;
+    }
+
+
+    void wait(VkQueue queue, SubmitTicket ticket){  //The ticket must have been flushed
+        QueueState& state = get(queue);
+        std::unique_lock<std::mutex> lock(state.mutex);
+        checkFailed(state, ticket);
+        retire(state);
+        if(ticket <= state.completed) return;
+        if(ticket >= state.nextTicket){
+            throw std::runtime_error("Waiting for a submission that was never flushed");
+        }
+
+        VkFence fence = VK_NULL_HANDLE;
+        for(const InFlight& flight : state.inFlight){
+            if(flight.ticket >= ticket){
+                fence = flight.fence;
+                break;
+            }
+        }
+
+        state.waiters++;        //Keeps retired fences out of the free list while we wait unlocked
+        lock.unlock();
+        {
+            PROFILE_ZONE("Wait for submission");
+            vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        }
+        lock.lock();
+        state.waiters--;
+        retire(state);
+    }
+
+
+    //vkQueuePresentKHR may block in the driver (FIFO with every image queued). Only callers of the same VkQueue wait
+    //behind it: with separate graphics and present queues flush() never does, but when one queue does both, Vulkan's
+    //external synchronization leaves no choice and the render thread's flush waits for the present to return
+    VkResult present(VkQueue queue, const VkPresentInfoKHR& presentInfo){
+        QueueState& state = get(queue);
+        std::lock_guard<std::mutex> lock(state.mutex);
+        PROFILE_ZONE("vkQueuePresentKHR");
+        return vkQueuePresentKHR(state.queue, &presentInfo);
+    }
+
+
+    VkResult bindSparse(VkQueue queue, uint32_t bindInfoCount, const VkBindSparseInfo* bindInfos, VkFence fence){
+        QueueState& state = get(queue);
+        std::lock_guard<std::mutex> lock(state.mutex);
+        PROFILE_ZONE("vkQueueBindSparse");
+        return vkQueueBindSparse(state.queue, bindInfoCount, bindInfos, fence);
+    }
+
+
+    uint64_t getSubmitCount() const { return submitCount; }
+
+
+    //Builds the VkSubmitInfos one flush hands to vkQueueSubmit. commandBuffers must have room for every command buffer
+    //of the submissions up front, the infos point into it
+    static void batch(const Submission* submissions, size_t count, std::pmr::vector<VkCommandBuffer>& commandBuffers,
+                      std::pmr::vector<VkSubmitInfo>& infos)
+    {
+        for(size_t i = 0; i < count; i++){
+            const Submission& submission = submissions[i];
+            //Waits happen before and signals after every command buffer of a VkSubmitInfo, so a submission may only
+            //join the previous one if it waits on nothing and the previous one signals nothing
+            bool merge = !infos.empty() && submission.waitSemaphores.empty() && infos.back().signalSemaphoreCount == 0;
+            if(!merge){
+                VkSubmitInfo info{};
+                info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                info.waitSemaphoreCount = static_cast<uint32_t>(submission.waitSemaphores.size());
+                info.pWaitSemaphores = submission.waitSemaphores.data();
+                info.pWaitDstStageMask = submission.waitStages.data();
+                info.pCommandBuffers = commandBuffers.data() + commandBuffers.size();
+                infos.push_back(info);
+            }
+            VkSubmitInfo& info = infos.back();
+            commandBuffers.insert(commandBuffers.end(), submission.commandBuffers.begin(), submission.commandBuffers.end());
+            info.commandBufferCount += static_cast<uint32_t>(submission.commandBuffers.size());
+            info.signalSemaphoreCount = static_cast<uint32_t>(submission.signalSemaphores.size());
+            info.pSignalSemaphores = submission.signalSemaphores.data();
+        }
+    }
+
+
+private:
+    struct InFlight {
+        VkFence fence;
+        SubmitTicket ticket;
+    };
+
+    struct QueueState {
+        VkQueue queue = VK_NULL_HANDLE;
+        std::mutex mutex;
+        std::vector<Submission> pending;
+        std::deque<InFlight> inFlight;          //Oldest first
+        std::vector<VkFence> freeFences;
+        std::vector<VkFence> retiredFences;     //Signalled, but a waiter may still hold the handle
+        std::vector<SubmitTicket> failed;       //Tickets whose vkQueueSubmit failed; their work never ran
+        SubmitTicket nextTicket = 1;
+        SubmitTicket completed = 0;
+        uint32_t waiters = 0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<std::unique_ptr<QueueState>> queues;    //Fixed after init, so lookups need no lock
+    std::atomic<uint64_t> submitCount{0};
+
+
+    QueueState* find(VkQueue queue){
+        for(auto& state : queues){
+            if(state->queue == queue) return state.get();
+        }
+        return nullptr;
+    }
+
+
+    QueueState& get(VkQueue queue){
+        QueueState* state = find(queue);
+        if(state == nullptr){
+            throw std::runtime_error("Queue was not added to the submission queue");
+        }
+        return *state;
+    }
+
+
+    static void checkFailed(const QueueState& state, SubmitTicket ticket){    //Called with the queue lock held
+        if(std::find(state.failed.begin(), state.failed.end(), ticket) != state.failed.end()){
+            throw std::runtime_error("Failed submission: ticket " + std::to_string(ticket) + " was never executed");
+        }
+    }
+
+
+    VkFence takeFence(QueueState& state){
+        if(!state.freeFences.empty()){
+            VkFence fence = state.freeFences.back();
+            state.freeFences.pop_back();
+            vkResetFences(device, 1, &fence);
+            return fence;
+        }
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        if(vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create submission fence");
+        }
+        return fence;
+    }
+
+
+    void retire(QueueState& state){     //Called with the queue lock held
+        while(!state.inFlight.empty() && vkGetFenceStatus(device, state.inFlight.front().fence) == VK_SUCCESS){
+            state.completed = state.inFlight.front().ticket;
+            state.retiredFences.push_back(state.inFlight.front().fence);
+            state.inFlight.pop_front();
+        }
+        if(state.waiters == 0){
+            state.freeFences.insert(state.freeFences.end(), state.retiredFences.begin(), state.retiredFences.end());
+            state.retiredFences.clear();
+        }
+    }
+};
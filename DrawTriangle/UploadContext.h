@@ -0,0 +1,298 @@
+#pragma once
+
+/*
+One-shot uploads and readbacks:
+    submit()/uploadBuffer() record into a single command buffer, submit through the SubmissionQueue and block on the
+    ticket; meant for load time work.
+
+    uploadBufferAsync()/readbackAsync() are coroutines (see Async.h): each records into its own transient command
+    buffer and co_awaits the ticket, so many can be in flight and no thread blocks while the GPU copies.
+
+    Uploads normally go through a host visible staging buffer. addHostSource() imports a long lived host range, such
+    as a memory mapped asset file, as buffer memory (VK_EXT_external_memory_host); uploads whose data lies inside it
+    are then copied by the GPU straight from there and the staging memcpy disappears. Only the part of the range
+    that is aligned to the import alignment is imported, data outside of it still takes the staging path.
+*/
+
+#include "DeviceAllocator.h"
+#include "GpuProfiler.h"
+#include "SubmissionQueue.h"
+#include "Async.h"
+
+#include <vector>
+#include <cstring>
+
+
+class UploadContext {
+
+public:
+    void init(DeviceAllocator& allocator, SubmissionQueue& submissions, VkQueue queue, uint32_t queueFamilyIndex, GpuProfiler* gpuProfiler = nullptr,
+              GpuCompletion* completion = nullptr)    //completion is needed by the async functions only
+    {
+        this->allocator = &allocator;
+        this->submissions = &submissions;
+        this->completion = completion;
+        this->gpuProfiler = gpuProfiler;
+        this->device = allocator.getDevice();
+        this->queue = queue;
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+        if(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create upload command pool");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        if(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS){
+            throw std::runtime_error("Failed to allocate upload command buffer");
+        }
+    }
+
+
+    void destroy(){
+        for(const HostSource& source : hostSources){
+            allocator->free(source.buffer);
+        }
+        hostSources.clear();
+        vkDestroyCommandPool(device, commandPool, nullptr);
+    }
+
+
+    //Imports the aligned part of [base, base + size) for uploads to copy from. False if there is none, or the device
+    //or driver cannot import it (some refuse read-only file mappings); uploads keep using staging then
+    bool addHostSource(const void* base, size_t size){
+        if(!allocator->canImportHost()) return false;
+
+        VkDeviceSize alignment = allocator->getHostImportAlignment();
+        uintptr_t begin = alignUp(reinterpret_cast<uintptr_t>(base), alignment);
+        uintptr_t end = (reinterpret_cast<uintptr_t>(base) + size) / alignment * alignment;
+        if(end <= begin) return false;
+
+        Allocation* buffer = allocator->importHostBuffer(reinterpret_cast<void*>(begin), end - begin, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        if(buffer == nullptr) return false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        hostSources.push_back({base, reinterpret_cast<const uint8_t*>(begin), reinterpret_cast<const uint8_t*>(end), buffer});
+        return true;
+    }
+
+
+    void removeHostSource(const void* base){    //Before the range is unmapped; no upload from it may still be in flight
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t i = 0; i < hostSources.size(); i++){
+            if(hostSources[i].base != base) continue;
+            allocator->free(hostSources[i].buffer);
+            hostSources.erase(hostSources.begin() + i);
+            return;
+        }
+    }
+
+
+    template<typename Record>
+    void submit(Record&& record){
+        std::lock_guard<std::mutex> lock(mutex);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        uint32_t zone = gpuProfiler ? gpuProfiler->begin(commandBuffer, "Upload") : GPU_ZONE_INVALID;
+        record(commandBuffer);
+        if(gpuProfiler) gpuProfiler->end(commandBuffer, zone);
+
+        vkEndCommandBuffer(commandBuffer);
+
+        SubmitTicket ticket = submissions->submit(queue, Submission(commandBuffer));    //Also flushes whatever else is pending
+        PROFILE_ZONE("Wait for upload");
+        submissions->wait(queue, ticket);
+    }
+
+
+    //Where [data, data + size) sits in an imported host source, for callers recording their own copies
+    bool findHostSource(const void* data, VkDeviceSize size, VkBuffer& buffer, VkDeviceSize& offset){
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        std::lock_guard<std::mutex> lock(mutex);
+        for(const HostSource& source : hostSources){
+            if(bytes >= source.begin && bytes + size <= source.end){
+                buffer = source.buffer->buffer;
+                offset = static_cast<VkDeviceSize>(bytes - source.begin);
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    void uploadBuffer(Allocation* destination, VkDeviceSize offset, const void* data, VkDeviceSize size){
+        if(destination->mapped != nullptr){     //Host visible, no copy on the GPU needed
+            memcpy(static_cast<char*>(destination->mapped) + offset, data, size);
+            return;
+        }
+
+        VkBuffer source;
+        VkDeviceSize sourceOffset;
+        if(findHostSource(data, size, source, sourceOffset)){   //Imported, the GPU reads the data where it is
+            submit([&](VkCommandBuffer commandBuffer){
+                VkBufferCopy region{};
+                region.srcOffset = sourceOffset;
+                region.dstOffset = offset;
+                region.size = size;
+                vkCmdCopyBuffer(commandBuffer, source, destination->buffer, 1, &region);
+            });
+            return;
+        }
+
+        Allocation* staging = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+        memcpy(staging->mapped, data, size);
+
+        submit([&](VkCommandBuffer commandBuffer){
+            VkBufferCopy region{};
+            region.dstOffset = offset;
+            region.size = size;
+            vkCmdCopyBuffer(commandBuffer, staging->buffer, destination->buffer, 1, &region);
+        });
+
+        allocator->free(staging);
+    }
+
+
+    Task<void> uploadBufferAsync(Allocation* destination, VkDeviceSize offset, const void* data, VkDeviceSize size){    //data must outlive the task
+        if(destination->mapped != nullptr){
+            memcpy(static_cast<char*>(destination->mapped) + offset, data, size);
+            co_return;
+        }
+
+        VkBuffer source;
+        VkDeviceSize sourceOffset;
+        if(findHostSource(data, size, source, sourceOffset)){
+            Transient transient = submitTransient("Upload", [&](VkCommandBuffer commandBuffer){
+                VkBufferCopy region{};
+                region.srcOffset = sourceOffset;
+                region.dstOffset = offset;
+                region.size = size;
+                vkCmdCopyBuffer(commandBuffer, source, destination->buffer, 1, &region);
+            });
+            co_await completion->ticket(queue, transient.ticket);
+            freeTransient(transient.commandBuffer);
+            co_return;
+        }
+
+        Allocation* staging = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+        memcpy(staging->mapped, data, size);
+
+        Transient transient = submitTransient("Upload", [&](VkCommandBuffer commandBuffer){
+            VkBufferCopy region{};
+            region.dstOffset = offset;
+            region.size = size;
+            vkCmdCopyBuffer(commandBuffer, staging->buffer, destination->buffer, 1, &region);
+        });
+        co_await completion->ticket(queue, transient.ticket);
+
+        freeTransient(transient.commandBuffer);
+        allocator->free(staging);
+    }
+
+
+    Task<std::vector<char>> readbackAsync(Allocation* source, VkDeviceSize offset, VkDeviceSize size){
+        Allocation* staging = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+
+        Transient transient = submitTransient("Readback", [&](VkCommandBuffer commandBuffer){
+            VkMemoryBarrier barrier{};      //Earlier submissions may still be writing the source
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            VkBufferCopy region{};
+            region.srcOffset = offset;
+            region.size = size;
+            vkCmdCopyBuffer(commandBuffer, source->buffer, staging->buffer, 1, &region);
+
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        });
+        co_await completion->ticket(queue, transient.ticket);
+
+        std::vector<char> data(size);
+        memcpy(data.data(), staging->mapped, size);
+        freeTransient(transient.commandBuffer);
+        allocator->free(staging);
+        co_return data;
+    }
+
+
+private:
+    struct Transient {
+        VkCommandBuffer commandBuffer;
+        SubmitTicket ticket;
+    };
+
+    struct HostSource {
+        const void* base;           //As passed to addHostSource()
+        const uint8_t* begin;       //Imported part
+        const uint8_t* end;
+        Allocation* buffer;
+    };
+
+    DeviceAllocator* allocator = nullptr;
+    GpuCompletion* completion = nullptr;
+    GpuProfiler* gpuProfiler = nullptr;
+    SubmissionQueue* submissions = nullptr;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    std::mutex mutex;       //Also guards commandPool (the async paths allocate from it) and hostSources
+    std::vector<HostSource> hostSources;
+
+
+    template<typename Record>
+    Transient submitTransient(const char* zoneName, Record&& record){     //Submits right away, the awaiter is about to wait for it
+        if(completion == nullptr){
+            throw std::runtime_error("UploadContext needs a GpuCompletion for async transfers");
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer transient;
+        if(vkAllocateCommandBuffers(device, &allocInfo, &transient) != VK_SUCCESS){
+            throw std::runtime_error("Failed to allocate transfer command buffer");
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(transient, &beginInfo);
+
+        uint32_t zone = gpuProfiler ? gpuProfiler->begin(transient, zoneName) : GPU_ZONE_INVALID;
+        record(transient);
+        if(gpuProfiler) gpuProfiler->end(transient, zone);
+
+        vkEndCommandBuffer(transient);
+        return {transient, submissions->submit(queue, Submission(transient))};
+    }
+
+
+    void freeTransient(VkCommandBuffer transient){
+        std::lock_guard<std::mutex> lock(mutex);
+        vkFreeCommandBuffers(device, commandPool, 1, &transient);
+    }
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+Packed vertex format shared by mesh loading and the GPU scene:
+    24 bytes instead of the 48 an all-float position/normal/uv/color vertex would take. The layout below is
+    checked at compile time (VulkanTypes.h), so a reordered or padded member breaks the build instead of
+    silently widening the stride.
+*/
+
+#include "VulkanTypes.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+
+struct Vertex {
+    float position[3];
+    Snorm8x4 normal;        //xyz normal, w tangent handedness
+    Half2 uv;
+    Unorm8x4 color;
+};
+
+VERTEX_LAYOUT(Vertex, position, normal, uv, color)
+
+
+inline uint16_t packHalf(float value){     //Round to nearest even, denormals flushed to zero
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFFu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+
+    if(((bits >> 23) & 0xFFu) == 0xFFu){    //Inf/NaN
+        return static_cast<uint16_t>(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+    }
+    if(exponent <= 0) return static_cast<uint16_t>(sign);
+    if(exponent >= 31) return static_cast<uint16_t>(sign | 0x7C00u);
+
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1FFFu;
+    if(rest > 0x1000u || (rest == 0x1000u && (half & 1u))){
+        half++;     //May carry into the exponent, which is still the correctly rounded result
+    }
+    return static_cast<uint16_t>(half);
+}
+
+
+inline int8_t packSnorm8(float value){
+    return static_cast<int8_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 127.0f));
+}
+
+
+inline uint8_t packUnorm8(float value){
+    return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+/*
+Video output for offscreen runs:
+    Frames are converted to YUV 4:2:0 and streamed to a VideoSink instead of being written as separate images and
+    encoded afterwards.
+
+    1) rgbaToYuv420 converts BT.601 limited range, 8 pixels of a row pair at a time with SSE2: full resolution luma,
+       and chroma from the average of each 2x2 block. The frame is split into bands of rows that run as jobs
+    2) The converted frame goes to a writer thread, which hands it to the sink (Y4mWriter writes a .y4m stream that
+       ffmpeg and most players read; another encoder only has to implement VideoSink). File IO therefore never runs on
+       the render thread
+    3) VIDEO_ENCODER_FRAMES YUV frames cycle between the two threads. encode() only waits when all of them are queued,
+       i.e. when the sink is slower than rendering over several frames
+
+    encode() reads the RGBA pixels before it returns, so the caller may overwrite them right after. Width and height
+    must be even.
+*/
+
+#include "SpscRing.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VIDEO_ENCODER_SSE2 1
+#endif
+
+
+const uint32_t VIDEO_ENCODER_FRAMES = 4;            //Power of two, SpscRing capacity
+const uint32_t VIDEO_ENCODER_BAND_ROWS = 32;        //Rows per conversion job, even
+
+
+struct Yuv420Frame {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> y;     //width * height
+    std::vector<uint8_t> u;     //(width / 2) * (height / 2)
+    std::vector<uint8_t> v;
+};
+
+
+class VideoSink {
+
+public:
+    virtual ~VideoSink() = default;
+
+    virtual bool writeFrame(const Yuv420Frame& frame) = 0;     //Writer thread
+};
+
+
+class Y4mWriter : public VideoSink {
+
+public:
+    bool open(const std::string& path, uint32_t width, uint32_t height, uint32_t fps){
+        file.open(path, std::ios::binary);
+        if(!file.is_open()) return false;
+        file << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n";
+        return static_cast<bool>(file);
+    }
+
+
+    bool writeFrame(const Yuv420Frame& frame) override {
+        file << "FRAME\n";
+        file.write(reinterpret_cast<const char*>(frame.y.data()), frame.y.size());
+        file.write(reinterpret_cast<const char*>(frame.u.data()), frame.u.size());
+        file.write(reinterpret_cast<const char*>(frame.v.data()), frame.v.size());
+        return static_cast<bool>(file);
+    }
+
+
+private:
+    std::ofstream file;
+};
+
+
+//Rows [firstRow, endRow) of an RGBA image with rowPixels pixels per row; both rows even
+inline void rgbaToYuv420(const uint8_t* rgba, uint32_t rowPixels, uint32_t firstRow, uint32_t endRow, Yuv420Frame& frame){
+    uint32_t width = frame.width;
+    uint32_t chromaWidth = width / 2;
+
+    for(uint32_t row = firstRow; row < endRow; row += 2){
+        const uint8_t* top = rgba + static_cast<size_t>(row) * rowPixels * 4;
+        const uint8_t* bottom = top + static_cast<size_t>(rowPixels) * 4;
+        uint8_t* yTop = frame.y.data() + static_cast<size_t>(row) * width;
+        uint8_t* yBottom = yTop + width;
+        uint8_t* u = frame.u.data() + static_cast<size_t>(row / 2) * chromaWidth;
+        uint8_t* v = frame.v.data() + static_cast<size_t>(row / 2) * chromaWidth;
+
+        uint32_t x = 0;
+#if defined(VIDEO_ENCODER_SSE2)
+        const __m128i byteMask = _mm_set1_epi32(0xFF);
+        const __m128i ones = _mm_set1_epi16(1);
+        auto channels = [&byteMask](const uint8_t* pixels, __m128i& r, __m128i& g, __m128i& b){     //8 pixels into 16-bit lanes
+            __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+            __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + 16));
+            r = _mm_packs_epi32(_mm_and_si128(first, byteMask), _mm_and_si128(second, byteMask));
+            g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(first, 8), byteMask), _mm_and_si128(_mm_srli_epi32(second, 8), byteMask));
+            b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(first, 16), byteMask), _mm_and_si128(_mm_srli_epi32(second, 16), byteMask));
+        };
+        auto luma = [](__m128i r, __m128i g, __m128i b){    //((66R + 129G + 25B + 128) >> 8) + 16, below 2^16 so unsigned 16-bit math holds
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+                                        _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+            return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+        };
+        auto blockAverage = [&ones](__m128i topChannel, __m128i bottomChannel){    //4 averages of 2x2 blocks, in 32-bit lanes
+            __m128i pairs = _mm_madd_epi16(_mm_add_epi16(topChannel, bottomChannel), ones);
+            return _mm_srai_epi32(_mm_add_epi32(pairs, _mm_set1_epi32(2)), 2);
+        };
+
+        for(; x + 8 <= width; x += 8){
+            __m128i rTop, gTop, bTop, rBottom, gBottom, bBottom;
+            channels(top + x * 4, rTop, gTop, bTop);
+            channels(bottom + x * 4, rBottom, gBottom, bBottom);
+
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(yTop + x), _mm_packus_epi16(luma(rTop, gTop, bTop), _mm_setzero_si128()));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(yBottom + x), _mm_packus_epi16(luma(rBottom, gBottom, bBottom), _mm_setzero_si128()));
+
+            __m128i r = _mm_packs_epi32(blockAverage(rTop, rBottom), _mm_setzero_si128());    //Averages fit easily in signed 16 bits
+            __m128i g = _mm_packs_epi32(blockAverage(gTop, gBottom), _mm_setzero_si128());
+            __m128i b = _mm_packs_epi32(blockAverage(bTop, bBottom), _mm_setzero_si128());
+            __m128i uSum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(-38)), _mm_mullo_epi16(g, _mm_set1_epi16(-74))),
+                                         _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)), _mm_set1_epi16(128)));
+            __m128i vSum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)), _mm_mullo_epi16(g, _mm_set1_epi16(-94))),
+                                         _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(-18)), _mm_set1_epi16(128)));
+            __m128i uValues = _mm_packus_epi16(_mm_add_epi16(_mm_srai_epi16(uSum, 8), _mm_set1_epi16(128)), _mm_setzero_si128());
+            __m128i vValues = _mm_packus_epi16(_mm_add_epi16(_mm_srai_epi16(vSum, 8), _mm_set1_epi16(128)), _mm_setzero_si128());
+            int32_t packedU = _mm_cvtsi128_si32(uValues);
+            int32_t packedV = _mm_cvtsi128_si32(vValues);
+            memcpy(u + x / 2, &packedU, 4);
+            memcpy(v + x / 2, &packedV, 4);
+        }
+#endif
+        for(; x < width; x += 2){
+            int32_t r = 0, g = 0, b = 0;
+            for(uint32_t dx = 0; dx < 2; dx++){
+                const uint8_t* pixels[2] = {top + (x + dx) * 4, bottom + (x + dx) * 4};
+                uint8_t* lumaRows[2] = {yTop, yBottom};
+                for(int line = 0; line < 2; line++){
+                    const uint8_t* p = pixels[line];
+                    lumaRows[line][x + dx] = static_cast<uint8_t>(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+            }
+            r = (r + 2) >> 2;
+            g = (g + 2) >> 2;
+            b = (b + 2) >> 2;
+            u[x / 2] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v[x / 2] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+
+class VideoEncoder {
+
+public:
+    void init(JobSystem& jobs, uint32_t width, uint32_t height, std::unique_ptr<VideoSink> sink){
+        if(width % 2 != 0 || height % 2 != 0){
+            throw std::runtime_error("Video frames need an even width and height");
+        }
+        this->jobs = &jobs;
+        this->sink = std::move(sink);
+
+        for(uint32_t i = 0; i < VIDEO_ENCODER_FRAMES; i++){
+            Yuv420Frame& frame = frames[i];
+            frame.width = width;
+            frame.height = height;
+            frame.y.resize(static_cast<size_t>(width) * height);
+            frame.u.resize(static_cast<size_t>(width / 2) * (height / 2));
+            frame.v.resize(static_cast<size_t>(width / 2) * (height / 2));
+            freeFrames.tryPush(i);
+        }
+
+        running = true;
+        writer = std::thread([this]{ writeLoop(); });
+    }
+
+
+    void destroy(){     //Writes every frame encoded so far
+        running = false;
+        if(writer.joinable()){
+            writer.join();
+        }
+        sink.reset();
+    }
+
+
+    bool isOpen() const { return sink != nullptr; }
+
+    uint64_t getFramesWritten() const { return framesWritten; }
+
+    bool hasFailed() const { return failed; }
+
+
+    void encode(const uint8_t* rgba, uint32_t rowPixels){   //One thread only; returns once the pixels have been read
+        PROFILE_ZONE("VideoEncoder::encode");
+        uint32_t index;
+        {
+            PROFILE_ZONE("Wait for video writer");
+            while(!freeFrames.tryPop(index)){
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+
+        Yuv420Frame& frame = frames[index];
+        uint32_t bands = (frame.height + VIDEO_ENCODER_BAND_ROWS - 1) / VIDEO_ENCODER_BAND_ROWS;
+        jobs->wait(jobs->parallelFor(bands, 1, [rgba, rowPixels, &frame](uint32_t begin, uint32_t end){
+            for(uint32_t band = begin; band < end; band++){
+                uint32_t firstRow = band * VIDEO_ENCODER_BAND_ROWS;
+                rgbaToYuv420(rgba, rowPixels, firstRow, std::min(firstRow + VIDEO_ENCODER_BAND_ROWS, frame.height), frame);
+            }
+        }));
+        readyFrames.tryPush(index);     //Never full, there are only as many indices as slots
+    }
+
+
+private:
+    JobSystem* jobs = nullptr;
+    std::unique_ptr<VideoSink> sink;
+    Yuv420Frame frames[VIDEO_ENCODER_FRAMES];
+    SpscRing<uint32_t, VIDEO_ENCODER_FRAMES> freeFrames;    //writer -> encode
+    SpscRing<uint32_t, VIDEO_ENCODER_FRAMES> readyFrames;   //encode -> writer
+    std::thread writer;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> framesWritten{0};
+    std::atomic<bool> failed{false};
+
+
+    void writeLoop(){
+        PROFILE_THREAD("Video writer");
+        while(true){
+            bool stopping = !running;   //Read before popping, so every frame encoded before destroy() is seen
+            uint32_t index;
+            if(!readyFrames.tryPop(index)){
+                if(stopping) break;
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+            {
+                PROFILE_ZONE("VideoSink::writeFrame");
+                if(!failed && !sink->writeFrame(frames[index])){
+                    failed = true;      //Keep draining so encode() never stalls on a dead sink
+                }
+            }
+            framesWritten++;
+            freeFrames.tryPush(index);
+        }
+    }
+};
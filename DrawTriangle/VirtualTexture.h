@@ -0,0 +1,1056 @@
+#pragma once
+
+/*
+Virtual texturing for images that do not fit in device memory:
+    1) The image lives in the asset pack as fixed size pages per mip level (VirtualTextureHeader + pages, mip 0 first, row major)
+    2) Fragment shaders write the pages they need into a per-frame feedback buffer (shaders/virtual_texture.glsl), which
+       also carries the texture's sampling constants and the feedback jitter, so recorded draws stay valid across frames
+    3) update() reads the feedback of a retired frame, asks the loader threads for missing pages and
+       touches resident ones in the LRU page cache
+    4) Loaded pages are copied into the physical cache and the page table texture is patched so every entry points to the
+       finest resident page covering it
+
+    Physical cache:
+        sparse path      - a sparse resident image of the full virtual size; pages get memory from a fixed pool via vkQueueBindSparse
+                           (needs sparseResidencyImage2D and a page size equal to the sparse block size)
+        indirection path - a 2D atlas of cacheSide x cacheSide pages; the page table stores where each page sits in the atlas
+
+    Evicted cache slots are quarantined for framesInFlight updates, frames that were already recorded may still read them.
+    Shaders reach everything through getDescriptorSet(frameIndex), laid out as getDescriptorSetLayout() describes.
+*/
+
+#include "DeviceAllocator.h"
+#include "SubmissionQueue.h"
+#include "AssetPack.h"
+#include "Profiler.h"
+
+#include <list>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+
+
+const uint32_t VIRTUAL_TEXTURE_MAGIC = 0x58455456;  //"VTEX"
+const uint32_t VIRTUAL_TEXTURE_MAX_MIPS = 16;                //Page ids hold the mip in 4 bits
+const uint32_t VIRTUAL_TEXTURE_MAX_PAGES_PER_SIDE = 1 << 14;  //And x/y in 14 bits each
+const uint32_t VIRTUAL_TEXTURE_MAX_PAGE_SIZE = 4096;
+const uint32_t VIRTUAL_TEXTURE_MAX_CACHE_SIDE = 256;          //Page table entries hold the cache x/y in 8 bits each
+const uint32_t VIRTUAL_TEXTURE_FEEDBACK_CAPACITY = 16 * 1024;
+const uint32_t VIRTUAL_TEXTURE_FEEDBACK_STRIDE = 4;     //One pixel per 4x4 square reports each frame
+
+
+struct VirtualTextureHeader {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pageSize;          //Texels per page side, pages are always stored full size (padded at the right/bottom edges)
+    uint32_t mipCount;          //The last mip fits in a single page
+    uint32_t bytesPerTexel;     //4, texels are VK_FORMAT_R8G8B8A8_UNORM
+};
+
+
+struct VirtualTextureFeedback {     //Matches VtFeedback in shaders/virtual_texture.glsl
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t jitter;            //Pixel of each stride x stride square that reports, rotated by every update
+    uint32_t padding;
+    float info[4];              //Virtual width, virtual height, page size, mip count
+    float cacheInfo[4];         //Cache side in pages, 1 when sparse, feedback stride, unused
+    uint32_t entries[VIRTUAL_TEXTURE_FEEDBACK_CAPACITY];
+};
+
+
+//Page ids match vtPageId() in the shader: 4 bits mip, 14 bits y, 14 bits x
+static inline uint32_t makePageId(uint32_t mip, uint32_t x, uint32_t y){ return (mip << 28) | (y << 14) | x; }
+static inline uint32_t pageMip(uint32_t id){ return id >> 28; }
+static inline uint32_t pageX(uint32_t id){ return id & 0x3FFF; }
+static inline uint32_t pageY(uint32_t id){ return (id >> 14) & 0x3FFF; }
+
+
+class PageLoader {      //Copies pages out of the mapped pack on worker threads so page faults never hit the render thread
+
+public:
+    struct Request {
+        uint32_t pageId;
+        uint32_t stagingSlot;
+        const uint8_t* source;
+        uint8_t* destination;
+        size_t size;
+    };
+
+
+    void start(uint32_t threadCount){
+        running = true;
+        for(uint32_t i = 0; i < threadCount; i++){
+            threads.emplace_back([this]{ work(); });
+        }
+    }
+
+
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        for(auto& thread : threads){
+            thread.join();
+        }
+        threads.clear();
+        pending.clear();
+        completed.clear();
+    }
+
+
+    void enqueue(const Request& request){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(request);
+        }
+        wake.notify_one();
+    }
+
+
+    void collect(std::vector<Request>& out){
+        std::lock_guard<std::mutex> lock(mutex);
+        out.insert(out.end(), completed.begin(), completed.end());
+        completed.clear();
+    }
+
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Request> pending;
+    std::vector<Request> completed;
+    bool running = false;
+
+
+    void work(){
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            wake.wait(lock, [this]{ return !running || !pending.empty(); });
+            if(!running) return;
+
+            Request request = pending.front();
+            pending.pop_front();
+
+            lock.unlock();
+            memcpy(request.destination, request.source, request.size);
+            lock.lock();
+
+            completed.push_back(request);
+        }
+    }
+};
+
+
+class VirtualTexture {
+
+public:
+    uint32_t maxUploadsPerFrame = 32;
+
+
+    //sparseQueue is VK_NULL_HANDLE when the device cannot bind sparse images, the atlas is used then
+    void init(DeviceAllocator& allocator, SubmissionQueue& submissions, VkPhysicalDevice physicalDevice, VkQueue sparseQueue, const AssetPack& pack,
+              const char* name, uint32_t framesInFlight, uint32_t cacheSideInPages = 32, uint32_t loaderThreads = 2)
+    {
+        this->allocator = &allocator;
+        this->submissions = &submissions;
+        this->device = allocator.getDevice();
+        this->sparseQueue = sparseQueue;
+        this->framesInFlight = framesInFlight;
+        this->cacheSide = cacheSideInPages;
+
+        const AssetPackEntry* entry = pack.find(name);
+        if(entry == nullptr || entry->size < sizeof(VirtualTextureHeader)){
+            throw std::runtime_error(std::string("Virtual texture not found in asset pack: ") + name);
+        }
+        source = &pack;
+        pageData = pack.data(*entry) + sizeof(VirtualTextureHeader);
+        header = *reinterpret_cast<const VirtualTextureHeader*>(pack.data(*entry));
+
+        if(!validHeader()){     //The pack is untrusted input, everything below relies on these bounds
+            throw std::runtime_error(std::string("Invalid virtual texture header: ") + name);
+        }
+
+        pageBytes = static_cast<VkDeviceSize>(header.pageSize) * header.pageSize * header.bytesPerTexel;
+        computeLayout();
+        if(sizeof(VirtualTextureHeader) + pageCountTotal * pageBytes > entry->size){
+            throw std::runtime_error(std::string("Virtual texture page data truncated: ") + name);
+        }
+
+        sparse = sparseQueue != VK_NULL_HANDLE && sparseSupported(physicalDevice);
+
+        createPageTable();
+        if(sparse){
+            createSparseCache();
+        } else {
+            createAtlasCache();
+        }
+        createStaging();
+        createFeedback();
+        createSemaphores();
+        createDescriptors();
+
+        slots.resize(slotCount);
+        for(uint32_t i = 0; i < slotCount; i++){
+            freeSlots.push_back(slotCount - 1 - i);
+        }
+        quarantine.resize(framesInFlight);
+        retiredStaging.resize(framesInFlight);
+
+        loader.start(loaderThreads);
+
+        for(uint32_t mip = firstPinnedMip(); mip < header.mipCount; mip++){     //Coarse levels stay resident so there is always a fallback
+            for(uint32_t y = 0; y < pagesY[mip]; y++){
+                for(uint32_t x = 0; x < pagesX[mip]; x++){
+                    wanted.push_back(makePageId(mip, x, y));
+                }
+            }
+        }
+    }
+
+
+    void destroy(){     //Device must be idle
+        loader.stop();
+
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+        vkDestroySampler(device, pageTableSampler, nullptr);
+        vkDestroySampler(device, cacheSampler, nullptr);
+
+        for(VkSemaphore semaphore : bindSemaphores){
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        for(Allocation* buffer : feedbackBuffers){
+            allocator->free(buffer);
+        }
+        allocator->free(stagingBuffer);
+
+        vkDestroyImageView(device, cacheView, nullptr);
+        vkDestroyImage(device, cacheImage, nullptr);
+        allocator->free(cacheAllocation);
+        if(sparsePool != VK_NULL_HANDLE) vkFreeMemory(device, sparsePool, nullptr);
+        if(mipTailMemory != VK_NULL_HANDLE) vkFreeMemory(device, mipTailMemory, nullptr);
+
+        vkDestroyImageView(device, pageTableView, nullptr);
+        vkDestroyImage(device, pageTableImage, nullptr);
+        allocator->free(pageTableAllocation);
+    }
+
+
+    //Records uploads into commandBuffer. Call after the fence of frameIndex has signalled, before the draws that sample the texture.
+    //On the sparse path the caller's submission must wait on getBindSemaphore(frameIndex) at the transfer stage when it is not null.
+    void update(VkCommandBuffer commandBuffer, uint32_t frameIndex){
+        PROFILE_ZONE("VirtualTexture::update");
+        frame++;
+        bindSemaphorePending[frameIndex] = false;
+
+        for(uint32_t slot : retiredStaging[frameIndex]) freeStaging.push_back(slot);
+        retiredStaging[frameIndex].clear();
+        for(uint32_t slot : quarantine[frameIndex]) freeSlots.push_back(slot);
+        quarantine[frameIndex].clear();
+
+        readFeedback(frameIndex);
+        issueLoads();
+
+        loader.collect(ready);
+        std::vector<VkBufferImageCopy> pageCopies;
+        std::vector<VkSparseImageMemoryBind> binds;
+        placeReadyPages(frameIndex, pageCopies, binds);
+
+        if(!binds.empty()){
+            submitBinds(binds, frameIndex);
+        }
+
+        std::vector<VkBufferImageCopy> tableCopies;
+        stagePageTable(frameIndex, tableCopies);
+
+        if(!initialized || !pageCopies.empty() || !tableCopies.empty()){
+            recordUploads(commandBuffer, pageCopies, tableCopies);
+        }
+
+        maintainReserve(frameIndex);
+    }
+
+
+    //Records the barrier that makes frameIndex's feedback writes visible to the host, after the draws that sample the texture
+    void recordFeedbackBarrier(VkCommandBuffer commandBuffer) const {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+
+    VkSemaphore getBindSemaphore(uint32_t frameIndex) const { return bindSemaphorePending[frameIndex] ? bindSemaphores[frameIndex] : VK_NULL_HANDLE; }
+
+    //Fragment stage: binding 0 page table (usampler2D), 1 cache (sampler2D), 2 frameIndex's feedback buffer
+    VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+
+    VkDescriptorSet getDescriptorSet(uint32_t frameIndex) const { return descriptorSets[frameIndex]; }
+
+    bool isSparse() const { return sparse; }
+
+    const VirtualTextureHeader& getHeader() const { return header; }
+
+    uint32_t getCacheSide() const { return cacheSide; }
+
+
+private:
+    struct Slot {
+        uint32_t pageId = 0;
+        uint64_t lastUsed = 0;
+        bool used = false;
+        bool pinned = false;
+        std::list<uint32_t>::iterator lruPosition;
+    };
+
+    DeviceAllocator* allocator = nullptr;
+    SubmissionQueue* submissions = nullptr;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue sparseQueue = VK_NULL_HANDLE;
+    const AssetPack* source = nullptr;
+    const uint8_t* pageData = nullptr;
+    VirtualTextureHeader header{};
+    uint32_t framesInFlight = 2;
+    uint64_t frame = 0;
+    bool sparse = false;
+    bool initialized = false;
+
+    uint32_t pagesX[VIRTUAL_TEXTURE_MAX_MIPS];
+    uint32_t pagesY[VIRTUAL_TEXTURE_MAX_MIPS];
+    VkDeviceSize packMipOffset[VIRTUAL_TEXTURE_MAX_MIPS];   //In pages
+    VkDeviceSize pageCountTotal = 0;
+    VkDeviceSize pageBytes = 0;
+
+    //Page table: one RGBA8 texel per page (cache x, cache y, resident mip, valid), sized to powers of two so mip chains line up
+    VkImage pageTableImage = VK_NULL_HANDLE;
+    VkImageView pageTableView = VK_NULL_HANDLE;
+    Allocation* pageTableAllocation = nullptr;
+    uint32_t tableWidth[VIRTUAL_TEXTURE_MAX_MIPS];
+    uint32_t tableHeight[VIRTUAL_TEXTURE_MAX_MIPS];
+    VkDeviceSize tableOffset[VIRTUAL_TEXTURE_MAX_MIPS];     //In texels, into the CPU copy and the staging area
+    VkDeviceSize tableTexels = 0;
+    std::vector<uint32_t> table;
+    VkRect2D dirty[VIRTUAL_TEXTURE_MAX_MIPS];
+    bool dirtyMip[VIRTUAL_TEXTURE_MAX_MIPS] = {};
+
+    //Physical cache
+    VkImage cacheImage = VK_NULL_HANDLE;
+    VkImageView cacheView = VK_NULL_HANDLE;
+    Allocation* cacheAllocation = nullptr;
+    VkDeviceMemory sparsePool = VK_NULL_HANDLE;
+    VkDeviceMemory mipTailMemory = VK_NULL_HANDLE;
+    VkDeviceSize sparsePageStride = 0;
+    uint32_t mipTailFirstLod = VIRTUAL_TEXTURE_MAX_MIPS;
+    uint32_t cacheSide = 32;
+    uint32_t slotCount = 0;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::vector<std::vector<uint32_t>> quarantine;          //Per frame index
+    std::list<uint32_t> lru;                                //Front = most recently used
+    std::unordered_map<uint32_t, uint32_t> resident;        //pageId -> slot (sparse mip tail pages map to UINT32_MAX)
+    std::vector<std::pair<uint32_t, uint32_t>> evictedBinds;//(pageId, slot) still bound, unbound when the slot is reused
+
+    //Staging: page slots followed by one page table copy per frame in flight
+    Allocation* stagingBuffer = nullptr;
+    uint32_t stagingSlotCount = 0;
+    std::vector<uint32_t> freeStaging;
+    std::vector<std::vector<uint32_t>> retiredStaging;
+
+    std::vector<Allocation*> feedbackBuffers;
+    std::vector<VkSemaphore> bindSemaphores;
+    std::vector<bool> bindSemaphorePending;
+
+    VkSampler pageTableSampler = VK_NULL_HANDLE;
+    VkSampler cacheSampler = VK_NULL_HANDLE;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> descriptorSets;            //Per frame index, they differ in the feedback buffer
+
+    PageLoader loader;
+    std::vector<uint32_t> wanted;
+    std::unordered_set<uint32_t> inFlight;
+    std::vector<PageLoader::Request> ready;
+
+
+    bool validHeader() const {
+        if(header.magic != VIRTUAL_TEXTURE_MAGIC || header.bytesPerTexel != 4) return false;
+        if(header.mipCount == 0 || header.mipCount > VIRTUAL_TEXTURE_MAX_MIPS) return false;
+        if(header.pageSize == 0 || header.pageSize > VIRTUAL_TEXTURE_MAX_PAGE_SIZE) return false;
+        if(header.width == 0 || header.height == 0) return false;
+        if(cacheSide == 0 || cacheSide > VIRTUAL_TEXTURE_MAX_CACHE_SIDE) return false;
+
+        uint64_t pagesWide = (static_cast<uint64_t>(header.width) + header.pageSize - 1) / header.pageSize;    //Mip 0 has the most
+        uint64_t pagesHigh = (static_cast<uint64_t>(header.height) + header.pageSize - 1) / header.pageSize;
+        return pagesWide <= VIRTUAL_TEXTURE_MAX_PAGES_PER_SIDE && pagesHigh <= VIRTUAL_TEXTURE_MAX_PAGES_PER_SIDE;
+    }
+
+
+    void computeLayout(){
+        VkDeviceSize offset = 0;
+        for(uint32_t mip = 0; mip < header.mipCount; mip++){
+            uint32_t width = std::max(1u, header.width >> mip);
+            uint32_t height = std::max(1u, header.height >> mip);
+            pagesX[mip] = (width + header.pageSize - 1) / header.pageSize;
+            pagesY[mip] = (height + header.pageSize - 1) / header.pageSize;
+            packMipOffset[mip] = offset;
+            offset += static_cast<VkDeviceSize>(pagesX[mip]) * pagesY[mip];
+        }
+        pageCountTotal = offset;
+
+        uint32_t width = 1, height = 1;
+        while(width < pagesX[0]) width <<= 1;
+        while(height < pagesY[0]) height <<= 1;
+
+        VkDeviceSize texels = 0;
+        for(uint32_t mip = 0; mip < header.mipCount; mip++){
+            tableWidth[mip] = std::max(1u, width >> mip);
+            tableHeight[mip] = std::max(1u, height >> mip);
+            tableOffset[mip] = texels;
+            texels += static_cast<VkDeviceSize>(tableWidth[mip]) * tableHeight[mip];
+        }
+        tableTexels = texels;
+        table.assign(tableTexels, 0);
+    }
+
+
+    uint32_t firstPinnedMip() const {
+        return sparse ? std::min(mipTailFirstLod, header.mipCount - 1) : header.mipCount - 1;
+    }
+
+
+    bool inMipTail(uint32_t mip) const { return sparse && mip >= mipTailFirstLod; }
+
+
+    const uint8_t* pageSource(uint32_t pageId) const {
+        uint32_t mip = pageMip(pageId);
+        VkDeviceSize index = packMipOffset[mip] + static_cast<VkDeviceSize>(pageY(pageId)) * pagesX[mip] + pageX(pageId);
+        return pageData + index * pageBytes;
+    }
+
+
+    bool sparseSupported(VkPhysicalDevice physicalDevice){
+        uint32_t count = 0;
+        vkGetPhysicalDeviceSparseImageFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TYPE_2D, VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_IMAGE_TILING_OPTIMAL, &count, nullptr);
+        if(count == 0) return false;
+
+        std::vector<VkSparseImageFormatProperties> properties(count);
+        vkGetPhysicalDeviceSparseImageFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TYPE_2D, VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_IMAGE_TILING_OPTIMAL, &count, properties.data());
+
+        for(const auto& property : properties){     //Pages must line up with sparse blocks, otherwise fall back to the atlas
+            if(property.aspectMask & VK_IMAGE_ASPECT_COLOR_BIT){
+                return property.imageGranularity.width == header.pageSize && property.imageGranularity.height == header.pageSize;
+            }
+        }
+        return false;
+    }
+
+
+    VkImageView createView(VkImage image, VkFormat format, uint32_t mipLevels){
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = mipLevels;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        VkImageView view;
+        if(vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create virtual texture image view");
+        }
+        return view;
+    }
+
+
+    VkImageCreateInfo imageInfo(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels){
+        VkImageCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = format;
+        info.extent = {width, height, 1};
+        info.mipLevels = mipLevels;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        return info;
+    }
+
+
+    void createPageTable(){
+        VkImageCreateInfo info = imageInfo(VK_FORMAT_R8G8B8A8_UINT, tableWidth[0], tableHeight[0], header.mipCount);
+        if(vkCreateImage(device, &info, nullptr, &pageTableImage) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create page table image");
+        }
+        pageTableAllocation = allocator->allocateImage(pageTableImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        pageTableView = createView(pageTableImage, VK_FORMAT_R8G8B8A8_UINT, header.mipCount);
+
+        for(uint32_t mip = 0; mip < header.mipCount; mip++){    //Upload the all-invalid table on the first update
+            markDirty(mip, 0, 0, tableWidth[mip], tableHeight[mip]);
+        }
+    }
+
+
+    void createAtlasCache(){
+        slotCount = cacheSide * cacheSide;
+
+        VkImageCreateInfo info = imageInfo(VK_FORMAT_R8G8B8A8_UNORM, cacheSide * header.pageSize, cacheSide * header.pageSize, 1);
+        if(vkCreateImage(device, &info, nullptr, &cacheImage) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create virtual texture cache image");
+        }
+        cacheAllocation = allocator->allocateImage(cacheImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        cacheView = createView(cacheImage, VK_FORMAT_R8G8B8A8_UNORM, 1);
+    }
+
+
+    void createSparseCache(){
+        slotCount = cacheSide * cacheSide;
+
+        VkImageCreateInfo info = imageInfo(VK_FORMAT_R8G8B8A8_UNORM, header.width, header.height, header.mipCount);
+        info.flags = VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT;
+        if(vkCreateImage(device, &info, nullptr, &cacheImage) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create sparse virtual texture image");
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, cacheImage, &requirements);
+        sparsePageStride = requirements.alignment;      //One sparse block per page
+        uint32_t memoryTypeIndex = allocator->findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = sparsePageStride * slotCount;
+        allocInfo.memoryTypeIndex = memoryTypeIndex;
+        if(vkAllocateMemory(device, &allocInfo, nullptr, &sparsePool) != VK_SUCCESS){   //Raw block: sparse binds address it by offset
+            throw std::runtime_error("Failed to allocate sparse page pool");
+        }
+
+        uint32_t count = 0;
+        vkGetImageSparseMemoryRequirements(device, cacheImage, &count, nullptr);
+        std::vector<VkSparseImageMemoryRequirements> sparseRequirements(count);
+        vkGetImageSparseMemoryRequirements(device, cacheImage, &count, sparseRequirements.data());
+
+        for(const auto& requirement : sparseRequirements){
+            if(!(requirement.formatProperties.aspectMask & VK_IMAGE_ASPECT_COLOR_BIT)) continue;
+            mipTailFirstLod = requirement.imageMipTailFirstLod;
+
+            if(requirement.imageMipTailFirstLod < header.mipCount){
+                allocInfo.allocationSize = requirement.imageMipTailSize;
+                if(vkAllocateMemory(device, &allocInfo, nullptr, &mipTailMemory) != VK_SUCCESS){
+                    throw std::runtime_error("Failed to allocate sparse mip tail");
+                }
+
+                VkSparseMemoryBind tailBind{};
+                tailBind.resourceOffset = requirement.imageMipTailOffset;
+                tailBind.size = requirement.imageMipTailSize;
+                tailBind.memory = mipTailMemory;
+
+                VkSparseImageOpaqueMemoryBindInfo opaqueInfo{};
+                opaqueInfo.image = cacheImage;
+                opaqueInfo.bindCount = 1;
+                opaqueInfo.pBinds = &tailBind;
+
+                VkBindSparseInfo bindInfo{};
+                bindInfo.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+                bindInfo.imageOpaqueBindCount = 1;
+                bindInfo.pImageOpaqueBinds = &opaqueInfo;
+
+                VkFenceCreateInfo fenceInfo{};
+                fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                VkFence fence;
+                if(vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS){
+                    throw std::runtime_error("Failed to create sparse bind fence");
+                }
+                VkResult result = submissions->bindSparse(sparseQueue, 1, &bindInfo, fence);
+                if(result == VK_SUCCESS){
+                    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);    //One-off at load time
+                }
+                vkDestroyFence(device, fence, nullptr);
+                if(result != VK_SUCCESS){
+                    throw std::runtime_error("Failed to bind sparse mip tail");
+                }
+            }
+        }
+
+        cacheView = createView(cacheImage, VK_FORMAT_R8G8B8A8_UNORM, header.mipCount);
+    }
+
+
+    void createStaging(){
+        stagingSlotCount = maxUploadsPerFrame * (framesInFlight + 1);
+        VkDeviceSize size = stagingSlotCount * pageBytes + framesInFlight * tableTexels * sizeof(uint32_t);
+
+        stagingBuffer = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+
+        for(uint32_t i = 0; i < stagingSlotCount; i++){
+            freeStaging.push_back(stagingSlotCount - 1 - i);
+        }
+    }
+
+
+    void createFeedback(){
+        for(uint32_t i = 0; i < framesInFlight; i++){
+            Allocation* buffer = allocator->createBuffer(sizeof(VirtualTextureFeedback), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+
+            auto* feedback = static_cast<VirtualTextureFeedback*>(buffer->mapped);
+            feedback->count = 0;
+            feedback->capacity = VIRTUAL_TEXTURE_FEEDBACK_CAPACITY;
+            feedback->jitter = 0;
+            feedback->info[0] = static_cast<float>(header.width);
+            feedback->info[1] = static_cast<float>(header.height);
+            feedback->info[2] = static_cast<float>(header.pageSize);
+            feedback->info[3] = static_cast<float>(header.mipCount);
+            feedback->cacheInfo[0] = static_cast<float>(cacheSide);
+            feedback->cacheInfo[1] = sparse ? 1.0f : 0.0f;
+            feedback->cacheInfo[2] = static_cast<float>(VIRTUAL_TEXTURE_FEEDBACK_STRIDE);
+            feedback->cacheInfo[3] = 0.0f;
+            feedbackBuffers.push_back(buffer);
+        }
+    }
+
+
+    void createSemaphores(){
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        bindSemaphores.resize(framesInFlight);
+        bindSemaphorePending.assign(framesInFlight, false);
+        for(uint32_t i = 0; i < framesInFlight; i++){
+            if(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &bindSemaphores[i]) != VK_SUCCESS){
+                throw std::runtime_error("Failed to create sparse bind semaphore");
+            }
+        }
+    }
+
+
+    void createDescriptors(){
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;      //Integer page table entries, never filtered
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+        if(vkCreateSampler(device, &samplerInfo, nullptr, &pageTableSampler) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create page table sampler");
+        }
+
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        if(vkCreateSampler(device, &samplerInfo, nullptr, &cacheSampler) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create virtual texture cache sampler");
+        }
+
+        VkDescriptorSetLayoutBinding bindings[3]{};
+        bindings[0] = {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, &pageTableSampler};
+        bindings[1] = {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, &cacheSampler};
+        bindings[2] = {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr};
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 3;
+        layoutInfo.pBindings = bindings;
+        if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create virtual texture descriptor set layout");
+        }
+
+        VkDescriptorPoolSize poolSizes[2] = {{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * framesInFlight}, {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, framesInFlight}};
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = framesInFlight;
+        poolInfo.poolSizeCount = 2;
+        poolInfo.pPoolSizes = poolSizes;
+        if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create virtual texture descriptor pool");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(framesInFlight, descriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = framesInFlight;
+        allocInfo.pSetLayouts = layouts.data();
+        descriptorSets.resize(framesInFlight);
+        if(vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS){
+            throw std::runtime_error("Failed to allocate virtual texture descriptor sets");
+        }
+
+        VkDescriptorImageInfo pageTableInfo{VK_NULL_HANDLE, pageTableView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        VkDescriptorImageInfo cacheInfo{VK_NULL_HANDLE, cacheView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        for(uint32_t i = 0; i < framesInFlight; i++){
+            VkDescriptorBufferInfo feedbackInfo{feedbackBuffers[i]->buffer, 0, VK_WHOLE_SIZE};
+
+            VkWriteDescriptorSet writes[3]{};
+            for(uint32_t binding = 0; binding < 3; binding++){
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = descriptorSets[i];
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = bindings[binding].descriptorType;
+            }
+            writes[0].pImageInfo = &pageTableInfo;
+            writes[1].pImageInfo = &cacheInfo;
+            writes[2].pBufferInfo = &feedbackInfo;
+            vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+        }
+    }
+
+
+    ////////////////////////////////////////// Per-frame work ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    void readFeedback(uint32_t frameIndex){
+        auto* feedback = static_cast<VirtualTextureFeedback*>(feedbackBuffers[frameIndex]->mapped);
+        uint32_t count = std::min(feedback->count, feedback->capacity);
+
+        std::vector<uint32_t> requested(feedback->entries, feedback->entries + count);
+        feedback->count = 0;    //The GPU is done with this frame index, reset for its next use
+        feedback->jitter = static_cast<uint32_t>(frame % (VIRTUAL_TEXTURE_FEEDBACK_STRIDE * VIRTUAL_TEXTURE_FEEDBACK_STRIDE));
+
+        std::sort(requested.begin(), requested.end());
+        requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+
+        for(uint32_t pageId : requested){
+            uint32_t mip = pageMip(pageId);
+            if(mip >= header.mipCount || pageX(pageId) >= pagesX[mip] || pageY(pageId) >= pagesY[mip]) continue;
+
+            //Walk up until a resident ancestor is found so the coarser pages arrive first
+            for(uint32_t level = mip, x = pageX(pageId), y = pageY(pageId); level < header.mipCount; level++, x >>= 1, y >>= 1){
+                uint32_t id = makePageId(level, x, y);
+                auto found = resident.find(id);
+                if(found != resident.end()){
+                    touch(found->second);
+                    break;
+                }
+                wanted.push_back(id);
+            }
+        }
+    }
+
+
+    void touch(uint32_t slot){
+        if(slot == UINT32_MAX || slots[slot].pinned) return;
+        slots[slot].lastUsed = frame;
+        lru.splice(lru.begin(), lru, slots[slot].lruPosition);
+    }
+
+
+    void issueLoads(){
+        std::sort(wanted.begin(), wanted.end(), [](uint32_t a, uint32_t b){      //Coarse first
+            return pageMip(a) != pageMip(b) ? pageMip(a) > pageMip(b) : a < b;
+        });
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+        size_t issued = 0;
+        for(; issued < wanted.size() && !freeStaging.empty(); issued++){
+            uint32_t pageId = wanted[issued];
+            if(resident.count(pageId) || inFlight.count(pageId)) continue;
+
+            uint32_t stagingSlot = freeStaging.back();
+            freeStaging.pop_back();
+
+            PageLoader::Request request;
+            request.pageId = pageId;
+            request.stagingSlot = stagingSlot;
+            request.source = pageSource(pageId);
+            request.destination = static_cast<uint8_t*>(stagingBuffer->mapped) + stagingSlot * pageBytes;
+            request.size = pageBytes;
+
+            source->prefetch(request.source, request.size);
+            loader.enqueue(request);
+            inFlight.insert(pageId);
+        }
+
+        //Pages that did not fit this frame are requested again by the next feedback, pinned ones must not be lost
+        std::vector<uint32_t> keep;
+        for(size_t i = issued; i < wanted.size(); i++){
+            if(pageMip(wanted[i]) >= firstPinnedMip()) keep.push_back(wanted[i]);
+        }
+        wanted.swap(keep);
+    }
+
+
+    void placeReadyPages(uint32_t frameIndex, std::vector<VkBufferImageCopy>& copies, std::vector<VkSparseImageMemoryBind>& binds){
+        std::vector<PageLoader::Request> deferred;
+
+        for(const PageLoader::Request& request : ready){
+            uint32_t mip = pageMip(request.pageId);
+            bool pinned = mip >= firstPinnedMip();
+            uint32_t slot = UINT32_MAX;
+
+            if(!inMipTail(mip)){
+                if(freeSlots.empty() || copies.size() >= maxUploadsPerFrame){
+                    deferred.push_back(request);
+                    continue;
+                }
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+                unbindEvicted(slot, binds);
+
+                Slot& info = slots[slot];
+                info.pageId = request.pageId;
+                info.lastUsed = frame;
+                info.used = true;
+                info.pinned = pinned;
+                if(!pinned){
+                    lru.push_front(slot);
+                    info.lruPosition = lru.begin();
+                }
+            }
+
+            VkBufferImageCopy copy{};
+            copy.bufferOffset = request.stagingSlot * pageBytes;
+            copy.bufferRowLength = header.pageSize;
+            copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copy.imageSubresource.layerCount = 1;
+
+            if(sparse){
+                uint32_t width = std::max(1u, header.width >> mip);
+                uint32_t height = std::max(1u, header.height >> mip);
+                int32_t x = static_cast<int32_t>(pageX(request.pageId) * header.pageSize);
+                int32_t y = static_cast<int32_t>(pageY(request.pageId) * header.pageSize);
+                VkExtent3D extent = {std::min(header.pageSize, width - x), std::min(header.pageSize, height - y), 1};
+
+                copy.imageSubresource.mipLevel = mip;
+                copy.imageOffset = {x, y, 0};
+                copy.imageExtent = extent;
+
+                if(slot != UINT32_MAX){
+                    forgetEvictedBind(request.pageId);     //The region is rebound below, a later unbind must not clobber it
+
+                    VkSparseImageMemoryBind bind{};
+                    bind.subresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0};
+                    bind.offset = {x, y, 0};
+                    bind.extent = extent;
+                    bind.memory = sparsePool;
+                    bind.memoryOffset = slot * sparsePageStride;
+                    binds.push_back(bind);
+                }
+            } else {
+                copy.imageOffset = {static_cast<int32_t>((slot % cacheSide) * header.pageSize), static_cast<int32_t>((slot / cacheSide) * header.pageSize), 0};
+                copy.imageExtent = {header.pageSize, header.pageSize, 1};
+            }
+            copies.push_back(copy);
+
+            retiredStaging[frameIndex].push_back(request.stagingSlot);
+            inFlight.erase(request.pageId);
+            resident[request.pageId] = slot;
+            refreshTable(request.pageId);
+        }
+
+        ready.swap(deferred);
+    }
+
+
+    void unbindEvicted(uint32_t slot, std::vector<VkSparseImageMemoryBind>& binds){   //Sparse memory may only back one region at a time
+        for(size_t i = 0; i < evictedBinds.size(); i++){
+            if(evictedBinds[i].second != slot) continue;
+
+            uint32_t pageId = evictedBinds[i].first;
+            uint32_t mip = pageMip(pageId);
+            uint32_t width = std::max(1u, header.width >> mip);
+            uint32_t height = std::max(1u, header.height >> mip);
+            uint32_t x = pageX(pageId) * header.pageSize;
+            uint32_t y = pageY(pageId) * header.pageSize;
+
+            VkSparseImageMemoryBind bind{};
+            bind.subresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0};
+            bind.offset = {static_cast<int32_t>(x), static_cast<int32_t>(y), 0};
+            bind.extent = {std::min(header.pageSize, width - x), std::min(header.pageSize, height - y), 1};
+            bind.memory = VK_NULL_HANDLE;
+            binds.push_back(bind);
+
+            evictedBinds.erase(evictedBinds.begin() + i);
+            return;
+        }
+    }
+
+
+    void forgetEvictedBind(uint32_t pageId){
+        evictedBinds.erase(std::remove_if(evictedBinds.begin(), evictedBinds.end(), [pageId](const std::pair<uint32_t, uint32_t>& evicted){
+            return evicted.first == pageId;
+        }), evictedBinds.end());
+    }
+
+
+    void submitBinds(const std::vector<VkSparseImageMemoryBind>& binds, uint32_t frameIndex){
+        VkSparseImageMemoryBindInfo imageBind{};
+        imageBind.image = cacheImage;
+        imageBind.bindCount = static_cast<uint32_t>(binds.size());
+        imageBind.pBinds = binds.data();
+
+        VkBindSparseInfo bindInfo{};
+        bindInfo.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+        bindInfo.imageBindCount = 1;
+        bindInfo.pImageBinds = &imageBind;
+        bindInfo.signalSemaphoreCount = 1;
+        bindInfo.pSignalSemaphores = &bindSemaphores[frameIndex];
+
+        if(submissions->bindSparse(sparseQueue, 1, &bindInfo, VK_NULL_HANDLE) != VK_SUCCESS){
+            throw std::runtime_error("Failed to bind virtual texture pages");
+        }
+        bindSemaphorePending[frameIndex] = true;
+    }
+
+
+    void maintainReserve(uint32_t frameIndex){  //Evict ahead of time so slots are out of quarantine when loads land
+        size_t reserve = maxUploadsPerFrame;
+        size_t available = freeSlots.size();
+        for(const auto& list : quarantine) available += list.size();
+
+        while(available < reserve && !lru.empty()){
+            uint32_t slot = lru.back();
+            if(slots[slot].lastUsed + framesInFlight >= frame) break;   //Everything left is in active use
+
+            lru.pop_back();
+            Slot& info = slots[slot];
+            resident.erase(info.pageId);
+            refreshTable(info.pageId);
+            if(sparse){
+                evictedBinds.push_back({info.pageId, slot});
+            }
+            info.used = false;
+
+            quarantine[frameIndex].push_back(slot);
+            available++;
+        }
+    }
+
+
+    ////////////////////////////////////////// Page table ///////////////////////////////////////////////////////////////////////////////////////////////////
+
+    uint32_t tableEntry(uint32_t mip, uint32_t x, uint32_t y) const {
+        auto found = resident.find(makePageId(mip, x, y));
+        if(found != resident.end()){
+            uint32_t slot = found->second;
+            uint32_t cacheX = slot == UINT32_MAX ? 0 : slot % cacheSide;
+            uint32_t cacheY = slot == UINT32_MAX ? 0 : slot / cacheSide;
+            return cacheX | (cacheY << 8) | (mip << 16) | (0xFFu << 24);
+        }
+        if(mip + 1 < header.mipCount){
+            return table[tableOffset[mip + 1] + (y >> 1) * tableWidth[mip + 1] + (x >> 1)];
+        }
+        return 0;
+    }
+
+
+    void refreshTable(uint32_t pageId){     //Recompute every entry at or below this page that may fall back to it
+        uint32_t mip = pageMip(pageId);
+
+        for(int32_t level = static_cast<int32_t>(mip); level >= 0; level--){
+            uint32_t scale = 1u << (mip - level);
+            uint32_t x0 = pageX(pageId) * scale, x1 = std::min((pageX(pageId) + 1) * scale, pagesX[level]);
+            uint32_t y0 = pageY(pageId) * scale, y1 = std::min((pageY(pageId) + 1) * scale, pagesY[level]);
+            if(x0 >= x1 || y0 >= y1) break;
+
+            for(uint32_t y = y0; y < y1; y++){
+                for(uint32_t x = x0; x < x1; x++){
+                    table[tableOffset[level] + y * tableWidth[level] + x] = tableEntry(level, x, y);
+                }
+            }
+            markDirty(level, x0, y0, x1, y1);
+        }
+    }
+
+
+    void markDirty(uint32_t mip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1){
+        if(!dirtyMip[mip]){
+            dirty[mip] = {{static_cast<int32_t>(x0), static_cast<int32_t>(y0)}, {x1 - x0, y1 - y0}};
+            dirtyMip[mip] = true;
+            return;
+        }
+
+        uint32_t minX = std::min<uint32_t>(dirty[mip].offset.x, x0);
+        uint32_t minY = std::min<uint32_t>(dirty[mip].offset.y, y0);
+        uint32_t maxX = std::max<uint32_t>(dirty[mip].offset.x + dirty[mip].extent.width, x1);
+        uint32_t maxY = std::max<uint32_t>(dirty[mip].offset.y + dirty[mip].extent.height, y1);
+        dirty[mip] = {{static_cast<int32_t>(minX), static_cast<int32_t>(minY)}, {maxX - minX, maxY - minY}};
+    }
+
+
+    void stagePageTable(uint32_t frameIndex, std::vector<VkBufferImageCopy>& copies){
+        VkDeviceSize base = stagingSlotCount * pageBytes + frameIndex * tableTexels * sizeof(uint32_t);
+        uint32_t* staging = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(stagingBuffer->mapped) + base);
+
+        for(uint32_t mip = 0; mip < header.mipCount; mip++){
+            if(!dirtyMip[mip]) continue;
+            dirtyMip[mip] = false;
+
+            const VkRect2D& rect = dirty[mip];
+            for(uint32_t y = rect.offset.y; y < rect.offset.y + rect.extent.height; y++){
+                VkDeviceSize row = tableOffset[mip] + y * tableWidth[mip] + rect.offset.x;
+                memcpy(staging + row, table.data() + row, rect.extent.width * sizeof(uint32_t));
+            }
+
+            VkBufferImageCopy copy{};
+            copy.bufferOffset = base + (tableOffset[mip] + rect.offset.y * tableWidth[mip] + rect.offset.x) * sizeof(uint32_t);
+            copy.bufferRowLength = tableWidth[mip];
+            copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1};
+            copy.imageOffset = {rect.offset.x, rect.offset.y, 0};
+            copy.imageExtent = {rect.extent.width, rect.extent.height, 1};
+            copies.push_back(copy);
+        }
+    }
+
+
+    void transition(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                    VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+    {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1};
+
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+
+    void recordUploads(VkCommandBuffer commandBuffer, const std::vector<VkBufferImageCopy>& pageCopies, const std::vector<VkBufferImageCopy>& tableCopies){
+        //Previous frames sample both images; the barrier orders the copies after them on the queue
+        VkImageLayout oldLayout = initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags readStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+        transition(commandBuffer, pageTableImage, oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, readStage, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        transition(commandBuffer, cacheImage, oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, readStage, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        if(!pageCopies.empty()){
+            vkCmdCopyBufferToImage(commandBuffer, stagingBuffer->buffer, cacheImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(pageCopies.size()), pageCopies.data());
+        }
+        if(!tableCopies.empty()){
+            vkCmdCopyBufferToImage(commandBuffer, stagingBuffer->buffer, pageTableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(tableCopies.size()), tableCopies.data());
+        }
+
+        transition(commandBuffer, pageTableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, readStage);
+        transition(commandBuffer, cacheImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, readStage);
+
+        initialized = true;
+    }
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+/*
+Compile-time checked Vulkan struct setup:
+    1) makeInfo<T>() returns a zeroed T with the right sType, so the sType/struct pairing is written once here
+       instead of at every call site
+    2) StructChain<Root, Links...> owns a root struct plus the extension structs in its pNext chain. Every link is
+       checked against the root at compile time (StructExtends), duplicates are rejected, and the pointers are
+       relinked on copy. unlink<T>() drops an optional struct from the chain at runtime
+    3) VERTEX_LAYOUT(Vertex, members...) reflects a vertex struct: each member's VkFormat comes from its C++ type
+       (VertexFormatOf), offsets from offsetof and the stride from sizeof. The layout must cover the struct with no
+       gaps, so padding that would be fetched for nothing is a compile error. vertexInputState<Vertex>() hands the
+       result to a pipeline; the arrays are constexpr statics, nothing is built at runtime
+*/
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+
+////////////////////////////////////////// sType traits //////////////////////////////////////////
+
+template<typename T>
+struct StructureTypeOf {
+    static_assert(sizeof(T) == 0, "No sType registered for this struct, add it with VK_STRUCTURE_TYPE_OF");
+};
+
+#define VK_STRUCTURE_TYPE_OF(Type, sTypeValue) \
+    template<> struct StructureTypeOf<Type> { static constexpr VkStructureType value = sTypeValue; };
+
+VK_STRUCTURE_TYPE_OF(VkApplicationInfo, VK_STRUCTURE_TYPE_APPLICATION_INFO)
+VK_STRUCTURE_TYPE_OF(VkInstanceCreateInfo, VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkDebugUtilsMessengerCreateInfoEXT, VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT)
+VK_STRUCTURE_TYPE_OF(VkDeviceQueueCreateInfo, VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkDeviceCreateInfo, VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkSwapchainCreateInfoKHR, VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR)
+VK_STRUCTURE_TYPE_OF(VkPresentInfoKHR, VK_STRUCTURE_TYPE_PRESENT_INFO_KHR)
+VK_STRUCTURE_TYPE_OF(VkPresentIdKHR, VK_STRUCTURE_TYPE_PRESENT_ID_KHR)
+VK_STRUCTURE_TYPE_OF(VkCommandBufferInheritanceInfo, VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO)
+VK_STRUCTURE_TYPE_OF(VkImageViewCreateInfo, VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkRenderPassCreateInfo, VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkFramebufferCreateInfo, VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkRenderPassBeginInfo, VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineVertexInputStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineInputAssemblyStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineViewportStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineRasterizationStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineMultisampleStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineDepthStencilStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineColorBlendStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineDynamicStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkGraphicsPipelineCreateInfo, VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPipelineLayoutCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceFeatures2, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceBufferDeviceAddressFeatures, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceTimelineSemaphoreFeatures, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDevicePresentIdFeaturesKHR, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDevicePresentWaitFeaturesKHR, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceProperties2, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceExternalMemoryHostPropertiesEXT, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT)
+
+
+template<typename T>
+constexpr T makeInfo(){
+    T info{};
+    info.sType = StructureTypeOf<T>::value;
+    return info;
+}
+
+
+////////////////////////////////////////// pNext chains //////////////////////////////////////////
+
+//Which structs the spec allows in the pNext chain of which root (the "structextends" list of each struct)
+template<typename T, typename Root>
+struct StructExtends : std::false_type {};
+
+#define VK_STRUCT_EXTENDS(Type, Root) \
+    template<> struct StructExtends<Type, Root> : std::true_type {};
+
+VK_STRUCT_EXTENDS(VkDebugUtilsMessengerCreateInfoEXT, VkInstanceCreateInfo)
+VK_STRUCT_EXTENDS(VkPhysicalDeviceFeatures2, VkDeviceCreateInfo)
+VK_STRUCT_EXTENDS(VkPhysicalDeviceBufferDeviceAddressFeatures, VkDeviceCreateInfo)
+VK_STRUCT_EXTENDS(VkPhysicalDeviceBufferDeviceAddressFeatures, VkPhysicalDeviceFeatures2)
+VK_STRUCT_EXTENDS(VkPhysicalDeviceTimelineSemaphoreFeatures, VkDeviceCreateInfo)
+VK_STRUCT_EXTENDS(VkPhysicalDeviceTimelineSemaphoreFeatures, VkPhysicalDeviceFeatures2)
+VK_STRUCT_EXTENDS(VkPhysicalDevicePresentIdFeaturesKHR, VkDeviceCreateInfo)
+VK_STRUCT_EXTENDS(VkPhysicalDevicePresentIdFeaturesKHR, VkPhysicalDeviceFeatures2)
+VK_STRUCT_EXTENDS(VkPhysicalDevicePresentWaitFeaturesKHR, VkDeviceCreateInfo)
+VK_STRUCT_EXTENDS(VkPhysicalDevicePresentWaitFeaturesKHR, VkPhysicalDeviceFeatures2)
+VK_STRUCT_EXTENDS(VkPresentIdKHR, VkPresentInfoKHR)
+VK_STRUCT_EXTENDS(VkPhysicalDeviceExternalMemoryHostPropertiesEXT, VkPhysicalDeviceProperties2)
+
+
+template<typename T, typename... Others>
+constexpr bool isUniqueType(){
+    return !(std::is_same<T, Others>::value || ...);
+}
+
+template<typename T, typename... Rest>
+constexpr bool allUniqueTypes(){
+    if constexpr(sizeof...(Rest) == 0){
+        return true;
+    } else {
+        return isUniqueType<T, Rest...>() && allUniqueTypes<Rest...>();
+    }
+}
+
+
+template<typename Root, typename... Links>
+class StructChain {
+    static_assert((StructExtends<Links, Root>::value && ...), "Struct is not allowed in the pNext chain of this root");
+    static_assert(allUniqueTypes<Root, Links...>(), "A struct may appear only once in a pNext chain");
+
+public:
+    StructChain() : structs(makeInfo<Root>(), makeInfo<Links>()...) {
+        link(std::index_sequence_for<Root, Links...>{});
+    }
+
+    StructChain(const StructChain& other) : structs(other.structs) {   //Copied pointers would point into other
+        link(std::index_sequence_for<Root, Links...>{});
+    }
+
+    StructChain& operator=(const StructChain& other){
+        structs = other.structs;
+        link(std::index_sequence_for<Root, Links...>{});
+        return *this;
+    }
+
+
+    Root& root(){ return std::get<Root>(structs); }
+
+    template<typename T>
+    T& get(){ return std::get<T>(structs); }
+
+
+    template<typename T>
+    void unlink(){      //Removes T from the chain; its contents stay but the driver never sees them
+        static_assert(!std::is_same<T, Root>::value, "The root struct cannot be unlinked");
+
+        T& target = std::get<T>(structs);
+        void* after = const_cast<void*>(static_cast<const void*>(target.pNext));
+        std::apply([&](auto&... each){
+            ((each.pNext == &target ? (void)(each.pNext = after) : (void)0), ...);
+        }, structs);
+        target.pNext = nullptr;
+    }
+
+
+private:
+    std::tuple<Root, Links...> structs;
+
+
+    template<size_t... I>
+    void link(std::index_sequence<I...>){   //Walks back to front so every struct points at its successor
+        constexpr size_t count = sizeof...(I);
+        void* next = nullptr;
+        ((std::get<count - 1 - I>(structs).pNext = std::exchange(next, static_cast<void*>(&std::get<count - 1 - I>(structs)))), ...);
+    }
+};
+
+
+////////////////////////////////////////// Vertex layout reflection //////////////////////////////////////////
+
+//Typed wrappers for packed attributes whose raw storage type would be ambiguous (a uint16_t could be UINT, UNORM or a half)
+struct Half2 { uint16_t v[2]; };
+struct Half4 { uint16_t v[4]; };
+struct Unorm8x4 { uint8_t v[4]; };
+struct Snorm8x4 { int8_t v[4]; };
+struct Unorm16x2 { uint16_t v[2]; };
+struct Snorm16x2 { int16_t v[2]; };
+struct Uint8x4 { uint8_t v[4]; };
+
+
+template<typename T>
+struct VertexFormatOf {
+    static_assert(sizeof(T) == 0, "No VkFormat for this vertex member type, add it with VK_VERTEX_FORMAT_OF");
+};
+
+#define VK_VERTEX_FORMAT_OF(Type, formatValue) \
+    template<> struct VertexFormatOf<Type> { static constexpr VkFormat value = formatValue; };
+
+VK_VERTEX_FORMAT_OF(float, VK_FORMAT_R32_SFLOAT)
+VK_VERTEX_FORMAT_OF(float[2], VK_FORMAT_R32G32_SFLOAT)
+VK_VERTEX_FORMAT_OF(float[3], VK_FORMAT_R32G32B32_SFLOAT)
+VK_VERTEX_FORMAT_OF(float[4], VK_FORMAT_R32G32B32A32_SFLOAT)
+VK_VERTEX_FORMAT_OF(uint32_t, VK_FORMAT_R32_UINT)
+VK_VERTEX_FORMAT_OF(uint32_t[2], VK_FORMAT_R32G32_UINT)
+VK_VERTEX_FORMAT_OF(uint32_t[3], VK_FORMAT_R32G32B32_UINT)
+VK_VERTEX_FORMAT_OF(uint32_t[4], VK_FORMAT_R32G32B32A32_UINT)
+VK_VERTEX_FORMAT_OF(int32_t, VK_FORMAT_R32_SINT)
+VK_VERTEX_FORMAT_OF(Half2, VK_FORMAT_R16G16_SFLOAT)
+VK_VERTEX_FORMAT_OF(Half4, VK_FORMAT_R16G16B16A16_SFLOAT)
+VK_VERTEX_FORMAT_OF(Unorm8x4, VK_FORMAT_R8G8B8A8_UNORM)
+VK_VERTEX_FORMAT_OF(Snorm8x4, VK_FORMAT_R8G8B8A8_SNORM)
+VK_VERTEX_FORMAT_OF(Unorm16x2, VK_FORMAT_R16G16_UNORM)
+VK_VERTEX_FORMAT_OF(Snorm16x2, VK_FORMAT_R16G16_SNORM)
+VK_VERTEX_FORMAT_OF(Uint8x4, VK_FORMAT_R8G8B8A8_UINT)
+
+
+struct VertexMember {
+    VkFormat format;
+    uint32_t offset;
+    uint32_t size;
+};
+
+
+template<typename Vertex>
+struct VertexReflection {
+    static_assert(sizeof(Vertex) == 0, "Vertex type has no VERTEX_LAYOUT");
+};
+
+
+template<typename Vertex>
+constexpr bool vertexLayoutIsPacked(){  //Members in declaration order, back to back, ending exactly at the stride
+    constexpr auto& members = VertexReflection<Vertex>::members;
+    uint32_t end = 0;
+    for(const VertexMember& member : members){
+        if(member.offset != end) return false;
+        end += member.size;
+    }
+    return end == sizeof(Vertex);
+}
+
+
+//VERTEX_LAYOUT(Vertex, a, b, c) expands every member into a VertexMember; supports up to 8 members
+#define VK_DETAIL_EXPAND(x) x
+#define VK_DETAIL_MEMBER(Type, member) \
+    VertexMember{VertexFormatOf<std::remove_cv_t<decltype(Type::member)>>::value, static_cast<uint32_t>(offsetof(Type, member)), static_cast<uint32_t>(sizeof(Type::member))}
+#define VK_DETAIL_MEMBERS_1(Type, m) VK_DETAIL_MEMBER(Type, m)
+#define VK_DETAIL_MEMBERS_2(Type, m, ...) VK_DETAIL_MEMBER(Type, m), VK_DETAIL_EXPAND(VK_DETAIL_MEMBERS_1(Type, __VA_ARGS__))
+#define VK_DETAIL_MEMBERS_3(Type, m, ...) VK_DETAIL_MEMBER(Type, m), VK_DETAIL_EXPAND(VK_DETAIL_MEMBERS_2(Type, __VA_ARGS__))
+#define VK_DETAIL_MEMBERS_4(Type, m, ...) VK_DETAIL_MEMBER(Type, m), VK_DETAIL_EXPAND(VK_DETAIL_MEMBERS_3(Type, __VA_ARGS__))
+#define VK_DETAIL_MEMBERS_5(Type, m, ...) VK_DETAIL_MEMBER(Type, m), VK_DETAIL_EXPAND(VK_DETAIL_MEMBERS_4(Type, __VA_ARGS__))
+#define VK_DETAIL_MEMBERS_6(Type, m, ...) VK_DETAIL_MEMBER(Type, m), VK_DETAIL_EXPAND(VK_DETAIL_MEMBERS_5(Type, __VA_ARGS__))
+#define VK_DETAIL_MEMBERS_7(Type, m, ...) VK_DETAIL_MEMBER(Type, m), VK_DETAIL_EXPAND(VK_DETAIL_MEMBERS_6(Type, __VA_ARGS__))
+#define VK_DETAIL_MEMBERS_8(Type, m, ...) VK_DETAIL_MEMBER(Type, m), VK_DETAIL_EXPAND(VK_DETAIL_MEMBERS_7(Type, __VA_ARGS__))
+#define VK_DETAIL_PICK(_1, _2, _3, _4, _5, _6, _7, _8, NAME, ...) NAME
+#define VK_DETAIL_MEMBERS(Type, ...) VK_DETAIL_EXPAND(VK_DETAIL_PICK(__VA_ARGS__, VK_DETAIL_MEMBERS_8, VK_DETAIL_MEMBERS_7, VK_DETAIL_MEMBERS_6, \
+    VK_DETAIL_MEMBERS_5, VK_DETAIL_MEMBERS_4, VK_DETAIL_MEMBERS_3, VK_DETAIL_MEMBERS_2, VK_DETAIL_MEMBERS_1)(Type, __VA_ARGS__))
+
+#define VERTEX_LAYOUT(Type, ...) \
+    template<> struct VertexReflection<Type> { \
+        static_assert(std::is_standard_layout<Type>::value, #Type " must be standard layout for offsetof"); \
+        static constexpr VertexMember members[] = { VK_DETAIL_MEMBERS(Type, __VA_ARGS__) }; \
+    }; \
+    static_assert(vertexLayoutIsPacked<Type>(), #Type ": VERTEX_LAYOUT must list every member in order with no padding");
+
+
+template<typename Vertex>
+constexpr uint32_t vertexAttributeCount(){
+    return static_cast<uint32_t>(std::size(VertexReflection<Vertex>::members));
+}
+
+
+template<typename Vertex>
+constexpr VkVertexInputBindingDescription vertexBinding(uint32_t binding = 0, VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX){
+    return VkVertexInputBindingDescription{binding, static_cast<uint32_t>(sizeof(Vertex)), inputRate};
+}
+
+
+template<typename Vertex>
+constexpr std::array<VkVertexInputAttributeDescription, vertexAttributeCount<Vertex>()> vertexAttributes(uint32_t binding = 0, uint32_t firstLocation = 0){
+    constexpr auto& members = VertexReflection<Vertex>::members;
+    std::array<VkVertexInputAttributeDescription, vertexAttributeCount<Vertex>()> attributes{};
+    for(uint32_t i = 0; i < attributes.size(); i++){
+        attributes[i] = VkVertexInputAttributeDescription{firstLocation + i, binding, members[i].format, members[i].offset};
+    }
+    return attributes;
+}
+
+
+template<typename Vertex>
+struct VertexInputDescription {     //Static storage for a single binding at 0, locations from 0 in member order
+    static constexpr VkVertexInputBindingDescription binding = vertexBinding<Vertex>();
+    static constexpr auto attributes = vertexAttributes<Vertex>();
+};
+
+
+template<typename Vertex>
+VkPipelineVertexInputStateCreateInfo vertexInputState(){
+    VkPipelineVertexInputStateCreateInfo state = makeInfo<VkPipelineVertexInputStateCreateInfo>();
+    state.vertexBindingDescriptionCount = 1;
+    state.pVertexBindingDescriptions = &VertexInputDescription<Vertex>::binding;
+    state.vertexAttributeDescriptionCount = vertexAttributeCount<Vertex>();
+    state.pVertexAttributeDescriptions = VertexInputDescription<Vertex>::attributes.data();
+    return state;
+}
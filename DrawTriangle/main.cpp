@@ -26,11 +26,72 @@ Basic Process:
 #include <cstdint>
 #include <limits>
 #include <algorithm>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <utility>
+
+#include "DeviceAllocator.h"
+#include "Defragmenter.h"
+#include "VirtualTexture.h"
+#include "UploadContext.h"
+#include "GpuScene.h"
+#include "GpuResources.h"
+#include "JobSystem.h"
+#include "ShaderVariants.h"
+#include "VulkanTypes.h"
+#include "Profiler.h"
+#include "GpuProfiler.h"
+#include "FramePacket.h"
+#include "MathUtil.h"
+#include "SimulationClock.h"
+#include "LatencyTracker.h"
+#include "LateLatch.h"
+#include "CommandCache.h"
+#include "SubmissionQueue.h"
+#include "PresentThread.h"
+#include "Async.h"
+#include "FrameArena.h"
+#include "SoftwareRasterizer.h"
+#include "ImageCompare.h"
+#include "VideoEncoder.h"
+#include "SharedFrames.h"
+#include "GltfLoader.h"
+#include "SceneCache.h"
+#include "Bvh.h"
+#include "FrameExport.h"
+#include "PickBuffer.h"
 
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
+const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+const double DEFRAG_BUDGET_MS = 0.5;   //CPU time per frame the defragmenter may spend planning/retiring moves
+const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+const double SIMULATION_STEP_S = 1.0 / 60.0;   //Fixed update rate, independent of the present mode
+const double SIMULATION_IDLE_WAIT_S = 0.0005;   //Event wait while the render thread still has a packet queued
+const char* TRACE_PATH = "trace.json";     //Chrome trace of the run, open in chrome://tracing or ui.perfetto.dev
+const char* SOFTWARE_FRAME_PATH = "software_frame.ppm";     //Headless software rendering writes its frames here
+const uint64_t SOFTWARE_DUMP_INTERVAL = 60;     //Frames between headless dumps
+const uint64_t SOFTWARE_HEADLESS_FRAMES = 600;  //Without a window nothing asks to close, so headless runs stop after this many
+const float SCENE_SPIN_RAD_S = 0.5f;            //Default --spin, how fast loaded objects turn about their own centers
+const uint64_t GOLDEN_FRAME = 120;              //Frame compared in --golden runs, two simulated seconds in
+const char* GOLDEN_ACTUAL_PATH = "golden_actual.ppm";       //Written when a --golden comparison fails
+const char* GOLDEN_HEATMAP_PATH = "golden_heatmap.ppm";
+const ImageTolerance VULKAN_GOLDEN_TOLERANCE{8, 0.01, 0.95};    //--vulkan golden runs; edge coverage and float precision differ from the software rasterizer
+const uint32_t VIDEO_FPS = 60;                  //One simulation step per frame in offscreen runs, see SIMULATION_STEP_S
+const uint64_t VIDEO_DEFAULT_FRAMES = 600;
+const uint32_t SHARED_FRAME_SLOTS = MAX_FRAMES_IN_FLIGHT + 2;  //Frames in flight hold their slots until they retire, readers get the rest
+const char* SCENE_CACHE_SUFFIX = ".scenecache";     //Appended to the --scene path, see SceneCache.h
+const char* SCENE_VERTEX_SHADER_PATH = "shaders/scene.vert.spv";
+const char* SCENE_FRAGMENT_SHADER_PATH = "shaders/scene.frag.spv";
+const char* SCENE_VIRTUAL_FRAGMENT_SHADER_PATH = "shaders/scene_virtual.frag.spv";    //scene.frag built with SCENE_VIRTUAL_TEXTURE
+const uint32_t SCENE_FEATURE_VERTEX_COLOR = 1;      //Shader variant features, match shaders/scene.vert
+const uint32_t SCENE_FEATURES = SCENE_FEATURE_VERTEX_COLOR;    //Of every draw; glTF vertex colors default to white
+
 
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
@@ -42,6 +103,30 @@ struct QueueFamilyIndices {
 };
 
 
+struct SceneObject {         //Simulation side record of one GpuScene object
+    uint32_t object;
+    MeshHandle mesh;
+    uint32_t material;
+    float model[16];        //Fixed object to world placement (a glTF node's world matrix), the animated transform applies on top
+    Transform previous;     //State before and after the last fixed step, rendering blends between them
+    Transform current;
+    Vec3 angularVelocity;   //Axis * radians per second
+    Vec3 pivot;             //World space point the rotation turns about, the model's bounding sphere center
+    Vec3 center;            //Bounding sphere in object space
+    float radius;           //Already scaled by model
+    bool moved = true;      //Transform changed since the last packet was built
+    bool swept = false;     //BVH box still covers the previous step's transform as well
+};
+
+
+struct ScenePushConstants {     //Matches Push in shaders/scene.vert
+    VkDeviceAddress scene;      //GpuSceneTable of the frame in flight
+    VkDeviceAddress camera;     //LateLatchBuffer slot of the frame in flight
+    uint32_t features;          //Only read by the dynamic fallback variant
+    uint32_t padding;
+};
+
+
 struct SwapChainSupportDetails{
     VkSurfaceCapabilitiesKHR capabilities;
     std::vector<VkSurfaceFormatKHR> formats;
@@ -49,6 +134,14 @@ struct SwapChainSupportDetails{
 };
 
 
+struct SoftwareGl {     //GL 1.1 entry points for showing software frames; loaded through GLFW, the binary does not link libGL
+    void (APIENTRY* pixelStorei)(GLenum, GLint) = nullptr;
+    void (APIENTRY* rasterPos2f)(GLfloat, GLfloat) = nullptr;
+    void (APIENTRY* pixelZoom)(GLfloat, GLfloat) = nullptr;
+    void (APIENTRY* drawPixels)(GLsizei, GLsizei, GLenum, GLenum, const void*) = nullptr;
+};
+
+
 const std::vector<const char*> validationLayers = {     //Like extensions, validation layers need to be enabled by specifying their name
     "VK_LAYER_KHRONOS_validation"
 };
@@ -99,13 +192,67 @@ class HelloTriangleApplication {
 
 public:
     void run() {
-        initWindow();
+        if(goldenVulkan && (goldenPath.empty() || !videoPath.empty())){     //Video frames only come from the software rasterizer
+            throw std::runtime_error("--vulkan needs --golden or --update-golden, and no --video");
+        }
+        if(!isHeadless()){
+            initWindow();
+        } else {
+            window = nullptr;   //Software offscreen runs need no display
+        }
         initVulkan();
-        mainLoop();
+        if(!isOffscreen()){
+            mainLoop();
+        } else {
+            offscreenLoop();
+        }
         cleanup();
     }
 
 
+    void setGoldenTest(const std::string& referencePath, bool update){  //Before run(); renders GOLDEN_FRAME headless and compares it
+        goldenPath = referencePath;
+        goldenUpdate = update;
+    }
+
+
+    void setGoldenOnVulkan(bool vulkan){    //Before run(); the golden frame is rendered by the Vulkan renderer into a hidden window
+        goldenVulkan = vulkan;
+    }
+
+
+    void setVideoOutput(const std::string& path, uint64_t frames){     //Before run(); renders frames headless into a .y4m file
+        videoPath = path;
+        videoFrames = frames;
+    }
+
+
+    void setFrameSharing(const std::string& name){      //Before run(); publishes every frame in shared memory, see SharedFrames.h
+        sharedFramesName = name;
+    }
+
+
+    void setScenePath(const std::string& path){     //Before run(); glTF/GLB file to show
+        scenePath = path;
+    }
+
+
+    void setSpin(float radiansPerSecond){   //Before run(); angular speed of the loaded objects, 0 keeps them still
+        spin = radiansPerSecond;
+    }
+
+
+    void setVirtualTexture(const std::string& packPath, const std::string& name){   //Before run(); pack entry the scene is textured with
+        virtualTexturePackPath = packPath;
+        virtualTextureName = name;
+    }
+
+
+    bool offscreenRunFailed() const { return offscreenFailed; }
+
+    uint32_t getPickedObject() const { return pickedObject; }  //Simulation thread; scene object of the last click, UINT32_MAX for none
+
+
 private:
     GLFWwindow* window;
     VkInstance instance;
@@ -116,12 +263,95 @@ private:
     
     VkQueue graphicsQueue;
     VkQueue presentQueue;   //Presentation queue
+    bool sparseResidencySupported = false;  //graphicsQueue can bind sparse images; virtualTexture uses the indirection atlas otherwise
+    bool bufferDeviceAddressSupported = false;
+    bool presentWaitSupported = false;              //VK_KHR_present_id + VK_KHR_present_wait, lets LatencyTracker see when frames hit the screen
+    bool calibratedTimestampsSupported = false;     //GPU zones are aligned to CPU time by VK_EXT_calibrated_timestamps
+    bool externalMemoryHostSupported = false;       //VK_EXT_external_memory_host, host memory can back buffers directly
 
     VkSurfaceKHR surface;
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
+    uint32_t swapChainMinImageCount = 0;        //Surface minimum, bounds how many images may be held at once
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
+    bool swapChainExportable = false;   //Images were created with TRANSFER_SRC usage, for frameExport
+    std::vector<VkImageView> swapChainImageViews;
+    std::vector<VkFramebuffer> swapChainFramebuffers;  //One per swap chain image
+    VkRenderPass renderPass;            //The frame's single pass, see createRenderPass
+    VkFormat depthFormat;
+    ImageHandle depthImage;             //Shared by all frames in flight, the pass orders their use of it
+
+    VkCommandPool commandPool;
+    std::vector<VkCommandBuffer> commandBuffers;        //One per frame in flight
+    std::vector<VkSemaphore> renderFinishedSemaphores;  //One per swap chain image, presentation may still hold older ones
+    std::vector<SubmitTicket> frameTickets;         //Submission that last used each frame slot
+    FrameArenas frameArenas;                        //Per-thread scratch memory of each frame slot, reset when the slot retires
+    uint32_t currentFrame = 0;
+
+    FramePipe framePipe;                    //Simulation thread -> render thread, see FramePacket.h
+    std::thread renderThread;
+    std::atomic<bool> renderRunning{false};
+    std::atomic<bool> renderFailed{false};  //The render thread ended on an exception, the simulation loops stop
+    std::exception_ptr renderError;         //Set before renderFailed, rethrown by stopRenderThread
+    std::vector<SceneObject> sceneObjects;  //Simulation side view of what is drawn
+    Bvh sceneBvh;                           //Over sceneObjects, rebuilt when objects are added; culling and picking query it
+    uint32_t pickedObject = UINT32_MAX;     //Index into sceneObjects of the last click, UINT32_MAX for none
+    uint32_t pickSequence = 0;              //Of the last click; id buffer answers to older clicks are ignored
+    bool pickQueued = false;                //The last click still has to go out with a packet
+    int32_t pickPixel[2] = {0, 0};
+    SimulationClock simulationClock;
+    LatencyTracker latencyTracker;
+    PresentThread presentThread;            //Acquires and presents so the render thread never blocks in the driver
+    uint64_t pendingInputNs = 0;            //Earliest input event not yet folded into a frame packet
+    double cursorX = 0.0;                   //Framebuffer pixels, not the screen units GLFW reports
+    double cursorY = 0.0;
+    LatchedUniforms latchState{};           //Simulation thread's newest camera/cursor, published through latchMailbox
+    LatchMailbox<LatchedUniforms> latchMailbox;
+    LateLatchBuffer lateLatch;
+    CommandCache drawCache;                 //Secondary buffers for packet.draws, re-recorded only when the list changes
+    uint64_t drawCacheMeshGeneration = 0;
+    float cameraAngle = 0.0f;
+    float previousCameraAngle = 0.0f;
+
+    GpuProfiler gpuProfiler;
+    DeviceAllocator allocator;      //Suballocates device memory blocks, see DeviceAllocator.h
+    GpuResources resources;         //Buffers, images and pipelines behind generational handles, see GpuResources.h
+    Defragmenter defragmenter;
+    UploadContext uploadContext;
+    SubmissionQueue submissions;    //Every vkQueueSubmit/vkQueuePresentKHR goes through here, see SubmissionQueue.h
+    GpuCompletion gpuCompletion;    //Resumes coroutines waiting on the GPU, see Async.h
+    GpuScene scene;                 //Only created when bufferDeviceAddressSupported; the render thread owns it and the defragmenter after init
+
+    JobSystem jobs;
+    VkPipelineCache pipelineCache;
+    ShaderVariantManager shaderVariants;
+    VkPipelineLayout scenePipelineLayout = VK_NULL_HANDLE;      //Push constants, plus virtualTexture's set when one is loaded; the rest is reached by address
+    VkShaderModule sceneShaders[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE};     //Vertex, fragment; variants compile from them until destroy
+    uint32_t sceneProgram = 0;
+    VkPipeline drawCachePipeline = VK_NULL_HANDLE;  //Variant the cached chunks were recorded with
+
+    bool softwareRendering = false;         //No usable Vulkan device; frames go through softwareRasterizer instead
+    SoftwareRasterizer softwareRasterizer;
+    SoftwareGl softwareGl;                  //Empty when headless
+    std::string goldenPath;                 //Reference image of a --golden run, empty otherwise
+    bool goldenUpdate = false;              //Write the reference instead of comparing against it
+    bool goldenVulkan = false;              //Render the golden frame with Vulkan instead of the software rasterizer
+    Allocation* goldenReadback = nullptr;   //Host copy of the swap chain image on GOLDEN_FRAME, Vulkan golden runs only
+    std::string videoPath;                  //Output of a --video run, empty otherwise
+    uint64_t videoFrames = VIDEO_DEFAULT_FRAMES;
+    VideoEncoder videoEncoder;
+    std::atomic<bool> offscreenFailed{false};   //Golden mismatch or video write error; the exit code reports it
+    std::string sharedFramesName;           //shm_open() name of --share-frames, empty otherwise
+    SharedFrameWriter sharedFrames;
+    FrameExport frameExport;                //Vulkan path only; the software path copies into sharedFrames itself
+    PickBuffer pickBuffer;                  //Vulkan path only; the software path reads its framebuffer's ids directly
+    std::string scenePath;                  //--scene glTF file, empty otherwise
+    float spin = SCENE_SPIN_RAD_S;          //--spin, radians per second
+    std::string virtualTexturePackPath;     //--virtual-texture asset pack, empty otherwise
+    std::string virtualTextureName;         //Entry of that pack
+    AssetPack virtualTexturePack;           //Mapped while virtualTexture streams pages out of it
+    VirtualTexture virtualTexture;          //Multiplies the scene's colors when virtualTexturePack is open
 
 
     void initWindow(){
@@ -129,41 +359,255 @@ private:
         
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);   // Set window behaviour characteristics
         glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_VISIBLE, goldenVulkan ? GLFW_FALSE : GLFW_TRUE);    //Golden runs only need the swap chain
 
         window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+        setWindowCallbacks();
+    }
+
+
+    void setWindowCallbacks(){
+        if(window == nullptr) return;   //No display; only the headless software renderer can run
+        glfwSetWindowUserPointer(window, this);     //Input callbacks stamp arrival time for latency measurement
+        glfwSetKeyCallback(window, keyCallback);
+        glfwSetMouseButtonCallback(window, mouseButtonCallback);
+        glfwSetCursorPosCallback(window, cursorPosCallback);
+        glfwSetScrollCallback(window, scrollCallback);
+    }
+
+
+    static HelloTriangleApplication* fromWindow(GLFWwindow* window){
+        return static_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+    }
+
+    static void keyCallback(GLFWwindow* window, int /*key*/, int /*scancode*/, int /*action*/, int /*mods*/){ fromWindow(window)->onInput(); }
+
+    static void mouseButtonCallback(GLFWwindow* window, int button, int action, int /*mods*/){
+        HelloTriangleApplication* app = fromWindow(window);
+        app->onInput();
+        if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS){
+            app->pickAtCursor();
+        }
+    }
+
+    static void scrollCallback(GLFWwindow* window, double /*xOffset*/, double /*yOffset*/){ fromWindow(window)->onInput(); }
+
+    static void cursorPosCallback(GLFWwindow* window, double x, double y){
+        HelloTriangleApplication* app = fromWindow(window);
+        int windowWidth = 0, windowHeight = 0, framebufferWidth = 0, framebufferHeight = 0;
+        glfwGetWindowSize(window, &windowWidth, &windowHeight);
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        if(windowWidth > 0 && windowHeight > 0){    //HiDPI displays have more framebuffer pixels than screen units
+            x *= static_cast<double>(framebufferWidth) / windowWidth;
+            y *= static_cast<double>(framebufferHeight) / windowHeight;
+        }
+        app->cursorX = x;
+        app->cursorY = y;
+        app->onInput();
+        app->publishLatch();
+    }
+
+
+    void onInput(){     //Called from glfwPollEvents on the simulation thread
+        uint64_t now = Profiler::steadyNanoseconds();
+        if(pendingInputNs == 0){
+            pendingInputNs = now;
+        }
+        latchState.inputTimestampNs = now;
+    }
+
+
+    void publishLatch(){    //Simulation thread; the render thread picks this up right before its next submit
+        latchState.cursor[0] = static_cast<float>(cursorX);
+        latchState.cursor[1] = static_cast<float>(cursorY);
+        latchState.cursor[2] = static_cast<float>(cursorX / swapChainExtent.width * 2.0 - 1.0);
+        latchState.cursor[3] = static_cast<float>(cursorY / swapChainExtent.height * 2.0 - 1.0);
+        latchMailbox.publish(latchState);
     }
 
 
     void initVulkan() {
+        PROFILE_THREAD("Main");
+        PROFILE_ZONE("initVulkan");
+        jobs.start();
+        if(isHeadless()){               //Same pixels on every machine, so golden references can be shared
+            initSoftwareRenderer(nullptr);
+            return;
+        }
+        if(!glfwVulkanSupported()){     //No loader or no driver at all
+            initSoftwareRenderer("Vulkan is not available");
+            return;
+        }
         createInstance();
         setupDebugMessenger();
         createSurface();
-        pickPhysicalDevice();
+        if(!pickPhysicalDevice()){
+            destroyInstance();
+            initSoftwareRenderer("Failed to find a suitable GPU");
+            return;
+        }
         createLogicalDevice();
         createSwapChain();
+        createProfiler();
+        createAllocator();
+        createScene();
+        loadScene();
+        loadVirtualTexture();
+        createRenderPass();
+        createFramebuffers();
+        createPipelineCache();
+        createScenePipeline();
+        createFrameResources();
+        createFrameSharing();
+        createGoldenCapture();
+        latencyTracker.init(device, swapChain, presentWaitSupported);
+        presentThread.init(device, swapChain, submissions, presentQueue, graphicsQueue, static_cast<uint32_t>(swapChainImages.size()),
+            swapChainMinImageCount, latencyTracker, presentWaitSupported);
+    }
+
+
+    void mainLoop() {       //This thread handles window events and simulation, the render thread records and presents
+        startRenderThread();
+
+        simulationClock.start(SIMULATION_STEP_S);
+        uint64_t frameNumber = 0;
+
+        while(!renderFailed && (window != nullptr ? !glfwWindowShouldClose(window) : frameNumber < SOFTWARE_HEADLESS_FRAMES)){  //update window until close cmd or error received
+            PROFILE_ZONE("Simulation tick");
+            if(window != nullptr){
+                PROFILE_ZONE("Poll events");
+                glfwPollEvents();
+            }
+            applyPickResults();
+            if(!softwareRendering && presentThread.isFailed()){
+                break;      //presentThread.stop() below rethrows the error
+            }
+            if(!softwareRendering && presentThread.isOutOfDate()){
+                recreateSwapChain();
+            }
+
+            uint32_t steps = simulationClock.advance();
+            for(uint32_t i = 0; i < steps; i++){
+                simulate(static_cast<float>(simulationClock.getStep()));
+            }
+
+            FramePacket* packet = framePipe.queued() == 0 ? framePipe.acquire() : nullptr;  //A queued packet would only add latency
+            if(packet == nullptr){
+                if(window != nullptr){
+                    glfwWaitEventsTimeout(SIMULATION_IDLE_WAIT_S);
+                } else {
+                    std::this_thread::sleep_for(std::chrono::duration<double>(SIMULATION_IDLE_WAIT_S));
+                }
+                continue;
+            }
+
+            buildFramePacket(*packet, frameNumber++, simulationClock.getAlpha());
+            framePipe.publish(packet);
+        }
+
+        stopRenderThread();
+        if(!softwareRendering){
+            presentThread.stop();
+        }
     }
 
 
-    void mainLoop() {
-        while(!glfwWindowShouldClose(window)){  //update window until close cmd or error received
-            glfwPollEvents();
+    void startRenderThread(){
+        renderRunning = true;
+        renderThread = std::thread([this]{
+            try {
+                if(softwareRendering){
+                    softwareRenderLoop();
+                } else {
+                    renderLoop();
+                }
+            } catch(...){       //Escaping the thread would terminate the process; the simulation thread rethrows it
+                renderError = std::current_exception();
+                renderFailed = true;
+            }
+        });
+    }
+
+
+    void stopRenderThread(){    //Packets it has not taken stay queued for the next start; rethrows what ended the render thread
+        renderRunning = false;
+        renderThread.join();
+        if(!renderError) return;
+
+        renderFailed = false;
+        if(!softwareRendering){
+            try {
+                presentThread.stop();   //A running thread would terminate the process while the error unwinds
+            } catch(const std::exception&){}    //The render thread's error is the one reported
         }
+        std::rethrow_exception(std::exchange(renderError, nullptr));
     }
 
 
     void cleanup() {                //Get rid of all redundant objects explicitly
+        if(softwareRendering){
+            cleanupSoftwareRenderer();
+            return;
+        }
+
+        vkDeviceWaitIdle(device);   //Background copies may still be running
+
+        presentThread.destroy();
+        latencyTracker.destroy();
+        std::cout << latencyTracker.report();
+
+        destroyFrameResources();
+        destroyFramebuffers();
+        vkDestroyRenderPass(device, renderPass, nullptr);
+        if(sharedFrames.isOpen()){
+            frameExport.destroy();      //Releases the imported memory before the mapping goes away
+            sharedFrames.destroy();
+        }
+        allocator.free(goldenReadback);
+        shaderVariants.destroy();
+        for(VkShaderModule module : sceneShaders){
+            vkDestroyShaderModule(device, module, nullptr);
+        }
+        vkDestroyPipelineLayout(device, scenePipelineLayout, nullptr);
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+        gpuCompletion.destroy();
+        jobs.stop();
+
+        gpuProfiler.collect();
+        if(!Profiler::instance().exportChromeTrace(TRACE_PATH)){
+            std::cerr << "Failed to write " << TRACE_PATH << std::endl;
+        }
+        gpuProfiler.destroy();
+
+        if(bufferDeviceAddressSupported){
+            scene.destroy();
+        }
+        if(virtualTexturePack.isOpen()){
+            virtualTexture.destroy();
+            virtualTexturePack.close();
+        }
+        resources.destroy();
+        uploadContext.destroy();
+        defragmenter.destroy();
+        submissions.destroy();
+        allocator.destroy();
         vkDestroySwapchainKHR(device, swapChain, nullptr);
         vkDestroyDevice(device, nullptr);
-        
+        destroyInstance();
+
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+
+
+    void destroyInstance(){
         if(enableValidationLayers){
             DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
         }
         
         vkDestroySurfaceKHR(instance, surface, nullptr);
         vkDestroyInstance(instance, nullptr);
-        
-        glfwDestroyWindow(window);
-        glfwTerminate();
     }
 
     
@@ -175,41 +619,35 @@ private:
     */
 
     void createInstance(){
+        PROFILE_ZONE("createInstance");
         if(enableValidationLayers && !checkValidationLayerSupport()){
             throw std::runtime_error("Requested validation layers not available!");
         }
         
         else{
-            VkApplicationInfo appInfo{};                              //Optional application info handle for diagnostics
-            appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+            VkApplicationInfo appInfo = makeInfo<VkApplicationInfo>();  //Optional application info handle for diagnostics
             appInfo.pApplicationName = "Hello Triangle";
             appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
             appInfo.pEngineName = "No Engine";
             appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-            appInfo.apiVersion = VK_API_VERSION_1_0;
+            appInfo.apiVersion = VK_API_VERSION_1_2;               //Highest version we use; devices below it just miss optional features
 
-            uint32_t glfwExtensionCount = 0;            //glfw required extensions are different than vk required extensions
-            const char** glfwExtensions;
-            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-            VkInstanceCreateInfo createInfo{};                           //Tell Vulkan driver which global extensions and validation layers we want to use; <-extension info struct
-            createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+            StructChain<VkInstanceCreateInfo, VkDebugUtilsMessengerCreateInfoEXT> chain;
+            VkInstanceCreateInfo& createInfo = chain.root();                 //Tell Vulkan driver which global extensions and validation layers we want to use; <-extension info struct
             createInfo.pApplicationInfo = &appInfo;
             createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
             createInfo.ppEnabledExtensionNames = deviceExtensions.data();
             createInfo.enabledLayerCount = 0;
 
 
-            VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
             if(enableValidationLayers){
                 createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
                 createInfo.ppEnabledLayerNames = validationLayers.data();
                 
-                populateDebugMessengerCreateInfo(debugCreateInfo);
-                createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
+                populateDebugMessengerCreateInfo(chain.get<VkDebugUtilsMessengerCreateInfoEXT>());   //Also covers instance creation/destruction
             } else {
                 createInfo.enabledLayerCount = 0;
-                createInfo.pNext = nullptr;
+                chain.unlink<VkDebugUtilsMessengerCreateInfoEXT>();
             }
 
             auto extensions = getRequiredExtensions();
@@ -224,8 +662,9 @@ private:
 
 
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo){
-        createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+        const void* next = createInfo.pNext;    //Keep the chain link when filling a struct owned by a StructChain
+        createInfo = makeInfo<VkDebugUtilsMessengerCreateInfoEXT>();
+        createInfo.pNext = next;
         createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
         createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
         createInfo.pfnUserCallback = debugCallback;
@@ -233,9 +672,10 @@ private:
 
 
     void setupDebugMessenger() {
+        PROFILE_ZONE("setupDebugMessenger");
         if(!enableValidationLayers) return;
 
-        VkDebugUtilsMessengerCreateInfoEXT createInfo;
+        VkDebugUtilsMessengerCreateInfoEXT createInfo{};
         populateDebugMessengerCreateInfo(createInfo);
 
         if(CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS){
@@ -284,10 +724,10 @@ private:
 
 
     static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, 
-        VkDebugUtilsMessageTypeFlagsEXT messageType, 
-        const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, 
-        void* pUserData) 
+        VkDebugUtilsMessageSeverityFlagBitsEXT /*messageSeverity*/,
+        VkDebugUtilsMessageTypeFlagsEXT /*messageType*/,
+        const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+        void* /*pUserData*/)
     {
         std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
         return VK_FALSE;
@@ -295,12 +735,13 @@ private:
 
     ////////////////////////////////////////// Device/queue block ///////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    void pickPhysicalDevice(){
+    bool pickPhysicalDevice(){      //false if no device is usable; initVulkan falls back to the software rasterizer then
+        PROFILE_ZONE("pickPhysicalDevice");
         uint32_t deviceCount = 0;
         vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);    //get number of devices
 
         if(deviceCount == 0){
-            throw std::runtime_error("Failed to find GPU's with Vulkan support");
+            return false;
         }
     
         std::vector<VkPhysicalDevice> devices(deviceCount);
@@ -313,9 +754,7 @@ private:
             }
         }
 
-        if(physicalDevice == VK_NULL_HANDLE){
-            throw std::runtime_error("Failed to find a suitable GPU!");
-        }
+        return physicalDevice != VK_NULL_HANDLE;
     }
 
 
@@ -350,15 +789,29 @@ private:
     }
 
 
+    bool checkOptionalExtensionSupport(VkPhysicalDevice device, const char* extensionName){
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for(const auto& extension : availableExtensions){
+            if(strcmp(extension.extensionName, extensionName) == 0) return true;
+        }
+        return false;
+    }
+
+
     void createLogicalDevice(){
+        PROFILE_ZONE("createLogicalDevice");
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};   //Initialize queue vector
 
         float queuePriority = 1.0f;
         for(uint32_t queueFamily : uniqueQueueFamilies){
-            VkDeviceQueueCreateInfo queueCreateInfo{};
-            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            VkDeviceQueueCreateInfo queueCreateInfo = makeInfo<VkDeviceQueueCreateInfo>();
             queueCreateInfo.queueFamilyIndex = queueFamily;
             queueCreateInfo.queueCount = 1;
             queueCreateInfo.pQueuePriorities = &queuePriority;
@@ -366,14 +819,92 @@ private:
         }
 
 
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+        sparseResidencySupported = supportedFeatures.sparseBinding && supportedFeatures.sparseResidencyImage2D &&
+            queueFamilySupports(physicalDevice, indices.graphicsFamily.value(), VK_QUEUE_SPARSE_BINDING_BIT);
+
         VkPhysicalDeviceFeatures deviceFeatures{};
-        VkDeviceCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        deviceFeatures.sparseBinding = sparseResidencySupported;    //Only request what virtual textures can actually use
+        deviceFeatures.sparseResidencyImage2D = sparseResidencySupported;
+
+        std::vector<const char*> enabledExtensions(deviceExtensions.begin(), deviceExtensions.end());
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        bool addressCore = properties.apiVersion >= VK_API_VERSION_1_2;     //Core in 1.2, VK_KHR_buffer_device_address on 1.1
+        bool addressExtension = !addressCore && properties.apiVersion >= VK_API_VERSION_1_1 &&
+            checkOptionalExtensionSupport(physicalDevice, VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+
+        bool presentWaitExtensions = properties.apiVersion >= VK_API_VERSION_1_1 &&
+            checkOptionalExtensionSupport(physicalDevice, VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+            checkOptionalExtensionSupport(physicalDevice, VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+
+        if(properties.apiVersion >= VK_API_VERSION_1_1){
+            StructChain<VkPhysicalDeviceFeatures2, VkPhysicalDeviceBufferDeviceAddressFeatures,
+                VkPhysicalDevicePresentIdFeaturesKHR, VkPhysicalDevicePresentWaitFeaturesKHR> supported;
+            if(!addressCore && !addressExtension){  //Structs of extensions the device lacks must stay out of the chain
+                supported.unlink<VkPhysicalDeviceBufferDeviceAddressFeatures>();
+            }
+            if(!presentWaitExtensions){
+                supported.unlink<VkPhysicalDevicePresentIdFeaturesKHR>();
+                supported.unlink<VkPhysicalDevicePresentWaitFeaturesKHR>();
+            }
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supported.root());
+
+            bufferDeviceAddressSupported = (addressCore || addressExtension) && supportedFeatures.shaderInt64 &&    //Shaders do 64-bit address math
+                supported.get<VkPhysicalDeviceBufferDeviceAddressFeatures>().bufferDeviceAddress == VK_TRUE;
+            presentWaitSupported = presentWaitExtensions &&
+                supported.get<VkPhysicalDevicePresentIdFeaturesKHR>().presentId == VK_TRUE &&
+                supported.get<VkPhysicalDevicePresentWaitFeaturesKHR>().presentWait == VK_TRUE;
+        }
+
+        deviceFeatures.shaderInt64 = bufferDeviceAddressSupported;
+        if(bufferDeviceAddressSupported && addressExtension){
+            enabledExtensions.push_back(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+        }
+        if(presentWaitSupported){
+            enabledExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            enabledExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+        }
+
+        calibratedTimestampsSupported = checkOptionalExtensionSupport(physicalDevice, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+        if(calibratedTimestampsSupported){
+            enabledExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+        }
+
+        externalMemoryHostSupported = properties.apiVersion >= VK_API_VERSION_1_1 &&     //Builds on VK_KHR_external_memory, core in 1.1
+            checkOptionalExtensionSupport(physicalDevice, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+        if(externalMemoryHostSupported){
+            enabledExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+        }
+
+        //Feature structs beyond 1.0 can only be enabled through the pNext chain
+        StructChain<VkDeviceCreateInfo, VkPhysicalDeviceFeatures2, VkPhysicalDeviceBufferDeviceAddressFeatures,
+            VkPhysicalDevicePresentIdFeaturesKHR, VkPhysicalDevicePresentWaitFeaturesKHR> chain;
+        chain.get<VkPhysicalDeviceFeatures2>().features = deviceFeatures;
+        chain.get<VkPhysicalDeviceBufferDeviceAddressFeatures>().bufferDeviceAddress = VK_TRUE;
+        chain.get<VkPhysicalDevicePresentIdFeaturesKHR>().presentId = VK_TRUE;
+        chain.get<VkPhysicalDevicePresentWaitFeaturesKHR>().presentWait = VK_TRUE;
+
+        VkDeviceCreateInfo& createInfo = chain.root();
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
-        createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        if(!bufferDeviceAddressSupported){
+            chain.unlink<VkPhysicalDeviceBufferDeviceAddressFeatures>();
+        }
+        if(!presentWaitSupported){
+            chain.unlink<VkPhysicalDevicePresentIdFeaturesKHR>();
+            chain.unlink<VkPhysicalDevicePresentWaitFeaturesKHR>();
+        }
+        if(!bufferDeviceAddressSupported && !presentWaitSupported){     //Plain 1.0 path
+            chain.unlink<VkPhysicalDeviceFeatures2>();
+            createInfo.pEnabledFeatures = &deviceFeatures;
+        }
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 
         if(enableValidationLayers){
@@ -390,6 +921,10 @@ private:
 
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+        submissions.init(device);
+        submissions.addQueue(graphicsQueue);
+        submissions.addQueue(presentQueue);     //Often the same VkQueue, which then shares one lock
     }
 
 
@@ -429,9 +964,21 @@ private:
 
 
 
+    bool queueFamilySupports(VkPhysicalDevice device, uint32_t family, VkQueueFlags flags){
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+        return family < queueFamilyCount && (queueFamilies[family].queueFlags & flags) == flags;
+    }
+
+
     ///////////////// Window Surface Block ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
     void createSurface(){
+        PROFILE_ZONE("createSurface");
         if(glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS){
             throw std::runtime_error("Failed to create window surface");
         }
@@ -439,8 +986,10 @@ private:
 
 
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats){    //just an example of how we could select
+        //Golden runs compare against the software rasterizer, which stores shaded values without sRGB encoding
+        VkFormat preferred = goldenVulkan ? VK_FORMAT_B8G8R8A8_UNORM : VK_FORMAT_B8G8R8A8_SRGB;
         for(const auto& format : availableFormats){
-            if(format.format == VK_FORMAT_B8G8R8A8_SRGB && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) return format;
+            if(format.format == preferred && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) return format;
         }
         return availableFormats[0];
     }
@@ -449,7 +998,8 @@ private:
 
     ///////////////// Swap Chain Block //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    void createSwapChain(){
+    void createSwapChain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE){     //The caller destroys oldSwapchain
+        PROFILE_ZONE("createSwapChain");
         SwapChainSupportDetails details = querySwapChainSupport(physicalDevice);
         VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(details.formats);
         VkPresentModeKHR presentMode = chooseSwapPresentMode(details.presentModes);
@@ -460,15 +1010,18 @@ private:
             imageCount = details.capabilities.maxImageCount;
         }
 
-        VkSwapchainCreateInfoKHR createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        VkSwapchainCreateInfoKHR createInfo = makeInfo<VkSwapchainCreateInfoKHR>();
         createInfo.surface = surface;
         createInfo.minImageCount = imageCount;
         createInfo.imageFormat = surfaceFormat.format;
         createInfo.imageColorSpace = surfaceFormat.colorSpace;
         createInfo.imageExtent = extent;
         createInfo.imageArrayLayers = 1;
-        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;   //Cleared by the render pass
+        swapChainExportable = (!sharedFramesName.empty() || goldenVulkan) && (details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+        if(swapChainExportable){
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
 
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
         uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
@@ -487,7 +1040,7 @@ private:
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         createInfo.presentMode = presentMode;
         createInfo.clipped = VK_TRUE;
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+        createInfo.oldSwapchain = oldSwapchain;
 
         if(vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS){
             throw std::runtime_error("Failed to create swap chain");
@@ -499,6 +1052,7 @@ private:
 
         swapChainImageFormat = surfaceFormat.format;
         swapChainExtent = extent;
+        swapChainMinImageCount = details.capabilities.minImageCount;
     }
 
 
@@ -515,10 +1069,10 @@ private:
         }
 
         uint32_t presentModeCount;
-        vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &presentModeCount, nullptr);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
         if(presentModeCount != 0){
             details.presentModes.resize(presentModeCount);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+            vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
         }
 
         return details;
@@ -556,6 +1110,1199 @@ private:
     }
 
 
+    VkFormat findDepthFormat(){     //D16_UNORM is always supported as a depth attachment, the others are preferred
+        for(VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM}){
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+            if(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT){
+                return format;
+            }
+        }
+        return VK_FORMAT_D16_UNORM;
+    }
+
+
+    //Clears and draws into the swap chain image and pickBuffer's id image with a depth test. The image leaves the pass
+    //ready to present, or ready to be copied from when frames are shared; the ids are always left ready to be copied.
+    //The outgoing dependency covers both copies
+    void createRenderPass(){
+        depthFormat = findDepthFormat();
+
+        VkAttachmentDescription attachments[3]{};
+        attachments[0].format = swapChainImageFormat;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;      //Previous contents are never needed
+        attachments[0].finalLayout = swapChainExportable ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        attachments[1].format = PICK_FORMAT;
+        attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;      //To PICK_NONE
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+        attachments[2].format = depthFormat;
+        attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference colorReferences[] = {{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}, {1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}};
+        VkAttachmentReference depthReference{2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = static_cast<uint32_t>(std::size(colorReferences));
+        subpass.pColorAttachments = colorReferences;
+        subpass.pDepthStencilAttachment = &depthReference;
+
+        VkSubpassDependency dependencies[2]{};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;      //Acquire semaphore, and the previous frame's depth writes and id copy
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        dependencies[1].srcSubpass = 0;                        //Copies out of the pass's attachments
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        VkRenderPassCreateInfo createInfo = makeInfo<VkRenderPassCreateInfo>();
+        createInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
+        createInfo.pAttachments = attachments;
+        createInfo.subpassCount = 1;
+        createInfo.pSubpasses = &subpass;
+        createInfo.dependencyCount = 2;
+        createInfo.pDependencies = dependencies;
+
+        if(vkCreateRenderPass(device, &createInfo, nullptr, &renderPass) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create render pass");
+        }
+    }
+
+
+    void createFramebuffers(){      //Everything sized or counted by the current swap chain: views, framebuffers, ids, depth, semaphores
+        depthImage = resources.createImage(depthFormat, swapChainExtent.width, swapChainExtent.height,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+        pickBuffer.init(resources, allocator, swapChainExtent.width, swapChainExtent.height);
+
+        swapChainImageViews.resize(swapChainImages.size());
+        swapChainFramebuffers.resize(swapChainImages.size());
+        for(size_t i = 0; i < swapChainImages.size(); i++){
+            VkImageViewCreateInfo viewInfo = makeInfo<VkImageViewCreateInfo>();
+            viewInfo.image = swapChainImages[i];
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = swapChainImageFormat;
+            viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            if(vkCreateImageView(device, &viewInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS){
+                throw std::runtime_error("Failed to create swap chain image view");
+            }
+
+            VkImageView attachments[] = {swapChainImageViews[i], resources.getView(pickBuffer.getImage()), resources.getView(depthImage)};
+            VkFramebufferCreateInfo framebufferInfo = makeInfo<VkFramebufferCreateInfo>();
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
+            framebufferInfo.pAttachments = attachments;
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+            if(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS){
+                throw std::runtime_error("Failed to create framebuffer");
+            }
+        }
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        renderFinishedSemaphores.resize(swapChainImages.size());
+        for(VkSemaphore& semaphore : renderFinishedSemaphores){
+            if(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS){
+                throw std::runtime_error("Failed to create frame sync objects");
+            }
+        }
+    }
+
+
+    void destroyFramebuffers(){     //Device must be idle
+        for(VkSemaphore semaphore : renderFinishedSemaphores){
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        renderFinishedSemaphores.clear();
+        for(VkFramebuffer framebuffer : swapChainFramebuffers){
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        for(VkImageView view : swapChainImageViews){
+            vkDestroyImageView(device, view, nullptr);
+        }
+        swapChainFramebuffers.clear();
+        swapChainImageViews.clear();
+        resources.destroyImage(depthImage);
+        depthImage = {};
+        pickBuffer.destroy();
+    }
+
+
+    //Simulation thread, when the present thread saw VK_ERROR_OUT_OF_DATE_KHR or VK_SUBOPTIMAL_KHR. The surface keeps
+    //its format, so the render pass and the pipelines built against it stay valid; everything sized by the swap chain
+    //is rebuilt. While the window is minimized there is nothing to create and the next tick tries again.
+    //The render, present and present-wait threads are joined and started anew each time; the per-thread state they
+    //leave behind (FrameArenas slots, Profiler rings) is recycled when they exit, so resizes do not accumulate it
+    void recreateSwapChain(){
+        VkSurfaceCapabilitiesKHR capabilities;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &capabilities);
+        if(capabilities.currentExtent.width == 0 || capabilities.currentExtent.height == 0) return;
+
+        PROFILE_ZONE("recreateSwapChain");
+        stopRenderThread();
+        presentThread.stop();
+        vkDeviceWaitIdle(device);
+        presentThread.destroy();
+        latencyTracker.destroy();
+
+        destroyFramebuffers();
+        VkExtent2D previousExtent = swapChainExtent;
+        VkSwapchainKHR oldSwapChain = swapChain;
+        createSwapChain(oldSwapChain);
+        vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+        createFramebuffers();
+        drawCache.invalidate();     //Chunks set the viewport
+
+        bool resized = swapChainExtent.width != previousExtent.width || swapChainExtent.height != previousExtent.height;
+        if(sharedFrames.isOpen() && resized){    //Readers expect the size they mapped
+            for(uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++){
+                frameExport.retire(frame);
+            }
+            frameExport.destroy();
+            sharedFrames.destroy();
+            std::cerr << "Swap chain size changed, frames are no longer shared" << std::endl;
+        }
+
+        latencyTracker.init(device, swapChain, presentWaitSupported);
+        presentThread.init(device, swapChain, submissions, presentQueue, graphicsQueue, static_cast<uint32_t>(swapChainImages.size()),
+            swapChainMinImageCount, latencyTracker, presentWaitSupported);
+        startRenderThread();
+    }
+
+
+    ////////////////////////////////////////// Memory block ///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void createAllocator(){
+        PROFILE_ZONE("createAllocator");
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+        allocator.init(physicalDevice, device, bufferDeviceAddressSupported);
+        if(externalMemoryHostSupported){
+            StructChain<VkPhysicalDeviceProperties2, VkPhysicalDeviceExternalMemoryHostPropertiesEXT> properties;
+            vkGetPhysicalDeviceProperties2(physicalDevice, &properties.root());
+            allocator.enableHostImport(properties.get<VkPhysicalDeviceExternalMemoryHostPropertiesEXT>().minImportedHostPointerAlignment);
+        }
+        resources.init(allocator);
+        defragmenter.init(allocator, submissions, graphicsQueue, indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, &gpuProfiler);
+        gpuCompletion.init(device, jobs, submissions);
+        uploadContext.init(allocator, submissions, graphicsQueue, indices.graphicsFamily.value(), &gpuProfiler, &gpuCompletion);
+    }
+
+
+    void createScene(){     //Scene data is reached by device address only, see GpuScene.h
+        PROFILE_ZONE("createScene");
+        if(!bufferDeviceAddressSupported) return;
+
+        scene.init(allocator, uploadContext, MAX_FRAMES_IN_FLIGHT);
+    }
+
+
+    void loadScene(){       //Geometry is uploaded straight from the scene cache, imported as buffer memory where the device allows
+        PROFILE_ZONE("loadScene");
+        if(scenePath.empty()) return;
+        if(!bufferDeviceAddressSupported){
+            std::cerr << "Scenes need bufferDeviceAddress, " << scenePath << " is not loaded" << std::endl;
+            return;
+        }
+
+        SceneCache cache;
+        openSceneCache(cache);
+        if(cache.getMeshCount() == 0) return;
+
+        const uint8_t* geometry = cache.getGeometry();
+        VkBuffer source = VK_NULL_HANDLE;
+        VkDeviceSize sourceOffset = 0;
+        Allocation* staging = nullptr;
+        bool imported = uploadContext.addHostSource(cache.data(), cache.getSize()) &&
+                        uploadContext.findHostSource(geometry, cache.getGeometrySize(), source, sourceOffset);
+        if(!imported){
+            staging = allocator.createBuffer(cache.getGeometrySize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+            memcpy(staging->mapped, geometry, cache.getGeometrySize());
+            source = staging->buffer;
+        }
+
+        std::vector<StagedMesh> staged(cache.getMeshCount());
+        for(size_t i = 0; i < staged.size(); i++){
+            const GltfMesh& mesh = cache.getMeshes()[i];
+            staged[i] = {mesh.firstVertex * static_cast<VkDeviceSize>(sizeof(Vertex)), mesh.vertexCount,
+                         cache.getIndexOffset() + mesh.firstIndex * static_cast<VkDeviceSize>(sizeof(uint32_t)), mesh.indexCount,
+                         {mesh.center[0], mesh.center[1], mesh.center[2]}, mesh.radius};
+        }
+        std::vector<MeshHandle> meshes(staged.size());
+        scene.addMeshes(geometry, source, sourceOffset, staged.data(), static_cast<uint32_t>(staged.size()), sizeof(Vertex), meshes.data());
+        uploadContext.removeHostSource(cache.data());   //addMeshes waited for the copies
+        allocator.free(staging);
+
+        std::vector<uint32_t> materials;
+        for(uint32_t i = 0; i < cache.getMaterialCount(); i++){
+            materials.push_back(scene.addMaterial(toGpuMaterial(cache.getMaterials()[i])));
+        }
+        uint32_t defaultMaterial = scene.addMaterial(toGpuMaterial(GltfMaterial()));
+
+        for(uint32_t i = 0; i < cache.getInstanceCount(); i++){
+            const GltfInstance& instance = cache.getInstances()[i];
+            const GltfMesh& mesh = cache.getMeshes()[instance.mesh];
+            uint32_t material = mesh.material != GLTF_NO_MATERIAL ? materials[mesh.material] : defaultMaterial;
+            uint32_t object = scene.addObject(meshes[instance.mesh], material, instance.transform);
+            addSceneObject(object, meshes[instance.mesh], material, mesh, instance.transform);
+        }
+        buildSceneBvh();
+        std::cout << "Loaded " << scenePath << ": " << cache.getInstanceCount() << " objects, " << cache.getVertexCount() << " vertices"
+                  << (imported ? " (uploaded from the mapped cache)" : "") << std::endl;
+    }
+
+
+    void openSceneCache(SceneCache& cache){     //Maps the cache next to scenePath, importing the source first when it is missing or stale
+        uint64_t sourceHash = hashSceneSources(scenePath, jobs);
+        std::string cachePath = scenePath + SCENE_CACHE_SUFFIX;
+        if(cache.load(cachePath, sourceHash)) return;
+
+        GltfImporter importer;
+        importer.open(scenePath, jobs);
+        if(!cache.build(cachePath, sourceHash, importer, jobs)){
+            std::cerr << "Failed to write scene cache " << cachePath << std::endl;
+        }
+    }
+
+
+    void loadVirtualTexture(){      //Streams pages on demand, see VirtualTexture.h; the scene pipeline samples it by UV
+        PROFILE_ZONE("loadVirtualTexture");
+        if(virtualTexturePackPath.empty()) return;
+        if(!bufferDeviceAddressSupported){
+            std::cerr << "Virtual textures are drawn by the scene pipeline, which needs bufferDeviceAddress" << std::endl;
+            return;
+        }
+
+        virtualTexturePack.open(virtualTexturePackPath);
+        virtualTexture.init(allocator, submissions, physicalDevice, sparseResidencySupported ? graphicsQueue : VK_NULL_HANDLE,
+            virtualTexturePack, virtualTextureName.c_str(), MAX_FRAMES_IN_FLIGHT);
+
+        const VirtualTextureHeader& header = virtualTexture.getHeader();
+        std::cout << "Virtual texture " << virtualTextureName << ": " << header.width << "x" << header.height
+                  << (virtualTexture.isSparse() ? " (sparse residency)" : " (indirection atlas)") << std::endl;
+    }
+
+
+    static GpuMaterial toGpuMaterial(const GltfMaterial& source){
+        GpuMaterial material{};
+        memcpy(material.baseColor, source.baseColor, sizeof(source.baseColor));
+        memcpy(material.emissive, source.emissive, sizeof(source.emissive));
+        material.metallic = source.metallic;
+        material.roughness = source.roughness;
+        material.textureIndex = UINT32_MAX;     //glTF textures are not loaded
+        return material;
+    }
+
+
+    void addSceneObject(uint32_t object, MeshHandle mesh, uint32_t material, const GltfMesh& source, const float model[16]){
+        SceneObject record{};
+        record.object = object;
+        record.mesh = mesh;
+        record.material = material;
+        memcpy(record.model, model, sizeof(record.model));
+        record.center = Vec3(source.center[0], source.center[1], source.center[2]);
+
+        float scale = 0.0f;     //Largest axis scale of model, which bounds how far the sphere can stretch
+        for(int column = 0; column < 3; column++){
+            scale = std::max(scale, length(Vec3(model[column * 4], model[column * 4 + 1], model[column * 4 + 2])));
+        }
+        record.radius = source.radius * scale;
+
+        //Every object turns in place about its own axis: tilted off +y by a golden angle step per object, so neighbours
+        //visibly differ, with every other one going the other way. Deterministic, the golden test depends on it
+        float azimuth = 2.39996f * static_cast<float>(sceneObjects.size());
+        Vec3 axis = normalize(Vec3(0.5f * std::cos(azimuth), 1.0f, 0.5f * std::sin(azimuth)));
+        record.angularVelocity = axis * (sceneObjects.size() % 2 == 0 ? spin : -spin);
+        record.pivot = mat4TransformPoint(model, record.center);
+        sceneObjects.push_back(record);
+    }
+
+
+    ////////////////////////////////////////// Spatial query block ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void buildSceneBvh(){
+        std::vector<Aabb> bounds(sceneObjects.size());
+        for(size_t i = 0; i < sceneObjects.size(); i++){
+            bounds[i] = objectBounds(sceneObjects[i], sceneObjects[i].current);
+        }
+        sceneBvh.build(bounds.data(), static_cast<uint32_t>(bounds.size()), jobs);
+    }
+
+
+    static void worldSphere(const SceneObject& object, const Transform& transform, float matrix[16], Vec3& center, float& radius){
+        float animated[16];
+        transformToMatrix(transform, animated);
+        mat4Multiply(animated, object.model, matrix);
+        center = mat4TransformPoint(matrix, object.center);
+        radius = object.radius * transform.scale;
+    }
+
+
+    static Aabb objectBounds(const SceneObject& object, const Transform& transform){
+        float matrix[16];
+        Vec3 center;
+        float radius;
+        worldSphere(object, transform, matrix, center, radius);
+        return sphereBounds(center, radius);
+    }
+
+
+    void updateSceneBvh(){      //After a simulation step; boxes cover both states, which bounds the frames blended between them up to the arc of one step's rotation
+        for(size_t i = 0; i < sceneObjects.size(); i++){
+            SceneObject& object = sceneObjects[i];
+            bool moving = !(object.previous == object.current);
+            if(!moving && !object.swept) continue;
+
+            Aabb bounds = objectBounds(object, object.current);
+            if(moving){
+                bounds.grow(objectBounds(object, object.previous));
+            }
+            object.swept = moving;
+            sceneBvh.update(static_cast<uint32_t>(i), bounds);
+        }
+        sceneBvh.refit();
+    }
+
+
+    //Closest object whose bounding sphere the ray hits, against the current simulation state; UINT32_MAX for none
+    BvhHit raycastScene(const Vec3& origin, const Vec3& direction, float maxDistance = std::numeric_limits<float>::infinity()) const {
+        return sceneBvh.raycast(origin, direction, maxDistance, [this, &origin, &direction](uint32_t primitive, float tMax){
+            float matrix[16];
+            Vec3 center;
+            float radius;
+            worldSphere(sceneObjects[primitive], sceneObjects[primitive].current, matrix, center, radius);
+
+            Vec3 offset = origin - center;      //Solve |origin + t * direction - center| = radius
+            float a = dot(direction, direction);
+            float b = dot(offset, direction);
+            float c = dot(offset, offset) - radius * radius;
+            float discriminant = b * b - a * c;
+            if(discriminant < 0.0f) return std::numeric_limits<float>::infinity();
+            float t = (-b - std::sqrt(discriminant)) / a;
+            if(t < 0.0f) t = c <= 0.0f ? 0.0f : std::numeric_limits<float>::infinity();   //Starting inside counts as a hit at 0
+            return t < tMax ? t : std::numeric_limits<float>::infinity();
+        });
+    }
+
+
+    //Simulation thread; uses the camera of the last packet built. The bounding sphere hit applies right away and the
+    //id buffer's answer replaces it once the frame that carries the click has been read back, see PickBuffer.h
+    void pickAtCursor(){
+        if(++pickSequence == 0) pickSequence = 1;   //0 means no pick in a packet
+        pickQueued = true;
+        pickPixel[0] = static_cast<int32_t>(cursorX);
+        pickPixel[1] = static_cast<int32_t>(cursorY);
+
+        pickedObject = UINT32_MAX;
+        if(sceneObjects.empty()) return;
+        float inverse[16];
+        mat4Inverse(latchState.viewProjection, inverse);
+        Vec3 nearPoint = mat4Unproject(inverse, latchState.cursor[2], latchState.cursor[3], 0.0f);
+        Vec3 farPoint = mat4Unproject(inverse, latchState.cursor[2], latchState.cursor[3], 1.0f);
+
+        BvhHit hit = raycastScene(nearPoint, farPoint - nearPoint, 1.0f);
+        pickedObject = hit.primitive;
+    }
+
+
+    void applyPickResults(){    //Simulation thread; takes what the render thread has read back of the id buffer
+        PickResult result;
+        while(framePipe.takePick(result)){
+            if(result.sequence != pickSequence) continue;   //Overtaken by a newer click
+
+            pickedObject = UINT32_MAX;
+            for(size_t i = 0; i < sceneObjects.size() && result.object != PICK_NONE; i++){
+                if(sceneObjects[i].object == result.object){
+                    pickedObject = static_cast<uint32_t>(i);
+                    break;
+                }
+            }
+        }
+    }
+
+
+    ////////////////////////////////////////// Pipeline block /////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void createPipelineCache(){     //Seeded from the last run; the driver ignores data from another device/driver version
+        PROFILE_ZONE("createPipelineCache");
+        std::vector<char> initialData = syncWait(jobs, readFileAsync(jobs, PIPELINE_CACHE_PATH));
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = initialData.size();
+        cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+        if(vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create pipeline cache");
+        }
+
+        shaderVariants.init(device, pipelineCache, jobs);
+    }
+
+
+    void createScenePipeline(){     //Draws GpuScene objects, see shaders/scene.vert; needs the render pass
+        PROFILE_ZONE("createScenePipeline");
+        if(!bufferDeviceAddressSupported) return;   //No GpuScene, nothing to draw
+
+        VkPushConstantRange pushRange{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ScenePushConstants)};
+        VkDescriptorSetLayout virtualTextureLayout = virtualTexturePack.isOpen() ? virtualTexture.getDescriptorSetLayout() : VK_NULL_HANDLE;
+        VkPipelineLayoutCreateInfo layoutInfo = makeInfo<VkPipelineLayoutCreateInfo>();
+        layoutInfo.setLayoutCount = virtualTextureLayout != VK_NULL_HANDLE ? 1 : 0;     //Set 0 of scene_virtual.frag
+        layoutInfo.pSetLayouts = &virtualTextureLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushRange;
+        if(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &scenePipelineLayout) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create scene pipeline layout");
+        }
+
+        sceneShaders[0] = ShaderVariantManager::loadShaderModule(device, SCENE_VERTEX_SHADER_PATH);
+        sceneShaders[1] = ShaderVariantManager::loadShaderModule(device,
+            virtualTextureLayout != VK_NULL_HANDLE ? SCENE_VIRTUAL_FRAGMENT_SHADER_PATH : SCENE_FRAGMENT_SHADER_PATH);
+        sceneProgram = shaderVariants.registerProgram({{VK_SHADER_STAGE_VERTEX_BIT, sceneShaders[0]}, {VK_SHADER_STAGE_FRAGMENT_BIT, sceneShaders[1]}},
+            [this](VkPipelineCache cache, const VkPipelineShaderStageCreateInfo* stages, uint32_t stageCount){
+                return buildScenePipeline(cache, stages, stageCount);
+            });
+        shaderVariants.prewarm(sceneProgram, {SCENE_FEATURES});
+    }
+
+
+    //Worker threads too; only reads state that is fixed before the first variant is requested. Viewport and scissor
+    //are dynamic, so the pipeline does not depend on the swap chain extent
+    VkPipeline buildScenePipeline(VkPipelineCache cache, const VkPipelineShaderStageCreateInfo* stages, uint32_t stageCount){
+        VkPipelineVertexInputStateCreateInfo vertexInput = vertexInputState<Vertex>();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = makeInfo<VkPipelineInputAssemblyStateCreateInfo>();
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo viewportState = makeInfo<VkPipelineViewportStateCreateInfo>();
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo rasterization = makeInfo<VkPipelineRasterizationStateCreateInfo>();
+        rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterization.cullMode = VK_CULL_MODE_NONE;     //Two sided, like the software rasterizer
+        rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterization.lineWidth = 1.0f;
+
+        VkPipelineMultisampleStateCreateInfo multisample = makeInfo<VkPipelineMultisampleStateCreateInfo>();
+        multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil = makeInfo<VkPipelineDepthStencilStateCreateInfo>();
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+        VkPipelineColorBlendAttachmentState blendAttachments[2]{};
+        blendAttachments[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        blendAttachments[1].colorWriteMask = VK_COLOR_COMPONENT_R_BIT;     //Object ids, never blended
+
+        VkPipelineColorBlendStateCreateInfo colorBlend = makeInfo<VkPipelineColorBlendStateCreateInfo>();
+        colorBlend.attachmentCount = static_cast<uint32_t>(std::size(blendAttachments));
+        colorBlend.pAttachments = blendAttachments;
+
+        VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState = makeInfo<VkPipelineDynamicStateCreateInfo>();
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(std::size(dynamicStates));
+        dynamicState.pDynamicStates = dynamicStates;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = makeInfo<VkGraphicsPipelineCreateInfo>();
+        pipelineInfo.stageCount = stageCount;
+        pipelineInfo.pStages = stages;
+        pipelineInfo.pVertexInputState = &vertexInput;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterization;
+        pipelineInfo.pMultisampleState = &multisample;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlend;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = scenePipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+
+        VkPipeline pipeline;
+        if(vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS){
+            return VK_NULL_HANDLE;
+        }
+        return pipeline;
+    }
+
+
+    void savePipelineCache(){
+        size_t size = 0;
+        vkGetPipelineCacheData(device, pipelineCache, &size, nullptr);
+
+        std::vector<char> data(size);
+        if(size == 0 || vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS) return;
+
+        std::ofstream file(PIPELINE_CACHE_PATH, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), size);
+    }
+
+
+    ////////////////////////////////////////// Profiling block ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void createProfiler(){      //GPU zones land on the same timeline as PROFILE_ZONE, see Profiler.h
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        gpuProfiler.init(instance, physicalDevice, device, graphicsQueue, indices.graphicsFamily.value(), calibratedTimestampsSupported);
+    }
+
+
+    ////////////////////////////////////////// Frame block ////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void createFrameResources(){
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+
+        if(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS){
+            throw std::runtime_error("Failed to create command pool");
+        }
+
+        commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+
+        if(vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS){
+            throw std::runtime_error("Failed to allocate command buffers");
+        }
+
+        frameTickets.assign(MAX_FRAMES_IN_FLIGHT, 0);     //Ticket 0 is complete, the first wait on each frame must not block
+        frameArenas.init(MAX_FRAMES_IN_FLIGHT, jobs.getThreadCount() + 2);      //Workers, the render thread and a spare
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        lateLatch.init(allocator, MAX_FRAMES_IN_FLIGHT, properties.limits.minUniformBufferOffsetAlignment);
+        drawCache.init(device, indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT);
+    }
+
+
+    void createFrameSharing(){      //Swap chain images are copied into shared memory each frame, see FrameExport.h
+        if(sharedFramesName.empty()) return;
+        if(!swapChainExportable){
+            std::cerr << "Swap chain images cannot be copied from, frames are not shared" << std::endl;
+            return;
+        }
+
+        VkDeviceSize alignment = allocator.canImportHost() ? allocator.getHostImportAlignment() : 0;
+        if(!sharedFrames.create(sharedFramesName, swapChainExtent.width, swapChainExtent.height, swapChainExtent.width * 4,
+                                swapChainImageFormat, SHARED_FRAME_SLOTS, static_cast<size_t>(alignment)))
+        {
+            throw std::runtime_error("Failed to create shared memory " + sharedFramesName);
+        }
+        frameExport.init(allocator, sharedFrames, MAX_FRAMES_IN_FLIGHT);
+        std::cout << "Sharing frames as " << sharedFramesName << (frameExport.isZeroCopy() ? " (imported host memory)" : " (readback copy)") << std::endl;
+    }
+
+
+    void createGoldenCapture(){     //GOLDEN_FRAME's swap chain image is copied here by its own command buffer
+        if(!goldenVulkan) return;
+        if(!swapChainExportable){
+            throw std::runtime_error("Failed to set up the golden capture, swap chain images cannot be copied from");
+        }
+        goldenReadback = allocator.createBuffer(static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * 4,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false);
+    }
+
+
+    void recordGoldenCapture(VkCommandBuffer commandBuffer, VkImage image){     //image is in TRANSFER_SRC_OPTIMAL
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+        vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, goldenReadback->buffer, 1, &region);
+
+        VkMemoryBarrier hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+    }
+
+
+    RgbaImage readGoldenCapture(){      //The device must be idle
+        RgbaImage frame = makeRgbaImage(goldenReadback->mapped, swapChainExtent.width, swapChainExtent.height, swapChainExtent.width);
+        if(swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM || swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB){
+            for(size_t i = 0; i < frame.pixels.size(); i += 4){
+                std::swap(frame.pixels[i], frame.pixels[i + 2]);
+            }
+        }
+        return frame;
+    }
+
+
+    void destroyFrameResources(){
+        vkDestroyCommandPool(device, commandPool, nullptr);
+        lateLatch.destroy();
+        drawCache.destroy();
+    }
+
+
+    void simulate(float dt){   //One fixed step; simulation thread
+        PROFILE_ZONE("simulate");
+        previousCameraAngle = cameraAngle;
+        cameraAngle += 0.5f * dt;
+
+        for(SceneObject& object : sceneObjects){
+            object.previous = object.current;
+            float speed = length(object.angularVelocity);
+            if(speed > 0.0f){
+                object.current.rotation = quatMultiply(quatAxisAngle(object.angularVelocity, speed * dt), object.current.rotation);
+                object.current.position = object.pivot - quatRotate(object.current.rotation, object.pivot);    //Keeps the pivot in place
+            }
+            object.moved = object.moved || !(object.previous == object.current);
+        }
+        updateSceneBvh();
+    }
+
+
+    void buildFramePacket(FramePacket& packet, uint64_t frameNumber, float alpha){     //Simulation thread
+        PROFILE_ZONE("buildFramePacket");
+        packet.frameNumber = frameNumber;
+        packet.time = simulationClock.getInterpolatedTime();
+        packet.inputTimestampNs = pendingInputNs;
+        pendingInputNs = 0;
+
+        float angle = previousCameraAngle + (cameraAngle - previousCameraAngle) * alpha;
+        Vec3 eye(std::cos(angle) * 5.0f, 2.0f, std::sin(angle) * 5.0f);
+        CameraData& camera = packet.camera;
+        camera.fovY = 1.0472f;      //60 degrees
+        camera.position[0] = eye.x;
+        camera.position[1] = eye.y;
+        camera.position[2] = eye.z;
+        mat4LookAt(eye, Vec3(0.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f), camera.view);
+        mat4Perspective(camera.fovY, swapChainExtent.width / static_cast<float>(swapChainExtent.height), 0.1f, 100.0f, camera.projection);
+
+        float viewProjection[16];
+        mat4Multiply(camera.projection, camera.view, viewProjection);
+        std::memcpy(latchState.view, camera.view, sizeof(camera.view));
+        std::memcpy(latchState.projection, camera.projection, sizeof(camera.projection));
+        std::memcpy(latchState.viewProjection, viewProjection, sizeof(viewProjection));
+        std::memcpy(latchState.cameraPosition, camera.position, sizeof(camera.position));
+        publishLatch();
+
+        packet.clearColor[0] = 0.1f + 0.1f * std::sin(angle);
+        packet.clearColor[1] = 0.1f;
+        packet.clearColor[2] = 0.15f;
+        packet.clearColor[3] = 1.0f;
+
+        Frustum frustum = frustumFromMatrix(viewProjection);
+
+        sceneBvh.queryFrustum(frustum, [&](uint32_t index, bool inside){
+            SceneObject& object = sceneObjects[index];
+            Transform transform = interpolate(object.previous, object.current, alpha);
+            DrawItem draw{object.object, object.mesh, object.material, 0, {}};
+            Vec3 center;
+            float radius;
+            worldSphere(object, transform, draw.transform, center, radius);
+            if(!inside && !sphereInFrustum(frustum, center, radius)) return;
+            if(object.moved){
+                draw.flags |= DRAW_TRANSFORM_CHANGED;
+            }
+            object.moved = !(object.previous == object.current);    //Still blending between two different states
+            packet.draws.push_back(draw);
+        });
+
+        packet.pickSequence = pickQueued ? pickSequence : 0;
+        packet.pickPixel[0] = pickPixel[0];
+        packet.pickPixel[1] = pickPixel[1];
+        pickQueued = false;
+    }
+
+
+    static void idleBackoff(uint32_t spins){
+        if(spins < 64){
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+
+    void renderLoop(){
+        PROFILE_THREAD("Render");
+        uint32_t idleSpins = 0;
+        AcquiredImage image;
+        bool haveImage = false;
+
+        while(true){
+            if(!haveImage){
+                haveImage = presentThread.tryAcquire(image);    //Packets stay queued until there is an image to draw them into
+            }
+            const FramePacket* packet = haveImage ? framePipe.consume() : nullptr;
+            if(packet == nullptr){
+                if(!renderRunning.load()) break;
+                idleBackoff(idleSpins++);
+                continue;
+            }
+
+            idleSpins = 0;
+            drawFrame(*packet, image);
+            haveImage = false;
+            framePipe.release(packet);
+        }
+    }
+
+
+    void drawFrame(const FramePacket& packet, const AcquiredImage& image){     //Render thread
+        PROFILE_ZONE("drawFrame");
+        if(bufferDeviceAddressSupported){   //CPU side records only
+            for(const DrawItem& draw : packet.draws){
+                if(draw.flags & DRAW_TRANSFORM_CHANGED){
+                    scene.setTransform(draw.object, draw.transform);
+                }
+            }
+        }
+
+        submissions.wait(graphicsQueue, frameTickets[currentFrame]);
+        frameArenas.beginFrame(currentFrame);
+        if(sharedFrames.isOpen()){
+            frameExport.retire(currentFrame);   //Publishes what this frame slot rendered last time
+        }
+        pickBuffer.poll(submissions, graphicsQueue, [this](const PickResult& result){ framePipe.postPick(result); });
+        if(bufferDeviceAddressSupported){   //Without a GpuScene nothing writes ids, the bounding sphere pick stands
+            pickBuffer.request(packet);
+        }
+
+        uint32_t imageIndex = image.imageIndex;
+        gpuProfiler.collect();                          //Everything the previous use of this frame slot measured is done
+        defragmenter.step(DEFRAG_BUDGET_MS);
+        if(bufferDeviceAddressSupported){
+            scene.beginFrame(currentFrame);
+        }
+
+        static const std::vector<VkCommandBuffer> noDraws;
+        const std::vector<VkCommandBuffer>* drawChunks = &noDraws;
+        if(bufferDeviceAddressSupported){
+            if(scene.getMeshGeneration() != drawCacheMeshGeneration){    //Cached chunks bind mesh buffers by handle
+                drawCache.invalidate();
+                drawCacheMeshGeneration = scene.getMeshGeneration();
+            }
+            VkPipeline pipeline = shaderVariants.get(sceneProgram, SCENE_FEATURES);
+            if(pipeline != drawCachePipeline){      //The specialized variant replaced the fallback; both stay alive until cleanup
+                drawCache.invalidate();
+                drawCachePipeline = pipeline;
+            }
+            VkCommandBufferInheritanceInfo inheritance = makeInfo<VkCommandBufferInheritanceInfo>();
+            inheritance.renderPass = renderPass;
+            inheritance.subpass = 0;
+            drawChunks = &drawCache.update(currentFrame, packet.draws, inheritance,
+                [this](VkCommandBuffer commandBuffer, const DrawItem* draws, uint32_t count){ recordDraws(commandBuffer, currentFrame, draws, count); });
+        }
+
+        VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
+        vkResetCommandBuffer(commandBuffer, 0);
+        recordCommandBuffer(commandBuffer, imageIndex, *drawChunks, packet);
+
+        Submission submission(commandBuffer, &frameArenas.local());
+        submission.waitSemaphores = {image.semaphore};
+        submission.waitStages = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};   //Where the pass first writes the image
+        submission.signalSemaphores = {renderFinishedSemaphores[imageIndex]};
+        VkSemaphore bindSemaphore = virtualTexturePack.isOpen() ? virtualTexture.getBindSemaphore(currentFrame) : VK_NULL_HANDLE;
+        if(bindSemaphore != VK_NULL_HANDLE){    //Pages bound by this frame's update are copied into first
+            submission.waitSemaphores.push_back(bindSemaphore);
+            submission.waitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT);
+        }
+        submissions.enqueue(graphicsQueue, std::move(submission));
+
+        LatchedUniforms latched;
+        if(latchMailbox.read(latched)){     //As late as possible; the command buffer only references this frame's slot
+            lateLatch.latch(currentFrame, latched);
+        }
+
+        frameTickets[currentFrame] = submissions.flush(graphicsQueue);     //Defragmenter copies and the frame in one vkQueueSubmit
+        pickBuffer.submitted(frameTickets[currentFrame]);
+        uint64_t submitNs = Profiler::steadyNanoseconds();
+
+        presentThread.present({imageIndex, renderFinishedSemaphores[imageIndex], image.semaphore, frameTickets[currentFrame],
+                               packet.inputTimestampNs, submitNs});
+
+        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    }
+
+
+    //One CommandCache chunk of frameIndex's set. Everything that changes per frame is read through the addresses pushed
+    //here, so the chunk is reused until the draw list, the mesh buffers or the pipeline change
+    void recordDraws(VkCommandBuffer commandBuffer, uint32_t frameIndex, const DrawItem* draws, uint32_t count){
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawCachePipeline);
+
+        VkViewport viewport{0.0f, 0.0f, static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height), 0.0f, 1.0f};
+        VkRect2D scissor{{0, 0}, swapChainExtent};
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        ScenePushConstants push{scene.getTableAddress(frameIndex), lateLatch.getAddress(frameIndex), SCENE_FEATURES, 0};
+        vkCmdPushConstants(commandBuffer, scenePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
+        if(virtualTexturePack.isOpen()){    //Fixed per frame index, like the addresses above
+            VkDescriptorSet set = virtualTexture.getDescriptorSet(frameIndex);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scenePipelineLayout, 0, 1, &set, 0, nullptr);
+        }
+
+        VkDeviceSize offset = 0;
+        for(uint32_t i = 0; i < count; i++){
+            VkBuffer vertexBuffer = scene.getVertexBuffer(draws[i].mesh);
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+            vkCmdBindIndexBuffer(commandBuffer, scene.getIndexBuffer(draws[i].mesh), 0, VK_INDEX_TYPE_UINT32);
+            vkCmdDrawIndexed(commandBuffer, scene.getIndexCount(draws[i].mesh), 1, 0, 0, draws[i].object);    //Object id in gl_InstanceIndex
+        }
+    }
+
+
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, const std::vector<VkCommandBuffer>& drawChunks,
+                             const FramePacket& packet)
+    {
+        PROFILE_ZONE("recordCommandBuffer");
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS){
+            throw std::runtime_error("Failed to begin recording command buffer");
+        }
+        uint32_t zone = gpuProfiler.begin(commandBuffer, "Frame");
+        if(virtualTexturePack.isOpen()){    //The frame slot's fence has signalled, its feedback is complete
+            virtualTexture.update(commandBuffer, currentFrame);
+        }
+
+        VkClearValue clearValues[3]{};
+        memcpy(clearValues[0].color.float32, packet.clearColor, sizeof(clearValues[0].color.float32));
+        clearValues[1].color.uint32[0] = PICK_NONE;
+        clearValues[2].depthStencil = {1.0f, 0};
+
+        VkRenderPassBeginInfo passInfo = makeInfo<VkRenderPassBeginInfo>();
+        passInfo.renderPass = renderPass;
+        passInfo.framebuffer = swapChainFramebuffers[imageIndex];
+        passInfo.renderArea = {{0, 0}, swapChainExtent};
+        passInfo.clearValueCount = static_cast<uint32_t>(std::size(clearValues));
+        passInfo.pClearValues = clearValues;
+        vkCmdBeginRenderPass(commandBuffer, &passInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        if(!drawChunks.empty()){    //packet.draws, cached by drawCache
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(drawChunks.size()), drawChunks.data());
+        }
+        vkCmdEndRenderPass(commandBuffer);
+        pickBuffer.recordReadback(commandBuffer);
+        if(virtualTexturePack.isOpen()){
+            virtualTexture.recordFeedbackBarrier(commandBuffer);
+        }
+
+        if(swapChainExportable){        //The pass left the image in TRANSFER_SRC_OPTIMAL
+            if(sharedFrames.isOpen()){
+                frameExport.record(commandBuffer, currentFrame, packet.frameNumber, swapChainImages[imageIndex]);
+            }
+            if(goldenReadback != nullptr && packet.frameNumber == GOLDEN_FRAME){
+                recordGoldenCapture(commandBuffer, swapChainImages[imageIndex]);
+            }
+
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask = 0;      //Reads only, nothing to make visible
+            barrier.dstAccessMask = 0;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = swapChainImages[imageIndex];
+            barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+
+        gpuProfiler.end(commandBuffer, zone);
+        if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){
+            throw std::runtime_error("Failed to record command buffer");
+        }
+    }
+
+
+    ////////////////////////////////////////// Software fallback block ////////////////////////////////////////////////////////////////////////////////////////////
+
+    void initSoftwareRenderer(const char* reason){     //Replaces the rest of initVulkan when no Vulkan device is usable
+        PROFILE_ZONE("initSoftwareRenderer");
+        if(reason != nullptr){
+            std::cerr << reason << ", falling back to the software rasterizer" << std::endl;
+        }
+        if(goldenVulkan){
+            throw std::runtime_error(std::string("Failed to start the Vulkan golden run: ") + reason);
+        }
+        softwareRendering = true;
+        swapChainExtent = {WIDTH, HEIGHT};      //Used for the camera aspect and cursor mapping
+
+        if(window != nullptr){      //The window was made for Vulkan; frames are shown through a GL context instead
+            glfwDestroyWindow(window);
+            glfwDefaultWindowHints();
+            glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
+            glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+            window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan (software)", nullptr, nullptr);
+            setWindowCallbacks();
+        }
+
+        if(window != nullptr){
+            glfwMakeContextCurrent(window);
+            softwareGl.pixelStorei = (void (APIENTRY*)(GLenum, GLint)) glfwGetProcAddress("glPixelStorei");
+            softwareGl.rasterPos2f = (void (APIENTRY*)(GLfloat, GLfloat)) glfwGetProcAddress("glRasterPos2f");
+            softwareGl.pixelZoom = (void (APIENTRY*)(GLfloat, GLfloat)) glfwGetProcAddress("glPixelZoom");
+            softwareGl.drawPixels = (void (APIENTRY*)(GLsizei, GLsizei, GLenum, GLenum, const void*)) glfwGetProcAddress("glDrawPixels");
+            glfwMakeContextCurrent(nullptr);    //The render thread takes it
+        }
+        if(softwareGl.drawPixels == nullptr && !isOffscreen()){
+            std::cout << "No window to present to, writing every " << SOFTWARE_DUMP_INTERVAL << "th frame to " << SOFTWARE_FRAME_PATH << std::endl;
+        }
+
+        softwareRasterizer.init(WIDTH, HEIGHT);
+        loadSoftwareScene();
+
+        if(!videoPath.empty()){
+            auto writer = std::make_unique<Y4mWriter>();
+            if(!writer->open(videoPath, WIDTH, HEIGHT, VIDEO_FPS)){
+                throw std::runtime_error("Failed to open video output " + videoPath);
+            }
+            videoEncoder.init(jobs, WIDTH, HEIGHT, std::move(writer));
+        }
+
+        if(!sharedFramesName.empty()){
+            if(!sharedFrames.create(sharedFramesName, WIDTH, HEIGHT, WIDTH * 4, VK_FORMAT_R8G8B8A8_UNORM, SHARED_FRAME_SLOTS)){
+                throw std::runtime_error("Failed to create shared memory " + sharedFramesName);
+            }
+            std::cout << "Sharing frames as " << sharedFramesName << std::endl;
+        }
+    }
+
+
+    void loadSoftwareScene(){   //loadScene for the software rasterizer, which copies what it needs out of the cache
+        PROFILE_ZONE("loadSoftwareScene");
+        if(scenePath.empty()) return;
+
+        SceneCache cache;
+        openSceneCache(cache);
+        std::vector<MeshHandle> meshes;
+        for(uint32_t i = 0; i < cache.getMeshCount(); i++){
+            const GltfMesh& mesh = cache.getMeshes()[i];
+            meshes.push_back(softwareRasterizer.addMesh(cache.getVertices() + mesh.firstVertex, mesh.vertexCount, cache.getIndices() + mesh.firstIndex, mesh.indexCount));
+        }
+        std::vector<uint32_t> materials;
+        for(uint32_t i = 0; i < cache.getMaterialCount(); i++){
+            materials.push_back(softwareRasterizer.addMaterial(cache.getMaterials()[i].baseColor));
+        }
+        uint32_t defaultMaterial = softwareRasterizer.addMaterial(GltfMaterial().baseColor);
+
+        for(uint32_t i = 0; i < cache.getInstanceCount(); i++){
+            const GltfInstance& instance = cache.getInstances()[i];
+            const GltfMesh& mesh = cache.getMeshes()[instance.mesh];
+            uint32_t material = mesh.material != GLTF_NO_MATERIAL ? materials[mesh.material] : defaultMaterial;
+            addSceneObject(static_cast<uint32_t>(sceneObjects.size()), meshes[instance.mesh], material, mesh, instance.transform);
+        }
+        buildSceneBvh();
+    }
+
+
+    bool renderingFailed() const {      //No more packets will be drawn; stopping the threads rethrows the error
+        return renderFailed || (!softwareRendering && presentThread.isFailed());
+    }
+
+    bool isOffscreen() const { return !goldenPath.empty() || !videoPath.empty(); }
+
+    bool isHeadless() const { return isOffscreen() && !goldenVulkan; }   //Offscreen through the software rasterizer
+
+
+    //Replaces mainLoop for --golden/--video: exactly one simulation step per frame, so every frame is reproducible. No
+    //packet is built after the last frame, so the Vulkan renderer's late latch also holds that frame's camera
+    void offscreenLoop(){
+        uint64_t frameCount = 0;
+        if(!goldenPath.empty()) frameCount = GOLDEN_FRAME + 1;
+        if(!videoPath.empty()) frameCount = std::max(frameCount, videoFrames);
+
+        startRenderThread();
+
+        for(uint64_t frameNumber = 0; frameNumber < frameCount && !renderingFailed();){
+            if(window != nullptr){
+                glfwPollEvents();
+            }
+            FramePacket* packet = framePipe.acquire();
+            if(packet == nullptr){
+                std::this_thread::sleep_for(std::chrono::duration<double>(SIMULATION_IDLE_WAIT_S));
+                continue;
+            }
+            simulate(static_cast<float>(SIMULATION_STEP_S));
+            buildFramePacket(*packet, frameNumber++, 0.0f);
+            framePipe.publish(packet);
+        }
+
+        while(framePipe.queued() != 0 && !renderingFailed()){     //The render thread stops with packets still queued
+            std::this_thread::sleep_for(std::chrono::duration<double>(SIMULATION_IDLE_WAIT_S));
+        }
+        stopRenderThread();
+        if(!softwareRendering){
+            presentThread.stop();
+            vkDeviceWaitIdle(device);
+            checkGolden(readGoldenCapture(), VULKAN_GOLDEN_TOLERANCE);
+        }
+    }
+
+
+    void checkGolden(const RgbaImage& frame, const ImageTolerance& tolerance){     //On GOLDEN_FRAME
+        PROFILE_ZONE("checkGolden");
+        if(goldenUpdate){
+            if(!writePpm(goldenPath, frame)){
+                std::cerr << "Failed to write " << goldenPath << std::endl;
+                offscreenFailed = true;
+            }
+            return;
+        }
+
+        RgbaImage reference;
+        if(!readPpm(goldenPath, reference)){
+            std::cerr << "Failed to read golden image " << goldenPath << std::endl;
+            offscreenFailed = true;
+            return;
+        }
+
+        RgbaImage heatmap;
+        ImageDiff diff = compareImages(reference, frame, tolerance, &heatmap);
+        if(diff.sizeMismatch){
+            std::cerr << "Golden image " << goldenPath << " is " << reference.width << "x" << reference.height
+                      << ", the frame is " << frame.width << "x" << frame.height << std::endl;
+            offscreenFailed = true;
+            return;
+        }
+
+        std::cout << "Golden " << goldenPath << ": " << (diff.passed ? "passed" : "FAILED") << ", " << diff.badPixels << " pixels differ"
+                  << " (max " << diff.maxDifference << ", mean " << diff.meanDifference << "), SSIM " << diff.ssim << std::endl;
+        if(!diff.passed){
+            writePpm(GOLDEN_ACTUAL_PATH, frame);
+            writePpm(GOLDEN_HEATMAP_PATH, heatmap);
+            offscreenFailed = true;
+        }
+    }
+
+
+    void softwareRenderLoop(){      //Render thread when softwareRendering
+        PROFILE_THREAD("Render");
+        if(softwareGl.drawPixels != nullptr){
+            glfwMakeContextCurrent(window);
+            glfwSwapInterval(1);
+        }
+
+        uint32_t idleSpins = 0;
+        while(true){
+            const FramePacket* packet = framePipe.consume();
+            if(packet == nullptr){
+                if(!renderRunning.load()) break;
+                idleBackoff(idleSpins++);
+                continue;
+            }
+
+            idleSpins = 0;
+            softwareRasterizer.render(*packet, jobs);   //Geometry and tiles run on the workers, this thread helps
+            if(packet->pickSequence != 0){
+                answerSoftwarePick(*packet);
+            }
+            presentSoftwareFrame(packet->frameNumber);
+            framePipe.release(packet);
+        }
+
+        if(softwareGl.drawPixels != nullptr){
+            glfwMakeContextCurrent(nullptr);
+        }
+    }
+
+
+    void answerSoftwarePick(const FramePacket& packet){     //The ids are in memory already, nothing to wait for
+        const SoftwareFramebuffer& framebuffer = softwareRasterizer.getFramebuffer();
+        PickRegion region = pickRegion(packet.pickPixel[0], packet.pickPixel[1], framebuffer.width, framebuffer.height);
+        const uint32_t* ids = framebuffer.ids.data() + static_cast<size_t>(region.y0) * framebuffer.stride + region.x0;
+        framePipe.postPick({packet.pickSequence, resolvePick(ids, framebuffer.stride, region)});
+    }
+
+
+    void presentSoftwareFrame(uint64_t frameNumber){
+        PROFILE_ZONE("presentSoftwareFrame");
+        const SoftwareFramebuffer& framebuffer = softwareRasterizer.getFramebuffer();
+
+        if(sharedFrames.isOpen()){
+            uint32_t slot = sharedFrames.beginFrame();
+            uint8_t* destination = sharedFrames.slotData(slot);
+            for(uint32_t y = 0; y < framebuffer.height; y++){
+                memcpy(destination + static_cast<size_t>(y) * framebuffer.width * 4, framebuffer.color.data() + static_cast<size_t>(y) * framebuffer.stride,
+                       framebuffer.width * 4);
+            }
+            sharedFrames.endFrame(slot, frameNumber);
+        }
+
+        if(softwareGl.drawPixels != nullptr){
+            softwareGl.pixelStorei(GL_UNPACK_ROW_LENGTH, static_cast<GLint>(framebuffer.stride));
+            softwareGl.rasterPos2f(-1.0f, 1.0f);    //Top left; the framebuffer's first row is the top one
+            softwareGl.pixelZoom(1.0f, -1.0f);
+            softwareGl.drawPixels(framebuffer.width, framebuffer.height, GL_RGBA, GL_UNSIGNED_BYTE, framebuffer.color.data());
+            glfwSwapBuffers(window);
+        } else if(isOffscreen()){
+            if(!goldenPath.empty() && frameNumber == GOLDEN_FRAME){
+                checkGolden(makeRgbaImage(framebuffer.color.data(), framebuffer.width, framebuffer.height, framebuffer.stride), ImageTolerance{});
+            }
+            if(videoEncoder.isOpen() && frameNumber < videoFrames){     //Pixels are copied out before this returns
+                videoEncoder.encode(reinterpret_cast<const uint8_t*>(framebuffer.color.data()), framebuffer.stride);
+            }
+        } else if(frameNumber % SOFTWARE_DUMP_INTERVAL == 0){
+            if(!softwareRasterizer.writePpm(SOFTWARE_FRAME_PATH)){
+                std::cerr << "Failed to write " << SOFTWARE_FRAME_PATH << std::endl;
+            }
+        }
+    }
+
+
+    void cleanupSoftwareRenderer(){
+        if(videoEncoder.isOpen()){
+            videoEncoder.destroy();     //Flushes the queued frames
+            if(videoEncoder.hasFailed()){
+                std::cerr << "Failed to write " << videoPath << std::endl;
+                offscreenFailed = true;
+            } else {
+                std::cout << "Wrote " << videoEncoder.getFramesWritten() << " frames to " << videoPath << std::endl;
+            }
+        }
+        sharedFrames.destroy();
+        jobs.stop();
+        if(!Profiler::instance().exportChromeTrace(TRACE_PATH)){
+            std::cerr << "Failed to write " << TRACE_PATH << std::endl;
+        }
+        if(window != nullptr){
+            glfwDestroyWindow(window);
+        }
+        glfwTerminate();
+    }
+
+
     
 
 
@@ -570,9 +2317,41 @@ private:
 
 
 
-int main() {
+int main(int argc, char** argv) {
     HelloTriangleApplication app;
 
+    std::string videoPath;
+    uint64_t videoFrames = VIDEO_DEFAULT_FRAMES;
+    for(int i = 1; i < argc; i++){      //--golden <reference.ppm> compares, --update-golden <reference.ppm> (re)writes it
+        std::string argument = argv[i];
+        if((argument == "--golden" || argument == "--update-golden") && i + 1 < argc){
+            app.setGoldenTest(argv[++i], argument == "--update-golden");
+        } else if(argument == "--vulkan"){
+            app.setGoldenOnVulkan(true);
+        } else if(argument == "--video" && i + 1 < argc){
+            videoPath = argv[++i];
+        } else if(argument == "--frames" && i + 1 < argc){
+            videoFrames = std::strtoull(argv[++i], nullptr, 10);
+        } else if(argument == "--share-frames" && i + 1 < argc){
+            app.setFrameSharing(argv[++i]);
+        } else if(argument == "--scene" && i + 1 < argc){
+            app.setScenePath(argv[++i]);
+        } else if(argument == "--spin" && i + 1 < argc){
+            app.setSpin(std::strtof(argv[++i], nullptr));
+        } else if(argument == "--virtual-texture" && i + 2 < argc){
+            app.setVirtualTexture(argv[i + 1], argv[i + 2]);
+            i += 2;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--golden <reference.ppm> | --update-golden <reference.ppm> [--vulkan]]"
+                      << " [--video <output.y4m> [--frames <count>]] [--share-frames </shm-name>]"
+                      << " [--scene <file.gltf|file.glb> [--spin <radians/s>] [--virtual-texture <pack> <entry>]]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if(!videoPath.empty()){
+        app.setVideoOutput(videoPath, videoFrames);
+    }
+
     try {
         app.run();
     } catch (const std::exception& e) {
@@ -580,5 +2359,5 @@ int main() {
         return EXIT_FAILURE; //predefined termination codes form stdexcept
     }
 
-    return EXIT_SUCCESS;
+    return app.offscreenRunFailed() ? EXIT_FAILURE : EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+// GPU scene layout, #include'd by shaders that read a GpuScene (see GpuScene.h).
+// The scene is reached from a single 64-bit address, usually passed as the first push constant:
+//   layout(push_constant) uniform Push { SceneTable scene; } push;
+
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer Mesh {
+    uint64_t vertices;      // Raw vertex data, interpret with a Vertices reference of the right layout
+    uint64_t indices;
+    uint vertexCount;
+    uint indexCount;
+    uint vertexStride;
+    uint padding;
+    vec3 center;
+    float radius;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer Material {
+    vec4 baseColor;
+    vec4 emissive;
+    float metallic;
+    float roughness;
+    uint textureIndex;
+    uint flags;
+};
+
+const uint GPU_OBJECT_VISIBLE = 1u;
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer Object {
+    mat4 transform;
+    Mesh mesh;
+    Material material;
+    uint flags;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Indices {
+    uint values[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 8) readonly buffer SceneTable {
+    uint64_t objects;
+    uint64_t meshes;
+    uint64_t materials;
+    uint objectCount;
+    uint meshCount;
+    uint materialCount;
+};
+
+const uint GPU_OBJECT_STRIDE = 96u;     // sizeof(GpuObject): mat4 + two pointers + flags + padding
+
+Object sceneObject(SceneTable scene, uint index) {
+    return Object(scene.objects + uint64_t(index) * uint64_t(GPU_OBJECT_STRIDE));
+}
+
+uint sceneIndex(Mesh mesh, uint i) {
+    return Indices(mesh.indices).values[i];
+}
@@ -0,0 +1,18 @@
+// Late-latched camera and cursor, #include'd by shaders that read LatchedUniforms (see LateLatch.h).
+// Each frame in flight has its own slot, reached by device address, usually passed as a push constant:
+//   layout(push_constant) uniform Push { LateLatch camera; } push;
+// The render thread writes the slot right before the frame is submitted, so read it instead of baking the camera into
+// push constants or cached command buffers.
+
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+
+layout(buffer_reference, std140, buffer_reference_align = 16) readonly buffer LateLatch {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;        // xyz, w unused
+    vec4 cursor;                // Window pixels in xy, normalized device coordinates in zw
+    uint64_t inputTimestampNs;
+    uint64_t padding;
+};
@@ -0,0 +1,46 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// Flat two-sided lambert from the face normal, the same shading as SoftwareRasterizer.h, and the object id for picking.
+// Built a second time with -DSCENE_VIRTUAL_TEXTURE (scene_virtual.frag.spv) for --virtual-texture runs, which also
+// multiply by the virtual texture; only that build declares descriptors, so the plain pipeline layout has no sets.
+
+layout(location = 0) in vec3 inWorldPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) flat in uint inObject;
+layout(location = 3) in vec2 inUv;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out uint outObject;      // R32_UINT attachment of PickBuffer
+
+#ifdef SCENE_VIRTUAL_TEXTURE
+layout(set = 0, binding = 0) uniform usampler2D vtPageTable;
+layout(set = 0, binding = 1) uniform sampler2D vtCache;
+layout(set = 0, binding = 2) buffer VtFeedback {
+    uint count;
+    uint capacity;
+    uint jitter;
+    uint padding;
+    vec4 info;
+    vec4 cacheInfo;
+    uint entries[];
+} vtFeedback;
+
+#include "virtual_texture.glsl"
+#endif
+
+const vec3 LIGHT_DIRECTION = vec3(0.4, 1.0, 0.3);
+
+void main() {
+    vec3 normal = cross(dFdx(inWorldPosition), dFdy(inWorldPosition));
+    float normalLength = length(normal);
+    float shade = 0.2 + 0.8 * (normalLength > 0.0 ? abs(dot(normal / normalLength, normalize(LIGHT_DIRECTION))) : 0.0);
+    vec4 color = inColor;
+#ifdef SCENE_VIRTUAL_TEXTURE
+    vec2 uv = clamp(inUv, vec2(0.0), vec2(0.99999));    // Clamp to edge, page indices must stay in range
+    vtRequestPage(uv);
+    color *= vtSample(uv);
+#endif
+    outColor = vec4(color.rgb * shade, color.a);
+    outObject = inObject;
+}
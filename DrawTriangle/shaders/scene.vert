@@ -0,0 +1,43 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+// GpuScene objects, one vkCmdDrawIndexed each (recordDraws in main.cpp). firstInstance carries the object id, so the
+// transform and material are read from the scene and a cached command buffer stays valid while the object moves.
+
+#include "gpu_scene.glsl"
+#include "late_latch.glsl"
+
+layout(push_constant) uniform Push {
+    SceneTable scene;       // This frame in flight's copy
+    LateLatch camera;       // This frame in flight's slot, written right before submit
+    uint features;
+} push;
+
+#define VARIANT_RUNTIME_FEATURES push.features
+#include "variants.glsl"
+
+const uint SCENE_FEATURE_VERTEX_COLOR = 1u;     // Multiply the material color by COLOR_0
+
+layout(location = 0) in vec3 inPosition;        // Vertex in Vertex.h
+layout(location = 1) in vec4 inNormal;
+layout(location = 2) in vec2 inUv;
+layout(location = 3) in vec4 inColor;
+
+layout(location = 0) out vec3 outWorldPosition;
+layout(location = 1) out vec4 outColor;
+layout(location = 2) flat out uint outObject;  // Written to the pick id attachment, see PickBuffer.h
+layout(location = 3) out vec2 outUv;            // Only read by the virtual texture build of scene.frag
+
+void main() {
+    Object object = sceneObject(push.scene, uint(gl_InstanceIndex));
+    vec4 world = object.transform * vec4(inPosition, 1.0);
+    gl_Position = push.camera.viewProjection * world;
+
+    outWorldPosition = world.xyz;
+    outObject = uint(gl_InstanceIndex);
+    outUv = inUv;
+    outColor = object.material.baseColor;
+    if (hasFeature(SCENE_FEATURE_VERTEX_COLOR)) {
+        outColor *= inColor;
+    }
+}
@@ -0,0 +1,11 @@
+// Specialization constants used by ShaderVariantManager (see ShaderVariants.h), #include'd once per stage.
+//
+// The including shader defines VARIANT_RUNTIME_FEATURES before the #include (usually a push constant); only the
+// dynamic fallback variant reads it. Specialized variants fold every hasFeature() into a constant.
+
+layout(constant_id = 0) const bool VARIANT_DYNAMIC = true;
+layout(constant_id = 1) const uint VARIANT_FEATURES = 0u;
+
+bool hasFeature(uint feature) {
+    return ((VARIANT_DYNAMIC ? VARIANT_RUNTIME_FEATURES : VARIANT_FEATURES) & feature) != 0u;
+}
@@ -0,0 +1,67 @@
+// Virtual texture sampling, #include'd by fragment shaders that read a VirtualTexture (see VirtualTexture.h).
+//
+// The including shader declares, before the #include, the set VirtualTexture::getDescriptorSetLayout() describes:
+//   layout(set = N, binding = 0) uniform usampler2D vtPageTable;     // nearest filtering, all mips
+//   layout(set = N, binding = 1) uniform sampler2D vtCache;          // linear filtering; atlas or sparse image
+//   layout(set = N, binding = 2) buffer VtFeedback { uint count; uint capacity; uint jitter; uint padding;
+//                                                    vec4 info; vec4 cacheInfo; uint entries[]; } vtFeedback;
+// Written by the host, so cached command buffers need nothing per frame:
+//   info       vec4(virtualWidth, virtualHeight, pageSize, mipCount)
+//   cacheInfo  vec4(cacheSideInPages, sparse ? 1 : 0, feedbackStride, unused)
+//   jitter     which pixel of each feedbackStride^2 square reports this frame
+
+#define VT_INFO vtFeedback.info
+#define VT_CACHE_INFO vtFeedback.cacheInfo
+
+uint vtPageId(uint mip, uvec2 page) {
+    return (mip << 28) | (page.y << 14) | page.x;
+}
+
+float vtMip(vec2 uv) {
+    vec2 texel = uv * VT_INFO.xy;
+    float lod = log2(max(length(dFdx(texel)), length(dFdy(texel))));
+    return clamp(floor(lod), 0.0, VT_INFO.w - 1.0);
+}
+
+vec2 vtMipSize(uint mip) {
+    return max(floor(VT_INFO.xy / float(1u << mip)), vec2(1.0));
+}
+
+// Only one pixel in feedbackStride^2 reports, rotating with the jitter, which keeps atomics cheap
+void vtRequestPage(vec2 uv) {
+    uint stride = uint(VT_CACHE_INFO.z);
+    uvec2 pixel = uvec2(gl_FragCoord.xy);
+    if ((pixel.x % stride) + (pixel.y % stride) * stride != vtFeedback.jitter) {
+        return;
+    }
+
+    uint mip = uint(vtMip(uv));
+    uvec2 page = uvec2(uv * vtMipSize(mip) / VT_INFO.z);
+    uint index = atomicAdd(vtFeedback.count, 1u);
+    if (index < vtFeedback.capacity) {
+        vtFeedback.entries[index] = vtPageId(mip, page);
+    }
+}
+
+vec4 vtSample(vec2 uv) {
+    uint mip = uint(vtMip(uv));
+    uvec2 page = uvec2(uv * vtMipSize(mip) / VT_INFO.z);
+    uvec4 entry = texelFetch(vtPageTable, ivec2(page), int(mip));
+    if (entry.a == 0u) {
+        return vec4(0.0);   // Nothing resident yet
+    }
+
+    uint residentMip = entry.b;
+    if (VT_CACHE_INFO.y > 0.5) {
+        // Sparse: never sample a level finer than what is bound
+        return textureLod(vtCache, uv, float(max(mip, residentMip)));
+    }
+
+    // Indirection: locate the texel inside its page and remap into the atlas, clamped half a texel in to avoid bleeding
+    float pageSize = VT_INFO.z;
+    vec2 texel = uv * vtMipSize(residentMip);
+    vec2 inPage = (texel - floor(texel / pageSize) * pageSize) / pageSize;
+    inPage = clamp(inPage, vec2(0.5 / pageSize), vec2(1.0 - 0.5 / pageSize));
+    vec2 atlasUv = (vec2(entry.rg) + inPage) / VT_CACHE_INFO.x;
+    return textureLod(vtCache, atlasUv, 0.0);
+}
@@ -0,0 +1,922 @@
+/*
+Unit tests for the CPU side building blocks of DrawTriangle:
+    Each test is a plain function that checks its results with CHECK; a failed check prints where it failed and the
+    run keeps going, the exit code reports whether anything failed. No Vulkan device or window is needed: the
+    allocator and defragmenter tests run against the fake device below, the SubmissionQueue::batch test only
+    exercises the static merge rule with made up handles.
+
+    Run with "make unit" from this directory. The scene cache test imports ../DrawTriangle/scenes/golden.gltf and
+    writes its cache to /tmp, the glTF test writes its files there too.
+*/
+
+#include "DeviceAllocator.h"
+#include "Defragmenter.h"
+#include "SpscRing.h"
+#include "LateLatch.h"
+#include "SubmissionQueue.h"
+#include "FrameArena.h"
+#include "HandlePool.h"
+#include "SharedFrames.h"
+#include "SceneCache.h"
+#include "Bvh.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <limits>
+#include <cmath>
+
+
+const char* TEST_SCENE_PATH = "../DrawTriangle/scenes/golden.gltf";
+const char* TEST_SCENE_CACHE_PATH = "/tmp/unit_tests.scenecache";
+const char* TEST_MALFORMED_GLTF_PATH = "/tmp/unit_tests_malformed.gltf";
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool passed, const char* condition, const char* file, int line){
+    if(passed) return;
+    std::cerr << file << ":" << line << ": CHECK(" << condition << ") failed" << std::endl;
+    failures++;
+}
+
+
+template<typename T>
+static T fakeHandle(uintptr_t value){   //Only compared, never passed to Vulkan
+    return reinterpret_cast<T>(value);
+}
+
+
+////////////////////////////////////////// Fake device ///////////////////////////////////////////////////////////////
+
+//Definitions of the Vulkan entry points DeviceAllocator, Defragmenter and SubmissionQueue call. The executable's own
+//definitions win over libvulkan's, so these tests never reach a driver. Device memory is host memory, buffers remember
+//where they are bound, and a submission runs its recorded copies and signals its fence right away.
+
+const VkDeviceSize FAKE_BLOCK_SIZE = 1024;
+const VkDeviceSize FAKE_ALIGNMENT = 16;
+const VkMemoryPropertyFlags HOST_MEMORY = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+struct FakeBuffer {
+    VkDeviceSize size;
+    uint8_t* memory = nullptr;
+    VkDeviceSize offset = 0;
+};
+
+struct FakeFence {
+    bool signalled = false;
+};
+
+struct FakeCopy {
+    VkBuffer source;
+    VkBuffer destination;
+    VkBufferCopy region;
+};
+
+static struct {
+    int liveBuffers = 0;
+    int liveMemory = 0;
+    bool failMap = false;
+    bool failEnd = false;
+    std::vector<FakeCopy> copies;   //Recorded into the one command buffer, run by vkQueueSubmit
+} fake;
+
+
+static FakeBuffer* fakeBuffer(VkBuffer buffer){ return reinterpret_cast<FakeBuffer*>(buffer); }
+
+
+extern "C" {
+
+VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceMemoryProperties(VkPhysicalDevice, VkPhysicalDeviceMemoryProperties* properties){
+    *properties = {};
+    properties->memoryTypeCount = 2;
+    properties->memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    properties->memoryTypes[1].propertyFlags = HOST_MEMORY;
+    properties->memoryHeapCount = 1;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateBuffer(VkDevice, const VkBufferCreateInfo* info, const VkAllocationCallbacks*, VkBuffer* buffer){
+    *buffer = reinterpret_cast<VkBuffer>(new FakeBuffer{info->size});
+    fake.liveBuffers++;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyBuffer(VkDevice, VkBuffer buffer, const VkAllocationCallbacks*){
+    if(buffer == VK_NULL_HANDLE) return;
+    delete fakeBuffer(buffer);
+    fake.liveBuffers--;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetBufferMemoryRequirements(VkDevice, VkBuffer buffer, VkMemoryRequirements* requirements){
+    requirements->size = alignUp(fakeBuffer(buffer)->size, FAKE_ALIGNMENT);
+    requirements->alignment = FAKE_ALIGNMENT;
+    requirements->memoryTypeBits = 0x3;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkAllocateMemory(VkDevice, const VkMemoryAllocateInfo* info, const VkAllocationCallbacks*, VkDeviceMemory* memory){
+    *memory = reinterpret_cast<VkDeviceMemory>(calloc(1, info->allocationSize));
+    fake.liveMemory++;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkFreeMemory(VkDevice, VkDeviceMemory memory, const VkAllocationCallbacks*){
+    if(memory == VK_NULL_HANDLE) return;
+    ::free(memory);
+    fake.liveMemory--;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkMapMemory(VkDevice, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize, VkMemoryMapFlags, void** data){
+    if(fake.failMap) return VK_ERROR_MEMORY_MAP_FAILED;
+    *data = reinterpret_cast<uint8_t*>(memory) + offset;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkBindBufferMemory(VkDevice, VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize offset){
+    fakeBuffer(buffer)->memory = reinterpret_cast<uint8_t*>(memory);
+    fakeBuffer(buffer)->offset = offset;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateCommandPool(VkDevice, const VkCommandPoolCreateInfo*, const VkAllocationCallbacks*, VkCommandPool* pool){
+    *pool = fakeHandle<VkCommandPool>(1);
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyCommandPool(VkDevice, VkCommandPool, const VkAllocationCallbacks*){}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkAllocateCommandBuffers(VkDevice, const VkCommandBufferAllocateInfo*, VkCommandBuffer* commandBuffers){
+    commandBuffers[0] = fakeHandle<VkCommandBuffer>(1);
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkBeginCommandBuffer(VkCommandBuffer, const VkCommandBufferBeginInfo*){
+    fake.copies.clear();
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEndCommandBuffer(VkCommandBuffer){
+    return fake.failEnd ? VK_ERROR_OUT_OF_DEVICE_MEMORY : VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdPipelineBarrier(VkCommandBuffer, VkPipelineStageFlags, VkPipelineStageFlags, VkDependencyFlags,
+    uint32_t, const VkMemoryBarrier*, uint32_t, const VkBufferMemoryBarrier*, uint32_t, const VkImageMemoryBarrier*){}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdCopyBuffer(VkCommandBuffer, VkBuffer source, VkBuffer destination, uint32_t regionCount, const VkBufferCopy* regions){
+    for(uint32_t i = 0; i < regionCount; i++){
+        fake.copies.push_back({source, destination, regions[i]});
+    }
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkQueueSubmit(VkQueue, uint32_t, const VkSubmitInfo*, VkFence fence){
+    for(const FakeCopy& copy : fake.copies){
+        const FakeBuffer* source = fakeBuffer(copy.source);
+        const FakeBuffer* destination = fakeBuffer(copy.destination);
+        memcpy(destination->memory + destination->offset + copy.region.dstOffset,
+               source->memory + source->offset + copy.region.srcOffset, copy.region.size);
+    }
+    fake.copies.clear();
+    reinterpret_cast<FakeFence*>(fence)->signalled = true;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateFence(VkDevice, const VkFenceCreateInfo*, const VkAllocationCallbacks*, VkFence* fence){
+    *fence = reinterpret_cast<VkFence>(new FakeFence());
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyFence(VkDevice, VkFence fence, const VkAllocationCallbacks*){
+    delete reinterpret_cast<FakeFence*>(fence);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkResetFences(VkDevice, uint32_t fenceCount, const VkFence* fences){
+    for(uint32_t i = 0; i < fenceCount; i++){
+        reinterpret_cast<FakeFence*>(fences[i])->signalled = false;
+    }
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkGetFenceStatus(VkDevice, VkFence fence){
+    return reinterpret_cast<FakeFence*>(fence)->signalled ? VK_SUCCESS : VK_NOT_READY;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkWaitForFences(VkDevice, uint32_t, const VkFence*, VkBool32, uint64_t){
+    return VK_SUCCESS;
+}
+
+}
+
+
+static void initFakeAllocator(DeviceAllocator& allocator){
+    allocator.init(fakeHandle<VkPhysicalDevice>(1), fakeHandle<VkDevice>(1), false, FAKE_BLOCK_SIZE);
+}
+
+
+////////////////////////////////////////// DeviceAllocator ///////////////////////////////////////////////////////////
+
+static void testDeviceAllocator(){
+    DeviceAllocator allocator;
+    initFakeAllocator(allocator);
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    Allocation* a = allocator.createBuffer(256, usage, HOST_MEMORY);
+    Allocation* b = allocator.createBuffer(256, usage, HOST_MEMORY);
+    Allocation* c = allocator.createBuffer(256, usage, HOST_MEMORY);
+    Allocation* d = allocator.createBuffer(256, usage, HOST_MEMORY);
+    CHECK(a->block == d->block && a->memory == d->memory);
+    CHECK(a->offset == 0 && b->offset == 256 && c->offset == 512 && d->offset == 768);
+    CHECK(b->mapped == static_cast<char*>(a->mapped) + 256);
+    CHECK((a->usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) && (a->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT));     //Movable by default
+
+    Allocation* e = allocator.createBuffer(256, usage, HOST_MEMORY);   //First block is full
+    CHECK(e->block != a->block && e->offset == 0);
+    CHECK(allocator.totalBlockSize() == 2 * FAKE_BLOCK_SIZE && allocator.totalUsed() == 5 * 256);
+
+    allocator.free(b);                          //First fit fills the hole, kept sorted by offset
+    Allocation* f = allocator.createBuffer(200, usage, HOST_MEMORY);
+    Allocation* g = allocator.createBuffer(32, usage, HOST_MEMORY);
+    CHECK(f->block == a->block && f->offset == 256 && f->size == 208 && f->bufferSize == 200);
+    CHECK(g->block == a->block && g->offset == 464);
+    const std::vector<Allocation*>& placed = a->block->allocations;
+    CHECK(placed.size() == 5 && placed[1] == f && placed[2] == g && placed[3] == c);
+
+    allocator.free(c);
+    allocator.free(d);
+    allocator.free(f);
+    allocator.free(g);
+    CHECK(allocator.pickSparseBlock(0.2f) == nullptr);     //Both blocks are a quarter used
+    MemoryBlock* sparse = allocator.pickSparseBlock(0.5f);
+    CHECK(sparse == a->block && sparse->draining);
+    CHECK(allocator.pickSparseBlock(0.5f) == nullptr);     //The other block has nowhere left to go
+    std::vector<Allocation*> movable = allocator.movableAllocations(sparse);
+    CHECK(movable.size() == 1 && movable[0] == a);
+
+    memset(a->mapped, 0x5A, 256);
+    VkBuffer oldBuffer = a->buffer;
+    Allocation* ghost = allocator.beginMove(a);
+    CHECK(ghost != nullptr && a->moving);
+    if(ghost == nullptr){
+        allocator.destroy();
+        return;
+    }
+    CHECK(ghost->block == e->block && ghost->offset == 256 && ghost->bufferSize == 256);
+    CHECK(allocator.movableAllocations(sparse).empty());   //Already moving
+    memcpy(ghost->mapped, a->mapped, 256);                  //Stands in for the GPU copy
+
+    allocator.commitMove(a, ghost);
+    CHECK(!a->moving && a->block == e->block && a->offset == 256 && a->buffer != oldBuffer);
+    CHECK(a->mapped == static_cast<char*>(e->mapped) + 256 && static_cast<uint8_t*>(a->mapped)[255] == 0x5A);
+    CHECK(ghost->block == sparse && ghost->offset == 0 && ghost->buffer == oldBuffer);
+
+    allocator.free(ghost);
+    allocator.releaseEmptyBlocks();
+    CHECK(allocator.totalBlockSize() == 2 * FAKE_BLOCK_SIZE);  //Empty, but still draining
+    allocator.undrain(sparse);
+    allocator.releaseEmptyBlocks();
+    CHECK(allocator.totalBlockSize() == FAKE_BLOCK_SIZE && allocator.totalUsed() == 2 * 256);
+    CHECK(fake.liveMemory == 1);
+
+    Allocation* h = allocator.createBuffer(256, usage, HOST_MEMORY);   //Freed while its move is in flight
+    Allocation* hGhost = allocator.beginMove(h);
+    CHECK(hGhost != nullptr);
+    if(hGhost != nullptr){
+        allocator.free(h);
+        CHECK(h->freeRequested && allocator.totalUsed() == 4 * 256);
+        allocator.abortMove(h, hGhost);
+        allocator.releaseFreeRequested(h);
+        CHECK(allocator.totalUsed() == 2 * 256);
+    }
+
+    fake.failMap = true;                        //A new block that cannot be mapped leaves nothing behind
+    bool threw = false;
+    try {
+        allocator.createBuffer(2 * FAKE_BLOCK_SIZE, usage, HOST_MEMORY);
+    } catch(const std::runtime_error&){
+        threw = true;
+    }
+    fake.failMap = false;
+    CHECK(threw && fake.liveMemory == 1 && allocator.totalBlockSize() == FAKE_BLOCK_SIZE);
+
+    allocator.destroy();
+    CHECK(fake.liveBuffers == 0 && fake.liveMemory == 0);
+}
+
+
+////////////////////////////////////////// Defragmenter //////////////////////////////////////////////////////////////
+
+static void testDefragmenter(){
+    DeviceAllocator allocator;
+    initFakeAllocator(allocator);
+    SubmissionQueue submissions;
+    VkQueue queue = fakeHandle<VkQueue>(1);
+    submissions.init(allocator.getDevice());
+    submissions.addQueue(queue);
+    Defragmenter defragmenter;
+    defragmenter.init(allocator, submissions, queue, 0, 1);
+    const double budgetMs = 1000.0;     //Never the limit here
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    Allocation* a = allocator.createBuffer(200, usage, HOST_MEMORY);
+    Allocation* b = allocator.createBuffer(256, usage, HOST_MEMORY);
+    Allocation* c = allocator.createBuffer(256, usage, HOST_MEMORY);
+    Allocation* d = allocator.createBuffer(256, usage, HOST_MEMORY);
+    Allocation* e = allocator.createBuffer(768, usage, HOST_MEMORY);   //Dense second block, a moves in there
+    allocator.free(b);
+    allocator.free(c);
+    allocator.free(d);
+    MemoryBlock* source = a->block;
+
+    memset(a->mapped, 0x5A, 200);
+    uint32_t moved = 0;
+    a->onMove = [&moved](Allocation&, VkBuffer){ moved++; };
+
+    fake.failEnd = true;                //A copy that cannot be recorded leaves a where it is
+    bool threw = false;
+    try {
+        defragmenter.step(budgetMs);
+    } catch(const std::runtime_error&){
+        threw = true;
+    }
+    fake.failEnd = false;
+    CHECK(threw && !a->moving && a->block == source && e->block->allocations.size() == 1);
+
+    defragmenter.step(budgetMs);
+    CHECK(a->moving);
+    CHECK(fake.copies.size() == 1 && fake.copies[0].region.size == 200);   //The buffer's size, not the padded allocation
+    submissions.flush(queue);
+    allocator.touch(a);                 //Written while the copy ran
+
+    defragmenter.step(budgetMs);        //The stale copy is dropped and a is copied again
+    CHECK(moved == 0 && defragmenter.getBytesMoved() == 0);
+    CHECK(a->block == source && a->moving);
+    submissions.flush(queue);
+
+    defragmenter.step(budgetMs);
+    CHECK(moved == 1 && defragmenter.getBytesMoved() == a->size);
+    CHECK(!a->moving && a->block == e->block && a->offset == 768);
+    CHECK(static_cast<uint8_t*>(a->mapped)[0] == 0x5A && static_cast<uint8_t*>(a->mapped)[199] == 0x5A);
+
+    for(int i = 0; i < 2; i++){         //The old placement outlives the frame in flight, then its empty block goes
+        CHECK(allocator.totalBlockSize() == 2 * FAKE_BLOCK_SIZE);
+        defragmenter.step(budgetMs);
+    }
+    CHECK(allocator.totalBlockSize() == FAKE_BLOCK_SIZE);
+
+    defragmenter.destroy();
+    submissions.destroy();
+    allocator.destroy();
+    CHECK(fake.liveBuffers == 0 && fake.liveMemory == 0);
+}
+
+
+////////////////////////////////////////// JobSystem /////////////////////////////////////////////////////////////////
+
+static void testJobErrors(JobSystem& jobs){
+    std::atomic<uint32_t> ran{0};
+    JobHandle handle = jobs.parallelFor(64, 1, [&ran](uint32_t begin, uint32_t){
+        ran++;
+        if(begin == 17) throw std::runtime_error("job 17");
+    });
+
+    std::string message;
+    try {
+        jobs.wait(handle);
+    } catch(const std::runtime_error& e){
+        message = e.what();
+    }
+    CHECK(message == "job 17");
+    CHECK(ran == 64);                   //The other jobs of the handle still ran
+
+    bool after = false;                 //Every worker survived
+    for(uint32_t i = 0; i < jobs.getThreadCount() * 4; i++){
+        jobs.submit([]{});
+    }
+    jobs.wait(jobs.submit([&after]{ after = true; }));
+    CHECK(after);
+}
+
+
+////////////////////////////////////////// Profiler //////////////////////////////////////////////////////////////////
+
+static void testProfilerThreadTurnover(){
+    Profiler& profiler = Profiler::instance();
+    std::thread([&profiler]{ profiler.record("unit test", 0, 1); }).join();
+    size_t buffers = profiler.getThreadBufferCount();
+
+    for(int i = 0; i < 8; i++){             //Each thread takes over the ring the previous one left
+        std::thread([&profiler]{ profiler.record("unit test", 0, 1); }).join();
+    }
+    CHECK(profiler.getThreadBufferCount() == buffers);
+}
+
+
+////////////////////////////////////////// SpscRing /////////////////////////////////////////////////////////////////
+
+static void testSpscRing(){
+    SpscRing<int, 4> ring;
+    int value = 0;
+    CHECK(!ring.tryPop(value));
+    for(int i = 0; i < 4; i++) CHECK(ring.tryPush(i));
+    CHECK(!ring.tryPush(4));                //Full
+    CHECK(ring.size() == 4);
+    for(int i = 0; i < 4; i++){
+        CHECK(ring.tryPop(value) && value == i);
+    }
+    CHECK(!ring.tryPop(value));
+
+    for(int i = 0; i < 10; i++){            //Indices keep running past the capacity
+        CHECK(ring.tryPush(i));
+        CHECK(ring.tryPop(value) && value == i);
+    }
+
+    const uint32_t count = 200000;          //Across threads every value arrives once and in order
+    SpscRing<uint32_t, 64> shared;
+    std::thread producer([&shared]{
+        for(uint32_t i = 0; i < count;){
+            if(shared.tryPush(i)) i++;
+        }
+    });
+    uint32_t expected = 0;
+    bool ordered = true;
+    while(expected < count){
+        uint32_t received;
+        if(!shared.tryPop(received)) continue;
+        ordered = ordered && received == expected;
+        expected++;
+    }
+    producer.join();
+    CHECK(ordered);
+}
+
+
+////////////////////////////////////////// LatchMailbox //////////////////////////////////////////////////////////////
+
+static void testLatchMailbox(){
+    struct Pair {
+        uint64_t a = 0, b = 0;      //Written equal, a torn read would show them different
+    };
+
+    LatchMailbox<Pair> mailbox;
+    Pair value;
+    CHECK(!mailbox.read(value));            //Nothing published yet
+
+    mailbox.publish({1, 1});
+    mailbox.publish({2, 2});
+    CHECK(mailbox.read(value) && value.a == 2);     //Newest wins
+    CHECK(mailbox.read(value) && value.a == 2);     //Kept until something newer arrives
+    mailbox.publish({3, 3});
+    CHECK(mailbox.read(value) && value.a == 3);
+
+    LatchMailbox<Pair> shared;
+    const uint64_t count = 200000;
+    std::thread writer([&shared]{
+        for(uint64_t i = 1; i <= count; i++) shared.publish({i, i});
+    });
+    uint64_t last = 0;
+    bool consistent = true;
+    while(last < count){
+        Pair read;
+        if(!shared.read(read)) continue;
+        consistent = consistent && read.a == read.b && read.a >= last;
+        last = read.a;
+    }
+    writer.join();
+    CHECK(consistent);
+}
+
+
+////////////////////////////////////////// SubmissionQueue::batch ////////////////////////////////////////////////////
+
+static void testSubmissionBatch(){
+    std::vector<Submission> submissions;
+    auto add = [&submissions](uintptr_t commandBuffer, uintptr_t wait, uintptr_t signal){
+        Submission submission(fakeHandle<VkCommandBuffer>(commandBuffer));
+        if(wait != 0){
+            submission.waitSemaphores.push_back(fakeHandle<VkSemaphore>(wait));
+            submission.waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+        }
+        if(signal != 0){
+            submission.signalSemaphores.push_back(fakeHandle<VkSemaphore>(signal));
+        }
+        submissions.push_back(std::move(submission));
+    };
+    add(1, 0, 0);       //Copies with no semaphores merge
+    add(2, 0, 0);
+    add(3, 100, 0);     //Waits, so it starts a new info
+    add(4, 0, 200);     //Joins it and signals
+    add(5, 0, 0);       //The previous one signals, so a new info
+    add(6, 300, 400);   //Waits again
+
+    std::pmr::vector<VkCommandBuffer> commandBuffers;
+    std::pmr::vector<VkSubmitInfo> infos;
+    commandBuffers.reserve(submissions.size());
+    SubmissionQueue::batch(submissions.data(), submissions.size(), commandBuffers, infos);
+
+    CHECK(infos.size() == 4);
+    CHECK(commandBuffers.size() == 6);
+    if(infos.size() != 4) return;
+
+    const uint32_t expectedCounts[] = {2, 2, 1, 1};
+    uint32_t first = 0;
+    for(size_t i = 0; i < infos.size(); i++){
+        CHECK(infos[i].commandBufferCount == expectedCounts[i]);
+        CHECK(infos[i].pCommandBuffers == commandBuffers.data() + first);
+        first += expectedCounts[i];
+    }
+    CHECK(commandBuffers[2] == fakeHandle<VkCommandBuffer>(3) && commandBuffers[5] == fakeHandle<VkCommandBuffer>(6));
+    CHECK(infos[0].waitSemaphoreCount == 0 && infos[0].signalSemaphoreCount == 0);
+    CHECK(infos[1].waitSemaphoreCount == 1 && infos[1].pWaitSemaphores[0] == fakeHandle<VkSemaphore>(100));
+    CHECK(infos[1].signalSemaphoreCount == 1 && infos[1].pSignalSemaphores[0] == fakeHandle<VkSemaphore>(200));
+    CHECK(infos[2].waitSemaphoreCount == 0 && infos[2].signalSemaphoreCount == 0);
+    CHECK(infos[3].pWaitSemaphores[0] == fakeHandle<VkSemaphore>(300) && infos[3].pSignalSemaphores[0] == fakeHandle<VkSemaphore>(400));
+}
+
+
+////////////////////////////////////////// FrameArenas ///////////////////////////////////////////////////////////////
+
+static bool allocatesOnNewThread(FrameArenas& arenas){
+    bool allocated = false;
+    std::thread thread([&arenas, &allocated]{
+        try {
+            ArenaVector<uint32_t> values(&arenas.local());
+            values.assign(16, 7);
+            allocated = true;
+        } catch(const std::runtime_error&){}
+    });
+    thread.join();
+    return allocated;
+}
+
+
+static void testFrameArenaThreadTurnover(){
+    FrameArenas arenas;
+    arenas.init(2, 3);
+    arenas.beginFrame(0);
+
+    for(int i = 0; i < 8; i++){             //Restarted more often than there are slots, like the render thread on resizes
+        CHECK(allocatesOnNewThread(arenas));
+    }
+    CHECK(arenas.getUsed(0) == 8 * 16 * sizeof(uint32_t));     //Everything stays valid until the frame slot begins again
+
+    std::atomic<uint32_t> holding{0};       //Three live threads fill every slot, a fourth is refused
+    std::atomic<bool> release{false};
+    std::vector<std::thread> holders;
+    for(int i = 0; i < 3; i++){
+        holders.emplace_back([&arenas, &holding, &release]{
+            arenas.local();
+            holding++;
+            while(!release) std::this_thread::yield();
+        });
+    }
+    while(holding < 3) std::this_thread::yield();
+    CHECK(!allocatesOnNewThread(arenas));
+    release = true;
+    for(std::thread& holder : holders) holder.join();
+    CHECK(allocatesOnNewThread(arenas));    //Their slots came back when they exited
+}
+
+
+////////////////////////////////////////// Swap chain recreation ////////////////////////////////////////////////////
+
+static void testThreadRestarts(JobSystem& jobs){
+    FrameArenas arenas;                     //Sized like main.cpp's, recreateSwapChain restarts three threads per resize
+    arenas.init(2, jobs.getThreadCount() + 2);
+    Profiler& profiler = Profiler::instance();
+    size_t buffers = 0;
+
+    bool failed = false;
+    for(uint32_t resize = 0; resize < 4 * (jobs.getThreadCount() + 2); resize++){
+        arenas.beginFrame(resize % 2);
+        std::thread render([&arenas, &failed]{
+            PROFILE_ZONE("render");
+            try {
+                ArenaVector<uint32_t> submission(&arenas.local());
+                submission.push_back(1);
+            } catch(const std::runtime_error&){
+                failed = true;
+            }
+        });
+        std::thread present([]{ PROFILE_ZONE("present"); });
+        std::thread presentWait([]{ PROFILE_ZONE("present wait"); });
+        render.join();
+        present.join();
+        presentWait.join();
+        if(resize == 0) buffers = profiler.getThreadBufferCount();
+    }
+    CHECK(!failed);
+    CHECK(profiler.getThreadBufferCount() == buffers);
+}
+
+
+////////////////////////////////////////// HandlePool ////////////////////////////////////////////////////////////////
+
+static void testHandlePool(){
+    HandlePool<struct TestTag, int> pool;
+    Handle<struct TestTag> null;
+    CHECK(!null);
+    CHECK(pool.get(null) == nullptr);
+
+    auto a = pool.add(1);
+    auto b = pool.add(2);
+    auto c = pool.add(3);
+    CHECK(a && b && c);
+    CHECK(pool.size() == 3);
+    CHECK(*pool.get(b) == 2);
+
+    CHECK(pool.remove(a));
+    CHECK(!pool.remove(a));                 //Already stale
+    CHECK(pool.get(a) == nullptr);
+    CHECK(*pool.get(b) == 2 && *pool.get(c) == 3);      //The last item moved into the hole, its handle still works
+    CHECK(pool.denseIndex(c) == 0);
+    CHECK(pool.handleAt(0) == c);
+
+    bool threw = false;
+    try {
+        pool.at(a);
+    } catch(const std::runtime_error&){
+        threw = true;
+    }
+    CHECK(threw);
+
+    auto d = pool.add(4);       //Reuses a's slot with the next generation
+    CHECK(d.index == a.index && d.generation == a.generation + 1);
+    CHECK(pool.get(a) == nullptr);
+    CHECK(*pool.get(d) == 4);
+
+    int sum = 0;
+    for(int item : pool) sum += item;
+    CHECK(sum == 2 + 3 + 4);
+
+    pool.clear();
+    CHECK(pool.empty());
+    CHECK(pool.get(b) == nullptr && pool.get(c) == nullptr && pool.get(d) == nullptr);
+}
+
+
+////////////////////////////////////////// SharedFrames /////////////////////////////////////////////////////////////
+
+static void testSharedFrames(){
+    const std::string name = "/vulkantest-unit-" + std::to_string(getpid());
+    const uint32_t width = 4, height = 2, stride = width * 4;
+
+    SharedFrameWriter writer;
+    CHECK(!writer.create(name, width, height, stride, 0, 1));      //A ring needs two slots
+    CHECK(writer.create(name, width, height, stride, 0, 2));
+    if(!writer.isOpen()) return;
+
+    SharedFrameReader reader;
+    CHECK(reader.open(name));
+    if(!reader.isOpen()){
+        writer.destroy();
+        return;
+    }
+    CHECK(reader.getHeader().width == width && reader.getHeader().slotCount == 2);
+
+    uint64_t sequence = 0;
+    uint64_t frameNumber = 0;
+    CHECK(reader.beginRead(sequence) == nullptr);       //Nothing written yet
+
+    uint32_t slot = writer.beginFrame();
+    memset(writer.slotData(slot), 0x11, stride * height);
+    CHECK(reader.beginRead(sequence) == nullptr);       //Still being written
+    writer.endFrame(slot, 42);
+
+    const uint8_t* pixels = reader.beginRead(sequence, &frameNumber);
+    CHECK(pixels != nullptr && sequence == 1 && frameNumber == 42);
+    if(pixels != nullptr) CHECK(pixels[0] == 0x11 && pixels[stride * height - 1] == 0x11);
+    CHECK(reader.endRead(sequence));
+    CHECK(reader.beginRead(sequence) == nullptr);       //Not returned twice
+
+    slot = writer.beginFrame();                         //A slow reader: the writer laps it while it reads frame 2
+    writer.endFrame(slot, 43);
+    uint64_t lapped = 0;
+    pixels = reader.beginRead(lapped);
+    CHECK(pixels != nullptr && lapped == 2);
+    slot = writer.beginFrame();                         //Frame 3 reuses frame 1's slot, frame 2's is untouched
+    CHECK(reader.endRead(lapped));
+    writer.endFrame(slot, 44);
+    slot = writer.beginFrame();                         //Frame 4 reuses frame 2's slot while it is being read
+    CHECK(!reader.endRead(lapped));
+    writer.endFrame(slot, 45);
+
+    SharedFrameHeader& shared = const_cast<SharedFrameHeader&>(writer.getHeader());    //A broken or hostile writer
+    shared.slotCount = 0;
+    SharedFrameReader rejected;
+    CHECK(!rejected.open(name));                        //beginRead() would divide by zero
+    shared.slotCount = 2;
+
+    reader.close();
+    writer.destroy();
+    CHECK(!reader.open(name));                          //Unlinked
+}
+
+
+////////////////////////////////////////// GltfImporter //////////////////////////////////////////////////////////////
+
+static bool importsCleanly(const std::string& json, JobSystem& jobs){  //false if open() rejects the file
+    FILE* file = fopen(TEST_MALFORMED_GLTF_PATH, "wb");
+    if(file == nullptr) return false;
+    fwrite(json.data(), 1, json.size(), file);
+    fclose(file);
+
+    GltfImporter importer;
+    bool imported = true;
+    try {
+        importer.open(TEST_MALFORMED_GLTF_PATH, jobs);
+    } catch(const std::runtime_error&){
+        imported = false;
+    }
+    unlink(TEST_MALFORMED_GLTF_PATH);
+    return imported;
+}
+
+
+static std::string triangleGltf(uint32_t normalCount){     //Three positions and normalCount normals, all zero, in one embedded buffer
+    return R"({"asset": {"version": "2.0"},
+        "buffers": [{"byteLength": 84, "uri": "data:application/octet-stream;base64,)" + std::string(112, 'A') + R"("}],
+        "bufferViews": [{"buffer": 0, "byteLength": 84}],
+        "accessors": [{"bufferView": 0, "componentType": 5126, "count": 3, "type": "VEC3"},
+                      {"bufferView": 0, "byteOffset": 36, "componentType": 5126, "count": )" + std::to_string(normalCount) + R"(, "type": "VEC3"}],
+        "meshes": [{"primitives": [{"attributes": {"POSITION": 0, "NORMAL": 1}}]}],
+        "nodes": [{"mesh": 0}], "scenes": [{"nodes": [0]}], "scene": 0})";
+}
+
+
+static void testGltfAttributeCounts(JobSystem& jobs){
+    CHECK(importsCleanly(triangleGltf(3), jobs));
+    CHECK(!importsCleanly(triangleGltf(4), jobs));     //More normals than positions would be decoded past the end of the vertices
+    CHECK(!importsCleanly(triangleGltf(2), jobs));
+}
+
+
+////////////////////////////////////////// SceneCache ///////////////////////////////////////////////////////////////
+
+static void testSceneCache(JobSystem& jobs){
+    GltfImporter importer;
+    importer.open(TEST_SCENE_PATH, jobs);
+    const GltfScene& scene = importer.getScene();
+    CHECK(!scene.meshes.empty() && !scene.instances.empty());
+
+    uint64_t hash = hashSceneSources(TEST_SCENE_PATH, jobs);
+    unlink(TEST_SCENE_CACHE_PATH);
+    SceneCache built;
+    CHECK(built.build(TEST_SCENE_CACHE_PATH, hash, importer, jobs));
+    std::vector<uint8_t> builtGeometry(built.getGeometry(), built.getGeometry() + built.getGeometrySize());
+    built.close();
+
+    SceneCache cache;
+    CHECK(cache.load(TEST_SCENE_CACHE_PATH, hash));
+    if(cache.data() == nullptr) return;
+    CHECK(cache.getMeshCount() == scene.meshes.size());
+    CHECK(cache.getMaterialCount() == scene.materials.size());
+    CHECK(cache.getInstanceCount() == scene.instances.size());
+    CHECK(cache.getVertexCount() == scene.vertexCount && cache.getIndexCount() == scene.indexCount);
+    CHECK(memcmp(cache.getMeshes(), scene.meshes.data(), scene.meshes.size() * sizeof(GltfMesh)) == 0);    //Bounds included
+    CHECK(memcmp(cache.getInstances(), scene.instances.data(), scene.instances.size() * sizeof(GltfInstance)) == 0);
+    CHECK(cache.getGeometrySize() == builtGeometry.size() &&
+          memcmp(cache.getGeometry(), builtGeometry.data(), builtGeometry.size()) == 0);
+
+    for(uint32_t i = 0; i < cache.getMeshCount(); i++){     //Indices stay inside their mesh
+        const GltfMesh& mesh = cache.getMeshes()[i];
+        bool inside = true;
+        for(uint32_t j = 0; j < mesh.indexCount; j++){
+            inside = inside && cache.getIndices()[mesh.firstIndex + j] < mesh.vertexCount;
+        }
+        CHECK(inside);
+    }
+    cache.close();
+
+    CHECK(!cache.load(TEST_SCENE_CACHE_PATH, hash + 1));    //Stale source
+    CHECK(truncate(TEST_SCENE_CACHE_PATH, 100) == 0);
+    CHECK(!cache.load(TEST_SCENE_CACHE_PATH, hash));        //Truncated
+    unlink(TEST_SCENE_CACHE_PATH);
+}
+
+
+////////////////////////////////////////// Bvh ///////////////////////////////////////////////////////////////////////
+
+struct Sphere {
+    Vec3 center;
+    float radius;
+};
+
+
+static float raySphere(const Vec3& origin, const Vec3& direction, const Sphere& sphere){    //Infinity for a miss
+    Vec3 offset = origin - sphere.center;
+    float a = dot(direction, direction);
+    float b = dot(offset, direction);
+    float c = dot(offset, offset) - sphere.radius * sphere.radius;
+    float discriminant = b * b - a * c;
+    if(discriminant < 0.0f) return std::numeric_limits<float>::infinity();
+    float t = (-b - std::sqrt(discriminant)) / a;
+    return t >= 0.0f ? t : std::numeric_limits<float>::infinity();
+}
+
+
+static BvhHit bruteForce(const std::vector<Sphere>& spheres, const Vec3& origin, const Vec3& direction){
+    BvhHit hit;
+    for(uint32_t i = 0; i < spheres.size(); i++){
+        float t = raySphere(origin, direction, spheres[i]);
+        if(t < hit.t){
+            hit.t = t;
+            hit.primitive = i;
+        }
+    }
+    return hit;
+}
+
+
+static void testBvh(JobSystem& jobs){
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> size(0.2f, 1.5f);
+
+    std::vector<Sphere> spheres(BVH_PARALLEL_PRIMITIVES + 1000);    //Large enough for the parallel build path
+    std::vector<Aabb> bounds(spheres.size());
+    for(size_t i = 0; i < spheres.size(); i++){
+        spheres[i] = {Vec3(position(random), position(random), position(random)), size(random)};
+        bounds[i] = sphereBounds(spheres[i].center, spheres[i].radius);
+    }
+
+    Bvh bvh;
+    bvh.build(bounds.data(), static_cast<uint32_t>(bounds.size()), jobs);
+    CHECK(bvh.getPrimitiveCount() == spheres.size());
+    CHECK(bvh.getNodeCount() > 0 && bvh.getNodeCount() < spheres.size());
+
+    auto raycast = [&bvh, &spheres](const Vec3& origin, const Vec3& direction){
+        return bvh.raycast(origin, direction, std::numeric_limits<float>::infinity(), [&](uint32_t primitive, float tMax){
+            float t = raySphere(origin, direction, spheres[primitive]);
+            return t < tMax ? t : std::numeric_limits<float>::infinity();
+        });
+    };
+
+    uint32_t mismatches = 0;
+    uint32_t hits = 0;
+    for(int i = 0; i < 500; i++){           //Same closest hit as testing every sphere
+        Vec3 origin(position(random), position(random), position(random));
+        Vec3 direction = Vec3(position(random), position(random), position(random)) - origin;
+        BvhHit expected = bruteForce(spheres, origin, direction);
+        BvhHit hit = raycast(origin, direction);
+        if(expected.primitive != hit.primitive) mismatches++;
+        if(hit.primitive != BVH_EMPTY) hits++;
+    }
+    CHECK(mismatches == 0);
+    CHECK(hits > 0);
+
+    //Move one sphere far outside everything else; after refit the tree finds it there and no longer where it was
+    uint32_t moved = 123;
+    Vec3 oldCenter = spheres[moved].center;
+    spheres[moved].center = Vec3(500.0f, 0.0f, 0.0f);
+    bvh.update(moved, sphereBounds(spheres[moved].center, spheres[moved].radius));
+    bvh.refit();
+
+    BvhHit hit = raycast(Vec3(500.0f, 0.0f, -100.0f), Vec3(0.0f, 0.0f, 1.0f));
+    CHECK(hit.primitive == moved);
+    CHECK(std::fabs(hit.t - (100.0f - spheres[moved].radius)) < 1e-3f);
+
+    Vec3 toOld = oldCenter - Vec3(-200.0f, oldCenter.y, oldCenter.z);
+    BvhHit old = raycast(Vec3(-200.0f, oldCenter.y, oldCenter.z), toOld);
+    CHECK(old.primitive != moved);
+    CHECK(old.primitive == bruteForce(spheres, Vec3(-200.0f, oldCenter.y, oldCenter.z), toOld).primitive);
+
+    Bvh empty;
+    empty.build(nullptr, 0, jobs);
+    CHECK(empty.raycast(Vec3(), Vec3(1.0f, 0.0f, 0.0f), 10.0f, [](uint32_t, float){ return 0.0f; }).primitive == BVH_EMPTY);
+}
+
+
+int main(){
+    JobSystem jobs;
+    jobs.start();
+
+    testDeviceAllocator();
+    testDefragmenter();
+    testJobErrors(jobs);
+    testProfilerThreadTurnover();
+    testSpscRing();
+    testLatchMailbox();
+    testSubmissionBatch();
+    testFrameArenaThreadTurnover();
+    testThreadRestarts(jobs);
+    testHandlePool();
+    testBvh(jobs);
+    testSharedFrames();
+    testGltfAttributeCounts(jobs);
+    try {
+        testSceneCache(jobs);
+    } catch(const std::exception& e){
+        std::cerr << "testSceneCache: " << e.what() << std::endl;
+        failures++;
+    }
+
+    jobs.stop();
+    std::cout << (failures == 0 ? "All unit tests passed" : std::to_string(failures) + " checks failed") << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}